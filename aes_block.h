@@ -0,0 +1,36 @@
+#ifndef _AES_BLOCK_H
+#define _AES_BLOCK_H
+
+#include <stdint.h>
+
+/**
+ *  Single block AES-128 encryption, the building block of the CMAC and of the
+ *  software CCM.
+ *
+ *  On the device a block is encrypted by the application CRYPTO instance.
+ *  Building with AES_SOFTWARE uses a portable byte oriented implementation
+ *  instead, as a reference and for the host tools; the expanded key is then
+ *  kept in the key structure so that it is computed once per key.
+ */
+
+#ifndef AES_BLOCK_CRYPTO
+#define AES_BLOCK_CRYPTO         CRYPTO1
+#define AES_BLOCK_CRYPTO_CLOCK   cmuClock_CRYPTO1
+#endif
+
+#define AES_BLOCK_SIZE           16
+
+typedef struct {
+#ifdef AES_SOFTWARE
+  uint8_t round_keys[11 * AES_BLOCK_SIZE];
+#else
+  uint8_t key[AES_BLOCK_SIZE];
+#endif
+} tsAesKey;
+
+void aes_block_key(tsAesKey *k, const uint8_t *key);
+
+/* in and out may be the same buffer */
+void aes_block_encrypt(const tsAesKey *k, const uint8_t *in, uint8_t *out);
+
+#endif
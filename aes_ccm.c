@@ -0,0 +1,419 @@
+#include "aes_ccm.h"
+
+#include <string.h>
+
+#ifndef AES_SOFTWARE
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_crypto.h"
+#else
+#include "aes_block.h"
+#endif
+
+#define BLOCK       16
+
+/* The counter blocks are A_i = flags | nonce | i with at least two bytes for i
+ * (nonce of 13 bytes at most). A payload of up to 65535 bytes takes at most
+ * 4096 blocks, so a two byte increment of the counter is always enough. */
+
+#ifndef AES_SOFTWARE
+
+/* hardware: the MAC state X is kept in DATA3, the counter in DATA1 and the
+ * input block is written to DATA2 */
+
+static uint32_t s0[BLOCK / 4];      /* E(K, A_0), masks the MIC */
+
+static void seq_load(uint32_t seq0, uint32_t seq1)
+{
+  CRYPTO_TypeDef *crypto = AES_CCM_CRYPTO;
+
+  crypto->SEQ0 = seq0;
+  crypto->SEQ1 = seq1;
+  crypto->SEQ2 = CRYPTO_CMD_INSTR_END;
+}
+
+#define SEQ(i0, i1, i2, i3)  (CRYPTO_CMD_INSTR_##i0 << _CRYPTO_SEQ0_INSTR0_SHIFT \
+                              | CRYPTO_CMD_INSTR_##i1 << _CRYPTO_SEQ0_INSTR1_SHIFT \
+                              | CRYPTO_CMD_INSTR_##i2 << _CRYPTO_SEQ0_INSTR2_SHIFT \
+                              | CRYPTO_CMD_INSTR_##i3 << _CRYPTO_SEQ0_INSTR3_SHIFT)
+
+static void ccm_begin(const uint8_t *key, const uint8_t *a0)
+{
+  CRYPTO_TypeDef *crypto = AES_CCM_CRYPTO;
+  uint32_t block[BLOCK / 4];
+
+  CMU_ClockEnable(AES_CCM_CRYPTO_CLOCK, true);
+
+  crypto->CTRL = CRYPTO_CTRL_AES_AES128 | CRYPTO_CTRL_INCWIDTH_INCWIDTH2;
+  crypto->WAC = 0;
+  crypto->SEQCTRL = 0;
+  crypto->SEQCTRLB = 0;
+
+  memcpy(block, key, BLOCK);
+  CRYPTO_KeyBuf128Write(crypto, block);
+
+  memcpy(block, a0, BLOCK);
+  CRYPTO_DataWrite(&crypto->DATA1, block);
+  memset(block, 0, BLOCK);
+  CRYPTO_DataWrite(&crypto->DATA3, block);
+
+  seq_load(SEQ(DATA1TODATA0, AESENC, END, END), 0);
+  CRYPTO_InstructionSequenceExecute(crypto);
+  CRYPTO_InstructionSequenceWait(crypto);
+  CRYPTO_DataRead(&crypto->DATA0, s0);
+}
+
+/* X = E(K, X ^ B) for a block of B_0 or of the additional data */
+static void ccm_mac(const uint8_t *b)
+{
+  CRYPTO_TypeDef *crypto = AES_CCM_CRYPTO;
+  uint32_t block[BLOCK / 4];
+
+  memcpy(block, b, BLOCK);
+  seq_load(SEQ(DATA3TODATA0, DATA2TODATA0XOR, AESENC, DATA0TODATA3), 0);
+  CRYPTO_DataWrite(&crypto->DATA2, block);
+  CRYPTO_InstructionSequenceExecute(crypto);
+  CRYPTO_InstructionSequenceWait(crypto);
+}
+
+/* MAC and encrypt or decrypt whole payload blocks, one sequencer run per block */
+static void ccm_payload(const uint8_t *in, uint8_t *out, uint16_t blocks, int encrypt)
+{
+  CRYPTO_TypeDef *crypto = AES_CCM_CRYPTO;
+  CRYPTO_DataReg_TypeDef out_reg;
+  uint32_t block[BLOCK / 4];
+
+  if (encrypt) {
+    /* X = E(K, X ^ P), C = E(K, ++A) ^ P, C in DATA0 */
+    seq_load(SEQ(DATA3TODATA0, DATA2TODATA0XOR, AESENC, DATA0TODATA3),
+             SEQ(DATA1INC, DATA1TODATA0, AESENC, DATA2TODATA0XOR));
+    out_reg = &crypto->DATA0;
+  } else {
+    /* P = E(K, ++A) ^ C kept in DATA2, X = E(K, X ^ P) */
+    seq_load(SEQ(DATA1INC, DATA1TODATA0, AESENC, DATA2TODATA0XOR),
+             SEQ(DATA0TODATA2, DATA3TODATA0XOR, AESENC, DATA0TODATA3));
+    out_reg = &crypto->DATA2;
+  }
+
+  while (blocks--) {
+    memcpy(block, in, BLOCK);
+    CRYPTO_DataWrite(&crypto->DATA2, block);
+    CRYPTO_InstructionSequenceExecute(crypto);
+    CRYPTO_InstructionSequenceWait(crypto);
+    CRYPTO_DataRead(out_reg, block);
+    memcpy(out, block, BLOCK);
+    in += BLOCK;
+    out += BLOCK;
+  }
+}
+
+/* key stream block E(K, ++A) */
+static void ccm_keystream(uint8_t *ks)
+{
+  CRYPTO_TypeDef *crypto = AES_CCM_CRYPTO;
+  uint32_t block[BLOCK / 4];
+
+  seq_load(SEQ(DATA1INC, DATA1TODATA0, AESENC, END), 0);
+  CRYPTO_InstructionSequenceExecute(crypto);
+  CRYPTO_InstructionSequenceWait(crypto);
+  CRYPTO_DataRead(&crypto->DATA0, block);
+  memcpy(ks, block, BLOCK);
+}
+
+/* T = X ^ E(K, A_0) */
+static void ccm_end(uint8_t *tag)
+{
+  CRYPTO_TypeDef *crypto = AES_CCM_CRYPTO;
+  uint32_t block[BLOCK / 4];
+  int i;
+
+  CRYPTO_DataRead(&crypto->DATA3, block);
+  for (i = 0; i < BLOCK / 4; i++) {
+    block[i] ^= s0[i];
+  }
+  memcpy(tag, block, BLOCK);
+
+  /* do not leave the key and the MAC state behind */
+  memset(block, 0, BLOCK);
+  CRYPTO_KeyBuf128Write(crypto, block);
+  CRYPTO_DataWrite(&crypto->DATA3, block);
+}
+
+#else
+
+/* software reference on top of the software AES of aes_block */
+
+static tsAesKey aes_key;
+static uint8_t x[BLOCK];            /* CBC-MAC state */
+static uint8_t ctr[BLOCK];          /* counter block A_i */
+static uint8_t s0[BLOCK];           /* E(K, A_0), masks the MIC */
+
+static void ctr_inc(void)
+{
+  if (++ctr[BLOCK - 1] == 0) {
+    ctr[BLOCK - 2]++;
+  }
+}
+
+static void ccm_begin(const uint8_t *key, const uint8_t *a0)
+{
+  aes_block_key(&aes_key, key);
+  memcpy(ctr, a0, BLOCK);
+  memset(x, 0, BLOCK);
+  aes_block_encrypt(&aes_key, ctr, s0);
+}
+
+static void ccm_mac(const uint8_t *b)
+{
+  int i;
+
+  for (i = 0; i < BLOCK; i++) {
+    x[i] ^= b[i];
+  }
+  aes_block_encrypt(&aes_key, x, x);
+}
+
+static void ccm_keystream(uint8_t *ks)
+{
+  ctr_inc();
+  aes_block_encrypt(&aes_key, ctr, ks);
+}
+
+static void ccm_payload(const uint8_t *in, uint8_t *out, uint16_t blocks, int encrypt)
+{
+  uint8_t ks[BLOCK], p[BLOCK];
+  int i;
+
+  while (blocks--) {
+    ccm_keystream(ks);
+    for (i = 0; i < BLOCK; i++) {
+      p[i] = encrypt ? in[i] : (uint8_t)(in[i] ^ ks[i]);
+      out[i] = in[i] ^ ks[i];
+    }
+    ccm_mac(p);
+    in += BLOCK;
+    out += BLOCK;
+  }
+}
+
+static void ccm_end(uint8_t *tag)
+{
+  int i;
+
+  for (i = 0; i < BLOCK; i++) {
+    tag[i] = x[i] ^ s0[i];
+  }
+  memset(&aes_key, 0, sizeof(aes_key));
+  memset(x, 0, BLOCK);
+}
+
+#endif
+
+// local functions
+
+static int check_params(const uint8_t *key, const uint8_t *nonce, uint8_t nonce_len,
+    const uint8_t *aad, uint16_t aad_len, const uint8_t *in, const uint8_t *out, uint16_t len,
+    const uint8_t *mic, uint8_t mic_len)
+{
+  if (!key || !nonce || !mic || (aad_len && !aad) || (len && (!in || !out))) {
+    return 0;
+  }
+  if (nonce_len < AES_CCM_NONCE_MIN || nonce_len > AES_CCM_NONCE_MAX) {
+    return 0;
+  }
+  if (mic_len < AES_CCM_MIC_MIN || mic_len > AES_CCM_MIC_MAX || (mic_len & 1)) {
+    return 0;
+  }
+  /* the two byte encoding of the additional data length stops at 0xFEFF */
+  if (aad_len >= 0xFF00) {
+    return 0;
+  }
+  return 1;
+}
+
+/* Load the key, compute the MAC over B_0 and the additional data and set the counter to A_0. */
+static void ccm_start(const uint8_t *key, const uint8_t *nonce, uint8_t nonce_len,
+    const uint8_t *aad, uint16_t aad_len, uint16_t len, uint8_t mic_len)
+{
+  uint8_t b[BLOCK];
+  uint8_t q = 15 - nonce_len;       /* bytes of the length and counter fields */
+  uint16_t n;
+
+  /* A_0 */
+  memset(b, 0, BLOCK);
+  b[0] = q - 1;
+  memcpy(&b[1], nonce, nonce_len);
+  ccm_begin(key, b);
+
+  /* B_0, same nonce, with the flags and the payload length */
+  b[0] = (uint8_t)((aad_len ? 0x40 : 0) | (((mic_len - 2) / 2) << 3) | (q - 1));
+  b[BLOCK - 2] = (uint8_t)(len >> 8);
+  b[BLOCK - 1] = (uint8_t)len;
+  ccm_mac(b);
+
+  if (!aad_len) {
+    return;
+  }
+
+  /* the additional data prefixed with its length, zero padded to whole blocks */
+  b[0] = (uint8_t)(aad_len >> 8);
+  b[1] = (uint8_t)aad_len;
+  n = (aad_len < BLOCK - 2) ? aad_len : BLOCK - 2;
+  memset(&b[2], 0, BLOCK - 2);
+  memcpy(&b[2], aad, n);
+  ccm_mac(b);
+
+  for (aad += n, aad_len -= n; aad_len; aad += n, aad_len -= n) {
+    n = (aad_len < BLOCK) ? aad_len : BLOCK;
+    memset(b, 0, BLOCK);
+    memcpy(b, aad, n);
+    ccm_mac(b);
+  }
+}
+
+// public functions
+
+errorcode_t aes_ccm_encrypt(const uint8_t *key, const uint8_t *nonce, uint8_t nonce_len,
+    const uint8_t *aad, uint16_t aad_len, const uint8_t *in, uint8_t *out, uint16_t len,
+    uint8_t *mic, uint8_t mic_len)
+{
+  uint8_t b[BLOCK];
+  uint16_t tail;
+
+  if (!check_params(key, nonce, nonce_len, aad, aad_len, in, out, len, mic, mic_len)) {
+    return bg_err_invalid_param;
+  }
+
+  ccm_start(key, nonce, nonce_len, aad, aad_len, len, mic_len);
+
+  ccm_payload(in, out, len / BLOCK, 1);
+
+  /* the zero padding of the last block is what the MAC needs, only the
+   * payload bytes of the cipher text are kept */
+  tail = len % BLOCK;
+  if (tail) {
+    memset(b, 0, BLOCK);
+    memcpy(b, in + len - tail, tail);
+    ccm_payload(b, b, 1, 1);
+    memcpy(out + len - tail, b, tail);
+  }
+
+  ccm_end(b);
+  memcpy(mic, b, mic_len);
+
+  return bg_err_success;
+}
+
+errorcode_t aes_ccm_decrypt(const uint8_t *key, const uint8_t *nonce, uint8_t nonce_len,
+    const uint8_t *aad, uint16_t aad_len, const uint8_t *in, uint8_t *out, uint16_t len,
+    const uint8_t *mic, uint8_t mic_len)
+{
+  uint8_t b[BLOCK], ks[BLOCK];
+  uint16_t tail, i;
+  uint8_t diff = 0;
+
+  if (!check_params(key, nonce, nonce_len, aad, aad_len, in, out, len, mic, mic_len)) {
+    return bg_err_invalid_param;
+  }
+
+  ccm_start(key, nonce, nonce_len, aad, aad_len, len, mic_len);
+
+  ccm_payload(in, out, len / BLOCK, 0);
+
+  /* the MAC of the last block is over the zero padded plain text, which can
+   * only be built after the decryption */
+  tail = len % BLOCK;
+  if (tail) {
+    ccm_keystream(ks);
+    memset(b, 0, BLOCK);
+    for (i = 0; i < tail; i++) {
+      b[i] = in[len - tail + i] ^ ks[i];
+    }
+    ccm_mac(b);
+    memcpy(out + len - tail, b, tail);
+  }
+
+  ccm_end(b);
+  for (i = 0; i < mic_len; i++) {
+    diff |= b[i] ^ mic[i];
+  }
+
+  if (diff) {
+    memset(out, 0, len);
+    return bg_err_application_encryption_decryption_error;
+  }
+
+  return bg_err_success;
+}
+
+#ifdef AES_CCM_SELFTEST
+
+/* NIST SP 800-38C, appendix C, examples 1 to 3 */
+
+static const uint8_t test_key[16] = {
+  0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f
+};
+
+typedef struct {
+  uint8_t nonce_len;
+  uint8_t aad_len;
+  uint8_t len;
+  uint8_t mic_len;
+  uint8_t expected[32];       /* cipher text followed by the MIC */
+} tsCcmVector;
+
+static const tsCcmVector test_vectors[] = {
+  { 7, 8, 4, 4,
+    { 0x71, 0x62, 0x01, 0x5b, 0x4d, 0xac, 0x25, 0x5d } },
+  { 8, 16, 16, 6,
+    { 0xd2, 0xa1, 0xf0, 0xe0, 0x51, 0xea, 0x5f, 0x62, 0x08, 0x1a, 0x77, 0x92, 0x07, 0x3d, 0x59, 0x3d,
+      0x1f, 0xc6, 0x4f, 0xbf, 0xac, 0xcd } },
+  { 12, 20, 24, 8,
+    { 0xe3, 0xb2, 0x01, 0xa9, 0xf5, 0xb7, 0x1a, 0x7a, 0x9b, 0x1c, 0xea, 0xec, 0xcd, 0x97, 0xe7, 0x0b,
+      0x61, 0x76, 0xaa, 0xd9, 0xa4, 0x42, 0x8a, 0xa5, 0x48, 0x43, 0x92, 0xfb, 0xc1, 0xb0, 0x99, 0x51 } },
+};
+
+int aes_ccm_selftest(void)
+{
+  uint8_t nonce[AES_CCM_NONCE_MAX], aad[32], payload[32], out[32], mic[AES_CCM_MIC_MAX];
+  int failures = 0;
+  unsigned int v;
+  int i;
+
+  /* the example inputs are counting byte sequences */
+  for (i = 0; i < (int) sizeof(nonce); i++) {
+    nonce[i] = 0x10 + i;
+  }
+  for (i = 0; i < (int) sizeof(aad); i++) {
+    aad[i] = i;
+    payload[i] = 0x20 + i;
+  }
+
+  for (v = 0; v < sizeof(test_vectors) / sizeof(test_vectors[0]); v++) {
+    const tsCcmVector *t = &test_vectors[v];
+
+    if (aes_ccm_encrypt(test_key, nonce, t->nonce_len, aad, t->aad_len, payload, out, t->len, mic,
+        t->mic_len) != bg_err_success
+        || memcmp(out, t->expected, t->len) || memcmp(mic, &t->expected[t->len], t->mic_len)) {
+      failures++;
+      continue;
+    }
+
+    if (aes_ccm_decrypt(test_key, nonce, t->nonce_len, aad, t->aad_len, out, out, t->len, mic,
+        t->mic_len) != bg_err_success || memcmp(out, payload, t->len)) {
+      failures++;
+      continue;
+    }
+
+    /* a modified MIC must be rejected */
+    mic[0] ^= 1;
+    if (aes_ccm_decrypt(test_key, nonce, t->nonce_len, aad, t->aad_len, t->expected, out, t->len,
+        mic, t->mic_len) == bg_err_success) {
+      failures++;
+    }
+  }
+
+  return failures;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _AES_CCM_H
+#define _AES_CCM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  AES-128 CCM (NIST SP 800-38C) for end-to-end protection of vendor model payloads.
+ *
+ *  The CBC-MAC and the CTR encryption are done in a single pass over the data:
+ *  for each payload block one CRYPTO sequencer program updates the MAC and
+ *  produces the cipher text, so each block is written to and read from the
+ *  CRYPTO block once instead of once per pass.
+ *
+ *  The application uses its own CRYPTO instance so that the stack, which uses
+ *  CRYPTO0, and the application do not have to share the key and data registers.
+ *
+ *  Building with AES_SOFTWARE replaces the hardware with the software AES of
+ *  aes_block, used as a reference and on the host. AES_CCM_SELFTEST adds
+ *  aes_ccm_selftest(), which checks the NIST SP 800-38C example vectors.
+ */
+
+/* CRYPTO instance used by the application */
+#ifndef AES_CCM_CRYPTO
+#define AES_CCM_CRYPTO           CRYPTO1
+#define AES_CCM_CRYPTO_CLOCK     cmuClock_CRYPTO1
+#endif
+
+#define AES_CCM_KEY_LEN          16
+#define AES_CCM_NONCE_MIN        7
+#define AES_CCM_NONCE_MAX        13
+#define AES_CCM_MIC_MIN          4
+#define AES_CCM_MIC_MAX          16
+
+/* Encrypt len bytes from in to out (in == out is allowed) and compute a MIC of
+ * mic_len bytes (4, 6, ..., 16) over the additional data and the payload.
+ * The nonce is 7 to 13 bytes long, mesh uses 13. */
+errorcode_t aes_ccm_encrypt(const uint8_t *key, const uint8_t *nonce, uint8_t nonce_len,
+    const uint8_t *aad, uint16_t aad_len, const uint8_t *in, uint8_t *out, uint16_t len,
+    uint8_t *mic, uint8_t mic_len);
+
+/* Decrypt and check the MIC. On a MIC mismatch the output is cleared and
+ * bg_err_application_encryption_decryption_error is returned. */
+errorcode_t aes_ccm_decrypt(const uint8_t *key, const uint8_t *nonce, uint8_t nonce_len,
+    const uint8_t *aad, uint16_t aad_len, const uint8_t *in, uint8_t *out, uint16_t len,
+    const uint8_t *mic, uint8_t mic_len);
+
+#ifdef AES_CCM_SELFTEST
+/* Run the example vectors, returns the number of failures. */
+int aes_ccm_selftest(void);
+#endif
+
+#endif
@@ -0,0 +1,226 @@
+#include "aes_dma.h"
+
+#include <string.h>
+
+#include "em_device.h"
+#include "em_bus.h"
+#include "em_cmu.h"
+#include "em_crypto.h"
+
+#define BLOCK       16
+
+static struct {
+  aes_dma_callback callback;
+  void *context;
+  const uint8_t *in;
+  uint8_t *out;
+  uint8_t *iv;
+  CRYPTO_DataReg_TypeDef iv_reg;   /* register holding the chaining value or counter */
+  uint32_t remaining;
+  uint32_t chunk;
+  volatile uint8_t busy;
+} dma;
+
+// local functions
+
+/* Program both channels and the sequencer for the next chunk and start them. The
+ * sequence after EXECIFA is repeated for every block until the buffer length
+ * LENGTHA is used up. */
+static void start_chunk(void)
+{
+  CRYPTO_TypeDef *crypto = AES_DMA_CRYPTO;
+  uint32_t xfercnt;
+
+  dma.chunk = dma.remaining;
+  if (dma.chunk > AES_DMA_MAX_CHUNK) {
+    dma.chunk = AES_DMA_MAX_CHUNK;
+  }
+  xfercnt = ((dma.chunk / 4) - 1) << _LDMA_CH_CTRL_XFERCNT_SHIFT;
+
+  crypto->SEQCTRL = dma.chunk | CRYPTO_SEQCTRL_BLOCKSIZE_16BYTES | CRYPTO_SEQCTRL_DMA0PRESA;
+
+  LDMA->CH[AES_DMA_CH_IN].REQSEL = AES_DMA_REQSEL_IN;
+  LDMA->CH[AES_DMA_CH_IN].CFG = 0;
+  LDMA->CH[AES_DMA_CH_IN].LOOP = 0;
+  LDMA->CH[AES_DMA_CH_IN].LINK = 0;
+  LDMA->CH[AES_DMA_CH_IN].SRC = (uint32_t) dma.in;
+  LDMA->CH[AES_DMA_CH_IN].DST = (uint32_t) &crypto->DATA0;
+  LDMA->CH[AES_DMA_CH_IN].CTRL = xfercnt | LDMA_CH_CTRL_SIZE_WORD | LDMA_CH_CTRL_BLOCKSIZE_UNIT4
+                                 | LDMA_CH_CTRL_REQMODE_BLOCK | LDMA_CH_CTRL_SRCINC_ONE | LDMA_CH_CTRL_DSTINC_NONE;
+
+  LDMA->CH[AES_DMA_CH_OUT].REQSEL = AES_DMA_REQSEL_OUT;
+  LDMA->CH[AES_DMA_CH_OUT].CFG = 0;
+  LDMA->CH[AES_DMA_CH_OUT].LOOP = 0;
+  LDMA->CH[AES_DMA_CH_OUT].LINK = 0;
+  LDMA->CH[AES_DMA_CH_OUT].SRC = (uint32_t) &crypto->DATA0;
+  LDMA->CH[AES_DMA_CH_OUT].DST = (uint32_t) dma.out;
+  LDMA->CH[AES_DMA_CH_OUT].CTRL = xfercnt | LDMA_CH_CTRL_SIZE_WORD | LDMA_CH_CTRL_BLOCKSIZE_UNIT4
+                                  | LDMA_CH_CTRL_REQMODE_BLOCK | LDMA_CH_CTRL_SRCINC_NONE | LDMA_CH_CTRL_DSTINC_ONE
+                                  | LDMA_CH_CTRL_DONEIFSEN;
+
+  LDMA->IFC = (1UL << AES_DMA_CH_IN) | (1UL << AES_DMA_CH_OUT);
+  // the other LDMA channels (MX25 transfers) keep running, only these bits are touched
+  BUS_RegMaskedSet(&LDMA->IEN, (1UL << AES_DMA_CH_OUT) | LDMA_IEN_ERROR);
+  BUS_RegMaskedSet(&LDMA->CHEN, (1UL << AES_DMA_CH_IN) | (1UL << AES_DMA_CH_OUT));
+
+  crypto->CMD = CRYPTO_CMD_SEQSTART;
+}
+
+static void finish(errorcode_t result)
+{
+  CRYPTO_TypeDef *crypto = AES_DMA_CRYPTO;
+  aes_dma_callback callback = dma.callback;
+  uint32_t block[BLOCK / 4];
+
+  BUS_RegMaskedClear(&LDMA->CHEN, (1UL << AES_DMA_CH_IN) | (1UL << AES_DMA_CH_OUT));
+  BUS_RegMaskedClear(&LDMA->IEN, 1UL << AES_DMA_CH_OUT);
+
+  if (result == bg_err_success && dma.iv) {
+    CRYPTO_DataRead(dma.iv_reg, block);
+    memcpy(dma.iv, block, BLOCK);
+  }
+
+  /* do not leave the key behind */
+  memset(block, 0, BLOCK);
+  CRYPTO_KeyBuf128Write(crypto, block);
+
+  dma.busy = 0;
+  if (callback) {
+    callback(result, dma.context);
+  }
+}
+
+// public functions
+
+errorcode_t aes_dma_start(teAesDmaMode mode, int encrypt, const uint8_t *key, uint8_t *iv,
+    const uint8_t *in, uint8_t *out, uint32_t len, aes_dma_callback callback, void *context)
+{
+  CRYPTO_TypeDef *crypto = AES_DMA_CRYPTO;
+  uint32_t block[BLOCK / 4];
+
+  if (dma.busy) {
+    return bg_err_wrong_state;
+  }
+  if (!key || !in || !out || !len || (len % BLOCK) || ((uintptr_t) in & 3) || ((uintptr_t) out & 3)
+      || (mode != AES_DMA_ECB && !iv)) {
+    return bg_err_invalid_param;
+  }
+
+  CMU_ClockEnable(cmuClock_LDMA, true);
+  CMU_ClockEnable(AES_DMA_CRYPTO_CLOCK, true);
+  NVIC_EnableIRQ(LDMA_IRQn);
+
+  /* ECB and CBC decrypt with the last round key */
+  if (!encrypt && mode != AES_DMA_CTR) {
+    CRYPTO_AES_DecryptKey128(crypto, (uint8_t *) block, key);
+  } else {
+    memcpy(block, key, BLOCK);
+  }
+
+  crypto->CTRL = CRYPTO_CTRL_AES_AES128 | CRYPTO_CTRL_INCWIDTH_INCWIDTH4 | CRYPTO_CTRL_DMA0MODE_FULL
+                 | CRYPTO_CTRL_DMA0RSEL_DATA0;
+  crypto->WAC = 0;
+  crypto->SEQCTRLB = 0;
+  CRYPTO_KeyBuf128Write(crypto, block);
+
+  dma.iv = (mode == AES_DMA_ECB) ? NULL : iv;
+  if (dma.iv) {
+    memcpy(block, iv, BLOCK);
+  }
+
+  switch (mode) {
+    case AES_DMA_ECB:
+      CRYPTO_SEQ_LOAD_4(crypto,
+                        CRYPTO_CMD_INSTR_EXECIFA,
+                        CRYPTO_CMD_INSTR_DMA0TODATA,
+                        encrypt ? CRYPTO_CMD_INSTR_AESENC : CRYPTO_CMD_INSTR_AESDEC,
+                        CRYPTO_CMD_INSTR_DATATODMA0);
+      break;
+
+    case AES_DMA_CBC:
+      if (encrypt) {
+        /* C = E(K, C' ^ P), C' in DATA1 */
+        dma.iv_reg = &crypto->DATA1;
+        CRYPTO_SEQ_LOAD_6(crypto,
+                          CRYPTO_CMD_INSTR_EXECIFA,
+                          CRYPTO_CMD_INSTR_DATA1TODATA0,
+                          CRYPTO_CMD_INSTR_DMA0TODATAXOR,
+                          CRYPTO_CMD_INSTR_AESENC,
+                          CRYPTO_CMD_INSTR_DATA0TODATA1,
+                          CRYPTO_CMD_INSTR_DATATODMA0);
+      } else {
+        /* P = D(K, C) ^ C', C' in DATA2, C saved in DATA1 */
+        dma.iv_reg = &crypto->DATA2;
+        CRYPTO_SEQ_LOAD_7(crypto,
+                          CRYPTO_CMD_INSTR_EXECIFA,
+                          CRYPTO_CMD_INSTR_DMA0TODATA,
+                          CRYPTO_CMD_INSTR_DATA0TODATA1,
+                          CRYPTO_CMD_INSTR_AESDEC,
+                          CRYPTO_CMD_INSTR_DATA2TODATA0XOR,
+                          CRYPTO_CMD_INSTR_DATA1TODATA2,
+                          CRYPTO_CMD_INSTR_DATATODMA0);
+      }
+      CRYPTO_DataWrite(dma.iv_reg, block);
+      break;
+
+    case AES_DMA_CTR:
+      /* out = E(K, counter++) ^ in, counter in DATA1 */
+      dma.iv_reg = &crypto->DATA1;
+      CRYPTO_SEQ_LOAD_6(crypto,
+                        CRYPTO_CMD_INSTR_EXECIFA,
+                        CRYPTO_CMD_INSTR_DATA1TODATA0,
+                        CRYPTO_CMD_INSTR_AESENC,
+                        CRYPTO_CMD_INSTR_DATA1INC,
+                        CRYPTO_CMD_INSTR_DMA0TODATAXOR,
+                        CRYPTO_CMD_INSTR_DATATODMA0);
+      CRYPTO_DataWrite(dma.iv_reg, block);
+      break;
+
+    default:
+      return bg_err_invalid_param;
+  }
+
+  dma.callback = callback;
+  dma.context = context;
+  dma.in = in;
+  dma.out = out;
+  dma.remaining = len;
+  dma.busy = 1;
+
+  start_chunk();
+
+  return bg_err_success;
+}
+
+int aes_dma_busy(void)
+{
+  return dma.busy;
+}
+
+void aes_dma_irq(uint32_t pending)
+{
+  uint32_t error_ch;
+
+  if (!dma.busy) {
+    return;
+  }
+
+  // the error flag is shared, only an error on one of our channels ends the transfer
+  error_ch = (LDMA->STATUS & _LDMA_STATUS_CHERROR_MASK) >> _LDMA_STATUS_CHERROR_SHIFT;
+  if ((pending & LDMA_IF_ERROR) && (error_ch == AES_DMA_CH_IN || error_ch == AES_DMA_CH_OUT)) {
+    finish(bg_err_hardware);
+    return;
+  }
+
+  if (pending & (1UL << AES_DMA_CH_OUT)) {
+    dma.in += dma.chunk;
+    dma.out += dma.chunk;
+    dma.remaining -= dma.chunk;
+
+    if (dma.remaining) {
+      start_chunk();
+    } else {
+      finish(bg_err_success);
+    }
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef _AES_DMA_H
+#define _AES_DMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  Bulk AES-128 with the data moved by the LDMA.
+ *
+ *  One LDMA channel writes the input to the CRYPTO block and another reads the
+ *  result back, 16 bytes per request. The CRYPTO sequencer runs the whole
+ *  buffer as one looped sequence, so the CPU only sets up the transfer and is
+ *  called back when it is done. Buffers longer than AES_DMA_MAX_CHUNK are
+ *  processed in several runs, restarted from the LDMA interrupt; the chaining
+ *  value of CBC and the counter of CTR stay in the CRYPTO registers in between.
+ *
+ *  The transfers use the application CRYPTO instance shared with aes_ccm and
+ *  sha256, which must not be used while a transfer is running.
+ *
+ *  aes_dma_irq() has to be called from the LDMA interrupt handler.
+ */
+
+#ifndef AES_DMA_CRYPTO
+#define AES_DMA_CRYPTO           CRYPTO1
+#define AES_DMA_CRYPTO_CLOCK     cmuClock_CRYPTO1
+#define AES_DMA_REQSEL_IN        (LDMA_CH_REQSEL_SOURCESEL_CRYPTO1 | LDMA_CH_REQSEL_SIGSEL_CRYPTO1DATA0WR)
+#define AES_DMA_REQSEL_OUT       (LDMA_CH_REQSEL_SOURCESEL_CRYPTO1 | LDMA_CH_REQSEL_SIGSEL_CRYPTO1DATA0RD)
+#endif
+
+/* LDMA channels, channels 6 and 7 are used by the MX25 flash driver */
+#ifndef AES_DMA_CH_IN
+#define AES_DMA_CH_IN            4
+#endif
+#ifndef AES_DMA_CH_OUT
+#define AES_DMA_CH_OUT           5
+#endif
+
+/* bytes per sequencer run, limited by the 14 bit buffer length of the sequencer */
+#define AES_DMA_MAX_CHUNK        8192
+
+typedef enum {
+  AES_DMA_ECB,
+  AES_DMA_CBC,
+  AES_DMA_CTR
+} teAesDmaMode;
+
+/* called from interrupt context when the transfer is done */
+typedef void (*aes_dma_callback)(errorcode_t result, void *context);
+
+/* Start encrypting or decrypting len bytes (a multiple of 16) from in to out.
+ * Both buffers must be word aligned and stay valid until the callback; in ==
+ * out is allowed. iv is the CBC initialization vector or the initial CTR counter
+ * block (with a 32 bit counter in the last 4 bytes), NULL for ECB. When the
+ * transfer is done it holds the value to continue with. Returns
+ * bg_err_wrong_state if a transfer is already running. */
+errorcode_t aes_dma_start(teAesDmaMode mode, int encrypt, const uint8_t *key, uint8_t *iv,
+    const uint8_t *in, uint8_t *out, uint32_t len, aes_dma_callback callback, void *context);
+
+int aes_dma_busy(void);
+
+/* LDMA interrupt, pending are the flags of LDMA->IF that were set and enabled */
+void aes_dma_irq(uint32_t pending);
+
+#endif
@@ -0,0 +1,503 @@
+#include "blob_xfer.h"
+
+#include <string.h>
+
+#if BLOB_XFER_WINDOW > MESH_CFG_MAX_SEND_SEGS
+#error "BLOB_XFER_WINDOW must not be larger than MESH_CFG_MAX_SEND_SEGS"
+#endif
+
+#define SEND_IDLE            0
+#define SEND_STARTING        1    /* START sent, waiting for START_ACK */
+#define SEND_DATA            2
+
+#define BITMAP_BITS          32
+#define START_LEN            12
+#define START_ACK_LEN        5
+#define CHUNK_HEADER         3
+#define ACK_LEN              7
+
+static tsBlobXferOps ops;
+static tsBlobXferStats stats;
+
+static struct {
+  uint8_t state;
+  uint8_t id;
+  uint16_t addr;
+  uint32_t tag;
+  uint32_t size;
+  blob_xfer_read_fn read;
+  uint16_t chunks;
+  uint16_t base;                  /* first chunk not acknowledged */
+  uint16_t next;                  /* first chunk not sent yet */
+  uint32_t acked;                 /* bit i: chunk base + i acknowledged */
+  uint32_t resend;                /* bit i: chunk base + i to be sent again */
+  uint32_t sent_ms[BITMAP_BITS];  /* by chunk number modulo BITMAP_BITS */
+  uint32_t srtt_ms;               /* smoothed time from a chunk to its ACK */
+  uint8_t window;
+  uint8_t timeouts;
+  uint32_t last_ms;               /* last progress or timeout */
+  uint32_t start_ms;
+} tx;
+
+static struct {
+  uint8_t active;
+  uint8_t complete;
+  uint8_t id;
+  uint8_t window;
+  uint8_t unacked;                /* chunks received since the last ACK */
+  uint16_t chunk_size;
+  uint16_t addr;
+  uint32_t tag;
+  uint32_t size;
+  uint16_t chunks;
+  uint16_t base;                  /* first chunk missing */
+  uint32_t have;                  /* bit i: chunk base + i received */
+  uint32_t first_unacked_ms;
+  uint32_t ack_ms;
+} rx;
+
+// local functions
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, (uint16_t) v);
+  put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return p[0] | ((uint16_t) p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+static uint32_t shift_bitmap(uint32_t bits, uint32_t n)
+{
+  return n >= BITMAP_BITS ? 0 : bits >> n;
+}
+
+static uint32_t chunk_count(uint32_t size, uint16_t chunk_size)
+{
+  return (size + chunk_size - 1) / chunk_size;
+}
+
+static uint16_t chunk_len(uint32_t size, uint16_t chunk_size, uint16_t chunk)
+{
+  uint32_t left = size - (uint32_t) chunk * chunk_size;
+
+  return left < chunk_size ? (uint16_t) left : chunk_size;
+}
+
+/* a chunk not acknowledged within this is taken as lost */
+static uint32_t resend_guard(void)
+{
+  uint32_t guard = 2 * tx.srtt_ms;
+
+  if (guard < BLOB_XFER_RESEND_GUARD_MS) {
+    guard = BLOB_XFER_RESEND_GUARD_MS;
+  }
+  return guard < BLOB_XFER_ACK_TIMEOUT_MS ? guard : BLOB_XFER_ACK_TIMEOUT_MS;
+}
+
+static void send_done(errorcode_t result, uint32_t now)
+{
+  uint32_t bytes = stats.bytes_acked - stats.resume_offset;
+
+  stats.elapsed_ms = now - tx.start_ms;
+  stats.bytes_per_s = stats.elapsed_ms ? (uint32_t)((uint64_t) bytes * 1000 / stats.elapsed_ms) : 0;
+  tx.state = SEND_IDLE;
+  if (ops.done) {
+    ops.done(tx.addr, tx.id, 1, result);
+  }
+}
+
+static errorcode_t send_start(void)
+{
+  uint8_t msg[START_LEN];
+
+  msg[0] = tx.id;
+  put32(msg + 1, tx.tag);
+  put32(msg + 5, tx.size);
+  put16(msg + 9, BLOB_XFER_CHUNK_SIZE);
+  msg[11] = BLOB_XFER_WINDOW;
+  return ops.send(tx.addr, BLOB_XFER_OP_START, msg, sizeof(msg));
+}
+
+static errorcode_t send_chunk(uint16_t chunk, uint32_t now)
+{
+  uint8_t msg[CHUNK_HEADER + BLOB_XFER_CHUNK_SIZE];
+  uint16_t len = chunk_len(tx.size, BLOB_XFER_CHUNK_SIZE, chunk);
+  errorcode_t res;
+
+  msg[0] = tx.id;
+  put16(msg + 1, chunk);
+  res = tx.read((uint32_t) chunk * BLOB_XFER_CHUNK_SIZE, msg + CHUNK_HEADER, len);
+  if (res == bg_err_success) {
+    res = ops.send(tx.addr, BLOB_XFER_OP_CHUNK, msg, CHUNK_HEADER + len);
+  }
+  if (res == bg_err_success) {
+    tx.sent_ms[chunk % BITMAP_BITS] = now;
+    stats.chunks_sent++;
+  }
+  return res;
+}
+
+/* Send the chunks marked as lost, then new ones until the window is full.
+ * Stops when the stack has no segmentation buffer left, the next tick or ACK
+ * continues. */
+static void send_window(uint32_t now)
+{
+  errorcode_t res;
+  uint8_t i;
+
+  for (i = 0; tx.resend && i < BITMAP_BITS; i++) {
+    if (!(tx.resend & (1UL << i))) {
+      continue;
+    }
+    res = send_chunk(tx.base + i, now);
+    if (res == bg_err_out_of_memory) {
+      stats.busy++;
+      return;
+    }
+    if (res != bg_err_success) {
+      send_done(res, now);
+      return;
+    }
+    tx.resend &= ~(1UL << i);
+    stats.resent++;
+  }
+
+  while (tx.next < tx.chunks && tx.next - tx.base < tx.window) {
+    res = send_chunk(tx.next, now);
+    if (res == bg_err_out_of_memory) {
+      stats.busy++;
+      return;
+    }
+    if (res != bg_err_success) {
+      send_done(res, now);
+      return;
+    }
+    tx.next++;
+  }
+}
+
+static void handle_start_ack(const uint8_t *data, size_t len, uint32_t now)
+{
+  uint16_t resume;
+
+  if (tx.state != SEND_STARTING || len < START_ACK_LEN || data[0] != tx.id) {
+    return;
+  }
+  if (data[1] != BLOB_XFER_STATUS_OK) {
+    send_done(bg_err_not_supported, now);
+    return;
+  }
+
+  resume = get16(data + 2);
+  if (resume > tx.chunks) {
+    resume = tx.chunks;
+  }
+  tx.window = data[4] < BLOB_XFER_WINDOW ? data[4] : BLOB_XFER_WINDOW;
+  if (tx.window == 0) {
+    tx.window = 1;
+  }
+  tx.base = tx.next = resume;
+  tx.acked = tx.resend = 0;
+  tx.timeouts = 0;
+  tx.last_ms = now;
+  tx.state = SEND_DATA;
+  stats.resume_offset = stats.bytes_acked = resume < tx.chunks ? (uint32_t) resume * BLOB_XFER_CHUNK_SIZE : tx.size;
+
+  if (tx.base >= tx.chunks) {
+    send_done(bg_err_success, now);
+  } else {
+    send_window(now);
+  }
+}
+
+static void handle_ack(const uint8_t *data, size_t len, uint32_t now)
+{
+  uint32_t bitmap, fresh, guard, rtt;
+  uint16_t base, delta, sample;
+  uint8_t i;
+
+  if (tx.state != SEND_DATA || len < ACK_LEN || data[0] != tx.id) {
+    return;
+  }
+  base = get16(data + 1);
+  bitmap = get32(data + 3);
+  // an ACK older than the last one, or for chunks never sent
+  if (base < tx.base || base > tx.next) {
+    return;
+  }
+  stats.acks++;
+
+  delta = base - tx.base;
+  fresh = bitmap & ~shift_bitmap(tx.acked, delta);
+  // one chunk acknowledged for the first time gives the round trip time
+  sample = 0xFFFF;
+  if (delta && delta <= BITMAP_BITS && !(tx.acked & (1UL << (delta - 1)))) {
+    sample = base - 1;
+  } else if (fresh) {
+    for (i = BITMAP_BITS - 1; !(fresh & (1UL << i)); i--)
+      ;
+    sample = base + i;
+  }
+  if (sample != 0xFFFF) {
+    rtt = now - tx.sent_ms[sample % BITMAP_BITS];
+    tx.srtt_ms = tx.srtt_ms ? (7 * tx.srtt_ms + rtt) / 8 : rtt;
+  }
+  tx.acked = shift_bitmap(tx.acked, delta) | bitmap;
+  tx.resend = shift_bitmap(tx.resend, delta) & ~tx.acked;
+  tx.base = base;
+  if (delta || fresh) {
+    tx.timeouts = 0;
+    tx.last_ms = now;
+  }
+  stats.bytes_acked = tx.base < tx.chunks ? (uint32_t) tx.base * BLOB_XFER_CHUNK_SIZE : tx.size;
+
+  if (tx.base >= tx.chunks) {
+    send_done(bg_err_success, now);
+    return;
+  }
+
+  // everything the receiver still misses and that is overdue is sent again
+  guard = resend_guard();
+  for (i = 0; i < BITMAP_BITS && tx.base + i < tx.next; i++) {
+    if (!(tx.acked & (1UL << i)) && now - tx.sent_ms[(tx.base + i) % BITMAP_BITS] >= guard) {
+      tx.resend |= 1UL << i;
+    }
+  }
+  send_window(now);
+}
+
+static void send_ack(uint32_t now)
+{
+  uint8_t msg[ACK_LEN];
+
+  msg[0] = rx.id;
+  put16(msg + 1, rx.base);
+  put32(msg + 3, rx.have);
+  if (ops.send(rx.addr, BLOB_XFER_OP_ACK, msg, sizeof(msg)) == bg_err_success) {
+    rx.unacked = 0;
+    rx.ack_ms = now;
+    stats.rx_acks_sent++;
+  }
+}
+
+static void handle_start(uint16_t addr, const uint8_t *data, size_t len, uint32_t now)
+{
+  uint8_t msg[START_ACK_LEN];
+  uint32_t tag, size;
+  uint16_t chunk_size;
+
+  if (len < START_LEN) {
+    return;
+  }
+  tag = get32(data + 1);
+  size = get32(data + 5);
+  chunk_size = get16(data + 9);
+
+  msg[0] = data[0];
+  msg[1] = BLOB_XFER_STATUS_OK;
+
+  // the same blob again continues where the last attempt stopped
+  if (!(rx.active && rx.addr == addr && rx.id == data[0] && rx.tag == tag && rx.size == size
+        && rx.chunk_size == chunk_size)) {
+    if (chunk_size == 0 || chunk_size > BLOB_XFER_MAX_PAYLOAD - CHUNK_HEADER
+        || chunk_count(size, chunk_size) > 0xFFFF
+        || !ops.accept || ops.accept(addr, data[0], tag, size) != bg_err_success) {
+      msg[1] = BLOB_XFER_STATUS_REJECTED;
+    } else {
+      memset(&rx, 0, sizeof(rx));
+      rx.active = 1;
+      rx.addr = addr;
+      rx.id = data[0];
+      rx.tag = tag;
+      rx.size = size;
+      rx.chunk_size = chunk_size;
+      rx.chunks = (uint16_t) chunk_count(size, chunk_size);
+      rx.complete = rx.chunks == 0;
+    }
+  }
+
+  rx.window = data[11] < BITMAP_BITS ? data[11] : BITMAP_BITS;
+  rx.unacked = 0;
+  rx.ack_ms = now;
+  put16(msg + 2, msg[1] == BLOB_XFER_STATUS_OK ? rx.base : 0);
+  msg[4] = rx.window;
+  ops.send(addr, BLOB_XFER_OP_START_ACK, msg, sizeof(msg));
+}
+
+static void handle_chunk(uint16_t addr, const uint8_t *data, size_t len, uint32_t now)
+{
+  uint16_t chunk;
+  uint32_t bit;
+
+  if (!rx.active || addr != rx.addr || len < CHUNK_HEADER || data[0] != rx.id) {
+    return;
+  }
+  chunk = get16(data + 1);
+
+  if (chunk < rx.base || (chunk - rx.base < BITMAP_BITS && (rx.have & (1UL << (chunk - rx.base))))) {
+    // our ACK was lost, the sender would go on sending this chunk
+    stats.rx_duplicates++;
+    if (now - rx.ack_ms >= BLOB_XFER_ACK_DELAY_MS) {
+      send_ack(now);
+    }
+    return;
+  }
+  if (chunk >= rx.chunks || chunk - rx.base >= BITMAP_BITS
+      || len - CHUNK_HEADER != chunk_len(rx.size, rx.chunk_size, chunk)) {
+    stats.rx_out_of_window++;
+    return;
+  }
+  if (!ops.write || ops.write((uint32_t) chunk * rx.chunk_size, data + CHUNK_HEADER, (uint16_t)(len - CHUNK_HEADER)) != bg_err_success) {
+    return; // sent again later
+  }
+
+  stats.rx_chunks++;
+  bit = 1UL << (chunk - rx.base);
+  rx.have |= bit;
+  while (rx.have & 1) {
+    rx.have >>= 1;
+    rx.base++;
+  }
+  if (rx.unacked++ == 0) {
+    rx.first_unacked_ms = now;
+  }
+
+  if (rx.base >= rx.chunks) {
+    rx.complete = 1;
+    send_ack(now);
+    if (ops.done) {
+      ops.done(rx.addr, rx.id, 0, bg_err_success);
+    }
+  } else if (rx.unacked >= (rx.window > 1 ? rx.window / 2 : 1)) {
+    send_ack(now);
+  }
+}
+
+// public functions
+
+void blob_xfer_init(const tsBlobXferOps *o)
+{
+  ops = *o;
+  memset(&stats, 0, sizeof(stats));
+  memset(&tx, 0, sizeof(tx));
+  memset(&rx, 0, sizeof(rx));
+}
+
+errorcode_t blob_xfer_send_start(uint16_t addr, uint8_t id, uint32_t tag, uint32_t size, blob_xfer_read_fn read, uint32_t now_ms)
+{
+  errorcode_t res;
+
+  if (tx.state != SEND_IDLE) {
+    return bg_err_wrong_state;
+  }
+  if (!read || chunk_count(size, BLOB_XFER_CHUNK_SIZE) > 0xFFFF) {
+    return bg_err_invalid_param;
+  }
+
+  memset(&tx, 0, sizeof(tx));
+  tx.addr = addr;
+  tx.id = id;
+  tx.tag = tag;
+  tx.size = size;
+  tx.read = read;
+  tx.chunks = (uint16_t) chunk_count(size, BLOB_XFER_CHUNK_SIZE);
+  tx.start_ms = tx.last_ms = now_ms;
+
+  stats.size = size;
+  stats.resume_offset = stats.bytes_acked = 0;
+  stats.chunks_sent = stats.resent = stats.acks = stats.timeouts = stats.busy = 0;
+  stats.elapsed_ms = stats.bytes_per_s = 0;
+
+  res = send_start();
+  if (res != bg_err_success && res != bg_err_out_of_memory) {
+    return res;
+  }
+  // if the stack is busy, the START goes out again at the first timeout
+  tx.state = SEND_STARTING;
+  return bg_err_success;
+}
+
+void blob_xfer_send_cancel(void)
+{
+  tx.state = SEND_IDLE;
+}
+
+int blob_xfer_sending(void)
+{
+  return tx.state != SEND_IDLE;
+}
+
+void blob_xfer_receive(uint16_t addr, uint8_t opcode, const uint8_t *data, size_t len, uint32_t now_ms)
+{
+  switch (opcode) {
+    case BLOB_XFER_OP_START:
+      handle_start(addr, data, len, now_ms);
+      break;
+    case BLOB_XFER_OP_START_ACK:
+      if (addr == tx.addr) {
+        handle_start_ack(data, len, now_ms);
+      }
+      break;
+    case BLOB_XFER_OP_CHUNK:
+      handle_chunk(addr, data, len, now_ms);
+      break;
+    case BLOB_XFER_OP_ACK:
+      if (addr == tx.addr) {
+        handle_ack(data, len, now_ms);
+      }
+      break;
+  }
+}
+
+void blob_xfer_tick(uint32_t now_ms)
+{
+  if (rx.active && !rx.complete && rx.unacked && now_ms - rx.first_unacked_ms >= BLOB_XFER_ACK_DELAY_MS) {
+    send_ack(now_ms);
+  }
+
+  if (tx.state == SEND_IDLE) {
+    return;
+  }
+  if (tx.state == SEND_DATA) {
+    send_window(now_ms);
+    if (tx.state == SEND_IDLE) {
+      return;
+    }
+  }
+  if (now_ms - tx.last_ms < BLOB_XFER_ACK_TIMEOUT_MS) {
+    return;
+  }
+
+  tx.last_ms = now_ms;
+  stats.timeouts++;
+  if (++tx.timeouts > BLOB_XFER_MAX_TIMEOUTS) {
+    send_done(bg_err_timeout, now_ms);
+    return;
+  }
+  if (tx.state == SEND_STARTING) {
+    send_start();
+  } else {
+    // the first missing chunk makes the receiver report what it has
+    tx.resend |= 1;
+    send_window(now_ms);
+  }
+}
+
+void blob_xfer_get_stats(tsBlobXferStats *s)
+{
+  *s = stats;
+}
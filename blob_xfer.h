@@ -0,0 +1,148 @@
+#ifndef _BLOB_XFER_H
+#define _BLOB_XFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+#include "mesh_app_memory_config.h"
+
+/**
+ *  Transfer of blobs of a few kB (calibration tables, configuration) to a node
+ *  over vendor model messages.
+ *
+ *  The blob is cut into chunks that fill the largest access message, 380
+ *  octets in 32 segments, less the vendor opcode and the chunk header. Instead
+ *  of waiting for an answer to every chunk, the sender keeps up to
+ *  BLOB_XFER_WINDOW chunks in flight. Each of them takes one of the
+ *  MESH_CFG_MAX_SEND_SEGS segmented messages the stack can have in transit at a
+ *  time, so the window is never larger than that. The
+ *  receiver acknowledges selectively: an ACK carries the first chunk it is
+ *  still missing and a bitmap of the chunks after it that it already has, so
+ *  only the lost chunks are sent again. A chunk is sent again when a later one
+ *  has been acknowledged, or when no ACK has arrived for BLOB_XFER_ACK_TIMEOUT_MS.
+ *
+ *  The receiver keeps the state of a transfer after the sender has given up.
+ *  Starting the same blob (same id, tag and size) again resumes at the first
+ *  missing chunk reported in the answer to the start message.
+ *
+ *  Messages (little endian):
+ *    START      id, tag (4), size (4), chunk size (2), window
+ *    START_ACK  id, status, first missing chunk (2), window
+ *    CHUNK      id, chunk number (2), data
+ *    ACK        id, first missing chunk (2), bitmap (4), bit i is chunk first + i
+ *
+ *  The module does not send or read the clock itself, so that it can also be
+ *  run in a host simulation (tools/blob_sim.c): messages go out through the
+ *  send function given to blob_xfer_init(), received ones are passed to
+ *  blob_xfer_receive(), and blob_xfer_tick() is called every few tens of ms.
+ *  A device can be the sender and the receiver of one transfer each at a time.
+ */
+
+/* vendor opcodes */
+#ifndef BLOB_XFER_OP_START
+#define BLOB_XFER_OP_START           0x20
+#define BLOB_XFER_OP_START_ACK       0x21
+#define BLOB_XFER_OP_CHUNK           0x22
+#define BLOB_XFER_OP_ACK             0x23
+#endif
+
+/* chunks in flight, at most MESH_CFG_MAX_SEND_SEGS (the segmented messages
+ * the stack keeps in transit) */
+#ifndef BLOB_XFER_WINDOW
+#define BLOB_XFER_WINDOW             MESH_CFG_MAX_SEND_SEGS
+#endif
+
+#ifndef BLOB_XFER_ACK_TIMEOUT_MS
+#define BLOB_XFER_ACK_TIMEOUT_MS     2000
+#endif
+
+/* timeouts in a row without progress before the sender gives up */
+#ifndef BLOB_XFER_MAX_TIMEOUTS
+#define BLOB_XFER_MAX_TIMEOUTS       5
+#endif
+
+/* a chunk is not sent again sooner than this after it was sent */
+#ifndef BLOB_XFER_RESEND_GUARD_MS
+#define BLOB_XFER_RESEND_GUARD_MS    300
+#endif
+
+/* the receiver acknowledges the chunks received at the latest after this */
+#ifndef BLOB_XFER_ACK_DELAY_MS
+#define BLOB_XFER_ACK_DELAY_MS       150
+#endif
+
+/* payload of a vendor message: the 380 octet access message (32 segments of
+ * 12 octets less the 4 octet TransMIC) less the 3 octet opcode */
+#define BLOB_XFER_MAX_PAYLOAD        (380 - 3)
+
+/* data in a CHUNK, after the 3 octet chunk header */
+#ifndef BLOB_XFER_CHUNK_SIZE
+#define BLOB_XFER_CHUNK_SIZE         (BLOB_XFER_MAX_PAYLOAD - 3)
+#endif
+
+/* status of START_ACK */
+#define BLOB_XFER_STATUS_OK          0
+#define BLOB_XFER_STATUS_REJECTED    1
+
+/* send a vendor message to addr */
+typedef errorcode_t (*blob_xfer_send_fn)(uint16_t addr, uint8_t opcode, const uint8_t *data, uint16_t len);
+
+/* sender: read len bytes of the blob at offset */
+typedef errorcode_t (*blob_xfer_read_fn)(uint32_t offset, uint8_t *data, uint16_t len);
+
+/* receiver: a blob is offered, return bg_err_success to take it */
+typedef errorcode_t (*blob_xfer_accept_fn)(uint16_t addr, uint8_t id, uint32_t tag, uint32_t size);
+
+/* receiver: store len bytes of the blob at offset, chunks come in any order */
+typedef errorcode_t (*blob_xfer_write_fn)(uint32_t offset, const uint8_t *data, uint16_t len);
+
+/* a transfer has ended, sent == 1 for the sender side */
+typedef void (*blob_xfer_done_fn)(uint16_t addr, uint8_t id, uint8_t sent, errorcode_t result);
+
+typedef struct {
+  blob_xfer_send_fn send;
+  blob_xfer_accept_fn accept;   /* NULL if the device does not receive blobs */
+  blob_xfer_write_fn write;
+  blob_xfer_done_fn done;
+} tsBlobXferOps;
+
+typedef struct {
+  /* sender, last or current transfer */
+  uint32_t size;
+  uint32_t resume_offset;       /* offset the transfer started from */
+  uint32_t bytes_acked;
+  uint32_t chunks_sent;         /* including the ones sent again */
+  uint32_t resent;
+  uint32_t acks;
+  uint32_t timeouts;
+  uint32_t busy;                /* sends refused, segmentation buffers full */
+  uint32_t elapsed_ms;
+  uint32_t bytes_per_s;
+  /* receiver, all transfers */
+  uint32_t rx_chunks;
+  uint32_t rx_duplicates;
+  uint32_t rx_out_of_window;
+  uint32_t rx_acks_sent;
+} tsBlobXferStats;
+
+void blob_xfer_init(const tsBlobXferOps *ops);
+
+/* Send size bytes read with read to addr. bg_err_wrong_state if a transfer is
+ * being sent already. */
+errorcode_t blob_xfer_send_start(uint16_t addr, uint8_t id, uint32_t tag, uint32_t size, blob_xfer_read_fn read, uint32_t now_ms);
+
+/* give up the transfer being sent, the receiver keeps its part for a resume */
+void blob_xfer_send_cancel(void);
+
+int blob_xfer_sending(void);
+
+/* a vendor message with one of the BLOB_XFER_OP_ opcodes */
+void blob_xfer_receive(uint16_t addr, uint8_t opcode, const uint8_t *data, size_t len, uint32_t now_ms);
+
+/* resends, timeouts and delayed acknowledgements */
+void blob_xfer_tick(uint32_t now_ms);
+
+void blob_xfer_get_stats(tsBlobXferStats *stats);
+
+#endif
@@ -0,0 +1,698 @@
+#include "cdb_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_gecko.h"
+#include "node_db.h"
+#include "key_refresh.h"
+#include "mesh_kdf.h"
+
+#define MODE_IDLE            0
+#define MODE_EXPORT          1
+#define MODE_IMPORT          2
+
+#define TOKEN_MAX            48
+#define KEY_MAX              24
+
+/* top level arrays the importer reads, and the arrays inside a node object */
+#define SECTION_NONE         0
+#define SECTION_NETKEYS      1
+#define SECTION_APPKEYS      2
+#define SECTION_NODES        3
+#define SECTION_ELEMENTS     4
+
+/* depth of the records inside the top level arrays, and of the objects inside node arrays */
+#define DEPTH_RECORD         3
+#define DEPTH_NODE_ITEM      5
+
+#define FIELD_INDEX          0x01
+#define FIELD_KEY            0x02
+#define FIELD_UUID           0x04
+#define FIELD_ADDRESS        0x08
+#define FIELD_DEVICE_KEY     0x10
+
+typedef struct {
+  uint8_t depth;
+  uint32_t arrays;            /* bit n set if the container at depth n is an array */
+  uint8_t in_string;
+  uint8_t escape;
+  uint8_t expect_key;
+  uint8_t tok_len;
+  char tok[TOKEN_MAX];
+  char key[KEY_MAX];
+  uint8_t section;
+  uint8_t sub;                /* array inside the current node */
+  uint32_t bytes;
+  uint16_t chunk_bytes;
+  uint16_t nodes_added;
+  uint16_t nodes_skipped;
+  uint8_t have_netkey;        /* netkey of the document read, waiting for the appkey */
+} tsParser;
+
+/* fields of the record being read */
+typedef struct {
+  uint8_t fields;
+  uint16_t index;
+  uint8_t key[16];
+  uint8_t uuid[16];
+  uint8_t device_key[16];
+  uint16_t address;
+  uint16_t pid;
+  uint8_t elements;
+  uint8_t config_complete;
+} tsRecord;
+
+static uint8_t mode;
+static uint32_t export_seq;
+
+static tsNetworkKeys keys;
+static uint8_t keys_valid;
+static uint8_t keys_revoked;          /* saved keys replaced by a key refresh */
+static uint8_t import_pending;
+static cdb_stream_network_cb network_cb;
+
+static tsParser parser;
+static tsRecord rec;
+static uint8_t doc_netkey[16];
+
+// local functions
+
+static void print_hex(const uint8_t *data, uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < len; i++) {
+    printf("%02X", data[i]);
+  }
+}
+
+/* parse 2*len hex digits, dashes (as in UUIDs) are skipped */
+static int parse_hex(const char *s, uint8_t *out, uint32_t len)
+{
+  uint32_t n = 0;
+  uint8_t v;
+  char c;
+
+  memset(out, 0, len);
+  for (; *s; s++) {
+    c = *s;
+    if (c == '-') {
+      continue;
+    }
+    if (c >= '0' && c <= '9') {
+      v = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      v = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      v = c - 'A' + 10;
+    } else {
+      return -1;
+    }
+    if (n >= 2 * len) {
+      return -1;
+    }
+    out[n / 2] |= (n & 1) ? v : (v << 4);
+    n++;
+  }
+  return n == 2 * len ? 0 : -1;
+}
+
+static void save_keys(void)
+{
+  gecko_cmd_flash_ps_save(CDB_PS_KEY_NETWORK_KEYS, sizeof(keys), (const uint8 *) &keys);
+}
+
+/* ---- export ---- */
+
+static void export_header(void)
+{
+  printf("{\"$schema\":\"http://json-schema.org/draft-04/schema#\",\"version\":\"1.0.0\",\"meshName\":\"provisioner\",");
+  if (!keys_valid) {
+    printf("\"netKeys\":[],\"appKeys\":[],\"nodes\":[");
+    return;
+  }
+  printf("\"netKeys\":[{\"name\":\"netkey\",\"index\":%u,\"key\":\"", keys.netkey_index);
+  print_hex(keys.netkey, 16);
+  printf("\",\"phase\":0,\"minSecurity\":\"secure\"}],");
+  printf("\"appKeys\":[{\"name\":\"appkey\",\"index\":%u,\"boundNetKey\":%u,\"key\":\"", keys.appkey_index, keys.netkey_index);
+  print_hex(keys.appkey, 16);
+  printf("\"}],\"nodes\":[");
+}
+
+static void export_node(uint16_t slot)
+{
+  struct gecko_msg_mesh_prov_ddb_get_rsp_t *ddb;
+  uint8_t i;
+
+  if (slot > 0) {
+    printf(",");
+  }
+  printf("{\"UUID\":\"");
+  print_hex(_sNodeDB.uuid[slot], 16);
+  printf("\",\"unicastAddress\":\"%04X\"", _sNodeDB.address[slot]);
+
+  ddb = gecko_cmd_mesh_prov_ddb_get(16, _sNodeDB.uuid[slot]);
+  if (ddb->result == bg_err_success) {
+    printf(",\"deviceKey\":\"");
+    print_hex(ddb->device_key.data, 16);
+    printf("\",\"netKeys\":[{\"index\":%u,\"updated\":false}]", ddb->netkey_index);
+  }
+
+  printf(",\"security\":\"secure\",\"configComplete\":%s", _sNodeDB.config_state[slot] == NODE_DB_CONFIG_DONE ? "true" : "false");
+  if (_sNodeDB.product_id[slot]) {
+    printf(",\"pid\":\"%04X\"", _sNodeDB.product_id[slot]);
+  }
+  printf(",\"elements\":[");
+  for (i = 0; i < _sNodeDB.elements[slot]; i++) {
+    printf("%s{\"index\":%u,\"location\":\"0000\",\"models\":[]}", i ? "," : "", i);
+  }
+  printf("]");
+  if (keys_valid) {
+    printf(",\"appKeys\":[{\"index\":%u,\"updated\":false}]", keys.appkey_index);
+  }
+  printf(",\"excluded\":false}");
+}
+
+/* print one fragment: 0 is the header, 1..count the nodes, count + 1 the footer */
+static void export_step(void)
+{
+  uint32_t last = (uint32_t)_sNodeDB.count + 1;
+
+  printf("@cdb %lu ", (unsigned long) export_seq);
+  if (export_seq == 0) {
+    export_header();
+  } else if (export_seq < last) {
+    export_node(export_seq - 1);
+  } else {
+    printf("]}");
+  }
+  printf("\r\n");
+
+  if (export_seq >= last) {
+    printf("@cdb end %lu\r\n", (unsigned long) (last + 1));
+    mode = MODE_IDLE;
+  }
+  export_seq++;
+}
+
+/* ---- import ---- */
+
+static void import_stop(const char *error)
+{
+  if (error) {
+    printf("@cdb error %lu %s\r\n", (unsigned long) parser.bytes, error);
+  } else {
+    printf("@cdb done %u %u\r\n", parser.nodes_added, parser.nodes_skipped);
+  }
+  mode = MODE_IDLE;
+}
+
+static void import_start(void)
+{
+  memset(&parser, 0, sizeof(parser));
+  mode = MODE_IMPORT;
+  printf("@cdb ready %u\r\n", CDB_IMPORT_CHUNK);
+}
+
+static const char *commit_netkey(void)
+{
+  if (!(rec.fields & FIELD_KEY)) {
+    return "netkey without key";
+  }
+  if (parser.have_netkey) {
+    // the provisioner runs a single network
+    return NULL;
+  }
+  if (keys_valid && memcmp(keys.netkey, rec.key, 16) != 0) {
+    return "netkey differs from the local network, use cdb new first";
+  }
+  memcpy(doc_netkey, rec.key, 16);
+  parser.have_netkey = 1;
+  return NULL;
+}
+
+static const char *commit_appkey(void)
+{
+  if (!(rec.fields & FIELD_KEY) || !parser.have_netkey) {
+    return "appkey without key or netkey";
+  }
+  if (keys_valid) {
+    if (memcmp(keys.appkey, rec.key, 16) != 0) {
+      return "appkey differs from the local network, use cdb new first";
+    }
+    return NULL;
+  }
+  if (!import_pending) {
+    return "local network keys unknown, use cdb new first";
+  }
+  if (cdb_stream_create_network(doc_netkey, rec.key) != bg_err_success) {
+    return "creating the network failed";
+  }
+  if (network_cb) {
+    network_cb(&keys);
+  }
+  return NULL;
+}
+
+static const char *commit_node(void)
+{
+  struct gecko_msg_mesh_prov_ddb_add_rsp_t *add_rsp;
+  uuid_128 uuid;
+  aes_key_128 device_key;
+  uint16_t slot;
+
+  if ((rec.fields & (FIELD_UUID | FIELD_ADDRESS | FIELD_DEVICE_KEY)) != (FIELD_UUID | FIELD_ADDRESS | FIELD_DEVICE_KEY)) {
+    return "node without UUID, address or device key";
+  }
+  if (!keys_valid) {
+    return "node before network keys";
+  }
+
+  if (node_db_find_by_uuid(rec.uuid) != NODE_DB_INVALID) {
+    parser.nodes_skipped++;
+    return NULL;
+  }
+
+  memcpy(uuid.data, rec.uuid, 16);
+  memcpy(device_key.data, rec.device_key, 16);
+  add_rsp = gecko_cmd_mesh_prov_ddb_add(uuid, device_key, keys.netkey_index, rec.address, rec.elements);
+  if (add_rsp->result == bg_err_mesh_already_exists) {
+    parser.nodes_skipped++;
+    return NULL;
+  }
+  if (add_rsp->result != bg_err_success) {
+    return "adding the node to the DDB failed";
+  }
+
+  slot = node_db_add(rec.uuid, rec.address, rec.elements);
+  if (slot == NODE_DB_INVALID) {
+    return "node table full or address in use";
+  }
+  key_refresh_node_provisioned(slot);
+  node_db_set_dcd(rec.address, rec.pid, rec.elements);
+  node_db_set_config_state(rec.address, rec.config_complete ? NODE_DB_CONFIG_DONE : NODE_DB_CONFIG_PENDING);
+  parser.nodes_added++;
+  return NULL;
+}
+
+/* a string or bare value 'tok' was read for the member 'key' */
+static const char *import_value(int is_string)
+{
+  const char *key = parser.key;
+  const char *tok = parser.tok;
+
+  if (parser.depth == DEPTH_RECORD) {
+    if (!strcmp(key, "index") && !is_string) {
+      rec.index = (uint16_t) strtoul(tok, NULL, 10);
+      rec.fields |= FIELD_INDEX;
+    } else if (!strcmp(key, "key")) {
+      if (parse_hex(tok, rec.key, 16)) {
+        return "bad key";
+      }
+      rec.fields |= FIELD_KEY;
+    } else if (!strcmp(key, "UUID")) {
+      if (parse_hex(tok, rec.uuid, 16)) {
+        return "bad UUID";
+      }
+      rec.fields |= FIELD_UUID;
+    } else if (!strcmp(key, "deviceKey")) {
+      if (parse_hex(tok, rec.device_key, 16)) {
+        return "bad device key";
+      }
+      rec.fields |= FIELD_DEVICE_KEY;
+    } else if (!strcmp(key, "unicastAddress")) {
+      rec.address = (uint16_t) strtoul(tok, NULL, 16);
+      rec.fields |= FIELD_ADDRESS;
+    } else if (!strcmp(key, "pid")) {
+      rec.pid = (uint16_t) strtoul(tok, NULL, 16);
+    } else if (!strcmp(key, "configComplete")) {
+      rec.config_complete = !strcmp(tok, "true");
+    }
+  }
+  return NULL;
+}
+
+static const char *import_open(char c)
+{
+  uint8_t depth = parser.depth + 1;
+
+  if (depth >= 32) {
+    return "nesting too deep";
+  }
+
+  if (c == '[') {
+    parser.arrays |= (1UL << depth);
+    if (depth == 2) {
+      if (!strcmp(parser.key, "netKeys")) {
+        parser.section = SECTION_NETKEYS;
+      } else if (!strcmp(parser.key, "appKeys")) {
+        parser.section = SECTION_APPKEYS;
+      } else if (!strcmp(parser.key, "nodes")) {
+        parser.section = SECTION_NODES;
+      } else {
+        parser.section = SECTION_NONE;
+      }
+    } else if (depth == DEPTH_RECORD + 1 && parser.section == SECTION_NODES) {
+      parser.sub = !strcmp(parser.key, "elements") ? SECTION_ELEMENTS : SECTION_NONE;
+    }
+  } else {
+    parser.arrays &= ~(1UL << depth);
+    parser.expect_key = 1;
+    if (depth == DEPTH_RECORD && parser.section != SECTION_NONE) {
+      memset(&rec, 0, sizeof(rec));
+    } else if (depth == DEPTH_NODE_ITEM && parser.sub == SECTION_ELEMENTS) {
+      rec.elements++;
+    }
+  }
+  parser.depth = depth;
+  parser.key[0] = '\0';
+  return NULL;
+}
+
+static const char *import_close(char c)
+{
+  const char *error = NULL;
+  uint8_t depth = parser.depth;
+
+  if (depth == 0 || ((c == ']') != ((parser.arrays >> depth) & 1))) {
+    return "unbalanced brackets";
+  }
+
+  if (c == '}' && depth == DEPTH_RECORD) {
+    switch (parser.section) {
+      case SECTION_NETKEYS:
+        error = commit_netkey();
+      break;
+
+      case SECTION_APPKEYS:
+        error = commit_appkey();
+      break;
+
+      case SECTION_NODES:
+        error = commit_node();
+      break;
+
+      default:
+      break;
+    }
+  } else if (c == ']' && depth == DEPTH_RECORD + 1) {
+    parser.sub = SECTION_NONE;
+  } else if (c == ']' && depth == 2) {
+    parser.section = SECTION_NONE;
+  }
+
+  parser.depth--;
+  parser.expect_key = 0;
+  return error;
+}
+
+/* end of a bare value (number, true, false, null) */
+static const char *import_flush_bare(void)
+{
+  const char *error = NULL;
+
+  if (parser.tok_len) {
+    parser.tok[parser.tok_len] = '\0';
+    error = import_value(0);
+    parser.tok_len = 0;
+  }
+  return error;
+}
+
+static const char *import_char(char c)
+{
+  const char *error = NULL;
+
+  if (parser.in_string) {
+    if (parser.escape) {
+      parser.escape = 0;
+    } else if (c == '\\') {
+      parser.escape = 1;
+      return NULL;
+    } else if (c == '"') {
+      parser.in_string = 0;
+      parser.tok[parser.tok_len] = '\0';
+      if (parser.expect_key) {
+        strncpy(parser.key, parser.tok, KEY_MAX - 1);
+        parser.key[KEY_MAX - 1] = '\0';
+      } else {
+        error = import_value(1);
+      }
+      parser.tok_len = 0;
+      return error;
+    }
+    // long strings (names) are truncated, the fields used are short
+    if (parser.tok_len < TOKEN_MAX - 1) {
+      parser.tok[parser.tok_len++] = c;
+    }
+    return NULL;
+  }
+
+  switch (c) {
+    case '{':
+    case '[':
+      return import_open(c);
+
+    case '}':
+    case ']':
+      error = import_flush_bare();
+      return error ? error : import_close(c);
+
+    case ',':
+      error = import_flush_bare();
+      if (!((parser.arrays >> parser.depth) & 1)) {
+        parser.expect_key = 1;
+      }
+      return error;
+
+    case ':':
+      parser.expect_key = 0;
+      return NULL;
+
+    case '"':
+      parser.in_string = 1;
+      parser.tok_len = 0;
+      return NULL;
+
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+      return import_flush_bare();
+
+    default:
+      if (parser.depth == 0) {
+        return "document must be a single object";
+      }
+      if (parser.tok_len < TOKEN_MAX - 1) {
+        parser.tok[parser.tok_len++] = c;
+      }
+      return NULL;
+  }
+}
+
+static void import_input(char c)
+{
+  const char *error;
+
+  // skip anything before the document, e.g. the end of the command line
+  if (parser.bytes == 0 && c != '{') {
+    return;
+  }
+  parser.bytes++;
+
+  error = import_char(c);
+  if (error) {
+    import_stop(error);
+    return;
+  }
+  if (parser.depth == 0) {
+    import_stop(NULL);
+    return;
+  }
+
+  if (++parser.chunk_bytes == CDB_IMPORT_CHUNK) {
+    parser.chunk_bytes = 0;
+    printf("@cdb ack %lu\r\n", (unsigned long) parser.bytes);
+  }
+}
+
+/* ---- commands ---- */
+
+/* "cdb site <id> <secret>": create the network with the keys of a site */
+static void site_command(const char *args)
+{
+  uint8_t secret[MESH_KDF_KEY_LEN];
+  uint8_t netkey[16], appkey[16];
+  uint8_t enc_key[16], priv_key[16], network_id[8];
+  uint8_t p = 0, nid;
+  uint32_t site_id;
+  char *end;
+
+  site_id = strtoul(args, &end, 0);
+  while (*end == ' ') {
+    end++;
+  }
+  if (end == args || parse_hex(end, secret, sizeof(secret))) {
+    printf("@cdb site error usage: cdb site <id> <secret, 32 hex digits>\r\n");
+    return;
+  }
+  if (!import_pending) {
+    printf("@cdb site error network exists, use cdb new first\r\n");
+    return;
+  }
+
+  mesh_site_keys(secret, site_id, netkey, appkey);
+  memset(secret, 0, sizeof(secret));
+
+  if (cdb_stream_create_network(netkey, appkey) != bg_err_success) {
+    printf("@cdb site error creating the network failed\r\n");
+    return;
+  }
+  if (network_cb) {
+    network_cb(&keys);
+  }
+
+  mesh_k2(netkey, &p, 1, &nid, enc_key, priv_key);
+  mesh_k3(netkey, network_id);
+  printf("@cdb site %lu nid %02X aid %02X network id ", (unsigned long) site_id, nid, mesh_k4(appkey));
+  print_hex(network_id, sizeof(network_id));
+  printf("\r\n");
+}
+
+// public functions
+
+void cdb_stream_init(cdb_stream_network_cb cb)
+{
+  struct gecko_msg_flash_ps_load_rsp_t *load_rsp;
+
+  network_cb = cb;
+  mode = MODE_IDLE;
+
+  load_rsp = gecko_cmd_flash_ps_load(CDB_PS_KEY_NETWORK_KEYS);
+  keys_valid = (load_rsp->result == 0 && load_rsp->value.len == sizeof(keys));
+  if (keys_valid) {
+    memcpy(&keys, load_rsp->value.data, sizeof(keys));
+  }
+
+  load_rsp = gecko_cmd_flash_ps_load(CDB_PS_KEY_KEYS_REVOKED);
+  keys_revoked = (load_rsp->result == 0 && load_rsp->value.len == 1 && load_rsp->value.data[0]);
+
+  load_rsp = gecko_cmd_flash_ps_load(CDB_PS_KEY_IMPORT_PENDING);
+  import_pending = (load_rsp->result == 0 && load_rsp->value.len == 1 && load_rsp->value.data[0]);
+}
+
+errorcode_t cdb_stream_create_network(const uint8_t *netkey, const uint8_t *appkey)
+{
+  struct gecko_msg_mesh_prov_create_network_rsp_t *net_rsp;
+  struct gecko_msg_mesh_prov_create_appkey_rsp_t *app_rsp;
+  struct gecko_msg_system_get_random_data_rsp_t *rnd;
+
+  // the key values are chosen here so that they can be exported later
+  if (netkey) {
+    memcpy(keys.netkey, netkey, 16);
+  } else {
+    rnd = gecko_cmd_system_get_random_data(16);
+    if (rnd->result != 0 || rnd->data.len != 16) {
+      return rnd->result ? rnd->result : bg_err_hardware;
+    }
+    memcpy(keys.netkey, rnd->data.data, 16);
+  }
+
+  net_rsp = gecko_cmd_mesh_prov_create_network(16, keys.netkey);
+  if (net_rsp->result != 0) {
+    return net_rsp->result;
+  }
+  keys.netkey_index = net_rsp->network_id;
+
+  if (appkey) {
+    memcpy(keys.appkey, appkey, 16);
+  } else {
+    rnd = gecko_cmd_system_get_random_data(16);
+    if (rnd->result != 0 || rnd->data.len != 16) {
+      return rnd->result ? rnd->result : bg_err_hardware;
+    }
+    memcpy(keys.appkey, rnd->data.data, 16);
+  }
+
+  app_rsp = gecko_cmd_mesh_prov_create_appkey(keys.netkey_index, 16, keys.appkey);
+  if (app_rsp->result != 0) {
+    return app_rsp->result;
+  }
+  keys.appkey_index = app_rsp->appkey_index;
+
+  keys_valid = 1;
+  save_keys();
+  if (keys_revoked) {
+    keys_revoked = 0;
+    gecko_cmd_flash_ps_erase(CDB_PS_KEY_KEYS_REVOKED);
+  }
+
+  if (import_pending) {
+    import_pending = 0;
+    gecko_cmd_flash_ps_erase(CDB_PS_KEY_IMPORT_PENDING);
+  }
+  return bg_err_success;
+}
+
+const tsNetworkKeys *cdb_stream_keys(void)
+{
+  return keys_valid ? &keys : NULL;
+}
+
+int cdb_stream_import_pending(void)
+{
+  return import_pending;
+}
+
+/* the stack keeps the new keys of a key refresh to itself, the saved ones are stale from now on */
+void cdb_stream_revoke_keys(void)
+{
+  keys_revoked = 1;
+  gecko_cmd_flash_ps_save(CDB_PS_KEY_KEYS_REVOKED, 1, &keys_revoked);
+}
+
+int cdb_stream_command(const char *cmd)
+{
+  if (!strncmp(cmd, "cdb export", 10)) {
+    if (keys_revoked) {
+      // the keys of the export would be the ones the key refresh has replaced
+      printf("@cdb error keys replaced by a key refresh, export refused\r\n");
+      return 0;
+    }
+    export_seq = strtoul(cmd + 10, NULL, 10);
+    mode = MODE_EXPORT;
+  } else if (!strcmp(cmd, "cdb import")) {
+    import_start();
+  } else if (!strncmp(cmd, "cdb site ", 9)) {
+    site_command(cmd + 9);
+  } else if (!strcmp(cmd, "cdb new")) {
+    uint8_t flag = 1;
+
+    printf("@cdb reset\r\n");
+    gecko_cmd_flash_ps_erase_all();
+    gecko_cmd_flash_ps_save(CDB_PS_KEY_IMPORT_PENDING, 1, &flag);
+    gecko_cmd_system_reset(0);
+  } else {
+    printf("@cdb unknown command\r\n");
+  }
+  return mode == MODE_IMPORT;
+}
+
+int cdb_stream_input(char c)
+{
+  if (mode == MODE_IMPORT) {
+    import_input(c);
+  }
+  return mode != MODE_IMPORT;
+}
+
+void cdb_stream_poll(void)
+{
+  // one fragment per poll keeps the event loop responsive during long exports
+  if (mode == MODE_EXPORT) {
+    export_step();
+  }
+}
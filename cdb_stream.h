@@ -0,0 +1,81 @@
+#ifndef _CDB_STREAM_H
+#define _CDB_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  Export and import of the network in the style of the Mesh Configuration
+ *  Database (CDB) JSON format over the debug UART.
+ *
+ *  Neither direction builds the document in memory. The export is produced one
+ *  fragment at a time (the header with the keys, one fragment per node, the
+ *  footer), each printed as a line "@cdb <n> <json>". The host concatenates the
+ *  JSON parts; an interrupted export is resumed with "cdb export <n>".
+ *
+ *  The import feeds the document through a character level parser that keeps
+ *  only the fields of the object being read. The host sends the document in
+ *  chunks of CDB_IMPORT_CHUNK bytes and waits for "@cdb ack <bytes>" after each
+ *  one. Nodes already in the device database are skipped, so an interrupted
+ *  import is resumed by sending the document again.
+ *
+ *  UART commands, passed on by the console (see console.h):
+ *    cdb export [n]   print the network, starting at fragment n
+ *    cdb import       read a network document
+ *    cdb new          factory reset and wait for an import instead of creating keys
+ *    cdb site <id> <secret>
+ *                     after cdb new, create the network with the keys of a site
+ *                     derived from the master secret (see mesh_kdf)
+ *
+ *  After a key refresh the saved keys are stale and cdb export is refused
+ *  until a new network is created.
+ */
+
+/* import chunk size, must fit in the receive buffer of the UART driver (RXBUFSIZE) */
+#ifndef CDB_IMPORT_CHUNK
+#define CDB_IMPORT_CHUNK         64
+#endif
+
+/* persistent store keys, the application keys of the configuration progress start at 0x4000 */
+#define CDB_PS_KEY_NETWORK_KEYS     0x4001
+#define CDB_PS_KEY_IMPORT_PENDING   0x4002
+#define CDB_PS_KEY_KEYS_REVOKED     0x4003
+
+typedef struct {
+  uint16_t netkey_index;
+  uint16_t appkey_index;
+  uint8_t netkey[16];
+  uint8_t appkey[16];
+} tsNetworkKeys;
+
+/* called when an import has created the network keys */
+typedef void (*cdb_stream_network_cb)(const tsNetworkKeys *keys);
+
+/* Load the network keys saved by cdb_stream_create_network(). */
+void cdb_stream_init(cdb_stream_network_cb network_cb);
+
+/* Create the network and application key, random ones if the key pointers are NULL. */
+errorcode_t cdb_stream_create_network(const uint8_t *netkey, const uint8_t *appkey);
+
+/* keys of the network, NULL if they are not known */
+const tsNetworkKeys *cdb_stream_keys(void);
+
+/* nonzero after "cdb new", until an import has created the network */
+int cdb_stream_import_pending(void);
+
+/* The saved keys were replaced by a key refresh, refuse exports until a new network is created. */
+void cdb_stream_revoke_keys(void);
+
+/* Run a "cdb ..." command line. Returns nonzero if the following UART input
+ * goes to cdb_stream_input(). */
+int cdb_stream_command(const char *cmd);
+
+/* Input after "cdb import". Returns nonzero once the document has ended. */
+int cdb_stream_input(char c);
+
+/* Advance a running export. Call periodically. */
+void cdb_stream_poll(void);
+
+#endif
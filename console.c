@@ -0,0 +1,255 @@
+#include "console.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "em_device.h"
+#include "native_gecko.h"
+#include "retargetserial.h"
+#include "cdb_stream.h"
+#include "oob_store.h"
+#include "key_refresh.h"
+#include "blob_xfer.h"
+#include "liveness.h"
+#include "flash_stream.h"
+
+#define MODE_IDLE            0
+#define MODE_CDB             1   /* input to cdb_stream_input() */
+#define MODE_OOB_IMPORT      2
+#define MODE_IMAGE           3
+
+#define LINE_MAX             64
+
+#define STR_(x)              #x
+#define STR(x)               STR_(x)
+
+#if (CONSOLE_IMAGE_ADDR % FLASH_PAGE_SIZE) || (CONSOLE_IMAGE_SIZE % FLASH_PAGE_SIZE) || CONSOLE_IMAGE_SIZE == 0
+#error "CONSOLE_IMAGE_ADDR and CONSOLE_IMAGE_SIZE must be page aligned"
+#endif
+#if CONSOLE_IMAGE_ADDR + CONSOLE_IMAGE_SIZE > FLASH_BASE + FLASH_SIZE
+#error "the image staging region must lie in the internal flash"
+#endif
+
+/* the end of the application and the persistent store are only known when
+ * linking, the linker script checks the region against them */
+#ifdef __GNUC__
+__asm__(".global __console_image_start\n"
+        ".set __console_image_start, " STR(CONSOLE_IMAGE_ADDR) "\n"
+        ".global __console_image_end\n"
+        ".set __console_image_end, " STR(CONSOLE_IMAGE_ADDR) " + " STR(CONSOLE_IMAGE_SIZE) "\n");
+#endif
+
+static uint8_t mode;
+static char line[LINE_MAX];
+static uint8_t line_len;
+
+static tsFlashStream image;
+static uint8_t image_chunk[CONSOLE_IMAGE_CHUNK];
+static uint16_t image_fill;
+static uint32_t image_size;           /* size of the image being staged */
+static uint32_t image_staged;         /* size of the complete image in flash, 0 if none */
+
+// local functions
+
+static uint32_t time_ms(void)
+{
+  struct gecko_msg_hardware_get_time_rsp_t *t = gecko_cmd_hardware_get_time();
+  return t->seconds * 1000 + ((uint32_t)t->ticks * 1000) / 32768;
+}
+
+/* test pattern sent by "blob send", the same for every id */
+static errorcode_t blob_pattern(uint32_t offset, uint8_t *data, uint16_t len)
+{
+  uint16_t i;
+
+  for (i = 0; i < len; i++, offset++) {
+    data[i] = (uint8_t)(offset ^ (offset >> 8));
+  }
+  return bg_err_success;
+}
+
+/* "blob send <address> <size> <id>", sending the same id again resumes */
+static void blob_command(const char *args)
+{
+  uint32_t addr, size, id;
+  errorcode_t res;
+  char *end;
+
+  addr = strtoul(args, &end, 0);
+  size = strtoul(end, &end, 0);
+  id = strtoul(end, &end, 0);
+  if (addr == 0 || addr >= 0x8000 || size == 0 || id > 0xFF) {
+    printf("@blob error usage: blob send <address> <size> <id>\r\n");
+    return;
+  }
+
+  res = blob_xfer_send_start(addr, id, size, size, blob_pattern, time_ms());
+  if (res != bg_err_success) {
+    printf("@blob error %x\r\n", res);
+  }
+}
+
+static void image_stop(errorcode_t res)
+{
+  mode = MODE_IDLE;
+  if (res != bg_err_success) {
+    printf("@image error %lu %x\r\n", (unsigned long) flash_stream_offset(&image), res);
+    return;
+  }
+  image_staged = image_size;
+  printf("@image done %lu, %lu bytes/s\r\n", (unsigned long) image_size,
+      (unsigned long) (image.stats.busy_ms ? (uint64_t) image.stats.bytes * 1000 / image.stats.busy_ms : 0));
+}
+
+/* raw image bytes, written out one acknowledged chunk at a time */
+static void image_input(char c)
+{
+  errorcode_t res;
+
+  image_chunk[image_fill++] = (uint8_t) c;
+  if (image_fill < sizeof(image_chunk) && flash_stream_offset(&image) + image_fill < image_size) {
+    return;
+  }
+
+  res = flash_stream_write(&image, image_chunk, image_fill);
+  image_fill = 0;
+  if (res == bg_err_success && flash_stream_offset(&image) == image_size) {
+    image_stop(flash_stream_close(&image));
+  } else if (res != bg_err_success) {
+    image_stop(res);
+  } else {
+    printf("@image ack %lu\r\n", (unsigned long) flash_stream_offset(&image));
+  }
+}
+
+static errorcode_t image_read(uint32_t offset, uint8_t *data, uint16_t len)
+{
+  memcpy(data, (const uint8_t *) (CONSOLE_IMAGE_ADDR + offset), len);
+  return bg_err_success;
+}
+
+/* "image stage <size>" and "image send <address> <id>" */
+static void image_command(const char *args)
+{
+  uint32_t addr, size, id;
+  errorcode_t res;
+  char *end;
+
+  if (!strncmp(args, "stage ", 6)) {
+    size = strtoul(args + 6, &end, 0);
+    if (size == 0 || size > CONSOLE_IMAGE_SIZE) {
+      printf("@image error usage: image stage <size, up to %lu>\r\n", (unsigned long) CONSOLE_IMAGE_SIZE);
+      return;
+    }
+    image_staged = 0;
+    res = flash_stream_open(&image, CONSOLE_IMAGE_ADDR, CONSOLE_IMAGE_SIZE, 1);
+    if (res != bg_err_success) {
+      printf("@image error 0 %x\r\n", res);
+      return;
+    }
+    image_size = size;
+    image_fill = 0;
+    mode = MODE_IMAGE;
+    printf("@image ready %u\r\n", CONSOLE_IMAGE_CHUNK);
+  } else if (!strncmp(args, "send ", 5)) {
+    addr = strtoul(args + 5, &end, 0);
+    id = strtoul(end, &end, 0);
+    if (addr == 0 || addr >= 0x8000 || id > 0xFF) {
+      printf("@image error usage: image send <address> <id>\r\n");
+      return;
+    }
+    if (image_staged == 0) {
+      printf("@image error no image staged\r\n");
+      return;
+    }
+    res = blob_xfer_send_start(addr, id, image_staged, image_staged, image_read, time_ms());
+    if (res != bg_err_success) {
+      printf("@image error %x\r\n", res);
+    }
+  } else {
+    printf("@image error usage: image stage <size> | image send <address> <id>\r\n");
+  }
+}
+
+/* "kr start [s]" */
+static void kr_command(const char *args)
+{
+  const tsNetworkKeys *keys = cdb_stream_keys();
+  errorcode_t res = bg_err_wrong_state;
+
+  if (keys) {
+    res = key_refresh_start(keys->netkey_index, &keys->appkey_index, 1, strtoul(args, NULL, 0));
+  }
+  if (res != bg_err_success) {
+    printf("@kr error %x\r\n", res);
+  } else {
+    cdb_stream_revoke_keys();
+  }
+}
+
+static void command(const char *cmd)
+{
+  if (!strncmp(cmd, "cdb", 3) && (cmd[3] == ' ' || cmd[3] == '\0')) {
+    if (cdb_stream_command(cmd)) {
+      mode = MODE_CDB;
+    }
+  } else if (!strcmp(cmd, "oob import")) {
+    oob_store_import_start();
+    mode = MODE_OOB_IMPORT;
+  } else if (!strcmp(cmd, "oob clear")) {
+    printf(oob_store_clear() == bg_err_success ? "@oob cleared\r\n" : "@oob error clear failed\r\n");
+    oob_store_set_requirements();
+  } else if (!strncmp(cmd, "kr start", 8)) {
+    kr_command(cmd + 8);
+  } else if (!strncmp(cmd, "blob send ", 10)) {
+    blob_command(cmd + 10);
+  } else if (!strncmp(cmd, "image ", 6)) {
+    image_command(cmd + 6);
+  } else if (!strcmp(cmd, "live")) {
+    liveness_print(0);
+  } else if (cmd[0]) {
+    printf("@error unknown command\r\n");
+  }
+}
+
+// public functions
+
+void console_init(void)
+{
+  mode = MODE_IDLE;
+  line_len = 0;
+  image_staged = 0;
+}
+
+void console_poll(void)
+{
+  int c;
+
+  while ((c = RETARGET_ReadChar()) >= 0) {
+    if (mode == MODE_CDB) {
+      if (cdb_stream_input((char) c)) {
+        mode = MODE_IDLE;
+      }
+      continue;
+    }
+    if (mode == MODE_OOB_IMPORT) {
+      if (oob_store_import_char((char) c)) {
+        mode = MODE_IDLE;
+      }
+      continue;
+    }
+    if (mode == MODE_IMAGE) {
+      image_input((char) c);
+      continue;
+    }
+
+    if (c == '\r' || c == '\n') {
+      line[line_len] = '\0';
+      line_len = 0;
+      command(line);
+    } else if (line_len < LINE_MAX - 1) {
+      line[line_len++] = (char) c;
+    }
+  }
+}
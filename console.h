@@ -0,0 +1,54 @@
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#include <stdint.h>
+
+/**
+ *  Commands read from the debug UART, one per line. The "cdb" commands are
+ *  passed to cdb_stream (see cdb_stream.h), the others are run here. A
+ *  command followed by raw input (cdb import, oob import, image stage) gets
+ *  the characters of the UART until its input has ended.
+ *
+ *  UART commands besides the cdb ones:
+ *    oob import       read a table of static OOB values and public keys (see oob_store)
+ *    oob clear        erase the OOB table
+ *    kr start [s]     refresh the network and application key (see key_refresh),
+ *                     nodes not heard for s seconds are left out. The saved keys are
+ *                     stale afterwards and cdb export is refused until a new network
+ *                     is created.
+ *    blob send <address> <size> <id>
+ *                     send a test pattern with the blob transfer (see blob_xfer), the
+ *                     same id again resumes an interrupted transfer
+ *    live             print the liveness table of the nodes (see liveness)
+ *    image stage <size>
+ *                     write an image to the staging region of the internal flash (see
+ *                     flash_stream). The raw bytes follow "@image ready <chunk>" in
+ *                     chunks, each acknowledged with "@image ack <bytes>" like the import.
+ *    image send <address> <id>
+ *                     send the staged image with the blob transfer; the image is known
+ *                     until the next reset or stage command
+ */
+
+/* image chunk size, must fit in the receive buffer of the UART driver (RXBUFSIZE) */
+#ifndef CONSOLE_IMAGE_CHUNK
+#define CONSOLE_IMAGE_CHUNK      64
+#endif
+
+/* Staging region of "image stage" in the internal flash, page aligned, above the
+ * application and below the persistent store at the end of the flash. Plain
+ * numbers: they are passed to the linker script, which checks them against the
+ * application image. */
+#ifndef CONSOLE_IMAGE_ADDR
+#define CONSOLE_IMAGE_ADDR       0x00080000
+#endif
+
+#ifndef CONSOLE_IMAGE_SIZE
+#define CONSOLE_IMAGE_SIZE       0x00040000
+#endif
+
+void console_init(void);
+
+/* Read UART input and run the commands. Call periodically. */
+void console_poll(void);
+
+#endif
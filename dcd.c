@@ -20,7 +20,7 @@ const uint8_t __mesh_dcd[] = {
     /* Begin Primary Element */
         0x00, 0x00, /* Location = 0x0000 */
         0x05, /* Number of SIG Models = 0x05 */
-        0x00, /* Number of Vendor Models = 0x00 */
+        0x01, /* Number of Vendor Models = 0x01 */
         /* Begin SIG Models */
         0x00, 0x00, /* Configuration Server */
         0x02, 0x00, /* Health Server */
@@ -29,6 +29,7 @@ const uint8_t __mesh_dcd[] = {
         0x03, 0x00, /* Health Client */
         /* End SIG Models */
         /* Begin Vendor Models */
+        0x11, 0x11, 0x22, 0x22, /* Vendor ID = 0x1111, Model ID = 0x2222 */
         /* End Vendor Models */
     /* End Primary Element */
 };
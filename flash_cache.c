@@ -0,0 +1,222 @@
+#include "flash_cache.h"
+
+#include <string.h>
+
+#ifndef MX25_EMULATOR
+#include "mx25flash_spi.h"
+#else
+#include "mx25_emu.h"
+#endif
+
+#if FLASH_CACHE_PAGES <= FLASH_CACHE_READ_AHEAD
+#error "FLASH_CACHE_PAGES must be larger than FLASH_CACHE_READ_AHEAD"
+#endif
+
+#define PAGE_NONE            0xFFFFFFFF
+
+#define PAGE_OF(addr)        ((addr) & ~(uint32_t)(Page_Offset - 1))
+
+typedef struct {
+  uint32_t page;              /* flash address of the page, PAGE_NONE if unused */
+  uint32_t last_use;          /* value of use_clock at the last access */
+  uint8_t read_ahead;         /* loaded by read-ahead and not used yet */
+  uint8_t data[Page_Offset];
+} tsCachePage;
+
+static tsCachePage cache[FLASH_CACHE_PAGES];
+static uint32_t use_clock;
+static uint32_t last_miss = PAGE_NONE;
+
+static tsFlashCacheStats stats;
+
+// local functions
+
+static tsCachePage *cache_lookup(uint32_t page)
+{
+  int i;
+
+  for (i = 0; i < FLASH_CACHE_PAGES; i++) {
+    if (cache[i].page == page) {
+      return &cache[i];
+    }
+  }
+  return NULL;
+}
+
+/* unused page if there is one, least recently used page otherwise */
+static tsCachePage *cache_victim(void)
+{
+  tsCachePage *victim = &cache[0];
+  int i;
+
+  for (i = 0; i < FLASH_CACHE_PAGES; i++) {
+    if (cache[i].page == PAGE_NONE) {
+      return &cache[i];
+    }
+    if (cache[i].last_use < victim->last_use) {
+      victim = &cache[i];
+    }
+  }
+  return victim;
+}
+
+static tsCachePage *cache_load(uint32_t page, uint8_t read_ahead)
+{
+  tsCachePage *p = cache_victim();
+
+  p->page = PAGE_NONE;
+  if (MX25_READ(page, p->data, Page_Offset) != FlashOperationSuccess) {
+    return NULL;
+  }
+  p->page = page;
+  p->last_use = ++use_clock;
+  p->read_ahead = read_ahead;
+  return p;
+}
+
+static tsCachePage *cache_get(uint32_t page)
+{
+  tsCachePage *p = cache_lookup(page);
+  uint32_t next;
+  int i;
+
+  if (p) {
+    stats.hits++;
+    if (p->read_ahead) {
+      p->read_ahead = 0;
+      stats.read_ahead_hits++;
+    }
+    p->last_use = ++use_clock;
+    return p;
+  }
+
+  stats.misses++;
+  p = cache_load(page, 0);
+  if (!p) {
+    return NULL;
+  }
+
+  // a miss right after the previous one looks like a scan, fetch the following pages too
+  if (last_miss != PAGE_NONE && page == last_miss + Page_Offset) {
+    next = page;
+    for (i = 0; i < FLASH_CACHE_READ_AHEAD; i++) {
+      next += Page_Offset;
+      if (next >= FlashSize) {
+        break;
+      }
+      if (!cache_lookup(next)) {
+        if (!cache_load(next, 1)) {
+          break;
+        }
+        stats.read_ahead++;
+      }
+    }
+    // keep the requested page the most recently used one
+    p->last_use = ++use_clock;
+    last_miss = next;
+  } else {
+    last_miss = page;
+  }
+  return p;
+}
+
+// public functions
+
+void flash_cache_init(void)
+{
+  flash_cache_invalidate();
+  memset(&stats, 0, sizeof(stats));
+}
+
+void flash_cache_invalidate(void)
+{
+  int i;
+
+  for (i = 0; i < FLASH_CACHE_PAGES; i++) {
+    cache[i].page = PAGE_NONE;
+    cache[i].last_use = 0;
+  }
+  use_clock = 0;
+  last_miss = PAGE_NONE;
+}
+
+errorcode_t flash_cache_read(uint32_t addr, void *buf, uint32_t len)
+{
+  uint8_t *dst = (uint8_t *)buf;
+  tsCachePage *p;
+  uint32_t off, chunk;
+
+  while (len) {
+    p = cache_get(PAGE_OF(addr));
+    if (!p) {
+      return bg_err_hardware;
+    }
+    off = addr - p->page;
+    chunk = Page_Offset - off;
+    if (chunk > len) {
+      chunk = len;
+    }
+    memcpy(dst, &p->data[off], chunk);
+    addr += chunk;
+    dst += chunk;
+    len -= chunk;
+  }
+  return bg_err_success;
+}
+
+/* program len bytes, split at page boundaries since PP wraps around within a page */
+errorcode_t flash_cache_program(uint32_t addr, const void *buf, uint32_t len)
+{
+  const uint8_t *src = (const uint8_t *)buf;
+  tsCachePage *p;
+  uint32_t chunk, off, i;
+
+  while (len) {
+    off = addr & (Page_Offset - 1);
+    chunk = Page_Offset - off;
+    if (chunk > len) {
+      chunk = len;
+    }
+
+    p = cache_lookup(PAGE_OF(addr));
+    if (MX25_PP(addr, (uint8_t *)src, chunk) != FlashOperationSuccess) {
+      if (p) {
+        p->page = PAGE_NONE;
+      }
+      return bg_err_hardware;
+    }
+    // programming can only clear bits, do the same to the cached copy
+    if (p) {
+      for (i = 0; i < chunk; i++) {
+        p->data[off + i] &= src[i];
+      }
+    }
+
+    addr += chunk;
+    src += chunk;
+    len -= chunk;
+  }
+  return bg_err_success;
+}
+
+errorcode_t flash_cache_erase_sector(uint32_t addr)
+{
+  uint32_t sector = addr & ~(uint32_t)(Sector_Offset - 1);
+  int i;
+
+  for (i = 0; i < FLASH_CACHE_PAGES; i++) {
+    if (cache[i].page != PAGE_NONE && cache[i].page - sector < Sector_Offset) {
+      cache[i].page = PAGE_NONE;
+    }
+  }
+
+  if (MX25_SE(sector) != FlashOperationSuccess) {
+    return bg_err_hardware;
+  }
+  return bg_err_success;
+}
+
+void flash_cache_get_stats(tsFlashCacheStats *s)
+{
+  *s = stats;
+}
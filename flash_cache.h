@@ -0,0 +1,50 @@
+#ifndef _FLASH_CACHE_H
+#define _FLASH_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  Page cache in front of the MX25 SPI flash driver.
+ *
+ *  Reads are served in units of one flash page (256 bytes) from a small set of RAM
+ *  pages replaced in least recently used order. A miss on the page following the
+ *  previous miss is taken as a sequential scan and the next pages are read ahead.
+ *
+ *  Writes go to the flash right away. Cached copies of programmed pages are
+ *  updated the same way the flash is (bits can only be cleared) and pages of an
+ *  erased sector are dropped from the cache, so the cache never holds stale data
+ *  as long as all flash accesses are done through these functions.
+ */
+
+/* number of cached pages, 256 bytes of RAM each */
+#ifndef FLASH_CACHE_PAGES
+#define FLASH_CACHE_PAGES        16
+#endif
+
+/* pages read ahead after a sequential miss, 0 disables read-ahead */
+#ifndef FLASH_CACHE_READ_AHEAD
+#define FLASH_CACHE_READ_AHEAD   2
+#endif
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t read_ahead;        /* pages loaded by read-ahead */
+  uint32_t read_ahead_hits;   /* read-ahead pages that were used before eviction */
+} tsFlashCacheStats;
+
+void flash_cache_init(void);
+
+errorcode_t flash_cache_read(uint32_t addr, void *buf, uint32_t len);
+errorcode_t flash_cache_program(uint32_t addr, const void *buf, uint32_t len);
+errorcode_t flash_cache_erase_sector(uint32_t addr);
+
+/* drop all cached pages, for flash accesses done outside of the cache */
+void flash_cache_invalidate(void);
+
+void flash_cache_get_stats(tsFlashCacheStats *stats);
+
+#endif
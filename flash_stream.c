@@ -0,0 +1,186 @@
+#include "flash_stream.h"
+
+#include <string.h>
+
+#ifndef MSC_EMULATOR
+#include "em_device.h"
+#include "em_msc.h"
+#include "native_gecko.h"
+
+#define FLASH_PTR(addr)      ((uint32_t *)(addr))
+
+// from the linker script: the initialised data is stored in flash after the code
+extern char __etext[], __data_start__[], __data_end__[], __nvm3Base[];
+
+#define APP_END              ((uint32_t)__etext + (uint32_t)(__data_end__ - __data_start__))
+#define STORE_START          ((uint32_t)__nvm3Base)
+#else
+#include "msc_emu.h"
+
+#define FLASH_PTR(addr)      msc_emu_ptr(addr)
+#define APP_END              MSC_EMU_APP_END
+#define STORE_START          MSC_EMU_STORE_START
+#endif
+
+#if (FLASH_STREAM_BURST % 4) || (FLASH_PAGE_SIZE % FLASH_STREAM_BURST)
+#error "FLASH_STREAM_BURST must be a multiple of 4 and divide FLASH_PAGE_SIZE"
+#endif
+
+// local functions
+
+static uint32_t time_ms(void)
+{
+#ifndef MSC_EMULATOR
+  struct gecko_msg_hardware_get_time_rsp_t *t = gecko_cmd_hardware_get_time();
+  return t->seconds * 1000 + ((uint32_t)t->ticks * 1000) / 32768;
+#else
+  return (uint32_t)(msc_emu_time_us() / 1000);
+#endif
+}
+
+static errorcode_t msc_result(MSC_Status_TypeDef status)
+{
+  switch (status) {
+    case mscReturnOk:
+      return bg_err_success;
+    case mscReturnInvalidAddr:
+    case mscReturnUnaligned:
+      return bg_err_invalid_param;
+    case mscReturnTimeOut:
+      return bg_err_timeout;
+    default:
+      return bg_err_hardware;
+  }
+}
+
+static errorcode_t erase_page(tsFlashStream *s)
+{
+  MSC_Status_TypeDef status;
+
+  status = MSC_ErasePage(FLASH_PTR(s->erased_end));
+  if (status != mscReturnOk) {
+    return msc_result(status);
+  }
+  s->erased_end += FLASH_PAGE_SIZE;
+  s->stats.pages_erased++;
+  return bg_err_success;
+}
+
+/* write the full burst buffer at the cursor */
+static errorcode_t flush_burst(tsFlashStream *s)
+{
+  MSC_Status_TypeDef status;
+  errorcode_t res;
+
+  // a page is erased when its first burst is written
+  while (s->erased_end < s->cursor + FLASH_STREAM_BURST) {
+    res = erase_page(s);
+    if (res != bg_err_success) {
+      return res;
+    }
+  }
+
+  status = MSC_WriteWordFast(FLASH_PTR(s->cursor), s->buf, FLASH_STREAM_BURST);
+  if (status != mscReturnOk) {
+    return msc_result(status);
+  }
+  if (s->verify && memcmp(FLASH_PTR(s->cursor), s->buf, FLASH_STREAM_BURST) != 0) {
+    s->stats.verify_errors++;
+    return bg_err_data_corrupted;
+  }
+
+  s->cursor += FLASH_STREAM_BURST;
+  s->fill = 0;
+  s->stats.bytes += FLASH_STREAM_BURST;
+  s->stats.bursts++;
+  return bg_err_success;
+}
+
+// public functions
+
+/**
+ * Start writing a stream to the internal flash region [start, start + size).
+ * The region must be page aligned and lie between the end of the running
+ * application image, its code and initialised data, and the persistent
+ * store in the last pages of the flash.
+ */
+errorcode_t flash_stream_open(tsFlashStream *s, uint32_t start, uint32_t size, int verify)
+{
+  if ((start % FLASH_PAGE_SIZE) || (size % FLASH_PAGE_SIZE) || size == 0
+      || start < APP_END || start > STORE_START || size > STORE_START - start) {
+    return bg_err_invalid_param;
+  }
+
+  memset(s, 0, sizeof(*s));
+  s->start = start;
+  s->end = start + size;
+  s->cursor = start;
+  s->erased_end = start;
+  s->verify = verify ? 1 : 0;
+  s->open = 1;
+
+  MSC_Init();
+  return bg_err_success;
+}
+
+errorcode_t flash_stream_write(tsFlashStream *s, const void *data, uint32_t len)
+{
+  const uint8_t *src = (const uint8_t *)data;
+  uint32_t start_ms, chunk;
+  errorcode_t res = bg_err_success;
+
+  if (!s->open) {
+    return bg_err_wrong_state;
+  }
+  if (len > s->end - s->cursor - s->fill) {
+    return bg_err_out_of_memory;
+  }
+
+  start_ms = time_ms();
+  while (len) {
+    chunk = FLASH_STREAM_BURST - s->fill;
+    if (chunk > len) {
+      chunk = len;
+    }
+    memcpy((uint8_t *)s->buf + s->fill, src, chunk);
+    s->fill += chunk;
+    src += chunk;
+    len -= chunk;
+
+    if (s->fill == FLASH_STREAM_BURST) {
+      res = flush_burst(s);
+      if (res != bg_err_success) {
+        s->open = 0;
+        break;
+      }
+    }
+  }
+  s->stats.busy_ms += time_ms() - start_ms;
+  return res;
+}
+
+errorcode_t flash_stream_close(tsFlashStream *s)
+{
+  uint32_t start_ms;
+  errorcode_t res = bg_err_success;
+
+  if (!s->open) {
+    return bg_err_wrong_state;
+  }
+
+  start_ms = time_ms();
+  if (s->fill) {
+    memset((uint8_t *)s->buf + s->fill, 0xFF, FLASH_STREAM_BURST - s->fill);
+    s->fill = FLASH_STREAM_BURST;
+    res = flush_burst(s);
+  }
+  s->open = 0;
+  MSC_Deinit();
+  s->stats.busy_ms += time_ms() - start_ms;
+  return res;
+}
+
+uint32_t flash_stream_offset(const tsFlashStream *s)
+{
+  return s->cursor + s->fill - s->start;
+}
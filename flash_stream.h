@@ -0,0 +1,60 @@
+#ifndef _FLASH_STREAM_H
+#define _FLASH_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  Streaming writer for the internal flash.
+ *
+ *  Data of any size is collected in a word aligned burst buffer and written with
+ *  MSC_WriteWordFast() once the buffer is full, so the flash controller is always
+ *  fed whole bursts. A page is erased when the first burst for it is written.
+ *  Each burst can optionally be read back and compared.
+ *
+ *  MSC_WriteWordFast() runs with interrupts disabled, so the burst size bounds
+ *  the interrupt latency seen by the radio stack while a stream is written.
+ *  MSC_ErasePage() stalls the CPU for the whole page erase, the write that
+ *  starts a new page takes that much longer.
+ *
+ *  Built with -DMSC_EMULATOR the module runs on the host on the flash emulation
+ *  of tools/msc_emu.c, see tools/flash_stream_sim.c.
+ */
+
+/* bytes written per MSC_WriteWordFast() call, multiple of 4 and divides the page size */
+#ifndef FLASH_STREAM_BURST
+#define FLASH_STREAM_BURST       256
+#endif
+
+typedef struct {
+  uint32_t bytes;             /* bytes written to flash, including padding of the last burst */
+  uint32_t bursts;
+  uint32_t pages_erased;
+  uint32_t verify_errors;
+  uint32_t busy_ms;           /* time spent in flash_stream_write() and flash_stream_close() */
+} tsFlashStreamStats;
+
+typedef struct {
+  uint32_t start;             /* first byte of the region, page aligned */
+  uint32_t end;               /* first byte after the region */
+  uint32_t cursor;            /* flash address of the first byte in buf */
+  uint32_t erased_end;        /* pages below this address have been erased */
+  uint16_t fill;              /* bytes in buf */
+  uint8_t verify;
+  uint8_t open;
+  uint32_t buf[FLASH_STREAM_BURST / 4];
+  tsFlashStreamStats stats;
+} tsFlashStream;
+
+errorcode_t flash_stream_open(tsFlashStream *s, uint32_t start, uint32_t size, int verify);
+errorcode_t flash_stream_write(tsFlashStream *s, const void *data, uint32_t len);
+
+/* Write out the partly filled last burst, padded with 0xFF. */
+errorcode_t flash_stream_close(tsFlashStream *s);
+
+/* number of bytes accepted so far */
+uint32_t flash_stream_offset(const tsFlashStream *s);
+
+#endif
@@ -9,4 +9,7 @@
 #define HAL_I2CSENSOR_ENABLE              (0)
 #define HAL_SPIDISPLAY_ENABLE             (0)
 
+/* UART receive buffer of the retarget driver, holds one network import chunk */
+#define RXBUFSIZE                         (128)
+
 #endif
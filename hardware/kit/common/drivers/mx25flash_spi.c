@@ -7,10 +7,14 @@
  * $Id: MX25_CMD.c,v 1.31 2015/03/24 01:06:33 mxclldb1 Exp $
  */
 
+#include <stddef.h>
 #include "mx25flash_spi.h"
 #include "em_gpio.h"
 #include "em_usart.h"
 #include "em_cmu.h"
+#include "em_emu.h"
+#include "em_bus.h"
+#include "em_core.h"
 
 /* Fallback to loc 11 if no location is defined for backwards compatibility */
 #ifndef MX25_LOC_RX
@@ -1610,3 +1614,311 @@ ReturnMsg MX25_NOP( void )
     return FlashOperationSuccess;
 }
 
+
+
+/*
+ --DMA transfers
+ */
+
+/* Two LDMA channels are used for a bulk transfer. The TX channel feeds
+ * USART TXDATA, either from the source buffer or with a constant dummy byte,
+ * and the RX channel drains RXDATA, either into the target buffer or into a
+ * discard byte. A byte is received for every byte clocked out, so the RX
+ * channel finishing means the whole transfer is on the wire and CS can go
+ * high without polling for TX complete.
+ */
+#ifndef MX25_DMA_CH_RX
+#define MX25_DMA_CH_RX         6
+#endif
+#ifndef MX25_DMA_CH_TX
+#define MX25_DMA_CH_TX         7
+#endif
+#ifndef MX25_DMA_REQSEL_RX
+#define MX25_DMA_REQSEL_RX     (LDMA_CH_REQSEL_SOURCESEL_USART1 | LDMA_CH_REQSEL_SIGSEL_USART1RXDATAV)
+#endif
+#ifndef MX25_DMA_REQSEL_TX
+#define MX25_DMA_REQSEL_TX     (LDMA_CH_REQSEL_SOURCESEL_USART1 | LDMA_CH_REQSEL_SIGSEL_USART1TXBL)
+#endif
+
+/* largest transfer count of a single LDMA descriptor */
+#define MX25_DMA_MAX_XFER      (( _LDMA_CH_CTRL_XFERCNT_MASK >> _LDMA_CH_CTRL_XFERCNT_SHIFT ) + 1)
+
+static struct {
+    MX25_DmaCallback   callback;
+    void               *context;
+    uint8_t            *target;
+    const uint8_t      *source;
+    uint32_t           remaining;
+    uint32_t           chunk;
+    volatile bool      busy;
+    volatile ReturnMsg result;
+    bool               initialized;
+} mx25_dma;
+
+static const uint8_t mx25_dma_dummy_tx = 0xff;
+static uint8_t mx25_dma_discard;
+
+static void DmaSetup( void )
+{
+    if( mx25_dma.initialized ) return;
+
+    CMU_ClockEnable( cmuClock_LDMA, true );
+    NVIC_ClearPendingIRQ( LDMA_IRQn );
+    NVIC_EnableIRQ( LDMA_IRQn );
+    mx25_dma.initialized = true;
+}
+
+/* Program both channels for the next chunk of the transfer and start them */
+static void DmaStartChunk( void )
+{
+    uint32_t xfercnt;
+
+    mx25_dma.chunk = mx25_dma.remaining;
+    if( mx25_dma.chunk > MX25_DMA_MAX_XFER )
+        mx25_dma.chunk = MX25_DMA_MAX_XFER;
+    xfercnt = ( mx25_dma.chunk - 1 ) << _LDMA_CH_CTRL_XFERCNT_SHIFT;
+
+    LDMA->CH[MX25_DMA_CH_RX].REQSEL = MX25_DMA_REQSEL_RX;
+    LDMA->CH[MX25_DMA_CH_RX].CFG    = 0;
+    LDMA->CH[MX25_DMA_CH_RX].LOOP   = 0;
+    LDMA->CH[MX25_DMA_CH_RX].LINK   = 0;
+    LDMA->CH[MX25_DMA_CH_RX].SRC    = (uint32_t)&MX25_USART->RXDATA;
+    if( mx25_dma.target != NULL )
+    {
+        LDMA->CH[MX25_DMA_CH_RX].DST  = (uint32_t)mx25_dma.target;
+        LDMA->CH[MX25_DMA_CH_RX].CTRL = xfercnt | LDMA_CH_CTRL_SIZE_BYTE | LDMA_CH_CTRL_SRCINC_NONE
+                                        | LDMA_CH_CTRL_DSTINC_ONE | LDMA_CH_CTRL_DONEIFSEN;
+    }
+    else
+    {
+        LDMA->CH[MX25_DMA_CH_RX].DST  = (uint32_t)&mx25_dma_discard;
+        LDMA->CH[MX25_DMA_CH_RX].CTRL = xfercnt | LDMA_CH_CTRL_SIZE_BYTE | LDMA_CH_CTRL_SRCINC_NONE
+                                        | LDMA_CH_CTRL_DSTINC_NONE | LDMA_CH_CTRL_DONEIFSEN;
+    }
+
+    LDMA->CH[MX25_DMA_CH_TX].REQSEL = MX25_DMA_REQSEL_TX;
+    LDMA->CH[MX25_DMA_CH_TX].CFG    = 0;
+    LDMA->CH[MX25_DMA_CH_TX].LOOP   = 0;
+    LDMA->CH[MX25_DMA_CH_TX].LINK   = 0;
+    LDMA->CH[MX25_DMA_CH_TX].DST    = (uint32_t)&MX25_USART->TXDATA;
+    if( mx25_dma.source != NULL )
+    {
+        LDMA->CH[MX25_DMA_CH_TX].SRC  = (uint32_t)mx25_dma.source;
+        LDMA->CH[MX25_DMA_CH_TX].CTRL = xfercnt | LDMA_CH_CTRL_SIZE_BYTE | LDMA_CH_CTRL_SRCINC_ONE
+                                        | LDMA_CH_CTRL_DSTINC_NONE;
+    }
+    else
+    {
+        LDMA->CH[MX25_DMA_CH_TX].SRC  = (uint32_t)&mx25_dma_dummy_tx;
+        LDMA->CH[MX25_DMA_CH_TX].CTRL = xfercnt | LDMA_CH_CTRL_SIZE_BYTE | LDMA_CH_CTRL_SRCINC_NONE
+                                        | LDMA_CH_CTRL_DSTINC_NONE;
+    }
+
+    LDMA->IFC  = ( 1UL << MX25_DMA_CH_RX ) | ( 1UL << MX25_DMA_CH_TX );
+    BUS_RegMaskedSet( &LDMA->IEN, ( 1UL << MX25_DMA_CH_RX ) | LDMA_IEN_ERROR );
+
+    // Both channels in one atomic set, the other channels (AES) are left alone.
+    // No byte is clocked before TX runs, so RX cannot miss one.
+    BUS_RegMaskedSet( &LDMA->CHEN, ( 1UL << MX25_DMA_CH_RX ) | ( 1UL << MX25_DMA_CH_TX ) );
+}
+
+static void DmaFinish( ReturnMsg result )
+{
+    MX25_DmaCallback callback = mx25_dma.callback;
+
+    BUS_RegMaskedClear( &LDMA->CHEN, ( 1UL << MX25_DMA_CH_RX ) | ( 1UL << MX25_DMA_CH_TX ) );
+    BUS_RegMaskedClear( &LDMA->IEN, 1UL << MX25_DMA_CH_RX );
+
+    // Chip select go high to end the flash command
+    CS_High();
+
+    mx25_dma.result = result;
+    mx25_dma.busy   = false;
+    if( callback != NULL )
+        callback( result, mx25_dma.context );
+}
+
+/* Wait in EM1 until the running transfer completes. Used when no callback is given. */
+static ReturnMsg DmaWait( void )
+{
+    CORE_DECLARE_IRQ_STATE;
+
+    // The flag is tested with interrupts off: an interrupt that becomes pending
+    // after the test still wakes the core from WFI, and is taken once they are
+    // enabled again, so completion cannot slip in between the test and the sleep.
+    CORE_ENTER_CRITICAL();
+    while( mx25_dma.busy )
+    {
+        EMU_EnterEM1();
+        CORE_EXIT_CRITICAL();
+        CORE_ENTER_CRITICAL();
+    }
+    CORE_EXIT_CRITICAL();
+    return mx25_dma.result;
+}
+
+static ReturnMsg DmaStart( uint8_t *target_address, const uint8_t *source_address, uint32_t byte_length,
+                           MX25_DmaCallback callback, void *context )
+{
+    mx25_dma.target    = target_address;
+    mx25_dma.source    = source_address;
+    mx25_dma.remaining = byte_length;
+    mx25_dma.callback  = callback;
+    mx25_dma.context   = context;
+    mx25_dma.result    = FlashOperationSuccess;
+
+    // Drop whatever the command phase left in the receive buffer
+    MX25_USART->CMD = USART_CMD_CLEARRX;
+
+    if( byte_length == 0 )
+    {
+        DmaFinish( FlashOperationSuccess );
+        return FlashOperationSuccess;
+    }
+
+    DmaStartChunk();
+
+    if( callback == NULL )
+        return DmaWait();
+    return FlashOperationSuccess;
+}
+
+/* The error flag is shared by all LDMA channels, STATUS names the one that failed */
+static bool DmaOwnsError( void )
+{
+    uint32_t ch = ( LDMA->STATUS & _LDMA_STATUS_CHERROR_MASK ) >> _LDMA_STATUS_CHERROR_SHIFT;
+
+    return ch == MX25_DMA_CH_RX || ch == MX25_DMA_CH_TX;
+}
+
+/* Called by the application's LDMA_IRQHandler with the pending interrupt flags */
+void MX25_DMA_IRQHandler( uint32_t pending )
+{
+    if( !mx25_dma.busy ) return;
+
+    if( ( pending & LDMA_IF_ERROR ) && DmaOwnsError() )
+    {
+        DmaFinish( FlashTimeOut );
+        return;
+    }
+
+    if( pending & ( 1UL << MX25_DMA_CH_RX ) )
+    {
+        if( mx25_dma.target != NULL ) mx25_dma.target += mx25_dma.chunk;
+        if( mx25_dma.source != NULL ) mx25_dma.source += mx25_dma.chunk;
+        mx25_dma.remaining -= mx25_dma.chunk;
+
+        if( mx25_dma.remaining > 0 )
+            DmaStartChunk();
+        else
+            DmaFinish( FlashOperationSuccess );
+    }
+}
+
+/*
+ * Function:       MX25_READ_DMA
+ * Arguments:      flash_address, 32 bit flash memory address
+ *                 target_address, buffer address to store returned data
+ *                 byte_length, length of returned data in byte unit
+ *                 callback, called from interrupt context when the data is in
+ *                 the buffer, NULL to wait for the transfer in EM1
+ *                 context, passed to the callback
+ * Description:    Same as MX25_READ but the data phase is moved by the LDMA.
+ *                 The buffer must stay valid until the transfer completes.
+ * Return Message: FlashAddressInvalid, FlashIsBusy, FlashOperationSuccess,
+ *                 FlashTimeOut
+ */
+ReturnMsg MX25_READ_DMA( uint32_t flash_address, uint8_t *target_address, uint32_t byte_length,
+                         MX25_DmaCallback callback, void *context )
+{
+    uint8_t  addr_4byte_mode;
+
+    // Check flash address
+    if( flash_address > FlashSize ) return FlashAddressInvalid;
+
+    // Only one DMA transfer at a time
+    if( mx25_dma.busy ) return FlashIsBusy;
+
+    DmaSetup();
+
+    // Check 3-byte or 4-byte mode
+    if( IsFlash4Byte() )
+        addr_4byte_mode = TRUE;  // 4-byte mode
+    else
+        addr_4byte_mode = FALSE; // 3-byte mode
+
+    mx25_dma.busy = true;
+
+    // Chip select go low to start a flash command
+    CS_Low();
+
+    // Write READ command and address
+    SendByte( FLASH_CMD_READ, SIO );
+    SendFlashAddr( flash_address, SIO, addr_4byte_mode );
+
+    return DmaStart( target_address, NULL, byte_length, callback, context );
+}
+
+/*
+ * Function:       MX25_PP_DMA
+ * Arguments:      flash_address, 32 bit flash memory address
+ *                 source_address, buffer address of source data to program
+ *                 byte_length, byte length of data to programm
+ *                 callback, called from interrupt context when the data has
+ *                 been sent, NULL to wait for the transfer in EM1
+ *                 context, passed to the callback
+ * Description:    Same as MX25_PP but the data phase is moved by the LDMA.
+ *                 Completion means the page buffer of the flash has been
+ *                 loaded; the flash is programming after that and reports
+ *                 busy until the program cycle is over (MX25_RDSR).
+ * Return Message: FlashAddressInvalid, FlashIsBusy, FlashOperationSuccess,
+ *                 FlashTimeOut
+ */
+ReturnMsg MX25_PP_DMA( uint32_t flash_address, const uint8_t *source_address, uint32_t byte_length,
+                       MX25_DmaCallback callback, void *context )
+{
+    uint8_t  addr_4byte_mode;
+
+    // Check flash address
+    if( flash_address > FlashSize ) return FlashAddressInvalid;
+
+    // Only one DMA transfer at a time
+    if( mx25_dma.busy ) return FlashIsBusy;
+
+    // Check flash is busy or not
+    if( IsFlashBusy() )    return FlashIsBusy;
+
+    DmaSetup();
+
+    // Check 3-byte or 4-byte mode
+    if( IsFlash4Byte() )
+        addr_4byte_mode = TRUE;  // 4-byte mode
+    else
+        addr_4byte_mode = FALSE; // 3-byte mode
+
+    // Setting Write Enable Latch bit
+    MX25_WREN();
+
+    mx25_dma.busy = true;
+
+    // Chip select go low to start a flash command
+    CS_Low();
+
+    // Write Page Program command
+    SendByte( FLASH_CMD_PP, SIO );
+    SendFlashAddr( flash_address, SIO, addr_4byte_mode );
+
+    // Note: only last 256 byte ( or 32 byte ) will be programmed
+    return DmaStart( NULL, source_address, byte_length, callback, context );
+}
+
+/*
+ * Function:       MX25_DMA_Busy
+ * Arguments:      None.
+ * Description:    Check whether a DMA transfer is still running.
+ * Return Message: true while a transfer is in progress
+ */
+bool MX25_DMA_Busy( void )
+{
+    return mx25_dma.busy;
+}
@@ -225,6 +225,9 @@ struct sFlashStatus{
 
 typedef struct sFlashStatus FlashStatus;
 
+/* Completion callback of the DMA transfers, called from interrupt context */
+typedef void (*MX25_DmaCallback)( ReturnMsg result, void *context );
+
 void MX25_init( void );
 
 /* Flash commands */
@@ -272,6 +275,15 @@ ReturnMsg MX25_PGM_ERS_S( void );
 ReturnMsg MX25_PGM_ERS_R( void );
 ReturnMsg MX25_NOP( void );
 
+/* DMA transfers */
+ReturnMsg MX25_READ_DMA( uint32_t flash_address, uint8_t *target_address, uint32_t byte_length,
+                         MX25_DmaCallback callback, void *context );
+ReturnMsg MX25_PP_DMA( uint32_t flash_address, const uint8_t *source_address, uint32_t byte_length,
+                       MX25_DmaCallback callback, void *context );
+bool MX25_DMA_Busy( void );
+/* LDMA interrupt, pending are the flags of LDMA->IF that were set and enabled */
+void MX25_DMA_IRQHandler( uint32_t pending );
+
 
 
 
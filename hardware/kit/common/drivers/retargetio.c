@@ -47,6 +47,10 @@ int _write(int file, const char *ptr, int len);
 
 extern char _end;                 /**< Defined by the linker */
 
+/** Bytes handed out by _sbrk() and the highest value reached, for heap usage reports */
+size_t RETARGET_SbrkUsed = 0;
+size_t RETARGET_SbrkPeak = 0;
+
 /**************************************************************************//**
  * @brief
  *  Close a file.
@@ -215,6 +219,11 @@ caddr_t _sbrk(int incr)
   prev_heap_end = heap_end;
   heap_end += incr;
 
+  RETARGET_SbrkUsed = (size_t) (heap_end - &_end);
+  if (RETARGET_SbrkUsed > RETARGET_SbrkPeak) {
+    RETARGET_SbrkPeak = RETARGET_SbrkUsed;
+  }
+
   return (caddr_t) prev_heap_end;
 }
 
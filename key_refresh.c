@@ -0,0 +1,277 @@
+#include "key_refresh.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "native_gecko.h"
+#include "record_store.h"
+
+static uint8_t counted[NODE_DB_MAX_NODES];     /* node counted in stats.updated */
+static uint16_t left_out[NODE_DB_MAX_NODES];   /* addresses of the nodes marked failed, as stored */
+static uint16_t num_left_out;
+
+static uint16_t netkey;
+static uint32_t start_s;
+static uint32_t report_s;
+static tsKeyRefreshStats stats;
+
+// local functions
+
+static uint32_t now_s(void)
+{
+  return gecko_cmd_hardware_get_time()->seconds;
+}
+
+static uint16_t blacklist(uint16_t slot, uint8_t status)
+{
+  return gecko_cmd_mesh_prov_set_key_refresh_blacklist(netkey, status, 16, _sNodeDB.uuid[slot])->result;
+}
+
+/* left out by an earlier key refresh, or heard since boot but not for silent_s seconds */
+static int excluded(uint16_t slot, uint32_t now, uint32_t silent_s)
+{
+  if (_sNodeDB.kr_phase[slot] == NODE_DB_KR_FAILED) {
+    return 1;
+  }
+  return silent_s && _sNodeDB.last_seen[slot] && now - _sNodeDB.last_seen[slot] >= silent_s;
+}
+
+static int is_left_out(uint16_t address)
+{
+  uint16_t i;
+
+  for (i = 0; i < num_left_out; i++) {
+    if (left_out[i] == address) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* store the addresses of the nodes marked failed */
+static void save_left_out(void)
+{
+  errorcode_t res;
+  uint16_t slot;
+
+  num_left_out = 0;
+  for (slot = 0; slot < _sNodeDB.count; slot++) {
+    if (_sNodeDB.kr_phase[slot] == NODE_DB_KR_FAILED) {
+      left_out[num_left_out++] = _sNodeDB.address[slot];
+    }
+  }
+  if (num_left_out) {
+    res = record_store_write(KEY_REFRESH_RECORD_KEY, left_out, num_left_out * sizeof(left_out[0]));
+  } else {
+    res = record_store_delete(KEY_REFRESH_RECORD_KEY);
+  }
+  if (res != bg_err_success) {
+    printf("key refresh: nodes left out not saved, code %x\r\n", res);
+  }
+}
+
+/* nodes without the new keys when phase 2 starts are shut out at the end */
+static void mark_failed(void)
+{
+  uint16_t slot;
+
+  for (slot = 0; slot < stats.nodes; slot++) {
+    if (_sNodeDB.kr_phase[slot] == NODE_DB_KR_NONE) {
+      _sNodeDB.kr_phase[slot] = NODE_DB_KR_FAILED;
+      stats.failed++;
+      printf("key refresh: node %4.4x left out\r\n", _sNodeDB.address[slot]);
+    }
+  }
+  save_left_out();
+}
+
+/* Progress counts one step per node and phase. The time left is projected
+ * from the rate of the steps done so far. */
+static void update_progress(uint32_t now)
+{
+  uint32_t steps = 0, total = 3 * (uint32_t) stats.nodes;
+  uint32_t elapsed = now - start_s;
+  uint16_t slot;
+
+  for (slot = 0; slot < stats.nodes; slot++) {
+    if (_sNodeDB.kr_phase[slot] == NODE_DB_KR_FAILED) {
+      steps += 3;
+    } else {
+      steps += _sNodeDB.kr_phase[slot];
+    }
+  }
+  if (steps > total) {
+    steps = total;
+  }
+
+  stats.percent = total ? (uint8_t)(steps * 100 / total) : 100;
+  stats.seconds_left = (steps && elapsed) ? (uint32_t)((uint64_t) elapsed * (total - steps) / steps) : KEY_REFRESH_TIME_UNKNOWN;
+}
+
+static void report(void)
+{
+  printf("key refresh: phase %d, %d%%, %d of %d nodes updated, %d failed, %d of them excluded", stats.phase, stats.percent,
+      stats.updated, stats.nodes, stats.failed, stats.excluded);
+  if (stats.seconds_left != KEY_REFRESH_TIME_UNKNOWN) {
+    printf(", about %lu s left", (unsigned long) stats.seconds_left);
+  }
+  printf("\r\n");
+}
+
+// public functions
+
+void key_refresh_init(void)
+{
+  uint16_t len = 0;
+
+  num_left_out = 0;
+  if (record_store_read(KEY_REFRESH_RECORD_KEY, left_out, sizeof(left_out), &len) == bg_err_success) {
+    num_left_out = len / sizeof(left_out[0]);
+  }
+}
+
+void key_refresh_node_loaded(uint16_t slot)
+{
+  if (is_left_out(_sNodeDB.address[slot])) {
+    _sNodeDB.kr_phase[slot] = NODE_DB_KR_FAILED;
+  }
+}
+
+void key_refresh_node_provisioned(uint16_t slot)
+{
+  if (_sNodeDB.kr_phase[slot] == NODE_DB_KR_FAILED || is_left_out(_sNodeDB.address[slot])) {
+    _sNodeDB.kr_phase[slot] = NODE_DB_KR_NONE;
+    save_left_out();
+  }
+}
+
+errorcode_t key_refresh_start(uint16_t netkey_index, const uint16_t *appkey_indices, uint8_t num_appkeys,
+    uint32_t silent_s)
+{
+  uint8_t indices[2 * KEY_REFRESH_MAX_APPKEYS];
+  uint32_t now = now_s();
+  uint16_t slot, res;
+  uint8_t i, out;
+
+  if (stats.phase != 0) {
+    return bg_err_wrong_state;
+  }
+  if (num_appkeys > KEY_REFRESH_MAX_APPKEYS) {
+    return bg_err_invalid_param;
+  }
+
+  for (i = 0; i < num_appkeys; i++) {
+    indices[2 * i] = (uint8_t) appkey_indices[i];
+    indices[2 * i + 1] = (uint8_t)(appkey_indices[i] >> 8);
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  stats.nodes = _sNodeDB.count;
+  netkey = netkey_index;
+
+  // every node is set, the blacklist keeps its state from earlier procedures
+  for (slot = 0; slot < stats.nodes; slot++) {
+    res = blacklist(slot, excluded(slot, now, silent_s));
+    if (res != 0) {
+      return res;
+    }
+  }
+
+  res = gecko_cmd_mesh_prov_key_refresh_start(netkey, num_appkeys, 2 * num_appkeys, indices)->result;
+  if (res != 0) {
+    return res;
+  }
+
+  for (slot = 0; slot < stats.nodes; slot++) {
+    out = excluded(slot, now, silent_s);
+    counted[slot] = 0;
+    _sNodeDB.kr_phase[slot] = out ? NODE_DB_KR_FAILED : NODE_DB_KR_NONE;
+    if (out) {
+      stats.excluded++;
+      stats.failed++;
+    }
+  }
+
+  if (stats.excluded) {
+    save_left_out();
+  }
+
+  start_s = report_s = now;
+  stats.phase = 1;
+  stats.seconds_left = KEY_REFRESH_TIME_UNKNOWN;
+  printf("key refresh: started for %d nodes, %d excluded\r\n", stats.nodes, stats.excluded);
+  return bg_err_success;
+}
+
+void key_refresh_tick(void)
+{
+  uint32_t now;
+
+  if (stats.phase == 0) {
+    return;
+  }
+  now = now_s();
+  if (now - report_s >= KEY_REFRESH_REPORT_S) {
+    report_s = now;
+    update_progress(now);
+    report();
+  }
+}
+
+void key_refresh_node_update(uint16_t key, uint8_t phase, const uint8_t *uuid)
+{
+  uint16_t slot;
+
+  if (stats.phase == 0 || key != netkey) {
+    return;
+  }
+  slot = node_db_find_by_uuid(uuid);
+  if (slot == NODE_DB_INVALID || slot >= stats.nodes || _sNodeDB.kr_phase[slot] == NODE_DB_KR_FAILED) {
+    return;
+  }
+
+  _sNodeDB.kr_phase[slot] = phase;
+  if (phase >= 1 && !counted[slot]) {
+    counted[slot] = 1;
+    stats.updated++;
+  }
+}
+
+void key_refresh_phase_update(uint16_t key, uint8_t phase)
+{
+  if (stats.phase == 0 || key != netkey || phase <= stats.phase) {
+    return;
+  }
+  if (stats.phase == 1) {
+    mark_failed();
+  }
+  stats.phase = phase;
+  printf("key refresh: phase %d\r\n", stats.phase);
+}
+
+void key_refresh_complete(uint16_t key, uint16_t result)
+{
+  if (stats.phase == 0 || key != netkey) {
+    return;
+  }
+
+  if (stats.phase == 1) {
+    mark_failed();
+  }
+  stats.last_result = result;
+  stats.percent = 100;
+  stats.seconds_left = 0;
+  report();
+  printf("key refresh: done in %lu s, result %x\r\n", (unsigned long)(now_s() - start_s), result);
+  stats.phase = 0;
+}
+
+int key_refresh_running(void)
+{
+  return stats.phase != 0;
+}
+
+void key_refresh_get_stats(tsKeyRefreshStats *s)
+{
+  *s = stats;
+}
@@ -0,0 +1,93 @@
+#ifndef _KEY_REFRESH_H
+#define _KEY_REFRESH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+#include "node_db.h"
+
+/**
+ *  Key Refresh of the whole network: a blacklist of silent nodes and progress
+ *  reporting around the procedure of the stack.
+ *
+ *  The procedure is run by the stack (gecko_cmd_mesh_prov_key_refresh_start,
+ *  the only key refresh command of the release stack): it generates the new
+ *  keys, sends the NetKey and AppKey Updates to every node that is not on its
+ *  key refresh blacklist, retransmits them and moves through the phases on its
+ *  own. This module does not batch, throttle or retry anything; it only
+ *  decides who takes part. Nodes left out by an earlier key refresh, and with
+ *  silent_s nodes that have been heard since boot but not for silent_s
+ *  seconds, are blacklisted before the start. Updates to nodes that cannot
+ *  answer would otherwise take segmentation buffers (MESH_CFG_MAX_SEND_SEGS)
+ *  for the whole of phase 1. A node not heard at all since boot is kept, as
+ *  nothing is known about it.
+ *
+ *  The phase each node has confirmed is kept in the node table (kr_phase).
+ *  Nodes that were blacklisted, or had not confirmed the new keys when phase 2
+ *  was entered, are marked NODE_DB_KR_FAILED: they are shut out of the network
+ *  at the end and have to be provisioned again. Their addresses are kept in the
+ *  record store (KEY_REFRESH_RECORD_KEY), so that they are marked again when the
+ *  node table is loaded after a reset. Progress, with an estimate of the time
+ *  left, is printed every KEY_REFRESH_REPORT_S seconds. Nodes must not be
+ *  removed from the node table while a key refresh runs.
+ *
+ *  The stack does not give out the new key values, so the ones saved by
+ *  cdb_stream for the export can not follow; cdb_stream refuses the export
+ *  once a key refresh has been started.
+ */
+
+#ifndef KEY_REFRESH_REPORT_S
+#define KEY_REFRESH_REPORT_S         10
+#endif
+
+#define KEY_REFRESH_MAX_APPKEYS      4
+
+/* record store key of the addresses of the nodes left out */
+#ifndef KEY_REFRESH_RECORD_KEY
+#define KEY_REFRESH_RECORD_KEY       0x0001
+#endif
+
+/* seconds left when there is no estimate yet */
+#define KEY_REFRESH_TIME_UNKNOWN     0xFFFFFFFF
+
+typedef struct {
+  uint8_t phase;              /* 0 idle, 1 to 3 */
+  uint16_t nodes;
+  uint16_t updated;           /* nodes with the new keys */
+  uint16_t excluded;          /* nodes blacklisted at the start */
+  uint16_t failed;            /* nodes left out, the excluded ones included */
+  uint8_t percent;
+  uint32_t seconds_left;      /* KEY_REFRESH_TIME_UNKNOWN if not known */
+  uint16_t last_result;       /* result of the last completed key refresh */
+} tsKeyRefreshStats;
+
+/* Read the nodes left out by earlier key refreshes. Call once the record store
+ * is mounted, before the node table is loaded. */
+void key_refresh_init(void);
+
+/* A node has been added to the node table from the DDB. */
+void key_refresh_node_loaded(uint16_t slot);
+
+/* A node has been provisioned, again or for the first time, and has the current
+ * keys. */
+void key_refresh_node_provisioned(uint16_t slot);
+
+/* Start refreshing the network key and the given application keys. Nodes heard
+ * since boot but not for silent_s seconds are left out, 0 keeps them. Returns
+ * bg_err_wrong_state if a key refresh is already running. */
+errorcode_t key_refresh_start(uint16_t netkey_index, const uint16_t *appkey_indices, uint8_t num_appkeys,
+    uint32_t silent_s);
+
+/* Print the progress. Call once per second. */
+void key_refresh_tick(void);
+
+/* gecko_evt_mesh_prov_key_refresh_node_update, _phase_update and _complete */
+void key_refresh_node_update(uint16_t key, uint8_t phase, const uint8_t *uuid);
+void key_refresh_phase_update(uint16_t key, uint8_t phase);
+void key_refresh_complete(uint16_t key, uint16_t result);
+
+int key_refresh_running(void);
+void key_refresh_get_stats(tsKeyRefreshStats *stats);
+
+#endif
@@ -0,0 +1,243 @@
+#include "liveness.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "native_gecko.h"
+
+/* the subscription period as a power of two, like the publication period */
+#if LIVENESS_WINDOW_PERIODS == 4
+#define WINDOW_LOG           (LIVENESS_PERIOD_LOG + 2)
+#elif LIVENESS_WINDOW_PERIODS == 2
+#define WINDOW_LOG           (LIVENESS_PERIOD_LOG + 1)
+#else
+#define WINDOW_LOG           LIVENESS_PERIOD_LOG
+#endif
+
+#define WINDOW_S             (1UL << (WINDOW_LOG - 1))
+
+/* wait for the completion event this long after the window before giving up on it */
+#define WINDOW_GRACE_S       2
+
+/* a window opens this long before the heartbeat is due, last_seen is up to a tick late */
+#define WINDOW_MARGIN_S      2
+
+/* hb_missed saturates here; hops are 1 and up, 0 marks a node not heard yet */
+#define MISSED_MAX           0xFFFF
+
+static uint8_t checked[NODE_DB_MAX_NODES];     /* watched in the current pass */
+
+static uint16_t own_address;
+static uint16_t watched;                /* address of the node watched, 0 if none */
+static uint32_t start_s;                /* reference of the nodes never heard */
+static uint32_t window_end_s;
+static uint32_t report_s;
+static uint32_t windows;
+static uint32_t heartbeats;
+
+// local functions
+
+static uint32_t now_s(void)
+{
+  return gecko_cmd_hardware_get_time()->seconds;
+}
+
+/* nodes configured by this provisioner, or before a reset, publish heartbeats */
+static int eligible(uint16_t slot)
+{
+  return _sNodeDB.config_state[slot] == NODE_DB_CONFIG_DONE
+         || _sNodeDB.config_state[slot] == NODE_DB_CONFIG_UNKNOWN;
+}
+
+/* Seconds until the next heartbeat of a node is due. Heartbeats keep the phase
+ * of the last one heard; 0 for a node not heard yet or missing, its phase is not known. */
+static uint32_t due_in(uint16_t slot, uint32_t now)
+{
+  uint32_t late;
+
+  if (_sNodeDB.hb_min_hops[slot] == 0 || _sNodeDB.hb_missed[slot] != 0) {
+    return 0;
+  }
+  late = (now + WINDOW_MARGIN_S - _sNodeDB.last_seen[slot]) % LIVENESS_PERIOD_S;
+  return late ? LIVENESS_PERIOD_S - late : 0;
+}
+
+/* the node of the pass whose heartbeat is due first */
+static uint16_t next_slot(uint32_t now)
+{
+  uint16_t slot, best = NODE_DB_INVALID;
+  uint32_t wait, best_wait = 0;
+
+  for (slot = 0; slot < _sNodeDB.count; slot++) {
+    if (!eligible(slot) || checked[slot]) {
+      continue;
+    }
+    wait = due_in(slot, now);
+    if (best == NODE_DB_INVALID || wait < best_wait) {
+      best = slot;
+      best_wait = wait;
+    }
+  }
+  return best;
+}
+
+/* Each pass watches every node once, in the order their heartbeats are due,
+ * so that a node that answers costs a few seconds instead of half a period. */
+static void start_window(uint32_t now)
+{
+  uint16_t slot = next_slot(now);
+  uint16_t res;
+
+  if (slot == NODE_DB_INVALID) {
+    memset(checked, 0, sizeof(checked));
+    slot = next_slot(now);
+    if (slot == NODE_DB_INVALID) {
+      return;
+    }
+  }
+  res = gecko_cmd_mesh_test_set_local_heartbeat_subscription(_sNodeDB.address[slot], own_address, WINDOW_LOG)->result;
+  if (res != 0) {
+    // tried again on the next tick
+    return;
+  }
+  checked[slot] = 1;
+  watched = _sNodeDB.address[slot];
+  window_end_s = now + WINDOW_S + WINDOW_GRACE_S;
+}
+
+/* close the window of the watched node, the node may have moved to another slot meanwhile */
+static void finish_window(uint16_t count, uint8_t hop_min, uint8_t hop_max)
+{
+  uint16_t slot = node_db_find_by_address(watched);
+  uint32_t now = now_s(), since, missed;
+
+  watched = 0;
+  windows++;
+  if (slot == NODE_DB_INVALID) {
+    return;
+  }
+
+  if (count == 0) {
+    // all periods since the last heartbeat, or since watching started, not only the ones watched
+    since = _sNodeDB.last_seen[slot] ? _sNodeDB.last_seen[slot] : start_s;
+    missed = (now - since) / LIVENESS_PERIOD_S;
+    if (missed == 0) {
+      missed = 1;
+    }
+    _sNodeDB.hb_missed[slot] = missed > MISSED_MAX ? MISSED_MAX : (uint16_t) missed;
+    return;
+  }
+
+  heartbeats += count;
+  node_db_seen(_sNodeDB.address[slot]);
+  _sNodeDB.hb_missed[slot] = 0;
+  if (_sNodeDB.hb_min_hops[slot] == 0 || hop_min < _sNodeDB.hb_min_hops[slot]) {
+    _sNodeDB.hb_min_hops[slot] = hop_min;
+  }
+  if (hop_max > _sNodeDB.hb_max_hops[slot]) {
+    _sNodeDB.hb_max_hops[slot] = hop_max;
+  }
+}
+
+// public functions
+
+void liveness_init(uint16_t address)
+{
+  own_address = address;
+  watched = 0;
+  windows = 0;
+  heartbeats = 0;
+  memset(checked, 0, sizeof(checked));
+  start_s = report_s = now_s();
+}
+
+uint16_t liveness_publication_set(uint16_t node, uint16_t netkey_index)
+{
+  if (own_address == 0) {
+    return bg_err_wrong_state;
+  }
+  // periodic heartbeats only, none on feature changes
+  return gecko_cmd_mesh_prov_heartbeat_publication_set(node, netkey_index, own_address, 0xFF, LIVENESS_PERIOD_LOG, LIVENESS_TTL, 0,
+      netkey_index)->result;
+}
+
+void liveness_tick(void)
+{
+  struct gecko_msg_mesh_test_get_local_heartbeat_subscription_rsp_t *sub;
+  uint32_t now;
+
+  if (own_address == 0 || _sNodeDB.count == 0) {
+    return;
+  }
+  now = now_s();
+
+  if (watched) {
+    // one heartbeat is enough, the next node is watched right away
+    sub = gecko_cmd_mesh_test_get_local_heartbeat_subscription();
+    if (sub->result == 0 && sub->count > 0) {
+      finish_window(sub->count, sub->hop_min, sub->hop_max);
+    } else if ((int32_t)(now - window_end_s) >= 0) {
+      finish_window(0, 0, 0);
+    }
+  }
+  if (!watched) {
+    start_window(now);
+  }
+
+  if (LIVENESS_REPORT_S && now - report_s >= LIVENESS_REPORT_S) {
+    report_s = now;
+    liveness_print(1);
+  }
+}
+
+void liveness_subscription_complete(uint16_t count, uint8_t hop_min, uint8_t hop_max)
+{
+  // a subscription replaced early may still report, only the end of the current window counts
+  if (watched && (int32_t)(now_s() - (window_end_s - WINDOW_GRACE_S - 1)) >= 0) {
+    finish_window(count, hop_min, hop_max);
+  }
+}
+
+void liveness_print(int stale_only)
+{
+  tsLivenessStats stats;
+  uint32_t now = now_s();
+  uint16_t slot;
+
+  liveness_get_stats(&stats);
+  for (slot = 0; slot < _sNodeDB.count; slot++) {
+    if (!eligible(slot) || (stale_only && _sNodeDB.hb_min_hops[slot] != 0 && _sNodeDB.hb_missed[slot] == 0)) {
+      continue;
+    }
+    if (_sNodeDB.hb_min_hops[slot] == 0) {
+      printf("@live %4.4x never heard, %u periods missed\r\n", _sNodeDB.address[slot], _sNodeDB.hb_missed[slot]);
+    } else {
+      printf("@live %4.4x heard %lu s ago, %u-%u hops, %u periods missed\r\n", _sNodeDB.address[slot],
+          (unsigned long)(now - _sNodeDB.last_seen[slot]), _sNodeDB.hb_min_hops[slot], _sNodeDB.hb_max_hops[slot],
+          _sNodeDB.hb_missed[slot]);
+    }
+  }
+  printf("liveness: %d nodes, %d alive, %d stale, %lu windows, %lu heartbeats\r\n", stats.nodes, stats.alive, stats.stale,
+      (unsigned long) stats.windows, (unsigned long) stats.heartbeats);
+}
+
+void liveness_get_stats(tsLivenessStats *stats)
+{
+  uint16_t slot;
+
+  memset(stats, 0, sizeof(*stats));
+  for (slot = 0; slot < _sNodeDB.count; slot++) {
+    if (!eligible(slot)) {
+      continue;
+    }
+    stats->nodes++;
+    if (_sNodeDB.hb_min_hops[slot] != 0 && _sNodeDB.hb_missed[slot] == 0) {
+      stats->alive++;
+    } else {
+      stats->stale++;
+    }
+  }
+  stats->watching = watched;
+  stats->windows = windows;
+  stats->heartbeats = heartbeats;
+}
@@ -0,0 +1,87 @@
+#ifndef _LIVENESS_H
+#define _LIVENESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+#include "node_db.h"
+
+/**
+ *  Liveness of the configured nodes from their heartbeats.
+ *
+ *  Every node gets a heartbeat publication to the provisioner's primary
+ *  address while it is configured, one message every 2^(LIVENESS_PERIOD_LOG-1)
+ *  seconds, so that knowing which nodes are up needs no request to any of them.
+ *
+ *  The stack keeps a single heartbeat subscription, for one source address,
+ *  and reports only the number of heartbeats and the hop range at the end of
+ *  the subscription period. The subscription is therefore moved from node to
+ *  node: a node is watched for LIVENESS_WINDOW_PERIODS publication periods,
+ *  or until its first heartbeat arrives, then the next one is watched. Each
+ *  pass watches every node once, in the order their heartbeats are due from
+ *  the time the last one was heard, so a node that answers costs a few
+ *  seconds whatever the period. A silent node, or one not heard yet, costs
+ *  the whole window.
+ *
+ *  What is learned is kept in the node table: the time a node was last heard
+ *  (last_seen), the hop range of its heartbeats (hb_min_hops, hb_max_hops) and
+ *  the heartbeat periods it has missed since the last one (hb_missed), counted
+ *  from last_seen when a window stays silent. A node with missed periods, or
+ *  not heard yet, is stale.
+ *
+ *  The heartbeats are traffic outside the publish limits of mesh_lib: a
+ *  thousand nodes at a 32 s period would relay about 30 of them every second.
+ *  The default period is 256 s and the TTL the one of the model publications.
+ */
+
+/* heartbeat publication period of the nodes, 2^(n-1) s */
+#ifndef LIVENESS_PERIOD_LOG
+#define LIVENESS_PERIOD_LOG          9
+#endif
+
+/* TTL of the heartbeats, the hop counts are derived from it; as far as the model publications reach */
+#ifndef LIVENESS_TTL
+#define LIVENESS_TTL                 3
+#endif
+
+/* length of the subscription on one node, in publication periods: 1, 2 or 4 */
+#ifndef LIVENESS_WINDOW_PERIODS
+#define LIVENESS_WINDOW_PERIODS      2
+#endif
+
+/* print the summary every this many seconds, 0 for never */
+#ifndef LIVENESS_REPORT_S
+#define LIVENESS_REPORT_S            600
+#endif
+
+#define LIVENESS_PERIOD_S            (1UL << (LIVENESS_PERIOD_LOG - 1))
+
+typedef struct {
+  uint16_t nodes;             /* nodes watched */
+  uint16_t alive;
+  uint16_t stale;             /* missed periods, or not heard yet */
+  uint16_t watching;          /* address of the node watched now, 0 if none */
+  uint32_t windows;
+  uint32_t heartbeats;
+} tsLivenessStats;
+
+/* Start watching, heartbeats are sent to address, the provisioner's primary element. */
+void liveness_init(uint16_t address);
+
+/* Configure the heartbeat publication of a node, answered by
+ * gecko_evt_mesh_prov_heartbeat_publication_status. */
+uint16_t liveness_publication_set(uint16_t node, uint16_t netkey_index);
+
+/* Move the subscription along, call once per second. */
+void liveness_tick(void);
+
+/* gecko_evt_mesh_test_local_heartbeat_subscription_complete */
+void liveness_subscription_complete(uint16_t count, uint8_t hop_min, uint8_t hop_max);
+
+/* Print the table, or only the stale nodes. */
+void liveness_print(int stale_only);
+
+void liveness_get_stats(tsLivenessStats *stats);
+
+#endif
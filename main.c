@@ -7,6 +7,10 @@
  *
  *  Additional changes needed:
  *  - Configuration Client model needs to be added into the DCD
+ *  - the vendor client model (vendor 0x1111, model 0x2222) needs to be added into the DCD for the
+ *    vendor model messages, see vendor_client_init()
+ *  - the Test class (gecko_bgapi_class_mesh_test_init) for the heartbeat subscription of the
+ *    provisioner, see liveness
  *  - adjust following parameters in the memory configuration (in the DCD editor)
  *     - Max Provisioned Devices,
  *     - Max Provisioned Device Netkeys
@@ -53,9 +57,28 @@
 #include "mesh_lib.h"
 #include <mesh_sizes.h>
 
+/* Application headers */
+#include "node_db.h"
+#include "record_store.h"
+#include "flash_cache.h"
+#include "cdb_stream.h"
+#include "console.h"
+#include "seq_monitor.h"
+#include "mem_watch.h"
+#include "aes_ccm.h"
+#include "sha256.h"
+#include "aes_dma.h"
+#include "p256.h"
+#include "oob_store.h"
+#include "key_refresh.h"
+#include "blob_xfer.h"
+#include "liveness.h"
+#include "mx25flash_spi.h"
+
 /* Libraries containing default Gecko configuration values */
 #include "em_emu.h"
 #include "em_cmu.h"
+#include "em_crypto.h"
 #include <em_gpio.h>
 
 /* Device initialization header */
@@ -178,6 +201,17 @@ const gecko_configuration_t config = {
 #define TIMER_ID_APPKEY_BIND		      22
 #define TIMER_ID_PUB_SET 				  23
 #define TIMER_ID_SUB_ADD				  24
+#define TIMER_ID_SAVE_PROGRESS			  25
+#define TIMER_ID_STORE_COMPACT			  26
+#define TIMER_ID_UART_POLL				  27
+#define TIMER_ID_SEQ_MONITOR			  28
+#define TIMER_ID_MEM_REPORT				  29
+#define TIMER_ID_KEY_REFRESH			  30
+#define TIMER_ID_HEARTBEAT_SET			  31
+#define TIMER_ID_LIVENESS				  32
+
+/* interval of the RAM usage report */
+#define MEM_REPORT_INTERVAL_S			  300
 
 
 /** global variables */
@@ -193,10 +227,14 @@ enum {
 	waiting_appkey_ack,
 	waiting_bind_ack,
 	waiting_pub_ack,
-	waiting_sub_ack
+	waiting_sub_ack,
+	waiting_heartbeat_ack
 } state;
 
 static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt);
+static void vendor_publish_get(void);
+
+static uint8 pb0_down = 0; /* PB0 level at the last poll */
 
 /**
  * button initialization. Configure pushbuttons PB0,PB1
@@ -248,7 +286,23 @@ void initiate_factory_reset(void) {
 	gecko_cmd_hardware_set_soft_timer(2 * 32768, TIMER_ID_FACTORY_RESET, 1);
 }
 
+/**
+ * The LDMA interrupt is shared by the flash driver and the bulk AES transfers,
+ * each of them handles the flags of its own channels. The error flag is passed
+ * to both, only the one owning the channel in LDMA->STATUS acts on it.
+ */
+void LDMA_IRQHandler(void) {
+	uint32_t pending = LDMA->IF & LDMA->IEN;
+
+	LDMA->IFC = pending;
+	MX25_DMA_IRQHandler(pending);
+	aes_dma_irq(pending);
+}
+
 int main() {
+	// paint the stack for the usage report before anything else runs
+	mem_watch_init(bluetooth_stack_heap, sizeof(bluetooth_stack_heap));
+
 	// Initialize device
 	initMcu();
 	// Initialize board
@@ -269,9 +323,12 @@ int main() {
 	gecko_bgapi_class_test_init();
 	gecko_bgapi_class_sm_init();
 	gecko_bgapi_class_mesh_prov_init();
+	gecko_bgapi_class_mesh_node_init();
 	gecko_bgapi_class_mesh_proxy_init();
 	gecko_bgapi_class_mesh_proxy_client_init();
 	gecko_bgapi_class_mesh_proxy_server_init();
+	gecko_bgapi_class_mesh_vendor_model_init();
+	gecko_bgapi_class_mesh_test_init();
 	mesh_native_bgapi_init();
 	gecko_initCoexHAL();
 
@@ -293,8 +350,16 @@ int main() {
 }
 
 static void button_poll() {
+	uint8 pb0 = GPIO_PinInGet(BSP_BUTTON0_PORT, BSP_BUTTON0_PIN) == 0;
+	uint8 pb0_pressed = pb0 && !pb0_down;
 
+	pb0_down = pb0;
+
+	// outside of a provisioning prompt PB0 asks the vendor servers of the group for their status
 	if (ask_user_input == false) {
+		if (pb0_pressed) {
+			vendor_publish_get();
+		}
 		return;
 	}
 
@@ -406,6 +471,19 @@ tsConfig _sConfig;
 #define MY_MODEL_CLIENT_ID						0x2222
 #define MY_MODEL_GRP_ADDR					0xC003
 
+/* vendor model opcodes, shared with the node firmware */
+#define MY_MODEL_OP_GET						0x01
+#define MY_MODEL_OP_SET						0x02
+#define MY_MODEL_OP_STATUS					0x03
+#define MY_MODEL_OP_RECORDS					0x04	// packed records, see mesh_lib_vendor_pack_add()
+
+/* nodes the provisioner packs records for at the same time */
+#define VENDOR_PACK_DESTINATIONS			4
+
+/* publications of the provisioner's vendor client (PB0): bursts of 4, then one per second */
+#define PUBLISH_LIMIT_INTERVAL_MS			1000
+#define PUBLISH_LIMIT_BURST					4
+
 /* models used by simple light example (on/off only)
  * The beta SDK 1.0.1 and 1.1.0 examples are based on these
  * */
@@ -508,6 +586,456 @@ static void config_check() {
 
 }
 
+/*
+ * Configuration progress of the node being configured is kept in PS storage so that
+ * configuration can continue where it left off after a reset. To limit flash wear the
+ * progress is not written on every ack: changes are collected and written once the
+ * save timer expires. Losing the last few acks in a reset is harmless because the
+ * configuration steps are idempotent and are simply repeated.
+ *
+ * A PS key holds at most 56 bytes, so only the step and the done counters are saved.
+ * The lists themselves are built again by config_check() from the DCD, which is read
+ * from the node again when configuration is resumed.
+ */
+#define PS_KEY_CONFIG_PROGRESS      0x4000
+#define CONFIG_PROGRESS_SAVE_DELAY_MS  3000
+
+typedef struct {
+	uint16 address;
+	uint8 state;
+	uint8 num_bind_done;
+	uint8 num_pub_done;
+	uint8 num_sub_done;
+} tsConfigProgress;
+
+static uint8 config_progress_dirty = 0;
+
+/* progress loaded at boot, applied once the DCD has been read again */
+static tsConfigProgress config_resume;
+static uint8 config_resume_pending = 0;
+
+/* Mark progress changed, the write is deferred and coalesced with subsequent changes */
+static void config_progress_update(void) {
+	if (!config_progress_dirty) {
+		config_progress_dirty = 1;
+		gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(CONFIG_PROGRESS_SAVE_DELAY_MS), TIMER_ID_SAVE_PROGRESS, 1);
+	}
+}
+
+/* A failed save is tried again when the save timer expires next, the progress stays dirty. */
+static uint16 config_progress_save(void) {
+	tsConfigProgress progress;
+	uint16 res;
+
+	progress.address = provisionee_address;
+	progress.state = state;
+	progress.num_bind_done = _sConfig.num_bind_done;
+	progress.num_pub_done = _sConfig.num_pub_done;
+	progress.num_sub_done = _sConfig.num_sub_done;
+
+	config_progress_dirty = 0;
+	res = gecko_cmd_flash_ps_save(PS_KEY_CONFIG_PROGRESS, sizeof(progress), (const uint8 *) &progress)->result;
+	if (res) {
+		printf("error: config progress not saved, code %x, trying again\r\n", res);
+		config_progress_update();
+	}
+	return res;
+}
+
+static void config_progress_clear(void) {
+	if (config_progress_dirty) {
+		gecko_cmd_hardware_set_soft_timer(0, TIMER_ID_SAVE_PROGRESS, 1);
+		config_progress_dirty = 0;
+	}
+	gecko_cmd_flash_ps_erase(PS_KEY_CONFIG_PROGRESS);
+}
+
+/*
+ * Check if a node was being configured when the device was reset and continue
+ * with the step that was in progress. Returns true if configuration was resumed.
+ */
+static bool config_progress_resume(void) {
+	struct gecko_msg_flash_ps_load_rsp_t *load_rsp;
+	tsConfigProgress progress;
+	uint8 timer_handle = 0;
+
+	load_rsp = gecko_cmd_flash_ps_load(PS_KEY_CONFIG_PROGRESS);
+	if (load_rsp->result != 0 || load_rsp->value.len != sizeof(progress)) {
+		return false;
+	}
+	memcpy(&progress, load_rsp->value.data, sizeof(progress));
+
+	switch (progress.state) {
+		case provisioned:
+		case waiting_dcd:
+			timer_handle = TIMER_ID_GET_DCD;
+		break;
+
+		case waiting_appkey_ack:
+			timer_handle = TIMER_ID_APPKEY_ADD;
+		break;
+
+		case waiting_bind_ack:
+			timer_handle = TIMER_ID_APPKEY_BIND;
+		break;
+
+		case waiting_pub_ack:
+			timer_handle = TIMER_ID_PUB_SET;
+		break;
+
+		case waiting_sub_ack:
+			timer_handle = TIMER_ID_SUB_ADD;
+		break;
+
+		case waiting_heartbeat_ack:
+			timer_handle = TIMER_ID_HEARTBEAT_SET;
+		break;
+
+		default:
+		break;
+	}
+
+	if (timer_handle == 0) {
+		gecko_cmd_flash_ps_erase(PS_KEY_CONFIG_PROGRESS);
+		return false;
+	}
+
+	provisionee_address = progress.address;
+	state = progress.state;
+
+	// the configuration lists come from the DCD, read it again before going on with the step
+	if (timer_handle != TIMER_ID_GET_DCD) {
+		config_resume = progress;
+		config_resume_pending = 1;
+		timer_handle = TIMER_ID_GET_DCD;
+	}
+
+	printf("resuming configuration of %4.4x at step %d (bind %d, pub %d, sub %d done)\r\n", provisionee_address, state, progress.num_bind_done,
+			progress.num_pub_done, progress.num_sub_done);
+	gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), timer_handle, 1);
+	return true;
+}
+
+#if defined(FLASH_BENCHMARK) || defined(CRYPTO_BENCHMARK)
+static uint32_t time_ticks(void) {
+	struct gecko_msg_hardware_get_time_rsp_t *t = gecko_cmd_hardware_get_time();
+	return t->seconds * 32768 + t->ticks;
+}
+#endif
+
+#ifdef FLASH_BENCHMARK
+
+/*
+ * Read 64 kB from the external flash with the polled driver and with the LDMA, and
+ * print the throughput of both. Then hash the same 64 kB, first reading and hashing
+ * one sector after the other, then with the reads overlapping the hashing.
+ * Enabled with -DFLASH_BENCHMARK.
+ */
+static void flash_benchmark(void) {
+	static uint8_t buf[Sector_Offset];
+	uint32_t start, polled, dma, serial, overlapped;
+	tsSha256 sha;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	int i;
+
+	start = time_ticks();
+	for (i = 0; i < 16; i++) {
+		MX25_READ(REC_STORE_BASE_ADDR + i * Sector_Offset, buf, sizeof(buf));
+	}
+	polled = time_ticks() - start;
+
+	start = time_ticks();
+	for (i = 0; i < 16; i++) {
+		MX25_READ_DMA(REC_STORE_BASE_ADDR + i * Sector_Offset, buf, sizeof(buf), NULL, NULL);
+	}
+	dma = time_ticks() - start;
+
+	// 64 kB in 'ticks' 1/32768 s -> kB/s
+	printf("flash read 64 kB: polled %lu kB/s, dma %lu kB/s\r\n", (unsigned long) (64 * 32768 / (polled ? polled : 1)),
+			(unsigned long) (64 * 32768 / (dma ? dma : 1)));
+
+	start = time_ticks();
+	sha256_init(&sha);
+	for (i = 0; i < 16; i++) {
+		MX25_READ_DMA(REC_STORE_BASE_ADDR + i * Sector_Offset, buf, sizeof(buf), NULL, NULL);
+		sha256_update(&sha, buf, sizeof(buf));
+	}
+	sha256_final(&sha, digest);
+	serial = time_ticks() - start;
+
+	start = time_ticks();
+	sha256_init(&sha);
+	sha256_flash(&sha, REC_STORE_BASE_ADDR, 16 * Sector_Offset);
+	sha256_final(&sha, digest);
+	overlapped = time_ticks() - start;
+
+	printf("sha-256 of 64 kB: read then hash %lu kB/s, overlapped %lu kB/s\r\n", (unsigned long) (64 * 32768 / (serial ? serial : 1)),
+			(unsigned long) (64 * 32768 / (overlapped ? overlapped : 1)));
+}
+#endif
+
+#ifdef CRYPTO_BENCHMARK
+static volatile uint8_t crypto_benchmark_done;
+
+static void crypto_benchmark_cb(errorcode_t result, void *context) {
+	crypto_benchmark_done = 1;
+}
+
+/*
+ * Encrypt 32 kB in CTR mode with the register driven em_crypto function and with
+ * the LDMA, and print the throughput of both. Then time a P-256 scalar multiplication
+ * with and without the CRYPTO multiplier. Enabled with -DCRYPTO_BENCHMARK.
+ */
+static void crypto_benchmark(void) {
+	static uint32_t buf[8192 / 4];
+	static const uint8_t key[16] = { 0 };
+	uint8_t ctr[16] = { 0 };
+	uint32_t start, registers, dma;
+	int i;
+
+	CMU_ClockEnable(cmuClock_CRYPTO1, true);
+	start = time_ticks();
+	for (i = 0; i < 4; i++) {
+		CRYPTO_AES_CTR128(CRYPTO1, (uint8_t *) buf, (uint8_t *) buf, sizeof(buf), key, ctr, NULL);
+	}
+	registers = time_ticks() - start;
+
+	start = time_ticks();
+	for (i = 0; i < 4; i++) {
+		crypto_benchmark_done = 0;
+		if (aes_dma_start(AES_DMA_CTR, 1, key, ctr, (uint8_t *) buf, (uint8_t *) buf, sizeof(buf), crypto_benchmark_cb, NULL)) {
+			break;
+		}
+		while (!crypto_benchmark_done) {
+		}
+	}
+	dma = time_ticks() - start;
+
+	printf("aes-ctr 32 kB: registers %lu kB/s, dma %lu kB/s\r\n", (unsigned long) (32 * 32768 / (registers ? registers : 1)),
+			(unsigned long) (32 * 32768 / (dma ? dma : 1)));
+
+#ifndef P256_SOFTWARE
+	/* P-256 public key from a private key, multiplying with the CRYPTO block and on the CPU,
+	 * counted in core clock cycles */
+	{
+		static const uint8_t private_key[P256_PRIVATE_KEY_LEN] = { 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+				0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55 };
+		uint8_t public_key[P256_PUBLIC_KEY_LEN];
+		uint32_t cycles[2];
+
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+		for (i = 0; i < 2; i++) {
+			p256_use_software(i);
+			start = DWT->CYCCNT;
+			p256_public_key(private_key, public_key);
+			cycles[i] = DWT->CYCCNT - start;
+		}
+		p256_use_software(0);
+
+		printf("p-256 scalar multiplication: crypto %lu cycles, software %lu cycles\r\n", (unsigned long) cycles[0], (unsigned long) cycles[1]);
+	}
+#endif
+}
+#endif
+
+/*
+ * Wake up the external SPI flash (left in deep power down by initBoard) and mount the
+ * OOB table and the record store on it. Compaction of the store runs in the background
+ * from a soft timer.
+ */
+static void record_store_init(void) {
+	tsRecordStoreStats store_stats;
+	tsFlashCacheStats cache_stats;
+	tsOobStoreStats oob_stats;
+	uint8_t electronic_id;
+	uint16 res;
+
+	MX25_init();
+	MX25_RES(&electronic_id);
+
+#ifdef FLASH_BENCHMARK
+	flash_benchmark();
+#endif
+
+	flash_cache_init();
+
+	res = oob_store_mount();
+	if (res) {
+		printf("oob table mount failed, code %x\r\n", res);
+	} else {
+		oob_store_get_stats(&oob_stats);
+		printf("oob table: %d of %d devices, %d entries written, mounted in %lu ms\r\n", oob_stats.entries, OOB_STORE_MAX_ENTRIES, oob_stats.used,
+				(unsigned long) oob_stats.mount_ms);
+	}
+
+	res = record_store_mount();
+	if (res) {
+		printf("record store mount failed, code %x\r\n", res);
+		return;
+	}
+
+	record_store_get_stats(&store_stats);
+	printf("record store: %d records, %d free segments, mounted in %lu ms\r\n", store_stats.records, store_stats.free_segments, (unsigned long) store_stats.mount_ms);
+	flash_cache_get_stats(&cache_stats);
+	printf("flash cache: %lu hits, %lu misses, %lu pages read ahead\r\n", (unsigned long) cache_stats.hits, (unsigned long) cache_stats.misses,
+			(unsigned long) cache_stats.read_ahead);
+	gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(2000), TIMER_ID_STORE_COMPACT, 0);
+}
+
+static void vendor_status_received(const struct mesh_lib_vendor_model_message *msg) {
+	printf("vendor status from %4.4x:", msg->source_addr);
+	for (size_t i = 0; i < msg->payload_len; i++) {
+		printf(" %2.2x", msg->payload[i]);
+	}
+	printf("\r\n");
+}
+
+static void vendor_record_received(const struct mesh_lib_vendor_model_message *msg, uint8_t type, const uint8_t *data, size_t len) {
+	printf("vendor record %d from %4.4x:", type, msg->source_addr);
+	for (size_t i = 0; i < len; i++) {
+		printf(" %2.2x", data[i]);
+	}
+	printf("\r\n");
+}
+
+static void vendor_records_received(const struct mesh_lib_vendor_model_message *msg) {
+	if (mesh_lib_vendor_unpack(msg, vendor_record_received) < 0) {
+		printf("malformed records from %4.4x\r\n", msg->source_addr);
+	}
+}
+
+/* how much of the vendor traffic needed segmentation, for tuning the payloads */
+static void vendor_report(void) {
+	struct mesh_lib_vendor_model_stats stats;
+	struct mesh_lib_publish_limit_stats limit;
+	uint32_t packed;
+
+	mesh_lib_vendor_model_get_stats(&stats);
+	packed = stats.pack_flush_full + stats.pack_flush_deadline;
+	printf("vendor: %lu sent, %lu unsegmented, %lu segmented (%lu%%), %lu records in %lu packed messages, "
+			"%lu received\r\n", (unsigned long) stats.sent, (unsigned long) stats.unsegmented,
+			(unsigned long) stats.segmented, (unsigned long) (stats.sent ? stats.segmented * 100 / stats.sent : 0),
+			(unsigned long) stats.records, (unsigned long) packed, (unsigned long) stats.received);
+	if (stats.pack_retries || stats.pack_lost) {
+		printf("vendor packing: %lu messages sent again, %lu records lost\r\n", (unsigned long) stats.pack_retries,
+				(unsigned long) stats.pack_lost);
+	}
+	if (mesh_lib_publish_limit_get_stats(MY_VENDOR_ID, MY_MODEL_CLIENT_ID, 0, &limit) == bg_err_success) {
+		printf("vendor publications: %lu passed, %lu throttled, %lu coalesced, %lu delayed, %lu dropped\r\n",
+				(unsigned long) limit.passed, (unsigned long) limit.throttled, (unsigned long) limit.coalesced,
+				(unsigned long) limit.delayed, (unsigned long) limit.dropped);
+	}
+}
+
+static uint32_t time_ms(void) {
+	struct gecko_msg_hardware_get_time_rsp_t *t = gecko_cmd_hardware_get_time();
+
+	return t->seconds * 1000 + ((uint32_t) t->ticks * 1000) / 32768;
+}
+
+static void blob_received(const struct mesh_lib_vendor_model_message *msg) {
+	blob_xfer_receive(msg->source_addr, msg->opcode, msg->payload, msg->payload_len, time_ms());
+}
+
+static errorcode_t blob_send(uint16_t addr, uint8_t opcode, const uint8_t *data, uint16_t len) {
+	return mesh_lib_vendor_model_send(MY_VENDOR_ID, MY_MODEL_CLIENT_ID, 0, addr, appkey_id, opcode, data, len, 0);
+}
+
+static void blob_done(uint16_t addr, uint8_t id, uint8_t sent, errorcode_t result) {
+	tsBlobXferStats stats;
+
+	// the provisioner does not take blobs, only its own transfers end here
+	if (!sent) {
+		return;
+	}
+	blob_xfer_get_stats(&stats);
+	printf("@blob done %d to %4.4x, result %x: %lu of %lu bytes from offset %lu in %lu ms, %lu bytes/s, "
+			"%lu chunks, %lu sent again, %lu timeouts\r\n", id, addr, result, (unsigned long) stats.bytes_acked,
+			(unsigned long) stats.size, (unsigned long) stats.resume_offset, (unsigned long) stats.elapsed_ms,
+			(unsigned long) stats.bytes_per_s, (unsigned long) stats.chunks_sent, (unsigned long) stats.resent,
+			(unsigned long) stats.timeouts);
+}
+
+static const struct mesh_lib_vendor_model_handler vendor_client_handlers[] = {
+	{ MY_MODEL_OP_STATUS, vendor_status_received },
+	{ MY_MODEL_OP_RECORDS, vendor_records_received },
+	{ BLOB_XFER_OP_START_ACK, blob_received },
+	{ BLOB_XFER_OP_ACK, blob_received },
+};
+
+/* the provisioner only sends blobs */
+static const tsBlobXferOps blob_ops = { blob_send, NULL, NULL, blob_done };
+
+/* the provisioner's own vendor client, used to talk to the vendor servers of the nodes */
+static void vendor_client_init(void) {
+	errorcode_t res;
+
+	res = mesh_lib_init(mem_watch_malloc, mem_watch_free, 0);
+	if (res == bg_err_success) {
+		res = mesh_lib_vendor_init(1);
+	}
+	if (res == bg_err_success) {
+		res = mesh_lib_vendor_model_register(MY_VENDOR_ID, MY_MODEL_CLIENT_ID, 0, 1, vendor_client_handlers,
+				sizeof(vendor_client_handlers) / sizeof(vendor_client_handlers[0]));
+	}
+	if (res == bg_err_success) {
+		res = mesh_lib_vendor_pack_init(MY_MODEL_OP_RECORDS, VENDOR_PACK_DESTINATIONS);
+	}
+	// the vendor client is the only model the application publishes with, held back publications are sent from the 20 ms timer
+	if (res == bg_err_success) {
+		res = mesh_lib_publish_limit_init(1);
+	}
+	if (res == bg_err_success) {
+		res = mesh_lib_publish_limit_set(MY_VENDOR_ID, MY_MODEL_CLIENT_ID, 0, PUBLISH_LIMIT_INTERVAL_MS, PUBLISH_LIMIT_BURST);
+	}
+	if (res != bg_err_success) {
+		printf("vendor client not initialized, code %x\r\n", res);
+	}
+
+	blob_xfer_init(&blob_ops);
+}
+
+/* the provisioner's models are not configured over the air, the application key and the publication are set locally */
+static void vendor_client_bind(void) {
+	uint16 res = gecko_cmd_mesh_test_bind_local_model_app(0, appkey_id, MY_VENDOR_ID, MY_MODEL_CLIENT_ID)->result;
+
+	if (res != 0 && res != bg_err_mesh_already_exists) {
+		printf("vendor client not bound, code %x\r\n", res);
+	}
+
+	res = gecko_cmd_mesh_test_set_local_model_pub(0, appkey_id, MY_VENDOR_ID, MY_MODEL_CLIENT_ID, MY_MODEL_GRP_ADDR, 3, 0, 0, 0)->result;
+	if (res != 0) {
+		printf("vendor client publication not set, code %x\r\n", res);
+	}
+}
+
+/* a Get to the vendor group, the servers answer with their status. Publications
+ * over the limit are held back and sent from the 20 ms timer. */
+static void vendor_publish_get(void) {
+	errorcode_t res;
+
+	res = mesh_lib_vendor_model_publish(MY_VENDOR_ID, MY_MODEL_CLIENT_ID, 0, MY_MODEL_OP_GET, NULL, 0);
+	if (res != bg_err_success) {
+		printf("vendor get not published, code %x\r\n", res);
+	}
+}
+
+/* called when a network import has created the keys */
+static void network_imported(const tsNetworkKeys *keys) {
+	netkey_id = keys->netkey_index;
+	appkey_id = keys->appkey_index;
+	printf("network imported, netkey id = %x, appkey_id = %x\r\n", netkey_id, appkey_id);
+	vendor_client_bind();
+}
+
+static void config_done() {
+	printf("configuration complete\r\n");
+	node_db_set_config_state(provisionee_address, NODE_DB_CONFIG_DONE);
+	config_progress_clear();
+	state = scanning;
+}
+
 static void config_retry() {
 
 	uint8 timer_handle = 0;
@@ -529,6 +1057,10 @@ static void config_retry() {
 			timer_handle = TIMER_ID_SUB_ADD;
 		break;
 
+		case waiting_heartbeat_ack:
+			timer_handle = TIMER_ID_HEARTBEAT_SET;
+		break;
+
 		default:
 			printf("config_retry(): don't know how to handle state %d\r\n", state);
 		break;
@@ -557,6 +1089,25 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 			} else {
 				printf("Initializing as provisioner\r\n");
 
+				record_store_init();
+				key_refresh_init();
+
+#ifdef CRYPTO_BENCHMARK
+				crypto_benchmark();
+#endif
+#ifdef AES_CCM_SELFTEST
+				printf("aes-ccm self test: %d failures\r\n", aes_ccm_selftest());
+#endif
+#ifdef P256_SELFTEST
+				printf("p-256 self test: %d failures\r\n", p256_selftest());
+#endif
+
+				// network export / import and the other commands are read from the UART
+				cdb_stream_init(network_imported);
+				console_init();
+				gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(20), TIMER_ID_UART_POLL, 0);
+				gecko_cmd_hardware_set_soft_timer(MEM_REPORT_INTERVAL_S * TIMER_CLK_FREQ, TIMER_ID_MEM_REPORT, 0);
+
 				state = init;
 				// init as provisioner
 				struct gecko_msg_mesh_prov_init_rsp_t *prov_init_rsp = gecko_cmd_mesh_prov_init();
@@ -699,6 +1250,64 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 				}
 				break;
 
+				case TIMER_ID_HEARTBEAT_SET: {
+					uint16 res;
+
+					printf("\r\nheartbeat publication set: address %4.4x, period %lu s\r\n", provisionee_address, (unsigned long) LIVENESS_PERIOD_S);
+					res = liveness_publication_set(provisionee_address, netkey_id);
+
+					if (res == STATUS_OK) {
+						printf("success - waiting heartbeat ack\r\n");
+						state = waiting_heartbeat_ack;
+					} else if (res == STATUS_BUSY) {
+						printf(".");
+						fflush(stdout);
+						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_HEARTBEAT_SET, 1);
+					} else {
+						printf("prov_heartbeat_publication_set failed with result 0x%X\r\n", res);
+						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_HEARTBEAT_SET, 1);
+					}
+				}
+				break;
+
+				case TIMER_ID_LIVENESS:
+					liveness_tick();
+				break;
+
+				case TIMER_ID_SEQ_MONITOR:
+					seq_monitor_sample();
+				break;
+
+				case TIMER_ID_MEM_REPORT:
+					mem_watch_report();
+					vendor_report();
+				break;
+
+				case TIMER_ID_KEY_REFRESH:
+					key_refresh_tick();
+				break;
+
+				case TIMER_ID_UART_POLL:
+					console_poll();
+					cdb_stream_poll();
+					// the blob transfer, the record packing and the publish limits are clocked by the same 20 ms timer
+					if (blob_xfer_sending()) {
+						blob_xfer_tick(time_ms());
+					}
+					mesh_lib_vendor_pack_check_timeouts();
+					mesh_lib_publish_limit_check_timeouts();
+				break;
+
+				case TIMER_ID_STORE_COMPACT:
+					record_store_compact_step();
+				break;
+
+				case TIMER_ID_SAVE_PROGRESS:
+					if (config_progress_dirty) {
+						config_progress_save();
+					}
+				break;
+
 				case TIMER_ID_FACTORY_RESET:
 					gecko_cmd_system_reset(0);
 				break;
@@ -720,10 +1329,27 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 			if (pDCD->result == 0) {
 				// decode the DCD content
 				DCD_decode(pDCD);
+				node_db_set_dcd(provisionee_address, pDCD->pid, pDCD->elements);
 
 				// check the desired configuration settings depending on what's in the DCD
 				config_check();
 
+				if (config_resume_pending && config_resume.address == provisionee_address) {
+					// continue with the step that was in progress before the reset
+					config_resume_pending = 0;
+					_sConfig.num_bind_done = config_resume.num_bind_done < _sConfig.num_bind ? config_resume.num_bind_done : _sConfig.num_bind;
+					_sConfig.num_pub_done = config_resume.num_pub_done < _sConfig.num_pub ? config_resume.num_pub_done : _sConfig.num_pub;
+					_sConfig.num_sub_done = config_resume.num_sub_done < _sConfig.num_sub ? config_resume.num_sub_done : _sConfig.num_sub;
+					state = config_resume.state;
+					config_retry();
+					break;
+				}
+				config_resume_pending = 0;
+
+				// configuration list is known now, store the progress before starting to configure the node
+				state = waiting_appkey_ack;
+				config_progress_save();
+
 				// next step : send appkey to device
 				gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_APPKEY_ADD, 1);
 			} else {
@@ -737,6 +1363,7 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 			struct gecko_msg_mesh_prov_config_status_evt_t *conf_status_evt = (struct gecko_msg_mesh_prov_config_status_evt_t *) &evt->data;
 
 			printf("mesh_prov_config_status: addr = 0x%X, id = 0x%X, status = 0x%X\r\n", conf_status_evt->address, conf_status_evt->id, conf_status_evt->status);
+			node_db_seen(conf_status_evt->address);
 
 			if (conf_status_evt->status) {
 				printf("Not successful, will try again\n");
@@ -745,38 +1372,48 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 				// move to next phase in configuration
 
 				if (state == waiting_appkey_ack) {
+					state = waiting_bind_ack;
+					config_progress_update();
 					gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_APPKEY_BIND, 1);
 				} else if (state == waiting_bind_ack) {
 					printf("bind complete\r\n");
 					_sConfig.num_bind_done++;
+					config_progress_update();
 
 					if (_sConfig.num_bind_done < _sConfig.num_bind) {
 						// more model<->appkey bindings to be done
 						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_APPKEY_BIND, 1);
 					} else {
+						state = waiting_pub_ack;
 						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_PUB_SET, 1);
 					}
 				} else if (state == waiting_pub_ack) {
 					printf("PUB complete\r\n");
 					_sConfig.num_pub_done++;
+					config_progress_update();
 
 					if (_sConfig.num_pub_done < _sConfig.num_pub) {
 						// more publication settings to be done
 						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_PUB_SET, 1);
 					} else {
+						state = waiting_sub_ack;
 						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_SUB_ADD, 1);
 					}
 				} else if (state == waiting_sub_ack) {
 					printf("SUB complete\r\n");
 					_sConfig.num_sub_done++;
+					config_progress_update();
 					if (_sConfig.num_sub_done < _sConfig.num_sub) {
 						// more subscription settings to be done
 						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_SUB_ADD, 1);
 					} else {
-						printf("configuration complete\r\n");
-						state = scanning;
+						// last step, the node reports to the liveness table from now on
+						state = waiting_heartbeat_ack;
+						gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_HEARTBEAT_SET, 1);
 					}
 
+				} else if (state == waiting_heartbeat_ack) {
+					config_done();
 				} else {
 					printf("unexpected prov conf status: state = %d\r\n", state);
 				}
@@ -823,41 +1460,56 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 			printf("address: %x\r\n", initialized_evt->address);
 			printf("ivi: %x\r\n", (unsigned int) initialized_evt->ivi);
 
+			// static OOB authentication for the devices in the OOB table
+			oob_store_set_requirements();
+
+			vendor_client_init();
+
 			if (initialized_evt->networks > 0) {
 				printf("network keys already exist\r\n");
 				netkey_id = 0;
 				appkey_id = 0;
-			} else {
-				printf("Creating a new netkey\r\n");
-
-				struct gecko_msg_mesh_prov_create_network_rsp_t *new_netkey_rsp;
-				new_netkey_rsp = gecko_cmd_mesh_prov_create_network(0, (const uint8 *) "");
-
-				if (new_netkey_rsp->result == 0) {
-					netkey_id = new_netkey_rsp->network_id;
-					printf("Success, netkey id = %x\r\n", netkey_id);
-				} else {
-					printf("Failed to create new netkey. Error: %x", new_netkey_rsp->result);
-				}
+				vendor_client_bind();
 
-				printf("Creating a new appkey\r\n");
+				// rebuild the node table from the device database of the stack
+				printf("DDB contains %d devices\r\n", node_db_load());
+			} else if (cdb_stream_import_pending()) {
+				node_db_init();
+				printf("waiting for a network import (cdb import)\r\n");
+			} else {
+				node_db_init();
 
-				struct gecko_msg_mesh_prov_create_appkey_rsp_t *new_appkey_rsp;
-				new_appkey_rsp = gecko_cmd_mesh_prov_create_appkey(netkey_id, 0, (const uint8 *) "");
+				printf("Creating a new network\r\n");
 
-				if (new_netkey_rsp->result == 0) {
-					appkey_id = new_appkey_rsp->appkey_index;
-					printf("Success, appkey_id = %x\r\n", appkey_id);
+				uint16 res = cdb_stream_create_network(NULL, NULL);
+				if (res == 0) {
+					const tsNetworkKeys *keys = cdb_stream_keys();
+					netkey_id = keys->netkey_index;
+					appkey_id = keys->appkey_index;
+					printf("Success, netkey id = %x, appkey_id = %x\r\n", netkey_id, appkey_id);
+					vendor_client_bind();
 					printf("Appkey: ");
-					for (uint32_t i = 0; i < new_appkey_rsp->key.len; ++i) {
-						printf("%02x ", new_appkey_rsp->key.data[i]);
+					for (uint32_t i = 0; i < sizeof(keys->appkey); ++i) {
+						printf("%02x ", keys->appkey[i]);
 					}
 					printf("\r\n");
 				} else {
-					printf("Failed to create new appkey. Error: %x", new_appkey_rsp->result);
+					printf("Failed to create new network. Error: %x\r\n", res);
 				}
 			}
 
+			// watch the sequence numbers used by the provisioner's own messages
+			seq_monitor_init();
+			seq_monitor_sample();
+			gecko_cmd_hardware_set_soft_timer(SEQ_MONITOR_INTERVAL_S * TIMER_CLK_FREQ, TIMER_ID_SEQ_MONITOR, 0);
+
+			// progress of a key refresh started with "kr start", idle otherwise
+			gecko_cmd_hardware_set_soft_timer(TIMER_CLK_FREQ, TIMER_ID_KEY_REFRESH, 0);
+
+			// heartbeats of the configured nodes come to our primary address
+			liveness_init(initialized_evt->address);
+			gecko_cmd_hardware_set_soft_timer(TIMER_CLK_FREQ, TIMER_ID_LIVENESS, 0);
+
 			printf("Starting to scan for unprovisioned device beacons\r\n");
 
 			struct gecko_msg_mesh_prov_scan_unprov_beacons_rsp_t *scan_rsp;
@@ -870,6 +1522,11 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 				printf("Failure initializing unprovisioned beacon scan. Result: %x\r\n", scan_rsp->result);
 			}
 
+			// a node that was half-configured when we were reset is finished before accepting new ones
+			if (initialized_evt->networks > 0 && !config_progress_resume()) {
+				printf("no node configuration to resume\r\n");
+			}
+
 			// start timer for button polling
 			gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(100), TMIER_ID_BUTTON_POLL, 0);
 
@@ -895,6 +1552,60 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 			break;
 		}
 
+		case gecko_evt_mesh_prov_ddb_list_id: {
+			struct gecko_msg_mesh_prov_ddb_list_evt_t *ddb_evt = (struct gecko_msg_mesh_prov_ddb_list_evt_t *) &(evt->data);
+			uint16_t slot;
+
+			node_db_handle_ddb_list(ddb_evt->uuid.data, ddb_evt->address, ddb_evt->elements);
+			slot = node_db_find_by_address(ddb_evt->address);
+			if (slot != NODE_DB_INVALID) {
+				key_refresh_node_loaded(slot);
+			}
+			break;
+		}
+
+		case gecko_evt_mesh_node_changed_ivupdate_state_id: {
+			struct gecko_msg_mesh_node_changed_ivupdate_state_evt_t *iv_evt = (struct gecko_msg_mesh_node_changed_ivupdate_state_evt_t *) &(evt->data);
+
+			seq_monitor_ivupdate_changed(iv_evt->ivindex, iv_evt->state);
+			break;
+		}
+
+		case gecko_evt_mesh_prov_oob_pkey_request_id: {
+			struct gecko_msg_mesh_prov_oob_pkey_request_evt_t *pkey_evt = (struct gecko_msg_mesh_prov_oob_pkey_request_evt_t *) &(evt->data);
+
+			oob_store_handle_pkey_request(pkey_evt->uuid.data);
+			break;
+		}
+
+		case gecko_evt_mesh_prov_oob_auth_request_id: {
+			struct gecko_msg_mesh_prov_oob_auth_request_evt_t *auth_evt = (struct gecko_msg_mesh_prov_oob_auth_request_evt_t *) &(evt->data);
+
+			oob_store_handle_auth_request(auth_evt->output, auth_evt->uuid.data);
+			break;
+		}
+
+		case gecko_evt_mesh_prov_key_refresh_node_update_id: {
+			struct gecko_msg_mesh_prov_key_refresh_node_update_evt_t *kr_evt = (struct gecko_msg_mesh_prov_key_refresh_node_update_evt_t *) &(evt->data);
+
+			key_refresh_node_update(kr_evt->key, kr_evt->phase, kr_evt->uuid.data);
+			break;
+		}
+
+		case gecko_evt_mesh_prov_key_refresh_phase_update_id: {
+			struct gecko_msg_mesh_prov_key_refresh_phase_update_evt_t *kr_evt = (struct gecko_msg_mesh_prov_key_refresh_phase_update_evt_t *) &(evt->data);
+
+			key_refresh_phase_update(kr_evt->key, kr_evt->phase);
+			break;
+		}
+
+		case gecko_evt_mesh_prov_key_refresh_complete_id: {
+			struct gecko_msg_mesh_prov_key_refresh_complete_evt_t *kr_evt = (struct gecko_msg_mesh_prov_key_refresh_complete_evt_t *) &(evt->data);
+
+			key_refresh_complete(kr_evt->key, kr_evt->result);
+			break;
+		}
+
 		case gecko_evt_mesh_prov_provisioning_failed_id: {
 			struct gecko_msg_mesh_prov_provisioning_failed_evt_t *fail_evt = (struct gecko_msg_mesh_prov_provisioning_failed_evt_t*) &(evt->data);
 
@@ -906,6 +1617,7 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 
 		case gecko_evt_mesh_prov_device_provisioned_id: {
 			struct gecko_msg_mesh_prov_device_provisioned_evt_t *prov_evt = (struct gecko_msg_mesh_prov_device_provisioned_evt_t*) &(evt->data);
+			uint16_t slot;
 
 			printf("Node successfully provisioned. Address: %4.4x\r\n", prov_evt->address);
 			state = provisioned;
@@ -917,6 +1629,15 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 
 			provisionee_address = prov_evt->address;
 
+			slot = node_db_add(prov_evt->uuid.data, prov_evt->address, 0);
+			if (slot == NODE_DB_INVALID) {
+				printf("node %4.4x not added, table full or address in use\r\n", prov_evt->address);
+			} else {
+				key_refresh_node_provisioned(slot);
+			}
+
+			config_progress_save();
+
 			/* kick of next phase which is reading DCD from the newly provisioned node */
 			gecko_cmd_hardware_set_soft_timer(TIMER_MS_2_TIMERTICK(500), TIMER_ID_GET_DCD, 1);
 
@@ -925,6 +1646,32 @@ static void handle_gecko_event(uint32_t evt_id, struct gecko_cmd_packet *evt) {
 			break;
 		}
 
+		case gecko_evt_mesh_vendor_model_receive_id:
+			mesh_lib_vendor_model_event_handler(evt);
+			break;
+
+		case gecko_evt_mesh_prov_heartbeat_publication_status_id: {
+			struct gecko_msg_mesh_prov_heartbeat_publication_status_evt_t *hb_evt = (struct gecko_msg_mesh_prov_heartbeat_publication_status_evt_t *) &(evt->data);
+
+			printf("heartbeat publication status: addr = 0x%X, dest = 0x%X, period_log = %d\r\n", hb_evt->address, hb_evt->publication_address, hb_evt->period_log);
+			node_db_seen(hb_evt->address);
+			if (state == waiting_heartbeat_ack && hb_evt->address == provisionee_address) {
+				// a node that refused the setting is configured all the same, it just stays stale
+				if (hb_evt->period_log != LIVENESS_PERIOD_LOG) {
+					printf("heartbeat publication not accepted\r\n");
+				}
+				config_done();
+			}
+			break;
+		}
+
+		case gecko_evt_mesh_test_local_heartbeat_subscription_complete_id: {
+			struct gecko_msg_mesh_test_local_heartbeat_subscription_complete_evt_t *hb_evt = (struct gecko_msg_mesh_test_local_heartbeat_subscription_complete_evt_t *) &(evt->data);
+
+			liveness_subscription_complete(hb_evt->count, hb_evt->hop_min, hb_evt->hop_max);
+			break;
+		}
+
 		default:
 			printf("unhandled evt: %8.8x class %2.2x method %2.2x\r\n", (unsigned int) evt_id, (unsigned int) ((evt_id >> 16) & 0xFF), (unsigned int) ((evt_id >> 24) & 0xFF));
 		break;
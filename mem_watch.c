@@ -0,0 +1,116 @@
+#include "mem_watch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "em_device.h"
+
+#define STACK_PAINT          0xA5A5A5A5
+
+/* part of the stack below the current stack pointer left unpainted at init */
+#define STACK_PAINT_MARGIN   64
+
+/* header in front of each block allocated through mem_watch_malloc(), keeps 8 byte alignment */
+#define ALLOC_HEADER         8
+
+extern uint32_t __StackLimit;              /* lowest address of the main stack, from the linker */
+extern uint32_t __StackTop;
+extern size_t RETARGET_SbrkUsed;
+extern size_t RETARGET_SbrkPeak;
+
+static const uint32_t *bt_heap_start;
+static size_t bt_heap_len;
+static uint32_t alloc_used;
+static uint32_t alloc_peak;
+static uint32_t alloc_failures;
+
+// local functions
+
+/* the stack grows down from __StackTop, the first overwritten word from the bottom is the peak */
+static uint32_t stack_peak(void)
+{
+  const uint32_t *p = &__StackLimit;
+
+  while (p < &__StackTop && *p == STACK_PAINT) {
+    p++;
+  }
+  return (uint32_t)((uintptr_t)&__StackTop - (uintptr_t)p);
+}
+
+static uint32_t bt_heap_touched(void)
+{
+  size_t words = bt_heap_len / 4;
+
+  while (words > 0 && bt_heap_start[words - 1] == 0) {
+    words--;
+  }
+  return words * 4;
+}
+
+// public functions
+
+void mem_watch_init(const void *bt_heap, size_t bt_heap_size)
+{
+  uint32_t *p = &__StackLimit;
+  uint32_t *sp = (uint32_t *)(__get_MSP() - STACK_PAINT_MARGIN);
+
+  while (p < sp) {
+    *p++ = STACK_PAINT;
+  }
+
+  bt_heap_start = (const uint32_t *) bt_heap;
+  bt_heap_len = bt_heap_size;
+}
+
+void *mem_watch_malloc(size_t size)
+{
+  uint8_t *block = malloc(size + ALLOC_HEADER);
+
+  if (!block) {
+    alloc_failures++;
+    return NULL;
+  }
+  *(size_t *)block = size;
+  alloc_used += size;
+  if (alloc_used > alloc_peak) {
+    alloc_peak = alloc_used;
+  }
+  return block + ALLOC_HEADER;
+}
+
+void mem_watch_free(void *ptr)
+{
+  uint8_t *block;
+
+  if (!ptr) {
+    return;
+  }
+  block = (uint8_t *)ptr - ALLOC_HEADER;
+  alloc_used -= *(size_t *)block;
+  free(block);
+}
+
+void mem_watch_get(tsMemWatch *usage)
+{
+  usage->stack_size = (uint32_t)((uintptr_t)&__StackTop - (uintptr_t)&__StackLimit);
+  usage->stack_peak = stack_peak();
+  usage->sbrk_used = RETARGET_SbrkUsed;
+  usage->sbrk_peak = RETARGET_SbrkPeak;
+  usage->alloc_used = alloc_used;
+  usage->alloc_peak = alloc_peak;
+  usage->alloc_failures = alloc_failures;
+  usage->bt_heap_size = bt_heap_len;
+  usage->bt_heap_touched = bt_heap_start ? bt_heap_touched() : 0;
+}
+
+void mem_watch_report(void)
+{
+  tsMemWatch m;
+
+  mem_watch_get(&m);
+  printf("mem: stack %lu/%lu, heap %lu (peak %lu), alloc %lu (peak %lu, %lu failed), bt heap %lu/%lu\r\n",
+      (unsigned long) m.stack_peak, (unsigned long) m.stack_size, (unsigned long) m.sbrk_used, (unsigned long) m.sbrk_peak,
+      (unsigned long) m.alloc_used, (unsigned long) m.alloc_peak, (unsigned long) m.alloc_failures,
+      (unsigned long) m.bt_heap_touched, (unsigned long) m.bt_heap_size);
+}
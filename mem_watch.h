@@ -0,0 +1,40 @@
+#ifndef _MEM_WATCH_H
+#define _MEM_WATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  RAM usage instrumentation.
+ *
+ *  - main stack: the unused part of the stack is painted with a pattern at
+ *    startup, the peak use is found by scanning for the first overwritten word
+ *  - heap: _sbrk() in retargetio.c records how far the heap has grown
+ *  - mesh_lib: mem_watch_malloc() / mem_watch_free() can be passed to
+ *    mesh_lib_init() and count the bytes allocated through them
+ *  - Bluetooth stack heap: the array is zero at startup, the highest nonzero
+ *    word shows how much of it the stack has touched
+ */
+
+typedef struct {
+  uint32_t stack_size;
+  uint32_t stack_peak;
+  uint32_t sbrk_used;
+  uint32_t sbrk_peak;
+  uint32_t alloc_used;        /* bytes allocated through mem_watch_malloc() */
+  uint32_t alloc_peak;
+  uint32_t alloc_failures;
+  uint32_t bt_heap_size;
+  uint32_t bt_heap_touched;   /* bytes from the start up to the last nonzero word */
+} tsMemWatch;
+
+/* Paint the stack. Call first thing in main(), before the call depth grows. */
+void mem_watch_init(const void *bt_heap, size_t bt_heap_size);
+
+void *mem_watch_malloc(size_t size);
+void mem_watch_free(void *ptr);
+
+void mem_watch_get(tsMemWatch *usage);
+void mem_watch_report(void);
+
+#endif
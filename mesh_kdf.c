@@ -0,0 +1,199 @@
+#include "mesh_kdf.h"
+
+#include <string.h>
+
+#define BLOCK       AES_BLOCK_SIZE
+
+static uint8_t cache_ready;
+static tsCmacKey zero_key;          /* key of s1 */
+static tsCmacKey salt_k2;           /* s1("smk2") */
+static tsCmacKey salt_k3;           /* s1("smk3") */
+static tsCmacKey salt_k4;           /* s1("smk4") */
+static tsCmacKey salt_site_net;     /* s1("site netkey") */
+static tsCmacKey salt_site_app;     /* s1("site appkey") */
+
+/* T of the site keys for the last master secret, the same for all sites */
+static uint8_t site_secret[MESH_KDF_KEY_LEN];
+static uint8_t site_ready;
+static tsCmacKey site_t_net;
+static tsCmacKey site_t_app;
+
+// local functions
+
+/* shift left by one bit, and xor the constant Rb if a one was shifted out */
+static void subkey_double(const uint8_t *in, uint8_t *out)
+{
+  uint8_t msb = in[0] & 0x80;
+  int i;
+
+  for (i = 0; i < BLOCK - 1; i++) {
+    out[i] = (uint8_t)((in[i] << 1) | (in[i + 1] >> 7));
+  }
+  out[BLOCK - 1] = (uint8_t)(in[BLOCK - 1] << 1);
+  if (msb) {
+    out[BLOCK - 1] ^= 0x87;
+  }
+}
+
+static void salt_key(tsCmacKey *ck, const char *m)
+{
+  uint8_t salt[BLOCK];
+
+  mesh_cmac(&zero_key, (const uint8_t *) m, strlen(m), salt);
+  mesh_cmac_key(ck, salt);
+}
+
+static void cache_init(void)
+{
+  static const uint8_t zero[BLOCK];
+
+  if (cache_ready) {
+    return;
+  }
+  mesh_cmac_key(&zero_key, zero);
+  salt_key(&salt_k2, "smk2");
+  salt_key(&salt_k3, "smk3");
+  salt_key(&salt_k4, "smk4");
+  salt_key(&salt_site_net, "site netkey");
+  salt_key(&salt_site_app, "site appkey");
+  cache_ready = 1;
+}
+
+/* T = AES-CMAC_salt(N), prepared as a CMAC key */
+static void key_t(const tsCmacKey *salt, const uint8_t *n, size_t n_len, tsCmacKey *t)
+{
+  uint8_t mac[BLOCK];
+
+  mesh_cmac(salt, n, n_len, mac);
+  mesh_cmac_key(t, mac);
+}
+
+// public functions
+
+void mesh_cmac_key(tsCmacKey *ck, const uint8_t *key)
+{
+  static const uint8_t zero[BLOCK];
+  uint8_t l[BLOCK];
+
+  aes_block_key(&ck->aes, key);
+  aes_block_encrypt(&ck->aes, zero, l);
+  subkey_double(l, ck->k1);
+  subkey_double(ck->k1, ck->k2);
+}
+
+void mesh_cmac(const tsCmacKey *ck, const uint8_t *msg, size_t len, uint8_t *mac)
+{
+  uint8_t x[BLOCK];
+  size_t i;
+
+  memset(x, 0, BLOCK);
+
+  /* all blocks but the last one */
+  while (len > BLOCK) {
+    for (i = 0; i < BLOCK; i++) {
+      x[i] ^= msg[i];
+    }
+    aes_block_encrypt(&ck->aes, x, x);
+    msg += BLOCK;
+    len -= BLOCK;
+  }
+
+  /* the last block, complete with K1 or padded with K2 */
+  for (i = 0; i < BLOCK; i++) {
+    if (len == BLOCK) {
+      x[i] ^= msg[i] ^ ck->k1[i];
+    } else {
+      x[i] ^= ((i < len) ? msg[i] : (i == len) ? 0x80 : 0) ^ ck->k2[i];
+    }
+  }
+  aes_block_encrypt(&ck->aes, x, mac);
+}
+
+void mesh_s1(const uint8_t *m, size_t len, uint8_t *salt)
+{
+  cache_init();
+  mesh_cmac(&zero_key, m, len, salt);
+}
+
+void mesh_k1(const uint8_t *n, size_t n_len, const uint8_t *salt, const uint8_t *p, size_t p_len, uint8_t *out)
+{
+  tsCmacKey s, t;
+
+  mesh_cmac_key(&s, salt);
+  key_t(&s, n, n_len, &t);
+  mesh_cmac(&t, p, p_len, out);
+}
+
+void mesh_k2(const uint8_t *n, const uint8_t *p, size_t p_len, uint8_t *nid, uint8_t *enc_key, uint8_t *priv_key)
+{
+  uint8_t m[BLOCK + MESH_KDF_K2_P_MAX + 1];
+  uint8_t t1[BLOCK];
+  tsCmacKey t;
+
+  if (p_len > MESH_KDF_K2_P_MAX) {
+    p_len = MESH_KDF_K2_P_MAX;
+  }
+
+  cache_init();
+  key_t(&salt_k2, n, MESH_KDF_KEY_LEN, &t);
+
+  /* T1 = CMAC_T(P || 0x01), Tn = CMAC_T(Tn-1 || P || n) */
+  memcpy(m, p, p_len);
+  m[p_len] = 0x01;
+  mesh_cmac(&t, m, p_len + 1, t1);
+
+  memcpy(m, t1, BLOCK);
+  memcpy(m + BLOCK, p, p_len);
+  m[BLOCK + p_len] = 0x02;
+  mesh_cmac(&t, m, BLOCK + p_len + 1, enc_key);
+
+  memcpy(m, enc_key, BLOCK);
+  m[BLOCK + p_len] = 0x03;
+  mesh_cmac(&t, m, BLOCK + p_len + 1, priv_key);
+
+  *nid = t1[BLOCK - 1] & 0x7F;
+}
+
+void mesh_k3(const uint8_t *n, uint8_t *network_id)
+{
+  static const uint8_t id64[] = { 'i', 'd', '6', '4', 0x01 };
+  uint8_t mac[BLOCK];
+  tsCmacKey t;
+
+  cache_init();
+  key_t(&salt_k3, n, MESH_KDF_KEY_LEN, &t);
+  mesh_cmac(&t, id64, sizeof(id64), mac);
+  memcpy(network_id, mac + BLOCK - 8, 8);
+}
+
+uint8_t mesh_k4(const uint8_t *n)
+{
+  static const uint8_t id6[] = { 'i', 'd', '6', 0x01 };
+  uint8_t mac[BLOCK];
+  tsCmacKey t;
+
+  cache_init();
+  key_t(&salt_k4, n, MESH_KDF_KEY_LEN, &t);
+  mesh_cmac(&t, id6, sizeof(id6), mac);
+  return mac[BLOCK - 1] & 0x3F;
+}
+
+void mesh_site_keys(const uint8_t *secret, uint32_t site_id, uint8_t *netkey, uint8_t *appkey)
+{
+  uint8_t id[4];
+
+  id[0] = (uint8_t)(site_id >> 24);
+  id[1] = (uint8_t)(site_id >> 16);
+  id[2] = (uint8_t)(site_id >> 8);
+  id[3] = (uint8_t) site_id;
+
+  cache_init();
+  if (!site_ready || memcmp(site_secret, secret, MESH_KDF_KEY_LEN)) {
+    key_t(&salt_site_net, secret, MESH_KDF_KEY_LEN, &site_t_net);
+    key_t(&salt_site_app, secret, MESH_KDF_KEY_LEN, &site_t_app);
+    memcpy(site_secret, secret, MESH_KDF_KEY_LEN);
+    site_ready = 1;
+  }
+  mesh_cmac(&site_t_net, id, sizeof(id), netkey);
+  mesh_cmac(&site_t_app, id, sizeof(id), appkey);
+}
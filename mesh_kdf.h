@@ -0,0 +1,57 @@
+#ifndef _MESH_KDF_H
+#define _MESH_KDF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aes_block.h"
+
+/**
+ *  AES-CMAC (RFC 4493) and the key derivation functions of the Mesh Profile
+ *  specification (s1, k1, k2, k3, k4, section 3.8.2).
+ *
+ *  A CMAC key is prepared once with mesh_cmac_key(), which computes the two
+ *  subkeys (and on the host the expanded AES key), and can then be used for any
+ *  number of messages. The salts of k2, k3, k4 and of the site keys are fixed,
+ *  they are computed and prepared as CMAC keys on first use.
+ *
+ *  Site keys: the network and application key of a site are derived from a
+ *  master secret shared by all sites and the 32 bit site id, so that the keys
+ *  of any site can be recreated from the secret:
+ *    netkey = k1(secret, s1("site netkey"), site id)
+ *    appkey = k1(secret, s1("site appkey"), site id)
+ *  with the site id as 4 bytes, most significant first.
+ *
+ *  Built with AES_SOFTWARE the module runs on the host, tools/mesh_site_keys.c
+ *  uses it to list the keys and identifiers of a range of sites.
+ */
+
+#define MESH_KDF_KEY_LEN         16
+
+/* longest P of k2, the friendship credentials take 9 bytes */
+#define MESH_KDF_K2_P_MAX        16
+
+typedef struct {
+  tsAesKey aes;
+  uint8_t k1[AES_BLOCK_SIZE];
+  uint8_t k2[AES_BLOCK_SIZE];
+} tsCmacKey;
+
+void mesh_cmac_key(tsCmacKey *ck, const uint8_t *key);
+void mesh_cmac(const tsCmacKey *ck, const uint8_t *msg, size_t len, uint8_t *mac);
+
+void mesh_s1(const uint8_t *m, size_t len, uint8_t *salt);
+void mesh_k1(const uint8_t *n, size_t n_len, const uint8_t *salt, const uint8_t *p, size_t p_len, uint8_t *out);
+
+/* NID, encryption key and privacy key; p_len up to MESH_KDF_K2_P_MAX */
+void mesh_k2(const uint8_t *n, const uint8_t *p, size_t p_len, uint8_t *nid, uint8_t *enc_key, uint8_t *priv_key);
+
+/* 8 byte network ID */
+void mesh_k3(const uint8_t *n, uint8_t *network_id);
+
+/* 6 bit AID */
+uint8_t mesh_k4(const uint8_t *n);
+
+void mesh_site_keys(const uint8_t *secret, uint32_t site_id, uint8_t *netkey, uint8_t *appkey);
+
+#endif
@@ -0,0 +1,256 @@
+#include "node_db.h"
+
+#include <string.h>
+
+#include "native_gecko.h"
+
+/* hash indexes are kept at most half full to keep the probe sequences short */
+#define NODE_DB_INDEX_SIZE  (2 * NODE_DB_MAX_NODES + 1)
+
+tsNodeDB _sNodeDB;
+
+// slot numbers of the nodes, NODE_DB_INVALID marks an empty bucket
+static uint16_t addr_index[NODE_DB_INDEX_SIZE];
+static uint16_t uuid_index[NODE_DB_INDEX_SIZE];
+
+// local functions
+
+static uint32_t addr_hash(uint16_t address)
+{
+  return ((uint32_t)address * 40503u) % NODE_DB_INDEX_SIZE;
+}
+
+/* FNV-1a over the 16 byte UUID */
+static uint32_t uuid_hash(const uint8_t *uuid)
+{
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    h = (h ^ uuid[i]) * 16777619u;
+  }
+  return h % NODE_DB_INDEX_SIZE;
+}
+
+static uint32_t slot_hash(const uint16_t *index, uint16_t slot)
+{
+  if (index == addr_index) {
+    return addr_hash(_sNodeDB.address[slot]);
+  }
+  return uuid_hash(_sNodeDB.uuid[slot]);
+}
+
+static void index_insert(uint16_t *index, uint32_t bucket, uint16_t slot)
+{
+  while (index[bucket] != NODE_DB_INVALID) {
+    bucket = (bucket + 1) % NODE_DB_INDEX_SIZE;
+  }
+  index[bucket] = slot;
+}
+
+/* remove the bucket holding 'slot' and shift back the entries that probed past it */
+static void index_delete(uint16_t *index, uint32_t bucket, uint16_t slot)
+{
+  uint32_t hole, next, home;
+
+  while (index[bucket] != slot) {
+    bucket = (bucket + 1) % NODE_DB_INDEX_SIZE;
+  }
+
+  hole = bucket;
+  index[hole] = NODE_DB_INVALID;
+  next = (hole + 1) % NODE_DB_INDEX_SIZE;
+
+  while (index[next] != NODE_DB_INVALID) {
+    home = slot_hash(index, index[next]);
+    // move the entry if its home bucket is not within (hole, next]
+    if ((next > hole && (home <= hole || home > next))
+        || (next < hole && (home <= hole && home > next))) {
+      index[hole] = index[next];
+      index[next] = NODE_DB_INVALID;
+      hole = next;
+    }
+    next = (next + 1) % NODE_DB_INDEX_SIZE;
+  }
+}
+
+static void index_replace(uint16_t *index, uint32_t bucket, uint16_t old_slot, uint16_t new_slot)
+{
+  while (index[bucket] != old_slot) {
+    bucket = (bucket + 1) % NODE_DB_INDEX_SIZE;
+  }
+  index[bucket] = new_slot;
+}
+
+// public functions
+
+void node_db_init(void)
+{
+  memset(&_sNodeDB, 0, sizeof(_sNodeDB));
+  memset(addr_index, 0xFF, sizeof(addr_index));
+  memset(uuid_index, 0xFF, sizeof(uuid_index));
+}
+
+/**
+ * Start reading the stack DDB. Returns the number of devices the stack reported;
+ * the devices themselves are passed to node_db_handle_ddb_list() as the
+ * gecko_evt_mesh_prov_ddb_list events arrive.
+ */
+uint16_t node_db_load(void)
+{
+  struct gecko_msg_mesh_prov_ddb_list_devices_rsp_t *list_rsp;
+
+  node_db_init();
+
+  list_rsp = gecko_cmd_mesh_prov_ddb_list_devices();
+  if (list_rsp->result != 0) {
+    return 0;
+  }
+  return list_rsp->count;
+}
+
+void node_db_handle_ddb_list(const uint8_t *uuid, uint16_t address, uint8_t elements)
+{
+  uint16_t slot = node_db_add(uuid, address, elements);
+
+  if (slot != NODE_DB_INVALID) {
+    _sNodeDB.config_state[slot] = NODE_DB_CONFIG_UNKNOWN;
+  }
+}
+
+/**
+ * Add a node or update the existing entry with the same UUID.
+ * Returns the slot of the node or NODE_DB_INVALID if the table is full or
+ * the address belongs to another node.
+ */
+uint16_t node_db_add(const uint8_t *uuid, uint16_t address, uint8_t elements)
+{
+  uint16_t slot, owner;
+
+  slot = node_db_find_by_uuid(uuid);
+  owner = node_db_find_by_address(address);
+  if (owner != NODE_DB_INVALID && owner != slot) {
+    return NODE_DB_INVALID;
+  }
+
+  if (slot != NODE_DB_INVALID) {
+    // device was re-provisioned, possibly to a new address
+    if (_sNodeDB.address[slot] != address) {
+      index_delete(addr_index, addr_hash(_sNodeDB.address[slot]), slot);
+      _sNodeDB.address[slot] = address;
+      index_insert(addr_index, addr_hash(address), slot);
+    }
+  } else {
+    if (_sNodeDB.count >= NODE_DB_MAX_NODES) {
+      return NODE_DB_INVALID;
+    }
+    slot = _sNodeDB.count++;
+    _sNodeDB.address[slot] = address;
+    memcpy(_sNodeDB.uuid[slot], uuid, 16);
+    _sNodeDB.product_id[slot] = 0;
+    _sNodeDB.last_seen[slot] = 0;
+    _sNodeDB.kr_phase[slot] = NODE_DB_KR_NONE;
+    _sNodeDB.hb_min_hops[slot] = 0;
+    _sNodeDB.hb_max_hops[slot] = 0;
+    _sNodeDB.hb_missed[slot] = 0;
+    index_insert(addr_index, addr_hash(address), slot);
+    index_insert(uuid_index, uuid_hash(uuid), slot);
+  }
+
+  _sNodeDB.elements[slot] = elements;
+  _sNodeDB.config_state[slot] = NODE_DB_CONFIG_PENDING;
+  return slot;
+}
+
+/**
+ * Remove a node. The last slot is moved into the freed one so that the arrays
+ * stay dense.
+ */
+void node_db_remove(uint16_t address)
+{
+  uint16_t slot = node_db_find_by_address(address);
+  uint16_t last;
+
+  if (slot == NODE_DB_INVALID) {
+    return;
+  }
+
+  index_delete(addr_index, addr_hash(address), slot);
+  index_delete(uuid_index, uuid_hash(_sNodeDB.uuid[slot]), slot);
+
+  last = --_sNodeDB.count;
+  if (slot != last) {
+    index_replace(addr_index, addr_hash(_sNodeDB.address[last]), last, slot);
+    index_replace(uuid_index, uuid_hash(_sNodeDB.uuid[last]), last, slot);
+
+    _sNodeDB.address[slot] = _sNodeDB.address[last];
+    _sNodeDB.elements[slot] = _sNodeDB.elements[last];
+    _sNodeDB.config_state[slot] = _sNodeDB.config_state[last];
+    _sNodeDB.product_id[slot] = _sNodeDB.product_id[last];
+    _sNodeDB.last_seen[slot] = _sNodeDB.last_seen[last];
+    _sNodeDB.kr_phase[slot] = _sNodeDB.kr_phase[last];
+    _sNodeDB.hb_min_hops[slot] = _sNodeDB.hb_min_hops[last];
+    _sNodeDB.hb_max_hops[slot] = _sNodeDB.hb_max_hops[last];
+    _sNodeDB.hb_missed[slot] = _sNodeDB.hb_missed[last];
+    memcpy(_sNodeDB.uuid[slot], _sNodeDB.uuid[last], 16);
+  }
+}
+
+/* look up a node by its primary element address */
+uint16_t node_db_find_by_address(uint16_t address)
+{
+  uint32_t bucket = addr_hash(address);
+
+  while (addr_index[bucket] != NODE_DB_INVALID) {
+    if (_sNodeDB.address[addr_index[bucket]] == address) {
+      return addr_index[bucket];
+    }
+    bucket = (bucket + 1) % NODE_DB_INDEX_SIZE;
+  }
+  return NODE_DB_INVALID;
+}
+
+uint16_t node_db_find_by_uuid(const uint8_t *uuid)
+{
+  uint32_t bucket = uuid_hash(uuid);
+
+  while (uuid_index[bucket] != NODE_DB_INVALID) {
+    if (memcmp(_sNodeDB.uuid[uuid_index[bucket]], uuid, 16) == 0) {
+      return uuid_index[bucket];
+    }
+    bucket = (bucket + 1) % NODE_DB_INDEX_SIZE;
+  }
+  return NODE_DB_INVALID;
+}
+
+void node_db_set_dcd(uint16_t address, uint16_t product_id, uint8_t elements)
+{
+  uint16_t slot = node_db_find_by_address(address);
+
+  if (slot != NODE_DB_INVALID) {
+    _sNodeDB.product_id[slot] = product_id;
+    _sNodeDB.elements[slot] = elements;
+  }
+}
+
+void node_db_set_config_state(uint16_t address, uint8_t state)
+{
+  uint16_t slot = node_db_find_by_address(address);
+
+  if (slot != NODE_DB_INVALID) {
+    _sNodeDB.config_state[slot] = state;
+  }
+}
+
+/* record that a message from the node was received */
+void node_db_seen(uint16_t address)
+{
+  uint16_t slot = node_db_find_by_address(address);
+  uint32_t now;
+
+  if (slot != NODE_DB_INVALID) {
+    // 0 is kept for never
+    now = gecko_cmd_hardware_get_time()->seconds;
+    _sNodeDB.last_seen[slot] = now ? now : 1;
+  }
+}
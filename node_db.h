@@ -0,0 +1,69 @@
+#ifndef _NODE_DB_H
+#define _NODE_DB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mesh_app_memory_config.h"
+
+/**
+ *  Application-level table of provisioned nodes. It mirrors the device database
+ *  of the stack (which only holds UUID, address, element count and device key)
+ *  and adds the metadata learned while configuring the nodes.
+ *
+ *  The table is kept as a struct of arrays; nodes are referred to by slot index.
+ *  Lookup by unicast address or by UUID is done through hash indexes and does not
+ *  depend on the number of nodes.
+ */
+
+/* Number of nodes that fit in the table. By default the same as the stack DDB. */
+#ifndef NODE_DB_MAX_NODES
+#define NODE_DB_MAX_NODES   MESH_CFG_MAX_PROVISIONED_DEVICES
+#endif
+
+/* returned by the lookup functions when the node is not in the table */
+#define NODE_DB_INVALID     0xFFFF
+
+/* configuration state of a node */
+#define NODE_DB_CONFIG_UNKNOWN   0   /* restored from DDB, state not known   */
+#define NODE_DB_CONFIG_PENDING   1   /* provisioned, configuration not done  */
+#define NODE_DB_CONFIG_DONE      2   /* configuration completed              */
+#define NODE_DB_CONFIG_FAILED    3   /* configuration gave up                */
+
+/* key refresh phase a node has confirmed, see key_refresh */
+#define NODE_DB_KR_NONE          0   /* old keys only                        */
+#define NODE_DB_KR_FAILED        0xFF /* left out of the key refresh         */
+
+typedef struct {
+  uint16_t count;
+  uint16_t address[NODE_DB_MAX_NODES];
+  uint8_t elements[NODE_DB_MAX_NODES];
+  uint8_t config_state[NODE_DB_MAX_NODES];
+  uint16_t product_id[NODE_DB_MAX_NODES];
+  uint32_t last_seen[NODE_DB_MAX_NODES];   /* seconds since boot, 0 = never */
+  uint8_t kr_phase[NODE_DB_MAX_NODES];     /* key refresh phase, 1 to 3 or NODE_DB_KR_* */
+  uint8_t hb_min_hops[NODE_DB_MAX_NODES];  /* hop range of the heartbeats heard, 0 = none yet, see liveness */
+  uint8_t hb_max_hops[NODE_DB_MAX_NODES];
+  uint16_t hb_missed[NODE_DB_MAX_NODES];   /* heartbeat periods missed since the last one */
+  uint8_t uuid[NODE_DB_MAX_NODES][16];
+} tsNodeDB;
+
+extern tsNodeDB _sNodeDB;
+
+void node_db_init(void);
+
+/* Rebuild the table from the stack DDB. Entries arrive as gecko_evt_mesh_prov_ddb_list events. */
+uint16_t node_db_load(void);
+void node_db_handle_ddb_list(const uint8_t *uuid, uint16_t address, uint8_t elements);
+
+uint16_t node_db_add(const uint8_t *uuid, uint16_t address, uint8_t elements);
+void node_db_remove(uint16_t address);
+
+uint16_t node_db_find_by_address(uint16_t address);
+uint16_t node_db_find_by_uuid(const uint8_t *uuid);
+
+void node_db_set_dcd(uint16_t address, uint16_t product_id, uint8_t elements);
+void node_db_set_config_state(uint16_t address, uint8_t state);
+void node_db_seen(uint16_t address);
+
+#endif
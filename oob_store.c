@@ -0,0 +1,578 @@
+#include "oob_store.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "native_gecko.h"
+#include "flash_cache.h"
+#include "p256.h"
+
+#define SECTOR_SIZE          0x1000
+#define SECTOR_ENTRIES       (SECTOR_SIZE / OOB_STORE_ENTRY_SIZE)
+#define NUM_SLOTS            (OOB_STORE_NUM_SECTORS * SECTOR_ENTRIES)
+#define ENTRY_MAGIC          0x5A
+#define ENTRY_DEAD           0x00
+
+/* offsets in a flash entry */
+#define OFF_MAGIC            0
+#define OFF_FLAGS            1
+#define OFF_GEN              2
+#define OFF_UUID             4
+#define OFF_STATIC           20
+#define OFF_PUBLIC_KEY       36
+#define HEADER_SIZE          OFF_STATIC
+
+/* the index is kept at most half full to keep the probe sequences short */
+#define INDEX_SIZE           (2 * OOB_STORE_MAX_ENTRIES + 1)
+#define INDEX_EMPTY          0xFFFF
+
+/* longest import line: UUID, static OOB value and public key with separators */
+#define IMPORT_LINE_MAX      (32 + 1 + 32 + 1 + 128 + 8)
+
+/* state of an entry slot */
+#define SLOT_FREE            0
+#define SLOT_LIVE            1
+#define SLOT_DEAD            2      /* replaced, moved or torn, freed when its sector is erased */
+
+static uint16_t index_entry[INDEX_SIZE];
+static uint8_t slot_state[NUM_SLOTS];
+static tsOobStoreStats stats;
+
+static struct {
+  char line[IMPORT_LINE_MAX];
+  uint8_t len;
+  uint8_t overflow;
+  uint32_t bytes;
+  uint16_t chunk_bytes;
+  uint16_t lines;
+  uint16_t added;
+  uint16_t errors;
+} import;
+
+// local functions
+
+static uint32_t time_ms(void)
+{
+  struct gecko_msg_hardware_get_time_rsp_t *t = gecko_cmd_hardware_get_time();
+  return t->seconds * 1000 + ((uint32_t)t->ticks * 1000) / 32768;
+}
+
+static uint32_t entry_addr(uint16_t entry)
+{
+  return OOB_STORE_BASE_ADDR + (uint32_t)entry * OOB_STORE_ENTRY_SIZE;
+}
+
+/* FNV-1a over the 16 byte UUID */
+static uint32_t uuid_hash(const uint8_t *uuid)
+{
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    h = (h ^ uuid[i]) * 16777619u;
+  }
+  return h % INDEX_SIZE;
+}
+
+/* bucket holding the UUID, or the empty bucket where it would go */
+static uint32_t index_find(const uint8_t *uuid)
+{
+  uint32_t bucket = uuid_hash(uuid);
+  uint8_t stored[16];
+
+  while (index_entry[bucket] != INDEX_EMPTY) {
+    if (flash_cache_read(entry_addr(index_entry[bucket]) + OFF_UUID, stored, 16) == bg_err_success
+        && memcmp(stored, uuid, 16) == 0) {
+      break;
+    }
+    bucket = (bucket + 1) % INDEX_SIZE;
+  }
+  return bucket;
+}
+
+static void index_set(const uint8_t *uuid, uint16_t entry)
+{
+  uint32_t bucket = index_find(uuid);
+
+  if (index_entry[bucket] == INDEX_EMPTY) {
+    stats.entries++;
+  }
+  index_entry[bucket] = entry;
+}
+
+/* generation of an entry, 0 to 2; entries of the production programmer have 0xFF */
+static uint8_t entry_gen(uint8_t gen)
+{
+  return gen == 0xFF ? 0 : gen % 3;
+}
+
+/* a replacement is one generation ahead of the entry it replaces */
+static int replaces(uint8_t gen, uint8_t old_gen)
+{
+  return entry_gen(gen) == (entry_gen(old_gen) + 1) % 3;
+}
+
+static uint16_t free_slots(void)
+{
+  uint16_t slot, n = 0;
+
+  for (slot = 0; slot < NUM_SLOTS; slot++) {
+    n += slot_state[slot] == SLOT_FREE;
+  }
+  return n;
+}
+
+/* the first free slot outside of sector 'skip', NUM_SLOTS if none */
+static uint16_t free_slot(uint16_t skip)
+{
+  uint16_t slot;
+
+  for (slot = 0; slot < NUM_SLOTS; slot++) {
+    if (slot_state[slot] == SLOT_FREE && slot / SECTOR_ENTRIES != skip) {
+      return slot;
+    }
+  }
+  return NUM_SLOTS;
+}
+
+/* Program an entry. The magic byte is programmed last, so that an entry is only
+ * taken as valid once it has been written completely. */
+static errorcode_t write_slot(uint16_t slot, uint8_t *buf)
+{
+  uint8_t magic = ENTRY_MAGIC;
+  errorcode_t res;
+
+  buf[OFF_MAGIC] = 0xFF;
+  res = flash_cache_program(entry_addr(slot), buf, OOB_STORE_ENTRY_SIZE);
+  if (res == bg_err_success) {
+    res = flash_cache_program(entry_addr(slot) + OFF_MAGIC, &magic, 1);
+  }
+  // the slot is used even if programming failed half way
+  slot_state[slot] = res == bg_err_success ? SLOT_LIVE : SLOT_DEAD;
+  return res;
+}
+
+/* clear the magic byte, a NOR flash can do that without an erase */
+static errorcode_t kill_slot(uint16_t slot)
+{
+  uint8_t dead = ENTRY_DEAD;
+
+  slot_state[slot] = SLOT_DEAD;
+  return flash_cache_program(entry_addr(slot) + OFF_MAGIC, &dead, 1);
+}
+
+/* Move the live entries out of the sector with the most dead ones that the
+ * other sectors have room for and return it, NUM_SLOTS if there is none.
+ * Moved entries are copied before the original is killed, a reset in between
+ * leaves two copies that are the same. */
+static uint16_t compact(void)
+{
+  uint8_t buf[OOB_STORE_ENTRY_SIZE];
+  uint16_t sector, slot, to, best = NUM_SLOTS, best_dead = 0;
+  uint16_t total_free = free_slots(), live, dead, free_inside;
+
+  for (sector = 0; sector < OOB_STORE_NUM_SECTORS; sector++) {
+    live = dead = free_inside = 0;
+    for (slot = sector * SECTOR_ENTRIES; slot < (sector + 1) * SECTOR_ENTRIES; slot++) {
+      live += slot_state[slot] == SLOT_LIVE;
+      dead += slot_state[slot] == SLOT_DEAD;
+      free_inside += slot_state[slot] == SLOT_FREE;
+    }
+    if (dead > best_dead && live <= total_free - free_inside) {
+      best = sector;
+      best_dead = dead;
+    }
+  }
+  if (best == NUM_SLOTS) {
+    return NUM_SLOTS;
+  }
+
+  for (slot = best * SECTOR_ENTRIES; slot < (best + 1) * SECTOR_ENTRIES; slot++) {
+    if (slot_state[slot] != SLOT_LIVE) {
+      continue;
+    }
+    to = free_slot(best);
+    if (flash_cache_read(entry_addr(slot), buf, sizeof(buf)) != bg_err_success || write_slot(to, buf) != bg_err_success) {
+      return NUM_SLOTS;
+    }
+    index_entry[index_find(buf + OFF_UUID)] = to;
+    kill_slot(slot);
+  }
+  stats.compactions++;
+  return best;
+}
+
+static errorcode_t erase_sector(uint16_t sector)
+{
+  errorcode_t res = flash_cache_erase_sector(OOB_STORE_BASE_ADDR + (uint32_t)sector * SECTOR_SIZE);
+
+  if (res == bg_err_success) {
+    memset(&slot_state[sector * SECTOR_ENTRIES], SLOT_FREE, SECTOR_ENTRIES);
+  }
+  return res;
+}
+
+static int is_erased(const uint8_t *data, uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < len; i++) {
+    if (data[i] != 0xFF) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* parse 2*len hex digits, dashes (as in UUIDs) are skipped */
+static int parse_hex(const char *s, uint32_t s_len, uint8_t *out, uint32_t len)
+{
+  uint32_t n = 0, i;
+  uint8_t v;
+  char c;
+
+  memset(out, 0, len);
+  for (i = 0; i < s_len; i++) {
+    c = s[i];
+    if (c == '-') {
+      continue;
+    }
+    if (c >= '0' && c <= '9') {
+      v = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      v = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      v = c - 'A' + 10;
+    } else {
+      return -1;
+    }
+    if (n >= 2 * len) {
+      return -1;
+    }
+    out[n / 2] |= (n & 1) ? v : (v << 4);
+    n++;
+  }
+  return n == 2 * len ? 0 : -1;
+}
+
+/* "<uuid>,<static OOB>,<public key>", returns an error message or NULL */
+static const char *import_line(const char *line, uint8_t len)
+{
+  const char *field[3];
+  uint8_t field_len[3];
+  tsOobEntry entry;
+  uint8_t i, n = 0;
+
+  field[0] = line;
+  for (i = 0; i <= len && n < 3; i++) {
+    if (i == len || line[i] == ',') {
+      field_len[n] = (uint8_t)(line + i - field[n]);
+      if (++n < 3) {
+        field[n] = line + i + 1;
+      }
+    }
+  }
+  if (n != 3) {
+    return "expected uuid,static,public key";
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  if (parse_hex(field[0], field_len[0], entry.uuid, sizeof(entry.uuid))) {
+    return "bad uuid";
+  }
+  if (field_len[1]) {
+    if (parse_hex(field[1], field_len[1], entry.static_oob, sizeof(entry.static_oob))) {
+      return "bad static oob value";
+    }
+    entry.flags |= OOB_STORE_STATIC;
+  }
+  if (field_len[2]) {
+    if (parse_hex(field[2], field_len[2], entry.public_key, sizeof(entry.public_key))
+        || p256_check_public_key(entry.public_key) != bg_err_success) {
+      return "bad public key";
+    }
+    entry.flags |= OOB_STORE_PUBLIC_KEY;
+  }
+  if (!entry.flags) {
+    return "no oob data";
+  }
+
+  if (oob_store_add(&entry) != bg_err_success) {
+    return "table full";
+  }
+  import.added++;
+  return NULL;
+}
+
+static void print_uuid(const uint8_t *uuid)
+{
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    printf("%2.2x", uuid[i]);
+  }
+}
+
+// public functions
+
+/**
+ * Scan the table and build the index. An entry without the magic byte was
+ * replaced, or torn by a reset while it was written, and is skipped. A reset
+ * can also leave two valid entries of a UUID: a replacement whose old entry
+ * was not killed yet, which is one generation ahead, or two equal copies of
+ * a compaction.
+ */
+errorcode_t oob_store_mount(void)
+{
+  uint8_t header[OOB_STORE_ENTRY_SIZE];
+  uint8_t old_gen;
+  uint32_t start_ms = time_ms();
+  uint32_t bucket;
+  uint16_t slot;
+  errorcode_t res;
+
+  memset(index_entry, 0xFF, sizeof(index_entry));
+  memset(slot_state, SLOT_FREE, sizeof(slot_state));
+  memset(&stats, 0, sizeof(stats));
+
+  for (slot = 0; slot < NUM_SLOTS; slot++) {
+    res = flash_cache_read(entry_addr(slot), header, HEADER_SIZE);
+    if (res != bg_err_success) {
+      return res;
+    }
+    // a slot is only free if all of it is, an erase may have been cut short
+    if (is_erased(header, HEADER_SIZE)) {
+      res = flash_cache_read(entry_addr(slot), header, sizeof(header));
+      if (res != bg_err_success) {
+        return res;
+      }
+      if (is_erased(header, sizeof(header))) {
+        continue;
+      }
+    }
+    slot_state[slot] = SLOT_DEAD;
+    if (header[OFF_MAGIC] != ENTRY_MAGIC) {
+      continue;
+    }
+    bucket = index_find(header + OFF_UUID);
+    if (index_entry[bucket] != INDEX_EMPTY) {
+      res = flash_cache_read(entry_addr(index_entry[bucket]) + OFF_GEN, &old_gen, 1);
+      if (res != bg_err_success) {
+        return res;
+      }
+      // the loser is killed, left valid it could win against a later generation
+      if (!replaces(header[OFF_GEN], old_gen)) {
+        kill_slot(slot);
+        continue;
+      }
+      kill_slot(index_entry[bucket]);
+    }
+    index_set(header + OFF_UUID, slot);
+    slot_state[slot] = SLOT_LIVE;
+  }
+
+  stats.mount_ms = time_ms() - start_ms;
+  return bg_err_success;
+}
+
+errorcode_t oob_store_clear(void)
+{
+  uint32_t sector;
+  errorcode_t res;
+
+  for (sector = 0; sector < OOB_STORE_NUM_SECTORS; sector++) {
+    res = flash_cache_erase_sector(OOB_STORE_BASE_ADDR + sector * SECTOR_SIZE);
+    if (res != bg_err_success) {
+      return res;
+    }
+  }
+  return oob_store_mount();
+}
+
+/* Write an entry to a free slot and kill the one it replaces. A sector's
+ * worth of slots is kept free, so that compaction has room for the live
+ * entries of a sector, and the second spare sector makes sure there are
+ * dead entries to compact when that many are not free. */
+errorcode_t oob_store_add(const tsOobEntry *entry)
+{
+  uint8_t buf[OOB_STORE_ENTRY_SIZE];
+  uint8_t old_gen = 0xFF;
+  uint16_t old, slot, victim;
+  errorcode_t res;
+
+  old = index_entry[index_find(entry->uuid)];
+  if (old == INDEX_EMPTY && stats.entries >= OOB_STORE_MAX_ENTRIES) {
+    return bg_err_out_of_memory;
+  }
+
+  while (free_slots() <= SECTOR_ENTRIES) {
+    victim = compact();
+    if (victim == NUM_SLOTS) {
+      return bg_err_out_of_memory;
+    }
+    res = erase_sector(victim);
+    if (res != bg_err_success) {
+      return res;
+    }
+  }
+  // looked up again, compaction may have moved the entry
+  old = index_entry[index_find(entry->uuid)];
+  slot = free_slot(NUM_SLOTS);
+
+  memset(buf, 0xFF, sizeof(buf));
+  if (old != INDEX_EMPTY) {
+    res = flash_cache_read(entry_addr(old) + OFF_GEN, &old_gen, 1);
+    if (res != bg_err_success) {
+      return res;
+    }
+    buf[OFF_GEN] = (entry_gen(old_gen) + 1) % 3;
+  }
+  buf[OFF_FLAGS] = entry->flags;
+  memcpy(buf + OFF_UUID, entry->uuid, 16);
+  memcpy(buf + OFF_STATIC, entry->static_oob, 16);
+  memcpy(buf + OFF_PUBLIC_KEY, entry->public_key, 64);
+
+  res = write_slot(slot, buf);
+  if (res != bg_err_success) {
+    return res;
+  }
+  index_set(entry->uuid, slot);
+  if (old != INDEX_EMPTY) {
+    kill_slot(old);
+  }
+  return bg_err_success;
+}
+
+int oob_store_find(const uint8_t *uuid, tsOobEntry *entry)
+{
+  uint8_t buf[OFF_PUBLIC_KEY + 64];
+  uint32_t bucket = index_find(uuid);
+
+  if (index_entry[bucket] == INDEX_EMPTY
+      || flash_cache_read(entry_addr(index_entry[bucket]), buf, sizeof(buf)) != bg_err_success) {
+    return 0;
+  }
+
+  entry->flags = buf[OFF_FLAGS];
+  memcpy(entry->uuid, buf + OFF_UUID, 16);
+  memcpy(entry->static_oob, buf + OFF_STATIC, 16);
+  memcpy(entry->public_key, buf + OFF_PUBLIC_KEY, 64);
+  return 1;
+}
+
+void oob_store_set_requirements(void)
+{
+  uint16_t res;
+
+  if (stats.entries == 0) {
+    res = gecko_cmd_mesh_prov_set_oob_requirements(OOB_PKEY_NONE, OOB_AUTH_NONE, 0, 0, 0, 0)->result;
+  } else {
+    res = gecko_cmd_mesh_prov_set_oob_requirements(OOB_PKEY_NONE | OOB_PKEY_OOB,
+        OOB_AUTH_STATIC | (OOB_STORE_ALLOW_NO_AUTH ? OOB_AUTH_NONE : 0), 0, 0, 0, 0)->result;
+  }
+  if (res) {
+    printf("oob requirements not set, code %x\r\n", res);
+  }
+}
+
+void oob_store_handle_pkey_request(const uint8_t *uuid)
+{
+  tsOobEntry entry;
+  uint16_t res;
+
+  if (!oob_store_find(uuid, &entry) || !(entry.flags & OOB_STORE_PUBLIC_KEY)) {
+    stats.misses++;
+    printf("no oob public key for ");
+    print_uuid(uuid);
+    printf("\r\n");
+    return;
+  }
+
+  stats.hits++;
+  res = gecko_cmd_mesh_prov_oob_pkey_rsp(sizeof(entry.public_key), entry.public_key)->result;
+  if (res) {
+    printf("oob public key response failed, code %x\r\n", res);
+  }
+}
+
+void oob_store_handle_auth_request(uint8_t output, const uint8_t *uuid)
+{
+  tsOobEntry entry;
+  uint16_t res;
+
+  // output OOB shows the value on the device, only static values are in the table
+  if (output || !oob_store_find(uuid, &entry) || !(entry.flags & OOB_STORE_STATIC)) {
+    stats.misses++;
+    printf("no static oob value for ");
+    print_uuid(uuid);
+    printf("\r\n");
+    return;
+  }
+
+  stats.hits++;
+  res = gecko_cmd_mesh_prov_oob_auth_rsp(sizeof(entry.static_oob), entry.static_oob)->result;
+  memset(&entry, 0, sizeof(entry));
+  if (res) {
+    printf("oob auth response failed, code %x\r\n", res);
+  }
+}
+
+void oob_store_import_start(void)
+{
+  memset(&import, 0, sizeof(import));
+  printf("@oob ready\r\n");
+}
+
+int oob_store_import_char(char c)
+{
+  const char *error = NULL;
+  int done = 0;
+
+  import.bytes++;
+
+  if (c == '\r' || c == '\n') {
+    if (import.overflow) {
+      error = "line too long";
+    } else if (import.len == 3 && !memcmp(import.line, "end", 3)) {
+      done = 1;
+    } else if (import.len) {
+      error = import_line(import.line, import.len);
+    }
+    if (import.len || import.overflow) {
+      import.lines++;
+    }
+    if (error) {
+      import.errors++;
+      printf("@oob error %u %s\r\n", import.lines, error);
+    }
+    import.len = 0;
+    import.overflow = 0;
+  } else if (import.len < IMPORT_LINE_MAX) {
+    import.line[import.len++] = c;
+  } else {
+    import.overflow = 1;
+  }
+
+  if (done) {
+    printf("@oob done %u added, %u errors, %u devices\r\n", import.added, import.errors, stats.entries);
+    oob_store_set_requirements();
+    return 1;
+  }
+
+  if (++import.chunk_bytes == OOB_STORE_IMPORT_CHUNK) {
+    import.chunk_bytes = 0;
+    printf("@oob ack %lu\r\n", (unsigned long) import.bytes);
+  }
+  return 0;
+}
+
+void oob_store_get_stats(tsOobStoreStats *s)
+{
+  uint16_t slot;
+
+  *s = stats;
+  s->used = 0;
+  for (slot = 0; slot < NUM_SLOTS; slot++) {
+    s->used += slot_state[slot] != SLOT_FREE;
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef _OOB_STORE_H
+#define _OOB_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+#include "record_store.h"
+
+/**
+ *  Table of the out of band provisioning data of devices, by device UUID: the
+ *  16 byte static OOB authentication value and the 64 byte public key.
+ *
+ *  The entries are kept in their own area of the external flash, in slots of
+ *  OOB_STORE_ENTRY_SIZE bytes. Adding a UUID again writes a new entry one
+ *  generation ahead and kills the old one by clearing its magic byte. When
+ *  fewer than a sector's worth of slots are free, the live entries of the
+ *  sector with the most dead ones are moved and the sector is erased; the
+ *  table has two sectors more than OOB_STORE_MAX_ENTRIES needs for that. A RAM
+ *  hash index from UUID to entry is built by oob_store_mount(), so the OOB
+ *  requests of the stack are answered right away with one flash read, without
+ *  asking the host. The area can also be written by a production programmer,
+ *  entry layout:
+ *    0 magic (0x5A, written last, 0x00 once dead), 1 flags,
+ *    2 generation (0 to 2, 0xFF taken as 0), 3 0xFF, 4-19 UUID,
+ *    20-35 static OOB value, 36-99 public key (X, Y big endian), rest 0xFF
+ *
+ *  The table is loaded over the UART with the "oob import" command: a stream
+ *  of lines "<uuid>,<static OOB>,<public key>" in hex, either value may be
+ *  empty, ended by a line "end". Like the CDB import the host sends chunks of
+ *  OOB_STORE_IMPORT_CHUNK bytes and waits for "@oob ack <bytes>" after each.
+ *  Public keys are checked to be on the curve before they are stored.
+ *  "oob clear" erases the table.
+ *
+ *  While the table is not empty the provisioner requires static OOB
+ *  authentication (and allows OOB public keys), see oob_store_set_requirements().
+ */
+
+/* first byte of the table in the external flash, after the record store */
+#ifndef OOB_STORE_BASE_ADDR
+#define OOB_STORE_BASE_ADDR      (REC_STORE_BASE_ADDR + REC_STORE_NUM_SEGMENTS * REC_STORE_SEGMENT_SIZE)
+#endif
+
+/* size of the table in 4 kB sectors, 32 entries per sector and two spare sectors */
+#ifndef OOB_STORE_NUM_SECTORS
+#define OOB_STORE_NUM_SECTORS    34
+#endif
+
+/* provision devices without OOB authentication too, when the table is not empty */
+#ifndef OOB_STORE_ALLOW_NO_AUTH
+#define OOB_STORE_ALLOW_NO_AUTH  0
+#endif
+
+/* import chunk size, must fit in the receive buffer of the UART driver (RXBUFSIZE) */
+#ifndef OOB_STORE_IMPORT_CHUNK
+#define OOB_STORE_IMPORT_CHUNK   64
+#endif
+
+#define OOB_STORE_ENTRY_SIZE     128
+#define OOB_STORE_MAX_ENTRIES    ((OOB_STORE_NUM_SECTORS - 2) * 0x1000 / OOB_STORE_ENTRY_SIZE)
+
+/* flags of an entry */
+#define OOB_STORE_STATIC         0x01
+#define OOB_STORE_PUBLIC_KEY     0x02
+
+/* OOB requirement bitmaps of gecko_cmd_mesh_prov_set_oob_requirements */
+#define OOB_PKEY_NONE            0x01
+#define OOB_PKEY_OOB             0x02
+#define OOB_AUTH_NONE            0x01
+#define OOB_AUTH_STATIC          0x02
+
+typedef struct {
+  uint8_t flags;
+  uint8_t uuid[16];
+  uint8_t static_oob[16];
+  uint8_t public_key[64];
+} tsOobEntry;
+
+typedef struct {
+  uint16_t entries;           /* distinct UUIDs */
+  uint16_t used;              /* entry slots written, including dead ones */
+  uint32_t hits;              /* OOB requests answered */
+  uint32_t misses;            /* OOB requests for unknown devices */
+  uint32_t compactions;       /* sectors erased to make room */
+  uint32_t mount_ms;
+} tsOobStoreStats;
+
+errorcode_t oob_store_mount(void);
+errorcode_t oob_store_clear(void);
+errorcode_t oob_store_add(const tsOobEntry *entry);
+
+/* Returns nonzero and fills entry if the UUID is in the table. */
+int oob_store_find(const uint8_t *uuid, tsOobEntry *entry);
+
+/* Set the OOB requirements of the provisioner according to the table. Call
+ * when the provisioner has been initialized. */
+void oob_store_set_requirements(void);
+
+/* gecko_evt_mesh_prov_oob_pkey_request and gecko_evt_mesh_prov_oob_auth_request */
+void oob_store_handle_pkey_request(const uint8_t *uuid);
+void oob_store_handle_auth_request(uint8_t output, const uint8_t *uuid);
+
+/* "oob import": feed the following UART input to oob_store_import_char() until
+ * it returns nonzero */
+void oob_store_import_start(void);
+int oob_store_import_char(char c);
+
+void oob_store_get_stats(tsOobStoreStats *stats);
+
+#endif
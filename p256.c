@@ -0,0 +1,590 @@
+#include "p256.h"
+
+#include <string.h>
+
+#ifndef P256_SOFTWARE
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_crypto.h"
+#include "aes_dma.h"
+#endif
+
+#define WORDS       8
+
+/* numbers are 8 words of 32 bits, least significant word first */
+
+typedef struct {
+  uint32_t x[WORDS];
+  uint32_t y[WORDS];
+  uint32_t z[WORDS];
+} tsPoint;
+
+static const uint32_t curve_p[WORDS] = {
+  0xffffffff, 0xffffffff, 0xffffffff, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xffffffff
+};
+
+static const uint32_t curve_n[WORDS] = {
+  0xfc632551, 0xf3b9cac2, 0xa7179e84, 0xbce6faad, 0xffffffff, 0xffffffff, 0x00000000, 0xffffffff
+};
+
+static const uint32_t curve_b[WORDS] = {
+  0x27d2604b, 0x3bce3c3e, 0xcc53b0f6, 0x651d06b0, 0x769886bc, 0xb3ebbd55, 0xaa3a93e7, 0x5ac635d8
+};
+
+static const uint32_t curve_gx[WORDS] = {
+  0xd898c296, 0xf4a13945, 0x2deb33a0, 0x77037d81, 0x63a440f2, 0xf8bce6e5, 0xe12c4247, 0x6b17d1f2
+};
+
+static const uint32_t curve_gy[WORDS] = {
+  0x37bf51f5, 0xcbb64068, 0x6b315ece, 0x2bce3357, 0x7c0f9e16, 0x8ee7eb4a, 0xfe1a7f9b, 0x4fe342e2
+};
+
+// local functions
+
+static void from_bytes(uint32_t *r, const uint8_t *in)
+{
+  int i;
+
+  for (i = 0; i < WORDS; i++) {
+    const uint8_t *b = in + 4 * (WORDS - 1 - i);
+    r[i] = (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16 | (uint32_t) b[2] << 8 | b[3];
+  }
+}
+
+static void to_bytes(uint8_t *out, const uint32_t *a)
+{
+  int i;
+
+  for (i = 0; i < WORDS; i++) {
+    uint8_t *b = out + 4 * (WORDS - 1 - i);
+    b[0] = (uint8_t)(a[i] >> 24);
+    b[1] = (uint8_t)(a[i] >> 16);
+    b[2] = (uint8_t)(a[i] >> 8);
+    b[3] = (uint8_t) a[i];
+  }
+}
+
+static int bn_cmp(const uint32_t *a, const uint32_t *b)
+{
+  int i;
+
+  for (i = WORDS - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return (a[i] > b[i]) ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+static int bn_is_zero(const uint32_t *a)
+{
+  uint32_t bits = 0;
+  int i;
+
+  for (i = 0; i < WORDS; i++) {
+    bits |= a[i];
+  }
+  return bits == 0;
+}
+
+/* r = a + b, returns the carry */
+static uint32_t bn_add(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  uint64_t t = 0;
+  int i;
+
+  for (i = 0; i < WORDS; i++) {
+    t += (uint64_t) a[i] + b[i];
+    r[i] = (uint32_t) t;
+    t >>= 32;
+  }
+  return (uint32_t) t;
+}
+
+/* r = a - b, returns the borrow */
+static uint32_t bn_sub(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  int64_t t = 0;
+  int i;
+
+  for (i = 0; i < WORDS; i++) {
+    t += (int64_t) a[i] - b[i];
+    r[i] = (uint32_t) t;
+    t >>= 32;
+  }
+  return (uint32_t)(-t);
+}
+
+/* field arithmetic modulo p, all inputs and outputs are reduced */
+
+static void fe_add(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  if (bn_add(r, a, b) || bn_cmp(r, curve_p) >= 0) {
+    bn_sub(r, r, curve_p);
+  }
+}
+
+static void fe_sub(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  if (bn_sub(r, a, b)) {
+    bn_add(r, r, curve_p);
+  }
+}
+
+/* software multiplication: schoolbook product, then the fast reduction of
+ * FIPS 186-4, appendix D.2.3, which folds the upper half back with the sums
+ * s1 + 2 s2 + 2 s3 + s4 + s5 - s6 - s7 - s8 - s9 */
+static void fe_mul_sw(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  uint32_t c[2 * WORDS];
+  int64_t t[WORDS], carry;
+  uint64_t acc;
+  int i, j;
+
+  memset(c, 0, sizeof(c));
+  for (i = 0; i < WORDS; i++) {
+    acc = 0;
+    for (j = 0; j < WORDS; j++) {
+      acc += (uint64_t) a[i] * b[j] + c[i + j];
+      c[i + j] = (uint32_t) acc;
+      acc >>= 32;
+    }
+    c[i + WORDS] = (uint32_t) acc;
+  }
+
+  t[0] = (int64_t) c[0] + c[8] + c[9] - c[11] - c[12] - c[13] - c[14];
+  t[1] = (int64_t) c[1] + c[9] + c[10] - c[12] - c[13] - c[14] - c[15];
+  t[2] = (int64_t) c[2] + c[10] + c[11] - c[13] - c[14] - c[15];
+  t[3] = (int64_t) c[3] + 2 * (int64_t) c[11] + 2 * (int64_t) c[12] + c[13] - c[15] - c[8] - c[9];
+  t[4] = (int64_t) c[4] + 2 * (int64_t) c[12] + 2 * (int64_t) c[13] + c[14] - c[9] - c[10];
+  t[5] = (int64_t) c[5] + 2 * (int64_t) c[13] + 2 * (int64_t) c[14] + c[15] - c[10] - c[11];
+  t[6] = (int64_t) c[6] + 3 * (int64_t) c[14] + 2 * (int64_t) c[15] + c[13] - c[8] - c[9];
+  t[7] = (int64_t) c[7] + 3 * (int64_t) c[15] + c[8] - c[10] - c[11] - c[12] - c[13];
+
+  carry = 0;
+  for (i = 0; i < WORDS; i++) {
+    carry += t[i];
+    r[i] = (uint32_t) carry;
+    carry >>= 32;
+  }
+
+  /* the sum is within a few multiples of p */
+  while (carry < 0) {
+    carry += bn_add(r, r, curve_p);
+  }
+  while (carry > 0 || bn_cmp(r, curve_p) >= 0) {
+    carry -= bn_sub(r, r, curve_p);
+  }
+}
+
+#ifndef P256_SOFTWARE
+
+/* hardware multiplication: MMUL with the P-256 modulus, operands in DDATA1
+ * and DDATA2, product in DDATA0 */
+
+static void crypto_setup(void)
+{
+  CRYPTO_TypeDef *crypto = P256_CRYPTO;
+
+  CMU_ClockEnable(P256_CRYPTO_CLOCK, true);
+
+  crypto->CTRL = 0;
+  crypto->WAC = 0;
+  crypto->SEQCTRL = 0;
+  crypto->SEQCTRLB = 0;
+  CRYPTO_ModulusSet(crypto, cryptoModulusEccP256);
+  CRYPTO_MulOperandWidthSet(crypto, cryptoMulOperandModulusBits);
+  CRYPTO_ResultWidthSet(crypto, cryptoResult256Bits);
+}
+
+static void fe_mul_hw(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  CRYPTO_TypeDef *crypto = P256_CRYPTO;
+
+  CRYPTO_DDataWrite(&crypto->DDATA1, a);
+  if (a == b) {
+    CRYPTO_EXECUTE_2(crypto, CRYPTO_CMD_INSTR_SELDDATA1DDATA1, CRYPTO_CMD_INSTR_MMUL);
+  } else {
+    CRYPTO_DDataWrite(&crypto->DDATA2, b);
+    CRYPTO_EXECUTE_2(crypto, CRYPTO_CMD_INSTR_SELDDATA1DDATA2, CRYPTO_CMD_INSTR_MMUL);
+  }
+  CRYPTO_InstructionSequenceWait(crypto);
+  CRYPTO_DDataRead(&crypto->DDATA0, r);
+}
+
+#ifdef CRYPTO_BENCHMARK
+static uint8_t use_software;
+
+void p256_use_software(uint8_t on)
+{
+  use_software = on;
+}
+
+static void fe_mul(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  if (use_software) {
+    fe_mul_sw(r, a, b);
+  } else {
+    fe_mul_hw(r, a, b);
+  }
+}
+#else
+#define fe_mul      fe_mul_hw
+#endif
+
+static errorcode_t begin(void)
+{
+  if (aes_dma_busy()) {
+    return bg_err_wrong_state;
+  }
+  crypto_setup();
+  return bg_err_success;
+}
+
+#else
+
+#define fe_mul      fe_mul_sw
+
+static errorcode_t begin(void)
+{
+  return bg_err_success;
+}
+
+#endif
+
+static void fe_sqr(uint32_t *r, const uint32_t *a)
+{
+  fe_mul(r, a, a);
+}
+
+/* r = a^(p - 2) = 1 / a */
+static void fe_inv(uint32_t *r, const uint32_t *a)
+{
+  static const uint32_t p_minus_2[WORDS] = {
+    0xfffffffd, 0xffffffff, 0xffffffff, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xffffffff
+  };
+  uint32_t x[WORDS];
+  int i;
+
+  memcpy(x, a, sizeof(x));
+  for (i = 254; i >= 0; i--) {
+    fe_sqr(x, x);
+    if ((p_minus_2[i / 32] >> (i % 32)) & 1) {
+      fe_mul(x, x, a);
+    }
+  }
+  memcpy(r, x, sizeof(x));
+}
+
+/* Jacobian coordinates, (X, Y, Z) is (X / Z^2, Y / Z^3); a = -3 */
+
+static void point_double(tsPoint *r, const tsPoint *a)
+{
+  uint32_t delta[WORDS], gamma[WORDS], beta[WORDS], alpha[WORDS], t[WORDS];
+
+  fe_sqr(delta, a->z);
+  fe_sqr(gamma, a->y);
+  fe_mul(beta, a->x, gamma);
+
+  /* alpha = 3 (X - delta) (X + delta) */
+  fe_sub(t, a->x, delta);
+  fe_add(alpha, a->x, delta);
+  fe_mul(t, t, alpha);
+  fe_add(alpha, t, t);
+  fe_add(alpha, alpha, t);
+
+  /* Z3 = (Y + Z)^2 - gamma - delta */
+  fe_add(t, a->y, a->z);
+  fe_sqr(t, t);
+  fe_sub(t, t, gamma);
+  fe_sub(r->z, t, delta);
+
+  /* X3 = alpha^2 - 8 beta */
+  fe_add(beta, beta, beta);
+  fe_add(beta, beta, beta);
+  fe_sqr(t, alpha);
+  fe_sub(t, t, beta);
+  fe_sub(r->x, t, beta);
+
+  /* Y3 = alpha (4 beta - X3) - 8 gamma^2 */
+  fe_sub(t, beta, r->x);
+  fe_mul(t, alpha, t);
+  fe_sqr(gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_sub(r->y, t, gamma);
+}
+
+/* r = a + b for a != b, a != -b, neither at infinity; r may be a or b */
+static void point_add(tsPoint *r, const tsPoint *a, const tsPoint *b)
+{
+  uint32_t u1[WORDS], u2[WORDS], s1[WORDS], s2[WORDS], h[WORDS], t[WORDS];
+
+  fe_sqr(t, b->z);
+  fe_mul(u1, a->x, t);
+  fe_mul(t, t, b->z);
+  fe_mul(s1, a->y, t);
+
+  fe_sqr(t, a->z);
+  fe_mul(u2, b->x, t);
+  fe_mul(t, t, a->z);
+  fe_mul(s2, b->y, t);
+
+  /* H = U2 - U1, R = S2 - S1 (kept in s2) */
+  fe_sub(h, u2, u1);
+  fe_sub(s2, s2, s1);
+
+  /* Z3 = Z1 Z2 H */
+  fe_mul(t, a->z, b->z);
+  fe_mul(r->z, t, h);
+
+  /* U1 H^2 in u1, H^3 in h */
+  fe_sqr(t, h);
+  fe_mul(h, h, t);
+  fe_mul(u1, u1, t);
+
+  /* X3 = R^2 - H^3 - 2 U1 H^2 */
+  fe_sqr(t, s2);
+  fe_sub(t, t, h);
+  fe_sub(t, t, u1);
+  fe_sub(r->x, t, u1);
+
+  /* Y3 = R (U1 H^2 - X3) - S1 H^3 */
+  fe_sub(t, u1, r->x);
+  fe_mul(t, s2, t);
+  fe_mul(s1, s1, h);
+  fe_sub(r->y, t, s1);
+}
+
+static void point_swap(tsPoint *a, tsPoint *b, uint32_t swap)
+{
+  uint32_t *pa = (uint32_t *) a, *pb = (uint32_t *) b;
+  uint32_t mask = 0 - swap, t;
+  int i;
+
+  for (i = 0; i < 3 * WORDS; i++) {
+    t = mask & (pa[i] ^ pb[i]);
+    pa[i] ^= t;
+    pb[i] ^= t;
+  }
+}
+
+/* Affine (x, y) = k (px, py) for k in [1, n - 1]. Montgomery ladder: R1 - R0
+ * stays the input point, every bit takes one addition and one doubling. */
+static void scalar_mult(uint32_t *x, uint32_t *y, const uint32_t *k, const uint32_t *px, const uint32_t *py)
+{
+  tsPoint r0, r1;
+  uint32_t zi[WORDS], t[WORDS];
+  uint32_t bit;
+  int i;
+
+  i = 255;
+  while (!((k[i / 32] >> (i % 32)) & 1)) {
+    i--;
+  }
+
+  memcpy(r0.x, px, sizeof(r0.x));
+  memcpy(r0.y, py, sizeof(r0.y));
+  memset(r0.z, 0, sizeof(r0.z));
+  r0.z[0] = 1;
+  point_double(&r1, &r0);
+
+  for (i--; i >= 0; i--) {
+    bit = (k[i / 32] >> (i % 32)) & 1;
+    point_swap(&r0, &r1, bit);
+    point_add(&r1, &r0, &r1);
+    point_double(&r0, &r0);
+    point_swap(&r0, &r1, bit);
+  }
+
+  fe_inv(zi, r0.z);
+  fe_sqr(t, zi);
+  fe_mul(x, r0.x, t);
+  fe_mul(t, t, zi);
+  fe_mul(y, r0.y, t);
+}
+
+static int valid_scalar(const uint32_t *k)
+{
+  return !bn_is_zero(k) && bn_cmp(k, curve_n) < 0;
+}
+
+/* y^2 = x^3 - 3 x + b */
+static int on_curve(const uint32_t *x, const uint32_t *y)
+{
+  uint32_t lhs[WORDS], rhs[WORDS], t[WORDS];
+
+  if (bn_cmp(x, curve_p) >= 0 || bn_cmp(y, curve_p) >= 0) {
+    return 0;
+  }
+
+  fe_sqr(lhs, y);
+
+  fe_sqr(rhs, x);
+  fe_mul(rhs, rhs, x);
+  fe_add(t, x, x);
+  fe_add(t, t, x);
+  fe_sub(rhs, rhs, t);
+  fe_add(rhs, rhs, curve_b);
+
+  return bn_cmp(lhs, rhs) == 0;
+}
+
+// public functions
+
+errorcode_t p256_public_key(const uint8_t *private_key, uint8_t *public_key)
+{
+  uint32_t k[WORDS], x[WORDS], y[WORDS];
+  errorcode_t res;
+
+  from_bytes(k, private_key);
+  if (!valid_scalar(k)) {
+    return bg_err_invalid_param;
+  }
+  res = begin();
+  if (res) {
+    return res;
+  }
+
+  scalar_mult(x, y, k, curve_gx, curve_gy);
+  to_bytes(public_key, x);
+  to_bytes(public_key + P256_PRIVATE_KEY_LEN, y);
+  memset(k, 0, sizeof(k));
+  return bg_err_success;
+}
+
+errorcode_t p256_check_public_key(const uint8_t *public_key)
+{
+  uint32_t x[WORDS], y[WORDS];
+  errorcode_t res;
+
+  res = begin();
+  if (res) {
+    return res;
+  }
+
+  from_bytes(x, public_key);
+  from_bytes(y, public_key + P256_PRIVATE_KEY_LEN);
+  return on_curve(x, y) ? bg_err_success : bg_err_invalid_param;
+}
+
+errorcode_t p256_ecdh(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t *secret)
+{
+  uint32_t k[WORDS], x[WORDS], y[WORDS];
+  errorcode_t res;
+
+  from_bytes(k, private_key);
+  if (!valid_scalar(k)) {
+    return bg_err_invalid_param;
+  }
+  res = begin();
+  if (res) {
+    return res;
+  }
+
+  from_bytes(x, peer_public_key);
+  from_bytes(y, peer_public_key + P256_PRIVATE_KEY_LEN);
+  if (!on_curve(x, y)) {
+    return bg_err_invalid_param;
+  }
+
+  scalar_mult(x, y, k, x, y);
+  to_bytes(secret, x);
+  memset(k, 0, sizeof(k));
+  return bg_err_success;
+}
+
+#ifdef P256_SELFTEST
+
+/* NIST CAVS 14.1 ECC CDH primitive test vectors, P-256, COUNT = 0 and 1:
+ * peer public key QCAVS, private key dIUT, public key QIUT, secret ZIUT */
+
+typedef struct {
+  uint8_t peer[P256_PUBLIC_KEY_LEN];
+  uint8_t private_key[P256_PRIVATE_KEY_LEN];
+  uint8_t public_key[P256_PUBLIC_KEY_LEN];
+  uint8_t secret[P256_SECRET_LEN];
+} tsEcdhVector;
+
+static const tsEcdhVector test_vectors[] = {
+  { { 0x70, 0x0c, 0x48, 0xf7, 0x7f, 0x56, 0x58, 0x4c, 0x5c, 0xc6, 0x32, 0xca, 0x65, 0x64, 0x0d, 0xb9,
+      0x1b, 0x6b, 0xac, 0xce, 0x3a, 0x4d, 0xf6, 0xb4, 0x2c, 0xe7, 0xcc, 0x83, 0x88, 0x33, 0xd2, 0x87,
+      0xdb, 0x71, 0xe5, 0x09, 0xe3, 0xfd, 0x9b, 0x06, 0x0d, 0xdb, 0x20, 0xba, 0x5c, 0x51, 0xdc, 0xc5,
+      0x94, 0x8d, 0x46, 0xfb, 0xf6, 0x40, 0xdf, 0xe0, 0x44, 0x17, 0x82, 0xca, 0xb8, 0x5f, 0xa4, 0xac },
+    { 0x7d, 0x7d, 0xc5, 0xf7, 0x1e, 0xb2, 0x9d, 0xda, 0xf8, 0x0d, 0x62, 0x14, 0x63, 0x2e, 0xea, 0xe0,
+      0x3d, 0x90, 0x58, 0xaf, 0x1f, 0xb6, 0xd2, 0x2e, 0xd8, 0x0b, 0xad, 0xb6, 0x2b, 0xc1, 0xa5, 0x34 },
+    { 0xea, 0xd2, 0x18, 0x59, 0x01, 0x19, 0xe8, 0x87, 0x6b, 0x29, 0x14, 0x6f, 0xf8, 0x9c, 0xa6, 0x17,
+      0x70, 0xc4, 0xed, 0xbb, 0xf9, 0x7d, 0x38, 0xce, 0x38, 0x5e, 0xd2, 0x81, 0xd8, 0xa6, 0xb2, 0x30,
+      0x28, 0xaf, 0x61, 0x28, 0x1f, 0xd3, 0x5e, 0x2f, 0xa7, 0x00, 0x25, 0x23, 0xac, 0xc8, 0x5a, 0x42,
+      0x9c, 0xb0, 0x6e, 0xe6, 0x64, 0x83, 0x25, 0x38, 0x9f, 0x59, 0xed, 0xfc, 0xe1, 0x40, 0x51, 0x41 },
+    { 0x46, 0xfc, 0x62, 0x10, 0x64, 0x20, 0xff, 0x01, 0x2e, 0x54, 0xa4, 0x34, 0xfb, 0xdd, 0x2d, 0x25,
+      0xcc, 0xc5, 0x85, 0x20, 0x60, 0x56, 0x1e, 0x68, 0x04, 0x0d, 0xd7, 0x77, 0x89, 0x97, 0xbd, 0x7b } },
+  { { 0x80, 0x9f, 0x04, 0x28, 0x9c, 0x64, 0x34, 0x8c, 0x01, 0x51, 0x5e, 0xb0, 0x3d, 0x5c, 0xe7, 0xac,
+      0x1a, 0x8c, 0xb9, 0x49, 0x8f, 0x5c, 0xaa, 0x50, 0x19, 0x7e, 0x58, 0xd4, 0x3a, 0x86, 0xa7, 0xae,
+      0xb2, 0x9d, 0x84, 0xe8, 0x11, 0x19, 0x7f, 0x25, 0xeb, 0xa8, 0xf5, 0x19, 0x40, 0x92, 0xcb, 0x6f,
+      0xf4, 0x40, 0xe2, 0x6d, 0x44, 0x21, 0x01, 0x13, 0x72, 0x46, 0x1f, 0x57, 0x92, 0x71, 0xcd, 0xa3 },
+    { 0x38, 0xf6, 0x5d, 0x6d, 0xce, 0x47, 0x67, 0x60, 0x44, 0xd5, 0x8c, 0xe5, 0x13, 0x95, 0x82, 0xd5,
+      0x68, 0xf6, 0x4b, 0xb1, 0x60, 0x98, 0xd1, 0x79, 0xdb, 0xab, 0x07, 0x74, 0x1d, 0xd5, 0xca, 0xf5 },
+    { 0x11, 0x9f, 0x2f, 0x04, 0x79, 0x02, 0x78, 0x2a, 0xb0, 0xc9, 0xe2, 0x7a, 0x54, 0xaf, 0xf5, 0xeb,
+      0x9b, 0x96, 0x48, 0x29, 0xca, 0x99, 0xc0, 0x6b, 0x02, 0xdd, 0xba, 0x95, 0xb0, 0xa3, 0xf6, 0xd0,
+      0x8f, 0x52, 0xb7, 0x26, 0x66, 0x4c, 0xac, 0x36, 0x6f, 0xc9, 0x8a, 0xc7, 0xa0, 0x12, 0xb2, 0x68,
+      0x2c, 0xbd, 0x96, 0x2e, 0x5a, 0xcb, 0x54, 0x46, 0x71, 0xd4, 0x1b, 0x94, 0x45, 0x70, 0x4d, 0x1d },
+    { 0x05, 0x7d, 0x63, 0x60, 0x96, 0xcb, 0x80, 0xb6, 0x7a, 0x8c, 0x03, 0x8c, 0x89, 0x0e, 0x88, 0x7d,
+      0x1a, 0xdf, 0xa4, 0x19, 0x5e, 0x9b, 0x3c, 0xe2, 0x41, 0xc8, 0xa7, 0x78, 0xc5, 0x9c, 0xda, 0x67 } },
+};
+
+int p256_selftest(void)
+{
+  uint8_t key[P256_PUBLIC_KEY_LEN], secret[P256_SECRET_LEN];
+  int failures = 0;
+  int i;
+
+  for (i = 0; i < (int)(sizeof(test_vectors) / sizeof(test_vectors[0])); i++) {
+    const tsEcdhVector *v = &test_vectors[i];
+
+    if (p256_public_key(v->private_key, key) || memcmp(key, v->public_key, sizeof(key))) {
+      failures++;
+    }
+    if (p256_ecdh(v->private_key, v->peer, secret) || memcmp(secret, v->secret, sizeof(secret))) {
+      failures++;
+    }
+
+    /* a point off the curve must be refused */
+    memcpy(key, v->peer, sizeof(key));
+    key[P256_PUBLIC_KEY_LEN - 1] ^= 1;
+    if (p256_check_public_key(key) != bg_err_invalid_param) {
+      failures++;
+    }
+  }
+
+  /* n - 1 gives -G = (Gx, p - Gy), the largest private key */
+  {
+    uint32_t k[WORDS], y[WORDS];
+    uint8_t private_key[P256_PRIVATE_KEY_LEN], expected[P256_PUBLIC_KEY_LEN];
+
+    memcpy(k, curve_n, sizeof(k));
+    k[0]--;
+    to_bytes(private_key, k);
+    to_bytes(expected, curve_gx);
+    bn_sub(y, curve_p, curve_gy);
+    to_bytes(expected + P256_PRIVATE_KEY_LEN, y);
+    if (p256_public_key(private_key, key) || memcmp(key, expected, sizeof(key))) {
+      failures++;
+    }
+
+    /* n and zero are refused */
+    to_bytes(private_key, curve_n);
+    if (p256_public_key(private_key, key) != bg_err_invalid_param) {
+      failures++;
+    }
+    memset(private_key, 0, sizeof(private_key));
+    if (p256_public_key(private_key, key) != bg_err_invalid_param) {
+      failures++;
+    }
+  }
+
+  return failures;
+}
+
+#endif
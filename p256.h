@@ -0,0 +1,56 @@
+#ifndef _P256_H
+#define _P256_H
+
+#include <stdint.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  Elliptic curve Diffie-Hellman on NIST P-256, the curve of mesh provisioning.
+ *
+ *  Keys use the encoding of the provisioning protocol: a private key is a 32
+ *  byte big endian scalar, a public key the 32 byte X and Y coordinates, both
+ *  big endian. The scalar multiplication is a Montgomery ladder over Jacobian
+ *  coordinates, so the sequence of field operations does not depend on the key.
+ *
+ *  The field multiplications run on the MMUL instruction of the application
+ *  CRYPTO instance with the P-256 modulus selected by CRYPTO_ModulusSet(),
+ *  additions and subtractions stay on the CPU. The instance is shared with
+ *  aes_ccm, sha256 and aes_dma; bg_err_wrong_state is returned while an
+ *  aes_dma transfer is running.
+ *
+ *  Building with P256_SOFTWARE multiplies on the CPU with the NIST fast
+ *  reduction instead, as a reference and for the host tools (tools/p256_key.c).
+ *  P256_SELFTEST adds p256_selftest(), which checks NIST CAVS ECDH vectors.
+ */
+
+#ifndef P256_CRYPTO
+#define P256_CRYPTO              CRYPTO1
+#define P256_CRYPTO_CLOCK        cmuClock_CRYPTO1
+#endif
+
+#define P256_PRIVATE_KEY_LEN     32
+#define P256_PUBLIC_KEY_LEN      64
+#define P256_SECRET_LEN          32
+
+/* Public key of a private key, which must be in [1, n - 1]. */
+errorcode_t p256_public_key(const uint8_t *private_key, uint8_t *public_key);
+
+/* Returns bg_err_invalid_param unless the point is on the curve. */
+errorcode_t p256_check_public_key(const uint8_t *public_key);
+
+/* Shared secret: the X coordinate of private key * peer public key. The peer
+ * key is checked first. */
+errorcode_t p256_ecdh(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t *secret);
+
+#if defined(CRYPTO_BENCHMARK) && !defined(P256_SOFTWARE)
+/* Multiply on the CPU instead of the CRYPTO block, for comparison. */
+void p256_use_software(uint8_t on);
+#endif
+
+#ifdef P256_SELFTEST
+/* Run the test vectors, returns the number of failures. */
+int p256_selftest(void);
+#endif
+
+#endif
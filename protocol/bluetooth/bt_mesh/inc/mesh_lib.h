@@ -74,6 +74,16 @@ mesh_lib_generic_server_publish(uint16_t model_id,
                                 uint16_t element_index,
                                 mesh_generic_state_t kind);
 
+/*
+ * Registers the request and change callbacks of a server model.
+ *
+ * Retransmitted requests are dropped before they reach cb. The stack does
+ * not pass the transaction identifier up, so this is approximate: a
+ * request equal to the latest one from the same client within a few
+ * seconds is taken as a retransmission, even if the client sent it again
+ * on purpose with a new identifier. Level Delta Set and Level Move are
+ * always passed on, a retransmitted one is applied twice.
+ */
 errorcode_t
 mesh_lib_generic_server_register_handler(uint16_t model_id,
                                          uint16_t element_index,
@@ -127,4 +137,367 @@ mesh_lib_generic_client_register_handler(uint16_t model_id,
                                          uint16_t element_index,
                                          mesh_lib_generic_client_server_response_cb cb);
 
+/***
+ *** Generic Client request tracking
+ ***/
+
+/*
+ * Completion callback of a tracked request. On success result is
+ * bg_err_success and the server state is given; if no status arrives in
+ * time result is bg_err_timeout and current is NULL.
+ */
+typedef void
+(*mesh_lib_generic_client_request_cb)(uint16_t model_id,
+                                      uint16_t element_index,
+                                      uint16_t server_addr,
+                                      mesh_generic_state_t kind,
+                                      errorcode_t result,
+                                      const struct mesh_generic_state *current,
+                                      const struct mesh_generic_state *target,
+                                      uint32_t remaining_ms);
+
+/*
+ * Allocates the table of outstanding requests using the allocator given to
+ * mesh_lib_init(). max_requests limits how many tracked gets and sets can
+ * be in flight at the same time.
+ */
+errorcode_t mesh_lib_generic_client_init_requests(size_t max_requests);
+
+/*
+ * Like mesh_lib_generic_client_get(), but the status returned by the server
+ * is delivered to cb instead of the registered response handler. Only one
+ * request per (server, model, element, kind) can be outstanding.
+ */
+errorcode_t
+mesh_lib_generic_client_get_tracked(uint16_t model_id,
+                                    uint16_t element_index,
+                                    uint16_t server_addr,
+                                    uint16_t appkey_index,
+                                    mesh_generic_state_t kind,
+                                    uint32_t timeout_ms,
+                                    mesh_lib_generic_client_request_cb cb);
+
+errorcode_t
+mesh_lib_generic_client_set_tracked(uint16_t model_id,
+                                    uint16_t element_index,
+                                    uint16_t server_addr,
+                                    uint16_t appkey_index,
+                                    uint8_t transaction_id,
+                                    const struct mesh_generic_request *req,
+                                    uint32_t transition_ms,
+                                    uint16_t delay_ms,
+                                    uint8_t request_flags,
+                                    uint32_t timeout_ms,
+                                    mesh_lib_generic_client_request_cb cb);
+
+/*
+ * Expires tracked requests whose timeout has passed. Must be called
+ * periodically by the application, e.g. from a soft timer.
+ */
+void mesh_lib_generic_client_check_timeouts(void);
+
+size_t mesh_lib_generic_client_requests_outstanding(void);
+
+/***
+ *** Generic Client group status sweep
+ ***/
+
+/* Status collected from one server during a sweep */
+struct mesh_lib_generic_client_sweep_entry {
+  uint16_t server_addr;
+  uint32_t remaining_ms;
+  struct mesh_generic_state current;
+};
+
+/*
+ * Called once the sweep window has closed. responses holds table_size
+ * slots; slots with server_addr 0x0000 are unused. missing lists the
+ * expected members that did not answer. Both buffers are released when
+ * the callback returns.
+ */
+typedef void
+(*mesh_lib_generic_client_sweep_done_cb)(uint16_t group_addr,
+                                         mesh_generic_state_t kind,
+                                         const struct mesh_lib_generic_client_sweep_entry *responses,
+                                         size_t table_size,
+                                         size_t num_responses,
+                                         size_t num_duplicates,
+                                         const uint16_t *missing,
+                                         size_t num_missing);
+
+/*
+ * Sends a single get to group_addr and collects the status messages
+ * returned by the servers until window_ms has passed. Repeated answers
+ * from the same server are counted but not stored again. members lists
+ * the unicast addresses expected to answer and may be NULL. Only one
+ * sweep can run at a time; the window is closed by
+ * mesh_lib_generic_client_check_timeouts().
+ */
+errorcode_t
+mesh_lib_generic_client_sweep_start(uint16_t model_id,
+                                    uint16_t element_index,
+                                    uint16_t group_addr,
+                                    uint16_t appkey_index,
+                                    mesh_generic_state_t kind,
+                                    const uint16_t *members,
+                                    size_t num_members,
+                                    size_t max_responses,
+                                    uint32_t window_ms,
+                                    mesh_lib_generic_client_sweep_done_cb cb);
+
+void mesh_lib_generic_client_sweep_cancel(void);
+
+/***
+ *** Vendor models
+ ***/
+
+/* Vendor opcodes are 6 bits, the vendor ID is added by the stack */
+#define MESH_LIB_VENDOR_OPCODES 64
+
+/*
+ * Longest access payload of a vendor message: 32 segments of 12 octets
+ * less the 4 octet TransMIC give a 380 octet access PDU, less the 3 octet
+ * opcode
+ */
+#define MESH_LIB_VENDOR_MAX_PAYLOAD 377
+
+/* Payload passed to the stack in one send or set publication command */
+#define MESH_LIB_VENDOR_CMD_PAYLOAD 200
+
+/*
+ * Longest payload sent in a single unsegmented message: 11 octets of
+ * access PDU with a 32-bit TransMIC, less the 3 octet opcode
+ */
+#define MESH_LIB_VENDOR_UNSEG_PAYLOAD 8
+
+/* Received vendor message, payload is valid during the callback only */
+struct mesh_lib_vendor_model_message {
+  uint16_t vendor_id;
+  uint16_t model_id;
+  uint16_t element_index;
+  uint16_t source_addr;
+  uint16_t destination_addr;
+  uint16_t appkey_index;
+  uint8_t opcode;
+  uint8_t flags; // MESH_REQUEST_FLAG_NONRELAYED
+  const uint8_t *payload;
+  size_t payload_len;
+};
+
+typedef void
+(*mesh_lib_vendor_model_message_cb)(const struct mesh_lib_vendor_model_message *msg);
+
+struct mesh_lib_vendor_model_handler {
+  uint8_t opcode;
+  mesh_lib_vendor_model_message_cb cb;
+};
+
+/*
+ * Counters of the vendor model layer. They can also be used by host
+ * tests, which feed receive events built by hand to
+ * mesh_lib_vendor_model_event_handler() and check where they went.
+ */
+struct mesh_lib_vendor_model_stats {
+  uint32_t received;       // receive events
+  uint32_t partial;        // events carrying a part of a longer message
+  uint32_t dispatched;     // complete messages passed to a handler
+  uint32_t unknown_model;  // for a model that is not registered
+  uint32_t unknown_opcode; // opcode without a handler
+  uint32_t incomplete;     // messages dropped with parts missing or too long
+  uint32_t sent;           // messages sent or published
+  uint32_t unsegmented;    // of these, short enough for a single segment
+  uint32_t segmented;
+  uint32_t send_errors;
+  uint32_t records;        // records given to mesh_lib_vendor_pack_add()
+  uint32_t pack_flush_full;     // packed messages sent because they were full
+  uint32_t pack_flush_deadline; // or because a record was due
+  uint32_t pack_retries;   // packed messages the stack had no room for, kept
+  uint32_t pack_lost;      // records dropped because the stack refused them
+};
+
+/*
+ * Allocates the registration table for vendor_models models using the
+ * allocator given to mesh_lib_init().
+ */
+errorcode_t mesh_lib_vendor_init(size_t vendor_models);
+
+void mesh_lib_vendor_deinit(void);
+
+/*
+ * Initializes the vendor model in the stack with the opcodes of the
+ * handlers and registers the handlers. A received message is passed to
+ * the handler of its opcode once all of its parts have arrived.
+ */
+errorcode_t
+mesh_lib_vendor_model_register(uint16_t vendor_id,
+                               uint16_t model_id,
+                               uint16_t element_index,
+                               uint8_t publish,
+                               const struct mesh_lib_vendor_model_handler *handlers,
+                               size_t num_handlers);
+
+errorcode_t
+mesh_lib_vendor_model_unregister(uint16_t vendor_id,
+                                 uint16_t model_id,
+                                 uint16_t element_index);
+
+void mesh_lib_vendor_model_event_handler(struct gecko_cmd_packet *evt);
+
+errorcode_t
+mesh_lib_vendor_model_send(uint16_t vendor_id,
+                           uint16_t model_id,
+                           uint16_t element_index,
+                           uint16_t destination_addr,
+                           uint16_t appkey_index,
+                           uint8_t opcode,
+                           const uint8_t *payload,
+                           size_t payload_len,
+                           uint8_t request_flags);
+
+/* Sends to the source of msg with the same key and relaying */
+errorcode_t
+mesh_lib_vendor_model_reply(const struct mesh_lib_vendor_model_message *msg,
+                            uint8_t opcode,
+                            const uint8_t *payload,
+                            size_t payload_len);
+
+/* Sets the publication message of the model and publishes it */
+errorcode_t
+mesh_lib_vendor_model_publish(uint16_t vendor_id,
+                              uint16_t model_id,
+                              uint16_t element_index,
+                              uint8_t opcode,
+                              const uint8_t *payload,
+                              size_t payload_len);
+
+void mesh_lib_vendor_model_get_stats(struct mesh_lib_vendor_model_stats *stats);
+
+void mesh_lib_vendor_model_reset_stats(void);
+
+/***
+ *** Vendor model record packing
+ ***/
+
+/*
+ * Small application records to the same destination are packed into one
+ * unsegmented message with the packing opcode, as long as they fit in
+ * MESH_LIB_VENDOR_UNSEG_PAYLOAD octets. A segmented message costs several
+ * times the airtime and a transport layer acknowledgement.
+ *
+ * Each record is one header octet, length in the upper 3 bits and type in
+ * the lower 5 bits, followed by the data. Length 0 means the record
+ * extends to the end of the message; records longer than
+ * MESH_LIB_VENDOR_PACK_RECORD_MAX are sent that way in a message of
+ * their own.
+ */
+#define MESH_LIB_VENDOR_PACK_LEN_SHIFT 5
+#define MESH_LIB_VENDOR_PACK_MAX_TYPE 0x1f
+#define MESH_LIB_VENDOR_PACK_RECORD_MAX (MESH_LIB_VENDOR_UNSEG_PAYLOAD - 1)
+
+typedef void
+(*mesh_lib_vendor_record_cb)(const struct mesh_lib_vendor_model_message *msg,
+                             uint8_t type,
+                             const uint8_t *data,
+                             size_t len);
+
+/*
+ * Allocates packing buffers for up to destinations destinations at a
+ * time. Packed messages are sent with opcode.
+ */
+errorcode_t mesh_lib_vendor_pack_init(uint8_t opcode, size_t destinations);
+
+void mesh_lib_vendor_pack_deinit(void);
+
+/*
+ * Queues a record. It is sent at the latest max_delay_ms later, at once
+ * if max_delay_ms is 0. When all buffers are in use, the one due first
+ * is sent to make room.
+ *
+ * When the stack has no room for a packed message, the buffer is kept
+ * and sent again by mesh_lib_vendor_pack_check_timeouts(). If a buffer
+ * that has to make room for the record is kept, the record is not
+ * queued and the error is returned; the caller may add it again later.
+ * A buffer the stack refuses for good, or too many times, is dropped
+ * and its records counted in pack_lost. The error is returned if the
+ * record was among them.
+ */
+errorcode_t
+mesh_lib_vendor_pack_add(uint16_t vendor_id,
+                         uint16_t model_id,
+                         uint16_t element_index,
+                         uint16_t destination_addr,
+                         uint16_t appkey_index,
+                         uint8_t type,
+                         const uint8_t *data,
+                         size_t len,
+                         uint32_t max_delay_ms);
+
+/*
+ * Sends the buffers whose deadline has passed. Must be called
+ * periodically by the application, more often than the shortest delay.
+ */
+void mesh_lib_vendor_pack_check_timeouts(void);
+
+void mesh_lib_vendor_pack_flush(void);
+
+/*
+ * Passes the records of a packed message to cb. Returns the number of
+ * records, or -1 if the message is malformed (the records before the
+ * error have been passed).
+ */
+int mesh_lib_vendor_unpack(const struct mesh_lib_vendor_model_message *msg,
+                           mesh_lib_vendor_record_cb cb);
+
+/***
+ *** Publish rate limits
+ ***/
+
+/* Vendor ID of the SIG models in the rate limit functions */
+#define MESH_LIB_SIG_VENDOR_ID 0xffff
+
+struct mesh_lib_publish_limit_stats {
+  uint32_t passed;    // published when requested
+  uint32_t throttled; // held back for lack of credit
+  uint32_t coalesced; // held back ones replaced by a newer publication
+  uint32_t delayed;   // held back ones published later
+  uint32_t dropped;   // held back ones the stack refused later, or pushed out
+                      // by other server states
+};
+
+/*
+ * Allocates rate limits for up to max_limits models, using the
+ * allocator given to mesh_lib_init().
+ */
+errorcode_t mesh_lib_publish_limit_init(size_t max_limits);
+
+/*
+ * Limits the publications of a model, through
+ * mesh_lib_generic_server_publish(), mesh_lib_generic_client_publish()
+ * and mesh_lib_vendor_model_publish(), to bursts of up to burst
+ * messages and one message per interval_ms on average. The limit
+ * applies to the publication address the model is configured with.
+ * A publication over the limit is not sent, but kept until there is
+ * credit again, and the publish function returns bg_err_success. Only
+ * the latest one is kept per model, for a server the latest one of each
+ * state. interval_ms 0 removes the limit and sends what is held back.
+ */
+errorcode_t
+mesh_lib_publish_limit_set(uint16_t vendor_id,
+                           uint16_t model_id,
+                           uint16_t element_index,
+                           uint32_t interval_ms,
+                           uint16_t burst);
+
+/*
+ * Publishes the held back messages that have credit again. Must be
+ * called periodically by the application, e.g. from a soft timer.
+ */
+void mesh_lib_publish_limit_check_timeouts(void);
+
+errorcode_t
+mesh_lib_publish_limit_get_stats(uint16_t vendor_id,
+                                 uint16_t model_id,
+                                 uint16_t element_index,
+                                 struct mesh_lib_publish_limit_stats *stats);
+
 #endif
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* BG stack headers */
 #include "bg_types.h"
@@ -21,6 +22,16 @@
 #include "mesh_lib.h"
 #include "mesh_serdeser.h"
 
+/* Number of recent client requests remembered for duplicate detection */
+#ifndef MESH_LIB_DEDUP_CACHE_SIZE
+#define MESH_LIB_DEDUP_CACHE_SIZE 8
+#endif
+
+/* Retransmissions of the same request arrive within this window */
+#ifndef MESH_LIB_DEDUP_EXPIRY_MS
+#define MESH_LIB_DEDUP_EXPIRY_MS 6000
+#endif
+
 uint32_t mesh_lib_transition_time_to_ms(uint8_t t)
 {
   uint32_t res_ms[4] = { 100, 1000, 10000, 600000 };
@@ -46,6 +57,39 @@ struct reg {
 static struct reg *reg = NULL;
 static size_t regs = 0;
 
+struct request {
+  uint32_t deadline_ms;
+  uint16_t model_id;
+  uint16_t elem_index;
+  uint16_t server_addr;
+  uint8_t kind;
+  mesh_lib_generic_client_request_cb cb;
+};
+
+static struct request *request = NULL;
+static size_t requests = 0;
+static size_t requests_used = 0;
+
+/*
+ * State of the group sweep in progress. Responses are kept in an open
+ * addressing hash table keyed by server address so that repeated answers
+ * are detected in constant time.
+ */
+static struct {
+  mesh_lib_generic_client_sweep_done_cb cb;
+  uint32_t deadline_ms;
+  uint16_t model_id;
+  uint16_t elem_index;
+  uint16_t group_addr;
+  uint8_t kind;
+  struct mesh_lib_generic_client_sweep_entry *table;
+  size_t table_size; // power of two
+  size_t responses;
+  size_t duplicates;
+  uint16_t *members;
+  size_t num_members;
+} sweep;
+
 static void *(*lib_malloc_fn)(size_t) = NULL;
 static void (*lib_free_fn)(void *) = NULL;
 
@@ -72,6 +116,443 @@ static struct reg *find_free(void)
   return NULL;
 }
 
+/*
+ * Cache of recently handled client requests. The stack does not pass the
+ * transaction identifier up to the application, so a retransmission is
+ * recognized as a request identical to the latest one from the same client
+ * to the same model and element (same type, parameters, transition time and
+ * delay), received within MESH_LIB_DEDUP_EXPIRY_MS. Only the latest request
+ * is compared, so On, Off, On is three requests. The response sent by
+ * the application to the original request is stored alongside, so that a
+ * duplicate can be acknowledged without invoking the application again.
+ *
+ * Level Delta Set and Level Move are left out: the same step sent twice
+ * on purpose looks exactly like a retransmission, and dropping a step the
+ * user asked for is worse than applying a retransmitted one twice.
+ */
+struct dedup {
+  uint8_t used;
+  uint32_t time_ms;
+  uint16_t client_addr;
+  uint16_t model_id;
+  uint16_t elem_index;
+  uint8_t type;
+  uint8_t param_len;
+  uint8_t param[10];
+  uint32_t transition;
+  uint16_t delay;
+  uint8_t has_response;
+  uint8_t response_kind;
+  uint8_t response_flags;
+  uint8_t response_len;
+  uint16_t response_appkey_index;
+  uint32_t response_remaining_ms;
+  uint8_t response[12];
+};
+
+static struct dedup dedup_cache[MESH_LIB_DEDUP_CACHE_SIZE];
+
+static uint32_t lib_time_ms(void)
+{
+  struct gecko_msg_hardware_get_time_rsp_t *t = gecko_cmd_hardware_get_time();
+  return t->seconds * 1000 + ((uint32_t)t->ticks * 1000) / 32768;
+}
+
+static int dedup_is_live(const struct dedup *d, uint32_t now_ms)
+{
+  return d->used
+         && (uint32_t)(now_ms - d->time_ms) < MESH_LIB_DEDUP_EXPIRY_MS;
+}
+
+static int dedup_applies(const struct gecko_msg_mesh_generic_server_client_request_evt_t *req)
+{
+  return req->type != mesh_generic_request_level_delta
+         && req->type != mesh_generic_request_level_move
+         && req->parameters.len <= sizeof(dedup_cache[0].param);
+}
+
+/* latest request of a client to a model, NULL if none is live */
+static struct dedup *dedup_latest(uint16_t client_addr,
+                                  uint16_t model_id,
+                                  uint16_t element_index,
+                                  uint32_t now_ms)
+{
+  struct dedup *d = NULL;
+  size_t i;
+
+  for (i = 0; i < MESH_LIB_DEDUP_CACHE_SIZE; i++) {
+    if (dedup_is_live(&dedup_cache[i], now_ms)
+        && dedup_cache[i].client_addr == client_addr
+        && dedup_cache[i].model_id == model_id
+        && dedup_cache[i].elem_index == element_index
+        && (!d || (uint32_t)(now_ms - dedup_cache[i].time_ms)
+            < (uint32_t)(now_ms - d->time_ms))) {
+      d = &dedup_cache[i];
+    }
+  }
+  return d;
+}
+
+static struct dedup *dedup_find(const struct gecko_msg_mesh_generic_server_client_request_evt_t *req,
+                                uint32_t now_ms)
+{
+  struct dedup *d;
+
+  if (!dedup_applies(req)) {
+    return NULL;
+  }
+  d = dedup_latest(req->client_address, req->model_id, req->elem_index, now_ms);
+  if (d
+      && d->type == req->type
+      && d->transition == req->transition
+      && d->delay == req->delay
+      && d->param_len == req->parameters.len
+      && memcmp(d->param, req->parameters.data, d->param_len) == 0) {
+    return d;
+  }
+  return NULL;
+}
+
+static void dedup_insert(const struct gecko_msg_mesh_generic_server_client_request_evt_t *req,
+                         uint32_t now_ms)
+{
+  struct dedup *d = &dedup_cache[0];
+  size_t i;
+
+  if (!dedup_applies(req)) {
+    // not remembered, so the older request must not be taken for this one's duplicate
+    d = dedup_latest(req->client_address, req->model_id, req->elem_index, now_ms);
+    if (d) {
+      d->used = 0;
+    }
+    return;
+  }
+
+  // reuse an expired slot, otherwise evict the oldest entry
+  for (i = 0; i < MESH_LIB_DEDUP_CACHE_SIZE; i++) {
+    if (!dedup_is_live(&dedup_cache[i], now_ms)) {
+      d = &dedup_cache[i];
+      break;
+    }
+    if ((uint32_t)(now_ms - dedup_cache[i].time_ms)
+        > (uint32_t)(now_ms - d->time_ms)) {
+      d = &dedup_cache[i];
+    }
+  }
+
+  memset(d, 0, sizeof(*d));
+  d->used = 1;
+  d->time_ms = now_ms;
+  d->client_addr = req->client_address;
+  d->model_id = req->model_id;
+  d->elem_index = req->elem_index;
+  d->type = req->type;
+  d->param_len = req->parameters.len;
+  memcpy(d->param, req->parameters.data, d->param_len);
+  d->transition = req->transition;
+  d->delay = req->delay;
+}
+
+static void dedup_store_response(uint16_t model_id,
+                                 uint16_t element_index,
+                                 uint16_t client_addr,
+                                 uint16_t appkey_index,
+                                 uint8_t kind,
+                                 uint32_t remaining_ms,
+                                 uint8_t response_flags,
+                                 const uint8_t *buf,
+                                 size_t len)
+{
+  // attach the response to the most recent request from this client
+  struct dedup *d = dedup_latest(client_addr, model_id, element_index, lib_time_ms());
+
+  if (!d || len > sizeof(d->response)) {
+    return;
+  }
+
+  d->has_response = 1;
+  d->response_kind = kind;
+  d->response_flags = response_flags;
+  d->response_len = len;
+  d->response_appkey_index = appkey_index;
+  d->response_remaining_ms = remaining_ms;
+  memcpy(d->response, buf, len);
+}
+
+static void dedup_respond(const struct dedup *d,
+                          const struct gecko_msg_mesh_generic_server_client_request_evt_t *req,
+                          uint32_t now_ms)
+{
+  uint32_t elapsed_ms = now_ms - d->time_ms;
+  uint32_t remaining_ms = 0;
+
+  if (!d->has_response || !(req->flags & MESH_REQUEST_FLAG_RESPONSE_REQUIRED)) {
+    return;
+  }
+  if (d->response_remaining_ms > elapsed_ms) {
+    remaining_ms = d->response_remaining_ms - elapsed_ms;
+  }
+  gecko_cmd_mesh_generic_server_response(d->model_id,
+                                         d->elem_index,
+                                         d->client_addr,
+                                         d->response_appkey_index,
+                                         remaining_ms,
+                                         d->response_flags,
+                                         d->response_kind,
+                                         d->response_len,
+                                         d->response);
+}
+
+/*
+ * Publish rate limits. A token bucket per model: a publication costs
+ * interval_ms of credit, credit grows with time up to burst publications.
+ * A publication that finds the bucket empty is kept as the pending one
+ * of its model and sent once there is credit again; a newer one replaces
+ * it. Server states and vendor publication messages are already stored
+ * in the stack, so only the publish command is held back for them. A
+ * server publishes each of its states separately, so one pending kind
+ * is kept per state, up to MESH_LIB_PUBLISH_LIMIT_KINDS.
+ */
+#ifndef MESH_LIB_PUBLISH_LIMIT_KINDS
+#define MESH_LIB_PUBLISH_LIMIT_KINDS 4
+#endif
+
+#define PENDING_NONE 0
+#define PENDING_SERVER 1
+#define PENDING_CLIENT 2
+#define PENDING_VENDOR 3
+
+struct limit {
+  uint16_t vendor_id;
+  uint16_t model_id;
+  uint16_t elem_index;
+  uint8_t used;
+  uint8_t pending;
+  uint32_t interval_ms;
+  uint32_t max_credit_ms;
+  uint32_t credit_ms;
+  uint32_t last_ms;
+  union {
+    struct {
+      uint8_t num_kinds;
+      uint8_t kind[MESH_LIB_PUBLISH_LIMIT_KINDS]; // in the order held back
+    } server;
+    struct {
+      uint8_t transaction_id;
+      uint8_t flags;
+      uint8_t kind;
+      uint8_t len;
+      uint16_t delay_ms;
+      uint32_t transition_ms;
+      uint8_t buf[10];
+    } client;
+    size_t vendor_len;
+  };
+  struct mesh_lib_publish_limit_stats stats;
+};
+
+static struct limit *limit = NULL;
+static size_t limits = 0;
+
+static struct limit *limit_find(uint16_t vendor_id,
+                                uint16_t model_id,
+                                uint16_t elem_index)
+{
+  size_t l;
+  for (l = 0; l < limits; l++) {
+    if (limit[l].used
+        && limit[l].vendor_id == vendor_id
+        && limit[l].model_id == model_id
+        && limit[l].elem_index == elem_index) {
+      return &limit[l];
+    }
+  }
+  return NULL;
+}
+
+static void limit_refill(struct limit *l, uint32_t now_ms)
+{
+  uint32_t elapsed = now_ms - l->last_ms;
+
+  l->last_ms = now_ms;
+  if (elapsed >= l->max_credit_ms - l->credit_ms) {
+    l->credit_ms = l->max_credit_ms;
+  } else {
+    l->credit_ms += elapsed;
+  }
+}
+
+/*
+ * Returns nonzero if the publication can be sent now. Otherwise the
+ * caller stores it as the pending one, which replaces an older one.
+ * Client and vendor publications have a single pending one, server
+ * ones are handled by limit_admit_server().
+ */
+static int limit_admit(struct limit *l)
+{
+  limit_refill(l, lib_time_ms());
+  if (l->credit_ms >= l->interval_ms) {
+    l->credit_ms -= l->interval_ms;
+    l->stats.passed++;
+    if (l->pending != PENDING_NONE) {
+      // superseded by the one sent now
+      l->pending = PENDING_NONE;
+      l->stats.coalesced++;
+    }
+    return 1;
+  }
+  l->stats.throttled++;
+  if (l->pending != PENDING_NONE) {
+    l->stats.coalesced++;
+  }
+  return 0;
+}
+
+static int limit_kind_find(const struct limit *l, uint8_t kind)
+{
+  int i;
+
+  for (i = 0; i < l->server.num_kinds; i++) {
+    if (l->server.kind[i] == kind) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void limit_kind_remove(struct limit *l, int i)
+{
+  l->server.num_kinds--;
+  memmove(&l->server.kind[i], &l->server.kind[i + 1], l->server.num_kinds - i);
+  if (l->server.num_kinds == 0) {
+    l->pending = PENDING_NONE;
+  }
+}
+
+/*
+ * As limit_admit() for a server state. Only a held back publication of
+ * the same state is replaced; if all MESH_LIB_PUBLISH_LIMIT_KINDS are
+ * taken by other states, the oldest one is dropped.
+ */
+static int limit_admit_server(struct limit *l, mesh_generic_state_t kind)
+{
+  int i = limit_kind_find(l, kind);
+
+  limit_refill(l, lib_time_ms());
+  if (l->credit_ms >= l->interval_ms) {
+    l->credit_ms -= l->interval_ms;
+    l->stats.passed++;
+    if (i >= 0) {
+      limit_kind_remove(l, i);
+      l->stats.coalesced++;
+    }
+    return 1;
+  }
+  l->stats.throttled++;
+  if (i >= 0) {
+    l->stats.coalesced++;
+    return 0;
+  }
+  if (l->server.num_kinds == MESH_LIB_PUBLISH_LIMIT_KINDS) {
+    limit_kind_remove(l, 0);
+    l->stats.dropped++;
+  }
+  l->server.kind[l->server.num_kinds++] = kind;
+  l->pending = PENDING_SERVER;
+  return 0;
+}
+
+static void sweep_free(void)
+{
+  if (sweep.table) {
+    (lib_free_fn)(sweep.table);
+  }
+  if (sweep.members) {
+    (lib_free_fn)(sweep.members);
+  }
+  memset(&sweep, 0, sizeof(sweep));
+}
+
+static struct mesh_lib_generic_client_sweep_entry *sweep_slot(uint16_t addr)
+{
+  size_t mask = sweep.table_size - 1;
+  size_t i = ((size_t)addr * 40503u) & mask;
+  size_t n;
+
+  for (n = 0; n < sweep.table_size; n++) {
+    struct mesh_lib_generic_client_sweep_entry *e = &sweep.table[i];
+    if (e->server_addr == addr || e->server_addr == 0x0000) {
+      return e;
+    }
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+static void sweep_record(const struct gecko_msg_mesh_generic_client_server_status_evt_t *res)
+{
+  struct mesh_lib_generic_client_sweep_entry *e;
+  struct mesh_generic_state target;
+  int has_target;
+
+  e = sweep_slot(res->server_address);
+  if (!e) {
+    return; // table full
+  }
+  if (e->server_addr == res->server_address) {
+    sweep.duplicates++;
+    return;
+  }
+  if (mesh_lib_deserialize_state(&e->current,
+                                 &target,
+                                 &has_target,
+                                 res->type,
+                                 res->parameters.data,
+                                 res->parameters.len) != 0) {
+    return;
+  }
+  e->server_addr = res->server_address;
+  e->remaining_ms = res->remaining;
+  sweep.responses++;
+}
+
+static void sweep_finish(void)
+{
+  mesh_lib_generic_client_sweep_done_cb cb = sweep.cb;
+  struct mesh_lib_generic_client_sweep_entry *table = sweep.table;
+  uint16_t *members = sweep.members;
+  uint16_t group_addr = sweep.group_addr;
+  uint8_t kind = sweep.kind;
+  size_t table_size = sweep.table_size;
+  size_t responses = sweep.responses;
+  size_t duplicates = sweep.duplicates;
+  size_t num_missing = 0;
+  size_t m;
+
+  // compact the members that did not answer to the front of the list
+  for (m = 0; m < sweep.num_members; m++) {
+    struct mesh_lib_generic_client_sweep_entry *e = sweep_slot(members[m]);
+    if (!e || e->server_addr != members[m]) {
+      members[num_missing++] = members[m];
+    }
+  }
+
+  // the callback may start the next sweep, so this one is gone before it runs
+  memset(&sweep, 0, sizeof(sweep));
+  (cb)(group_addr,
+       (mesh_generic_state_t)kind,
+       table,
+       table_size,
+       responses,
+       duplicates,
+       members,
+       num_missing);
+  (lib_free_fn)(table);
+  if (members) {
+    (lib_free_fn)(members);
+  }
+}
+
 errorcode_t mesh_lib_init(void *(*malloc_fn)(size_t),
                           void (*free_fn)(void *),
                           size_t generic_models)
@@ -98,6 +579,335 @@ void mesh_lib_deinit(void)
     reg = NULL;
     regs = 0;
   }
+  sweep_free();
+  if (request) {
+    (lib_free_fn)(request);
+    request = NULL;
+    requests = 0;
+    requests_used = 0;
+  }
+  memset(dedup_cache, 0, sizeof(dedup_cache));
+  mesh_lib_vendor_deinit();
+  if (limit) {
+    (lib_free_fn)(limit);
+    limit = NULL;
+    limits = 0;
+  }
+}
+
+errorcode_t mesh_lib_generic_client_init_requests(size_t max_requests)
+{
+  if (!lib_malloc_fn || request) {
+    return bg_err_wrong_state;
+  }
+
+  if (max_requests) {
+    request = (lib_malloc_fn)(max_requests * sizeof(struct request));
+    if (!request) {
+      return bg_err_out_of_memory;
+    }
+    memset(request, 0, max_requests * sizeof(struct request));
+    requests = max_requests;
+  }
+
+  return bg_err_success;
+}
+
+static struct request *find_request(uint16_t model_id,
+                                    uint16_t elem_index,
+                                    uint16_t server_addr,
+                                    uint8_t kind)
+{
+  size_t r;
+  for (r = 0; r < requests; r++) {
+    if (request[r].cb
+        && request[r].model_id == model_id
+        && request[r].elem_index == elem_index
+        && request[r].server_addr == server_addr
+        && request[r].kind == kind) {
+      return &request[r];
+    }
+  }
+  return NULL;
+}
+
+static struct request *find_free_request(void)
+{
+  size_t r;
+  for (r = 0; r < requests; r++) {
+    if (!request[r].cb) {
+      return &request[r];
+    }
+  }
+  return NULL;
+}
+
+static void release_request(struct request *req)
+{
+  req->cb = NULL;
+  requests_used--;
+}
+
+/* State kind reported in the status message answering a set request */
+static mesh_generic_state_t request_status_kind(mesh_generic_request_t kind)
+{
+  switch (kind) {
+    case mesh_generic_request_on_off:
+      return mesh_generic_state_on_off;
+    case mesh_generic_request_on_power_up:
+      return mesh_generic_state_on_power_up;
+    case mesh_generic_request_level:
+    case mesh_generic_request_level_delta:
+    case mesh_generic_request_level_move:
+    case mesh_generic_request_level_halt:
+      return mesh_generic_state_level;
+    case mesh_generic_request_power_level:
+      return mesh_generic_state_power_level;
+    case mesh_generic_request_power_level_default:
+      return mesh_generic_state_power_level_default;
+    case mesh_generic_request_power_level_range:
+      return mesh_generic_state_power_level_range;
+    case mesh_generic_request_transition_time:
+      return mesh_generic_state_transition_time;
+    case mesh_generic_request_location_global:
+      return mesh_generic_state_location_global;
+    case mesh_generic_request_location_local:
+      return mesh_generic_state_location_local;
+    case mesh_generic_request_property_user:
+      return mesh_generic_state_property_user;
+    case mesh_generic_request_property_admin:
+      return mesh_generic_state_property_admin;
+    case mesh_generic_request_property_manuf:
+      return mesh_generic_state_property_manuf;
+    case mesh_lighting_request_lightness_actual:
+      return mesh_lighting_state_lightness_actual;
+    case mesh_lighting_request_lightness_linear:
+      return mesh_lighting_state_lightness_linear;
+    case mesh_lighting_request_lightness_default:
+      return mesh_lighting_state_lightness_default;
+    case mesh_lighting_request_lightness_range:
+      return mesh_lighting_state_lightness_range;
+    case mesh_lighting_request_ctl:
+      return mesh_lighting_state_ctl;
+    case mesh_lighting_request_ctl_temperature:
+      return mesh_lighting_state_ctl_temperature;
+    case mesh_lighting_request_ctl_default:
+      return mesh_lighting_state_ctl_default;
+    case mesh_lighting_request_ctl_temperature_range:
+      return mesh_lighting_state_ctl_temperature_range;
+  }
+  return (mesh_generic_state_t)kind;
+}
+
+static errorcode_t reserve_request(uint16_t model_id,
+                                   uint16_t elem_index,
+                                   uint16_t server_addr,
+                                   uint8_t kind,
+                                   uint32_t timeout_ms,
+                                   mesh_lib_generic_client_request_cb cb,
+                                   struct request **out)
+{
+  struct request *req;
+
+  if (!cb) {
+    return bg_err_invalid_param;
+  }
+  if (find_request(model_id, elem_index, server_addr, kind)) {
+    return bg_err_wrong_state; // already outstanding
+  }
+
+  req = find_free_request();
+  if (!req) {
+    return bg_err_too_many_requests;
+  }
+
+  req->deadline_ms = lib_time_ms() + timeout_ms;
+  req->model_id = model_id;
+  req->elem_index = elem_index;
+  req->server_addr = server_addr;
+  req->kind = kind;
+  req->cb = cb;
+  requests_used++;
+  *out = req;
+  return bg_err_success;
+}
+
+errorcode_t
+mesh_lib_generic_client_get_tracked(uint16_t model_id,
+                                    uint16_t element_index,
+                                    uint16_t server_addr,
+                                    uint16_t appkey_index,
+                                    mesh_generic_state_t kind,
+                                    uint32_t timeout_ms,
+                                    mesh_lib_generic_client_request_cb cb)
+{
+  struct request *req = NULL;
+  errorcode_t res;
+
+  res = reserve_request(model_id, element_index, server_addr, kind,
+                        timeout_ms, cb, &req);
+  if (res != bg_err_success) {
+    return res;
+  }
+
+  res = mesh_lib_generic_client_get(model_id,
+                                    element_index,
+                                    server_addr,
+                                    appkey_index,
+                                    kind);
+  if (res != bg_err_success) {
+    release_request(req);
+  }
+  return res;
+}
+
+errorcode_t
+mesh_lib_generic_client_set_tracked(uint16_t model_id,
+                                    uint16_t element_index,
+                                    uint16_t server_addr,
+                                    uint16_t appkey_index,
+                                    uint8_t transaction_id,
+                                    const struct mesh_generic_request *request,
+                                    uint32_t transition_ms,
+                                    uint16_t delay_ms,
+                                    uint8_t request_flags,
+                                    uint32_t timeout_ms,
+                                    mesh_lib_generic_client_request_cb cb)
+{
+  struct request *req = NULL;
+  errorcode_t res;
+
+  // without a response there is nothing to wait for
+  if (!(request_flags & MESH_REQUEST_FLAG_RESPONSE_REQUIRED)) {
+    return bg_err_invalid_param;
+  }
+
+  res = reserve_request(model_id, element_index, server_addr,
+                        request_status_kind(request->kind),
+                        timeout_ms, cb, &req);
+  if (res != bg_err_success) {
+    return res;
+  }
+
+  res = mesh_lib_generic_client_set(model_id,
+                                    element_index,
+                                    server_addr,
+                                    appkey_index,
+                                    transaction_id,
+                                    request,
+                                    transition_ms,
+                                    delay_ms,
+                                    request_flags);
+  if (res != bg_err_success) {
+    release_request(req);
+  }
+  return res;
+}
+
+void mesh_lib_generic_client_check_timeouts(void)
+{
+  uint32_t now_ms;
+  size_t r;
+
+  if (!requests_used && !sweep.cb) {
+    return;
+  }
+
+  now_ms = lib_time_ms();
+  if (sweep.cb && (int32_t)(now_ms - sweep.deadline_ms) >= 0) {
+    sweep_finish();
+  }
+  for (r = 0; r < requests; r++) {
+    struct request *req = &request[r];
+    if (req->cb && (int32_t)(now_ms - req->deadline_ms) >= 0) {
+      mesh_lib_generic_client_request_cb cb = req->cb;
+      // free the slot first so that the callback can issue a new request
+      release_request(req);
+      (cb)(req->model_id,
+           req->elem_index,
+           req->server_addr,
+           (mesh_generic_state_t)req->kind,
+           bg_err_timeout,
+           NULL,
+           NULL,
+           0);
+    }
+  }
+}
+
+size_t mesh_lib_generic_client_requests_outstanding(void)
+{
+  return requests_used;
+}
+
+errorcode_t
+mesh_lib_generic_client_sweep_start(uint16_t model_id,
+                                    uint16_t element_index,
+                                    uint16_t group_addr,
+                                    uint16_t appkey_index,
+                                    mesh_generic_state_t kind,
+                                    const uint16_t *members,
+                                    size_t num_members,
+                                    size_t max_responses,
+                                    uint32_t window_ms,
+                                    mesh_lib_generic_client_sweep_done_cb cb)
+{
+  size_t table_size = 1;
+  errorcode_t res;
+
+  if (!cb || !max_responses || (num_members && !members)) {
+    return bg_err_invalid_param;
+  }
+  // property states refer to the event buffer and cannot be collected
+  if (kind >= mesh_generic_state_property_user
+      && kind <= mesh_generic_state_property_list_client) {
+    return bg_err_invalid_param;
+  }
+  if (sweep.cb || !lib_malloc_fn) {
+    return bg_err_wrong_state;
+  }
+
+  // keep the load factor at or below one half
+  while (table_size < 2 * max_responses) {
+    table_size <<= 1;
+  }
+  sweep.table = (lib_malloc_fn)(table_size * sizeof(*sweep.table));
+  if (num_members) {
+    sweep.members = (lib_malloc_fn)(num_members * sizeof(uint16_t));
+  }
+  if (!sweep.table || (num_members && !sweep.members)) {
+    sweep_free();
+    return bg_err_out_of_memory;
+  }
+  memset(sweep.table, 0, table_size * sizeof(*sweep.table));
+  if (num_members) {
+    memcpy(sweep.members, members, num_members * sizeof(uint16_t));
+  }
+  sweep.table_size = table_size;
+  sweep.num_members = num_members;
+  sweep.model_id = model_id;
+  sweep.elem_index = element_index;
+  sweep.group_addr = group_addr;
+  sweep.kind = kind;
+
+  res = mesh_lib_generic_client_get(model_id,
+                                    element_index,
+                                    group_addr,
+                                    appkey_index,
+                                    kind);
+  if (res != bg_err_success) {
+    sweep_free();
+    return res;
+  }
+
+  sweep.deadline_ms = lib_time_ms() + window_ms;
+  sweep.cb = cb;
+  return bg_err_success;
+}
+
+void mesh_lib_generic_client_sweep_cancel(void)
+{
+  sweep_free();
 }
 
 errorcode_t
@@ -167,6 +977,14 @@ void mesh_lib_generic_server_event_handler(struct gecko_cmd_packet *evt)
       req = &(evt->data.evt_mesh_generic_server_client_request);
       reg = find_reg(req->model_id, req->elem_index);
       if (reg) {
+        uint32_t now_ms = lib_time_ms();
+        struct dedup *dup = dedup_find(req, now_ms);
+        if (dup) {
+          // retransmission of a request that was already handled
+          dedup_respond(dup, req, now_ms);
+          break;
+        }
+        dedup_insert(req, now_ms);
         if (mesh_lib_deserialize_request(&request,
                                          req->type,
                                          req->parameters.data,
@@ -211,6 +1029,7 @@ void mesh_lib_generic_client_event_handler(struct gecko_cmd_packet *evt)
   struct mesh_generic_state target;
   int has_target;
   struct reg *reg;
+  struct request *req;
 
   if (!evt) {
     return;
@@ -219,17 +1038,57 @@ void mesh_lib_generic_client_event_handler(struct gecko_cmd_packet *evt)
   switch (BGLIB_MSG_ID(evt->header)) {
     case gecko_evt_mesh_generic_client_server_status_id:
       res = &(evt->data.evt_mesh_generic_client_server_status);
-      reg = find_reg(res->model_id, res->elem_index);
-      if (reg) {
+      req = find_request(res->model_id,
+                         res->elem_index,
+                         res->server_address,
+                         res->type);
+      if (req) {
+        mesh_lib_generic_client_request_cb cb = req->cb;
+        release_request(req);
         if (mesh_lib_deserialize_state(&current,
                                        &target,
                                        &has_target,
                                        res->type,
                                        res->parameters.data,
                                        res->parameters.len) == 0) {
-          (reg->client.server_response_cb)(res->model_id,
-                                           res->elem_index,
-                                           res->client_address,
+          (cb)(res->model_id,
+               res->elem_index,
+               res->server_address,
+               (mesh_generic_state_t)res->type,
+               bg_err_success,
+               &current,
+               has_target ? &target : NULL,
+               res->remaining);
+        } else {
+          (cb)(res->model_id,
+               res->elem_index,
+               res->server_address,
+               (mesh_generic_state_t)res->type,
+               bg_err_invalid_param,
+               NULL,
+               NULL,
+               0);
+        }
+        break;
+      }
+      if (sweep.cb
+          && sweep.model_id == res->model_id
+          && sweep.elem_index == res->elem_index
+          && sweep.kind == res->type) {
+        sweep_record(res);
+        break;
+      }
+      reg = find_reg(res->model_id, res->elem_index);
+      if (reg) {
+        if (mesh_lib_deserialize_state(&current,
+                                       &target,
+                                       &has_target,
+                                       res->type,
+                                       res->parameters.data,
+                                       res->parameters.len) == 0) {
+          (reg->client.server_response_cb)(res->model_id,
+                                           res->elem_index,
+                                           res->client_address,
                                            res->server_address,
                                            &current,
                                            has_target ? &target : NULL,
@@ -257,6 +1116,15 @@ mesh_lib_generic_server_response(uint16_t model_id,
   if (mesh_lib_serialize_state(current, target, buf, sizeof(buf), &len) != 0) {
     return bg_err_invalid_param;
   }
+  dedup_store_response(model_id,
+                       element_index,
+                       client_addr,
+                       appkey_index,
+                       current->kind,
+                       remaining_ms,
+                       response_flags,
+                       buf,
+                       len);
   return gecko_cmd_mesh_generic_server_response(model_id,
                                                 element_index,
                                                 client_addr,
@@ -294,6 +1162,11 @@ mesh_lib_generic_server_publish(uint16_t model_id,
                                 uint16_t element_index,
                                 mesh_generic_state_t kind)
 {
+  struct limit *l = limit_find(MESH_LIB_SIG_VENDOR_ID, model_id, element_index);
+
+  if (l && !limit_admit_server(l, kind)) {
+    return bg_err_success;
+  }
   return gecko_cmd_mesh_generic_server_publish(model_id,
                                                element_index,
                                                kind)->result;
@@ -353,10 +1226,23 @@ mesh_lib_generic_client_publish(uint16_t model_id,
 {
   uint8_t buf[10];
   size_t len;
+  struct limit *l;
 
   if (mesh_lib_serialize_request(request, buf, sizeof(buf), &len) != 0) {
     return bg_err_invalid_param;
   }
+  l = limit_find(MESH_LIB_SIG_VENDOR_ID, model_id, element_index);
+  if (l && !limit_admit(l)) {
+    l->pending = PENDING_CLIENT;
+    l->client.transaction_id = transaction_id;
+    l->client.flags = request_flags;
+    l->client.kind = request->kind;
+    l->client.len = len;
+    l->client.delay_ms = delay_ms;
+    l->client.transition_ms = transition_ms;
+    memcpy(l->client.buf, buf, len);
+    return bg_err_success;
+  }
   return gecko_cmd_mesh_generic_client_publish(model_id,
                                                element_index,
                                                transaction_id,
@@ -367,3 +1253,805 @@ mesh_lib_generic_client_publish(uint16_t model_id,
                                                len,
                                                buf)->result;
 }
+
+/*
+ * Registered vendor models. Each registration holds a handler slot for
+ * every one of the 64 vendor opcodes, so that a received message is
+ * dispatched by indexing with its opcode.
+ */
+struct vendor_reg {
+  uint16_t vendor_id;
+  uint16_t model_id;
+  uint16_t elem_index;
+  uint8_t used;
+  mesh_lib_vendor_model_message_cb handler[MESH_LIB_VENDOR_OPCODES];
+};
+
+static struct vendor_reg *vendor_reg = NULL;
+static size_t vendor_regs = 0;
+
+/*
+ * A message longer than fits in one event arrives in several receive
+ * events, the last one with final set. The parts are collected here.
+ */
+static struct {
+  uint8_t *data;
+  size_t len;
+  uint16_t source_addr;
+  uint8_t opcode;
+  uint8_t overflow;
+  struct vendor_reg *reg;
+} vendor_rx;
+
+static struct mesh_lib_vendor_model_stats vendor_stats;
+
+static struct vendor_reg *find_vendor_reg(uint16_t vendor_id,
+                                          uint16_t model_id,
+                                          uint16_t elem_index)
+{
+  size_t r;
+  for (r = 0; r < vendor_regs; r++) {
+    if (vendor_reg[r].used
+        && vendor_reg[r].vendor_id == vendor_id
+        && vendor_reg[r].model_id == model_id
+        && vendor_reg[r].elem_index == elem_index) {
+      return &vendor_reg[r];
+    }
+  }
+  return NULL;
+}
+
+static void count_sent(size_t payload_len)
+{
+  vendor_stats.sent++;
+  if (payload_len > MESH_LIB_VENDOR_UNSEG_PAYLOAD) {
+    vendor_stats.segmented++;
+  } else {
+    vendor_stats.unsegmented++;
+  }
+}
+
+errorcode_t mesh_lib_vendor_init(size_t vendor_models)
+{
+  if (vendor_reg || !lib_malloc_fn) {
+    return bg_err_wrong_state;
+  }
+  if (!vendor_models) {
+    return bg_err_invalid_param;
+  }
+
+  vendor_reg = (lib_malloc_fn)(vendor_models * sizeof(struct vendor_reg));
+  vendor_rx.data = (lib_malloc_fn)(MESH_LIB_VENDOR_MAX_PAYLOAD);
+  if (!vendor_reg || !vendor_rx.data) {
+    mesh_lib_vendor_deinit();
+    return bg_err_out_of_memory;
+  }
+  memset(vendor_reg, 0, vendor_models * sizeof(struct vendor_reg));
+  vendor_regs = vendor_models;
+  memset(&vendor_stats, 0, sizeof(vendor_stats));
+
+  return bg_err_success;
+}
+
+void mesh_lib_vendor_deinit(void)
+{
+  mesh_lib_vendor_pack_deinit();
+  if (vendor_reg) {
+    (lib_free_fn)(vendor_reg);
+    vendor_reg = NULL;
+    vendor_regs = 0;
+  }
+  if (vendor_rx.data) {
+    (lib_free_fn)(vendor_rx.data);
+  }
+  memset(&vendor_rx, 0, sizeof(vendor_rx));
+}
+
+errorcode_t
+mesh_lib_vendor_model_register(uint16_t vendor_id,
+                               uint16_t model_id,
+                               uint16_t element_index,
+                               uint8_t publish,
+                               const struct mesh_lib_vendor_model_handler *handlers,
+                               size_t num_handlers)
+{
+  struct vendor_reg *r;
+  uint8_t opcodes[MESH_LIB_VENDOR_OPCODES];
+  errorcode_t res;
+  size_t n;
+
+  if (num_handlers > MESH_LIB_VENDOR_OPCODES) {
+    return bg_err_invalid_param;
+  }
+  for (n = 0; n < num_handlers; n++) {
+    if (handlers[n].opcode >= MESH_LIB_VENDOR_OPCODES || !handlers[n].cb) {
+      return bg_err_invalid_param;
+    }
+    opcodes[n] = handlers[n].opcode;
+  }
+  if (find_vendor_reg(vendor_id, model_id, element_index)) {
+    return bg_err_wrong_state;
+  }
+
+  r = NULL;
+  for (n = 0; n < vendor_regs; n++) {
+    if (!vendor_reg[n].used) {
+      r = &vendor_reg[n];
+      break;
+    }
+  }
+  if (!r) {
+    return bg_err_out_of_memory;
+  }
+
+  // the stack passes up only the opcodes given here
+  res = gecko_cmd_mesh_vendor_model_init(element_index,
+                                         vendor_id,
+                                         model_id,
+                                         publish,
+                                         num_handlers,
+                                         opcodes)->result;
+  if (res != bg_err_success) {
+    return res;
+  }
+
+  memset(r, 0, sizeof(*r));
+  r->vendor_id = vendor_id;
+  r->model_id = model_id;
+  r->elem_index = element_index;
+  r->used = 1;
+  for (n = 0; n < num_handlers; n++) {
+    r->handler[handlers[n].opcode] = handlers[n].cb;
+  }
+
+  return bg_err_success;
+}
+
+errorcode_t
+mesh_lib_vendor_model_unregister(uint16_t vendor_id,
+                                 uint16_t model_id,
+                                 uint16_t element_index)
+{
+  struct vendor_reg *r = find_vendor_reg(vendor_id, model_id, element_index);
+
+  if (!r) {
+    return bg_err_wrong_state;
+  }
+  if (vendor_rx.reg == r) {
+    vendor_rx.reg = NULL;
+    vendor_rx.len = 0;
+  }
+  memset(r, 0, sizeof(*r));
+  return gecko_cmd_mesh_vendor_model_deinit(element_index,
+                                            vendor_id,
+                                            model_id)->result;
+}
+
+void mesh_lib_vendor_model_event_handler(struct gecko_cmd_packet *evt)
+{
+  struct gecko_msg_mesh_vendor_model_receive_evt_t *rcv;
+  struct mesh_lib_vendor_model_message msg;
+  mesh_lib_vendor_model_message_cb cb;
+  struct vendor_reg *r;
+
+  if (!evt
+      || BGLIB_MSG_ID(evt->header) != gecko_evt_mesh_vendor_model_receive_id) {
+    return;
+  }
+
+  rcv = &(evt->data.evt_mesh_vendor_model_receive);
+  vendor_stats.received++;
+
+  r = find_vendor_reg(rcv->vendor_id, rcv->model_id, rcv->elem_index);
+  if (!r || !vendor_rx.data) {
+    vendor_stats.unknown_model++;
+    return;
+  }
+  cb = r->handler[rcv->opcode & (MESH_LIB_VENDOR_OPCODES - 1)];
+  if (rcv->opcode >= MESH_LIB_VENDOR_OPCODES || !cb) {
+    vendor_stats.unknown_opcode++;
+    return;
+  }
+
+  // a part of another message means the rest of that one was lost
+  if (vendor_rx.len
+      && (vendor_rx.reg != r
+          || vendor_rx.source_addr != rcv->source_address
+          || vendor_rx.opcode != rcv->opcode)) {
+    vendor_stats.incomplete++;
+    vendor_rx.len = 0;
+  }
+  if (vendor_rx.len == 0) {
+    vendor_rx.reg = r;
+    vendor_rx.source_addr = rcv->source_address;
+    vendor_rx.opcode = rcv->opcode;
+    vendor_rx.overflow = 0;
+  }
+  if (vendor_rx.len + rcv->payload.len > MESH_LIB_VENDOR_MAX_PAYLOAD) {
+    vendor_rx.overflow = 1;
+  } else {
+    memcpy(vendor_rx.data + vendor_rx.len,
+           rcv->payload.data,
+           rcv->payload.len);
+    vendor_rx.len += rcv->payload.len;
+  }
+  if (!rcv->final) {
+    vendor_stats.partial++;
+    return;
+  }
+
+  if (vendor_rx.overflow) {
+    vendor_stats.incomplete++;
+    vendor_rx.len = 0;
+    return;
+  }
+
+  msg.vendor_id = rcv->vendor_id;
+  msg.model_id = rcv->model_id;
+  msg.element_index = rcv->elem_index;
+  msg.source_addr = rcv->source_address;
+  msg.destination_addr = rcv->destination_address;
+  msg.appkey_index = rcv->appkey_index;
+  msg.opcode = rcv->opcode;
+  msg.flags = rcv->nonrelayed ? MESH_REQUEST_FLAG_NONRELAYED : 0;
+  msg.payload = vendor_rx.data;
+  msg.payload_len = vendor_rx.len;
+  vendor_rx.len = 0;
+
+  vendor_stats.dispatched++;
+  (cb)(&msg);
+}
+
+errorcode_t
+mesh_lib_vendor_model_send(uint16_t vendor_id,
+                           uint16_t model_id,
+                           uint16_t element_index,
+                           uint16_t destination_addr,
+                           uint16_t appkey_index,
+                           uint8_t opcode,
+                           const uint8_t *payload,
+                           size_t payload_len,
+                           uint8_t request_flags)
+{
+  errorcode_t res;
+  size_t offset = 0;
+  size_t len;
+
+  if (opcode >= MESH_LIB_VENDOR_OPCODES
+      || payload_len > MESH_LIB_VENDOR_MAX_PAYLOAD) {
+    return bg_err_invalid_param;
+  }
+
+  // longer payloads are passed to the stack in several commands
+  do {
+    len = payload_len - offset;
+    if (len > MESH_LIB_VENDOR_CMD_PAYLOAD) {
+      len = MESH_LIB_VENDOR_CMD_PAYLOAD;
+    }
+    res = gecko_cmd_mesh_vendor_model_send(element_index,
+                                           vendor_id,
+                                           model_id,
+                                           destination_addr,
+                                           0,
+                                           appkey_index,
+                                           (request_flags & MESH_REQUEST_FLAG_NONRELAYED) ? 1 : 0,
+                                           opcode,
+                                           offset + len == payload_len,
+                                           len,
+                                           payload + offset)->result;
+    offset += len;
+  } while (res == bg_err_success && offset < payload_len);
+
+  if (res == bg_err_success) {
+    count_sent(payload_len);
+  } else {
+    vendor_stats.send_errors++;
+  }
+  return res;
+}
+
+errorcode_t
+mesh_lib_vendor_model_reply(const struct mesh_lib_vendor_model_message *msg,
+                            uint8_t opcode,
+                            const uint8_t *payload,
+                            size_t payload_len)
+{
+  return mesh_lib_vendor_model_send(msg->vendor_id,
+                                    msg->model_id,
+                                    msg->element_index,
+                                    msg->source_addr,
+                                    msg->appkey_index,
+                                    opcode,
+                                    payload,
+                                    payload_len,
+                                    msg->flags);
+}
+
+errorcode_t
+mesh_lib_vendor_model_publish(uint16_t vendor_id,
+                              uint16_t model_id,
+                              uint16_t element_index,
+                              uint8_t opcode,
+                              const uint8_t *payload,
+                              size_t payload_len)
+{
+  errorcode_t res;
+  size_t offset = 0;
+  size_t len;
+
+  if (opcode >= MESH_LIB_VENDOR_OPCODES
+      || payload_len > MESH_LIB_VENDOR_MAX_PAYLOAD) {
+    return bg_err_invalid_param;
+  }
+
+  do {
+    len = payload_len - offset;
+    if (len > MESH_LIB_VENDOR_CMD_PAYLOAD) {
+      len = MESH_LIB_VENDOR_CMD_PAYLOAD;
+    }
+    res = gecko_cmd_mesh_vendor_model_set_publication(element_index,
+                                                      vendor_id,
+                                                      model_id,
+                                                      opcode,
+                                                      offset + len == payload_len,
+                                                      len,
+                                                      payload + offset)->result;
+    offset += len;
+  } while (res == bg_err_success && offset < payload_len);
+
+  // the publication message is set, only the publish itself may wait
+  if (res == bg_err_success) {
+    struct limit *l = limit_find(vendor_id, model_id, element_index);
+    if (l && !limit_admit(l)) {
+      l->pending = PENDING_VENDOR;
+      l->vendor_len = payload_len;
+      return bg_err_success;
+    }
+    res = gecko_cmd_mesh_vendor_model_publish(element_index,
+                                              vendor_id,
+                                              model_id)->result;
+  }
+
+  if (res == bg_err_success) {
+    count_sent(payload_len);
+  } else {
+    vendor_stats.send_errors++;
+  }
+  return res;
+}
+
+void mesh_lib_vendor_model_get_stats(struct mesh_lib_vendor_model_stats *stats)
+{
+  *stats = vendor_stats;
+}
+
+void mesh_lib_vendor_model_reset_stats(void)
+{
+  memset(&vendor_stats, 0, sizeof(vendor_stats));
+}
+
+/*
+ * Records waiting to be packed, one buffer per destination. A buffer is
+ * sent when the next record does not fit, when it is full, or when the
+ * earliest deadline of its records has passed. If the stack has no room
+ * for the message, the buffer is kept and sent again from
+ * mesh_lib_vendor_pack_check_timeouts(), up to MESH_LIB_VENDOR_PACK_TRIES
+ * times.
+ */
+#ifndef MESH_LIB_VENDOR_PACK_TRIES
+#define MESH_LIB_VENDOR_PACK_TRIES 50
+#endif
+
+struct pack_buf {
+  uint8_t used;
+  uint8_t len;
+  uint8_t records;
+  uint8_t tries;
+  uint8_t full;              // made to be sent because it was full
+  uint16_t vendor_id;
+  uint16_t model_id;
+  uint16_t elem_index;
+  uint16_t destination_addr;
+  uint16_t appkey_index;
+  uint32_t deadline_ms;
+  uint8_t data[MESH_LIB_VENDOR_UNSEG_PAYLOAD];
+};
+
+static struct pack_buf *pack_buf = NULL;
+static size_t pack_bufs = 0;
+static uint8_t pack_opcode;
+
+/*
+ * Sends a buffer, full tells why. On an error the buffer is still used
+ * if it is kept to be sent again; otherwise its records are lost.
+ */
+static errorcode_t pack_send(struct pack_buf *b, uint8_t full)
+{
+  errorcode_t res = mesh_lib_vendor_model_send(b->vendor_id,
+                                               b->model_id,
+                                               b->elem_index,
+                                               b->destination_addr,
+                                               b->appkey_index,
+                                               pack_opcode,
+                                               b->data,
+                                               b->len,
+                                               0);
+
+  b->full |= full;
+  if (res == bg_err_success) {
+    if (b->full) {
+      vendor_stats.pack_flush_full++;
+    } else {
+      vendor_stats.pack_flush_deadline++;
+    }
+  } else if (res == bg_err_out_of_memory && ++b->tries < MESH_LIB_VENDOR_PACK_TRIES) {
+    vendor_stats.pack_retries++;
+    return res;
+  } else {
+    vendor_stats.pack_lost += b->records;
+  }
+  b->used = 0;
+  return res;
+}
+
+static struct pack_buf *pack_find(uint16_t vendor_id,
+                                  uint16_t model_id,
+                                  uint16_t elem_index,
+                                  uint16_t destination_addr,
+                                  uint16_t appkey_index)
+{
+  size_t i;
+  for (i = 0; i < pack_bufs; i++) {
+    struct pack_buf *b = &pack_buf[i];
+    if (b->used
+        && b->vendor_id == vendor_id
+        && b->model_id == model_id
+        && b->elem_index == elem_index
+        && b->destination_addr == destination_addr
+        && b->appkey_index == appkey_index) {
+      return b;
+    }
+  }
+  return NULL;
+}
+
+errorcode_t mesh_lib_vendor_pack_init(uint8_t opcode, size_t destinations)
+{
+  if (pack_buf || !lib_malloc_fn) {
+    return bg_err_wrong_state;
+  }
+  if (opcode >= MESH_LIB_VENDOR_OPCODES || !destinations) {
+    return bg_err_invalid_param;
+  }
+
+  pack_buf = (lib_malloc_fn)(destinations * sizeof(struct pack_buf));
+  if (!pack_buf) {
+    return bg_err_out_of_memory;
+  }
+  memset(pack_buf, 0, destinations * sizeof(struct pack_buf));
+  pack_bufs = destinations;
+  pack_opcode = opcode;
+
+  return bg_err_success;
+}
+
+void mesh_lib_vendor_pack_deinit(void)
+{
+  if (pack_buf) {
+    (lib_free_fn)(pack_buf);
+    pack_buf = NULL;
+    pack_bufs = 0;
+  }
+}
+
+errorcode_t
+mesh_lib_vendor_pack_add(uint16_t vendor_id,
+                         uint16_t model_id,
+                         uint16_t element_index,
+                         uint16_t destination_addr,
+                         uint16_t appkey_index,
+                         uint8_t type,
+                         const uint8_t *data,
+                         size_t len,
+                         uint32_t max_delay_ms)
+{
+  uint8_t msg[MESH_LIB_VENDOR_MAX_PAYLOAD];
+  uint32_t now_ms = lib_time_ms();
+  struct pack_buf *b;
+  errorcode_t res;
+  size_t i;
+
+  if (!pack_buf) {
+    return bg_err_wrong_state;
+  }
+  if (type > MESH_LIB_VENDOR_PACK_MAX_TYPE
+      || len + 1 > MESH_LIB_VENDOR_MAX_PAYLOAD) {
+    return bg_err_invalid_param;
+  }
+  vendor_stats.records++;
+
+  b = pack_find(vendor_id, model_id, element_index, destination_addr, appkey_index);
+
+  // too long to be packed: sent on its own, after what is waiting, to keep the order
+  if (len > MESH_LIB_VENDOR_PACK_RECORD_MAX) {
+    if (b) {
+      res = pack_send(b, 1);
+      if (b->used) {
+        return res;
+      }
+    }
+    msg[0] = type; // length 0: to the end of the message
+    memcpy(msg + 1, data, len);
+    return mesh_lib_vendor_model_send(vendor_id,
+                                      model_id,
+                                      element_index,
+                                      destination_addr,
+                                      appkey_index,
+                                      pack_opcode,
+                                      msg,
+                                      len + 1,
+                                      0);
+  }
+
+  // a buffer that cannot be sent to make room is kept, the record is refused
+  if (b && b->len + 1 + len > sizeof(b->data)) {
+    res = pack_send(b, 1);
+    if (b->used) {
+      return res;
+    }
+    b = NULL;
+  }
+  if (!b) {
+    // a free buffer, or the one that is due first
+    for (i = 0; i < pack_bufs; i++) {
+      if (!pack_buf[i].used) {
+        b = &pack_buf[i];
+        break;
+      }
+      if (!b || (int32_t)(pack_buf[i].deadline_ms - b->deadline_ms) < 0) {
+        b = &pack_buf[i];
+      }
+    }
+    if (b->used) {
+      res = pack_send(b, 1);
+      if (b->used) {
+        return res;
+      }
+    }
+    b->used = 1;
+    b->len = 0;
+    b->records = 0;
+    b->tries = 0;
+    b->full = 0;
+    b->vendor_id = vendor_id;
+    b->model_id = model_id;
+    b->elem_index = element_index;
+    b->destination_addr = destination_addr;
+    b->appkey_index = appkey_index;
+    b->deadline_ms = now_ms + max_delay_ms;
+  }
+
+  b->data[b->len++] = (uint8_t)((len << MESH_LIB_VENDOR_PACK_LEN_SHIFT) | type);
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+  b->records++;
+  if ((int32_t)(now_ms + max_delay_ms - b->deadline_ms) < 0) {
+    b->deadline_ms = now_ms + max_delay_ms;
+  }
+
+  // sent when no record with data fits any more; an empty record extends
+  // to the end of the message, so nothing may follow it. A buffer kept to
+  // be sent again holds the record, so that is not an error.
+  res = bg_err_success;
+  if ((size_t)b->len + 1 >= sizeof(b->data) || len == 0 || max_delay_ms == 0) {
+    res = pack_send(b, max_delay_ms != 0);
+    if (b->used) {
+      res = bg_err_success;
+    }
+  }
+  return res;
+}
+
+void mesh_lib_vendor_pack_check_timeouts(void)
+{
+  uint32_t now_ms;
+  size_t i;
+
+  // the clock is only read when something is waiting
+  for (i = 0; i < pack_bufs && !pack_buf[i].used; i++)
+    ;
+  if (i == pack_bufs) {
+    return;
+  }
+  now_ms = lib_time_ms();
+  for (i = 0; i < pack_bufs; i++) {
+    if (pack_buf[i].used && (int32_t)(now_ms - pack_buf[i].deadline_ms) >= 0) {
+      pack_send(&pack_buf[i], 0);
+    }
+  }
+}
+
+void mesh_lib_vendor_pack_flush(void)
+{
+  size_t i;
+
+  for (i = 0; i < pack_bufs; i++) {
+    if (pack_buf[i].used) {
+      pack_send(&pack_buf[i], 0);
+    }
+  }
+}
+
+int mesh_lib_vendor_unpack(const struct mesh_lib_vendor_model_message *msg,
+                           mesh_lib_vendor_record_cb cb)
+{
+  size_t pos = 0;
+  size_t len;
+  int records = 0;
+  uint8_t hdr;
+
+  while (pos < msg->payload_len) {
+    hdr = msg->payload[pos++];
+    len = hdr >> MESH_LIB_VENDOR_PACK_LEN_SHIFT;
+    if (len == 0) {
+      len = msg->payload_len - pos;
+    }
+    if (pos + len > msg->payload_len) {
+      return -1;
+    }
+    (cb)(msg, hdr & MESH_LIB_VENDOR_PACK_MAX_TYPE, msg->payload + pos, len);
+    pos += len;
+    records++;
+  }
+  return records;
+}
+
+/* sends the oldest publication held back, its credit is taken already */
+static void limit_release(struct limit *l)
+{
+  errorcode_t res;
+
+  switch (l->pending) {
+    case PENDING_SERVER:
+      res = gecko_cmd_mesh_generic_server_publish(l->model_id,
+                                                  l->elem_index,
+                                                  (mesh_generic_state_t)l->server.kind[0])->result;
+      limit_kind_remove(l, 0);
+      break;
+    case PENDING_CLIENT:
+      res = gecko_cmd_mesh_generic_client_publish(l->model_id,
+                                                  l->elem_index,
+                                                  l->client.transaction_id,
+                                                  l->client.transition_ms,
+                                                  l->client.delay_ms,
+                                                  l->client.flags,
+                                                  l->client.kind,
+                                                  l->client.len,
+                                                  l->client.buf)->result;
+      l->pending = PENDING_NONE;
+      break;
+    default:
+      res = gecko_cmd_mesh_vendor_model_publish(l->elem_index,
+                                                l->vendor_id,
+                                                l->model_id)->result;
+      if (res == bg_err_success) {
+        count_sent(l->vendor_len);
+      } else {
+        vendor_stats.send_errors++;
+      }
+      l->pending = PENDING_NONE;
+      break;
+  }
+  if (res == bg_err_success) {
+    l->stats.delayed++;
+  } else {
+    l->stats.dropped++;
+  }
+}
+
+errorcode_t mesh_lib_publish_limit_init(size_t max_limits)
+{
+  if (limit || !lib_malloc_fn) {
+    return bg_err_wrong_state;
+  }
+  if (!max_limits) {
+    return bg_err_invalid_param;
+  }
+
+  limit = (lib_malloc_fn)(max_limits * sizeof(struct limit));
+  if (!limit) {
+    return bg_err_out_of_memory;
+  }
+  memset(limit, 0, max_limits * sizeof(struct limit));
+  limits = max_limits;
+
+  return bg_err_success;
+}
+
+errorcode_t
+mesh_lib_publish_limit_set(uint16_t vendor_id,
+                           uint16_t model_id,
+                           uint16_t element_index,
+                           uint32_t interval_ms,
+                           uint16_t burst)
+{
+  struct limit *l = limit_find(vendor_id, model_id, element_index);
+  size_t n;
+
+  if (!limit) {
+    return bg_err_wrong_state;
+  }
+  if (interval_ms == 0) {
+    // the publications held back are sent right away
+    if (l) {
+      while (l->pending != PENDING_NONE) {
+        limit_release(l);
+      }
+      l->used = 0;
+    }
+    return bg_err_success;
+  }
+  if (burst == 0 || (uint64_t)interval_ms * burst > 0x7fffffff) {
+    return bg_err_invalid_param;
+  }
+
+  if (!l) {
+    for (n = 0; n < limits && limit[n].used; n++)
+      ;
+    if (n == limits) {
+      return bg_err_out_of_memory;
+    }
+    l = &limit[n];
+    memset(l, 0, sizeof(*l));
+    l->used = 1;
+    l->vendor_id = vendor_id;
+    l->model_id = model_id;
+    l->elem_index = element_index;
+    l->last_ms = lib_time_ms();
+    l->credit_ms = interval_ms * burst; // a new bucket starts full
+  }
+  l->interval_ms = interval_ms;
+  l->max_credit_ms = interval_ms * burst;
+  if (l->credit_ms > l->max_credit_ms) {
+    l->credit_ms = l->max_credit_ms;
+  }
+
+  return bg_err_success;
+}
+
+void mesh_lib_publish_limit_check_timeouts(void)
+{
+  uint32_t now_ms = 0;
+  struct limit *l;
+  size_t n;
+
+  for (n = 0; n < limits; n++) {
+    l = &limit[n];
+    if (!l->used || l->pending == PENDING_NONE) {
+      continue;
+    }
+    if (!now_ms) {
+      now_ms = lib_time_ms();
+    }
+    limit_refill(l, now_ms);
+    while (l->pending != PENDING_NONE && l->credit_ms >= l->interval_ms) {
+      l->credit_ms -= l->interval_ms;
+      limit_release(l);
+    }
+  }
+}
+
+errorcode_t
+mesh_lib_publish_limit_get_stats(uint16_t vendor_id,
+                                 uint16_t model_id,
+                                 uint16_t element_index,
+                                 struct mesh_lib_publish_limit_stats *stats)
+{
+  struct limit *l = limit_find(vendor_id, model_id, element_index);
+
+  if (!l) {
+    return bg_err_invalid_param;
+  }
+  *stats = l->stats;
+  return bg_err_success;
+}
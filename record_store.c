@@ -0,0 +1,688 @@
+#include "record_store.h"
+
+#include <string.h>
+
+#include "flash_cache.h"
+#ifndef MX25_EMULATOR
+#include "mx25flash_spi.h"
+#include "native_gecko.h"
+#else
+#include "mx25_emu.h"
+#endif
+
+#define SEG_MAGIC            0x32475352   /* "RSG2" */
+#define SEG_HEADER_SIZE      20
+#define SEG_SEQ_FREE         0xFFFFFFFF
+
+#define REC_HEADER_SIZE      8
+#define REC_TYPE_DATA        0x01
+#define REC_TYPE_TOMBSTONE   0x02
+
+#define SEG_NONE             0xFFFF
+
+/* index location: segment number in the upper half, offset in the lower half */
+#define LOC(seg, off)        (((uint32_t)(seg) << 16) | (off))
+#define LOC_SEG(loc)         ((uint16_t)(((loc) >> 16) & 0x7FFF))
+#define LOC_OFF(loc)         ((uint16_t)((loc) & 0xFFFF))
+#define LOC_TOMBSTONE        0x80000000
+
+#define INDEX_SIZE           (2 * REC_STORE_MAX_RECORDS + 1)
+
+#define ALIGN4(n)            (((n) + 3) & ~3)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t erase_count;
+  uint32_t erase_count_inv;   /* ~erase_count, validates the header */
+  uint32_t sequence;          /* SEG_SEQ_FREE while the segment is erased */
+  uint32_t sequence_inv;      /* ~sequence, programmed together with it */
+} tsSegHeader;
+
+typedef struct {
+  uint16_t key;
+  uint16_t len;
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t crc;
+} tsRecHeader;
+
+typedef struct {
+  uint32_t erase_count;
+  uint32_t sequence;
+  uint16_t write_offset;      /* REC_STORE_SEGMENT_SIZE once the segment is sealed */
+  uint16_t live_bytes;
+} tsSegment;
+
+static tsSegment segments[REC_STORE_NUM_SEGMENTS];
+static uint16_t active_seg = SEG_NONE;
+static uint32_t next_sequence;
+static uint16_t free_segments;
+static uint8_t mounted;
+
+static uint16_t index_key[INDEX_SIZE];
+static uint32_t index_loc[INDEX_SIZE];
+static uint16_t index_count;
+
+static tsRecordStoreStats stats;
+
+/* bounce buffer for verifying and moving records, one flash page */
+static uint8_t page_buf[Page_Offset];
+
+// local functions
+
+static uint32_t time_ms(void)
+{
+#ifndef MX25_EMULATOR
+  struct gecko_msg_hardware_get_time_rsp_t *t = gecko_cmd_hardware_get_time();
+  return t->seconds * 1000 + ((uint32_t)t->ticks * 1000) / 32768;
+#else
+  return (uint32_t)(mx25_emu_time_us() / 1000);
+#endif
+}
+
+/* sequence numbers wrap, a is older than b if it is less than half the range behind */
+static int seq_before(uint32_t a, uint32_t b)
+{
+  return (int32_t)(a - b) < 0;
+}
+
+static uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+  static const uint16_t nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+  };
+  uint32_t i;
+
+  for (i = 0; i < len; i++) {
+    crc = (crc << 4) ^ nibble[(crc >> 12) ^ (data[i] >> 4)];
+    crc = (crc << 4) ^ nibble[(crc >> 12) ^ (data[i] & 0x0F)];
+  }
+  return crc;
+}
+
+static uint32_t seg_addr(uint16_t seg)
+{
+  return REC_STORE_BASE_ADDR + (uint32_t)seg * REC_STORE_SEGMENT_SIZE;
+}
+
+static errorcode_t flash_read(uint32_t addr, void *buf, uint32_t len)
+{
+  return flash_cache_read(addr, buf, len);
+}
+
+static errorcode_t flash_program(uint32_t addr, const void *buf, uint32_t len)
+{
+  errorcode_t res = flash_cache_program(addr, buf, len);
+
+  if (res == bg_err_success) {
+    stats.flash_bytes += len;
+  }
+  return res;
+}
+
+static errorcode_t seg_erase(uint16_t seg)
+{
+  tsSegHeader hdr;
+
+  if (flash_cache_erase_sector(seg_addr(seg)) != bg_err_success) {
+    return bg_err_hardware;
+  }
+  stats.erases++;
+
+  segments[seg].erase_count++;
+  segments[seg].sequence = SEG_SEQ_FREE;
+  segments[seg].write_offset = SEG_HEADER_SIZE;
+  segments[seg].live_bytes = 0;
+
+  // erase count survives the erase by being written back right away, sequence is left erased
+  hdr.magic = SEG_MAGIC;
+  hdr.erase_count = segments[seg].erase_count;
+  hdr.erase_count_inv = ~segments[seg].erase_count;
+  hdr.sequence = SEG_SEQ_FREE;
+  hdr.sequence_inv = SEG_SEQ_FREE;
+  return flash_program(seg_addr(seg), &hdr, sizeof(hdr));
+}
+
+static uint32_t index_hash(uint16_t key)
+{
+  return ((uint32_t)key * 40503u) % INDEX_SIZE;
+}
+
+static uint32_t index_find(uint16_t key)
+{
+  uint32_t bucket = index_hash(key);
+
+  while (index_key[bucket] != REC_STORE_KEY_INVALID) {
+    if (index_key[bucket] == key) {
+      return bucket;
+    }
+    bucket = (bucket + 1) % INDEX_SIZE;
+  }
+  return INDEX_SIZE;
+}
+
+static void index_remove(uint32_t bucket)
+{
+  uint32_t hole = bucket, next, home;
+
+  index_key[hole] = REC_STORE_KEY_INVALID;
+  index_count--;
+  next = (hole + 1) % INDEX_SIZE;
+
+  while (index_key[next] != REC_STORE_KEY_INVALID) {
+    home = index_hash(index_key[next]);
+    if ((next > hole && (home <= hole || home > next))
+        || (next < hole && (home <= hole && home > next))) {
+      index_key[hole] = index_key[next];
+      index_loc[hole] = index_loc[next];
+      index_key[next] = REC_STORE_KEY_INVALID;
+      hole = next;
+    }
+    next = (next + 1) % INDEX_SIZE;
+  }
+}
+
+static uint16_t rec_size(uint16_t len)
+{
+  return ALIGN4(REC_HEADER_SIZE + len);
+}
+
+/*
+ * Point the index at a newly written record and account the space of the copy it
+ * replaces as garbage.
+ */
+static errorcode_t index_update(uint16_t key, uint16_t seg, uint16_t off, uint16_t len, uint8_t type)
+{
+  uint32_t bucket = index_find(key);
+  uint32_t loc = LOC(seg, off);
+  tsRecHeader old;
+
+  if (bucket < INDEX_SIZE) {
+    uint32_t old_loc = index_loc[bucket];
+    if (flash_read(seg_addr(LOC_SEG(old_loc)) + LOC_OFF(old_loc), &old, sizeof(old)) == bg_err_success) {
+      segments[LOC_SEG(old_loc)].live_bytes -= rec_size(old.len);
+    }
+  } else {
+    if (index_count >= REC_STORE_MAX_RECORDS) {
+      return bg_err_out_of_memory;
+    }
+    bucket = index_hash(key);
+    while (index_key[bucket] != REC_STORE_KEY_INVALID) {
+      bucket = (bucket + 1) % INDEX_SIZE;
+    }
+    index_key[bucket] = key;
+    index_count++;
+  }
+
+  if (type == REC_TYPE_TOMBSTONE) {
+    loc |= LOC_TOMBSTONE;
+  }
+  index_loc[bucket] = loc;
+  segments[seg].live_bytes += rec_size(len);
+  return bg_err_success;
+}
+
+static uint16_t pick_free_segment(void)
+{
+  uint16_t best = SEG_NONE;
+  uint16_t seg;
+
+  // wear leveling: the least worn free segment is used first
+  for (seg = 0; seg < REC_STORE_NUM_SEGMENTS; seg++) {
+    if (segments[seg].sequence == SEG_SEQ_FREE
+        && (best == SEG_NONE || segments[seg].erase_count < segments[best].erase_count)) {
+      best = seg;
+    }
+  }
+  return best;
+}
+
+static errorcode_t open_segment(int for_compaction)
+{
+  uint16_t seg;
+  uint32_t seq[2];
+
+  // the last free segment is kept as the destination for compaction
+  if (free_segments == 0 || (free_segments == 1 && !for_compaction)) {
+    return bg_err_out_of_memory;
+  }
+
+  seg = pick_free_segment();
+  if (seg == SEG_NONE) {
+    return bg_err_out_of_memory;
+  }
+
+  // the value marking a free segment is skipped when the counter wraps
+  seq[0] = next_sequence++;
+  if (seq[0] == SEG_SEQ_FREE) {
+    seq[0] = next_sequence++;
+  }
+  seq[1] = ~seq[0];
+  if (flash_program(seg_addr(seg) + offsetof(tsSegHeader, sequence), seq, sizeof(seq)) != bg_err_success) {
+    return bg_err_hardware;
+  }
+  segments[seg].sequence = seq[0];
+  free_segments--;
+  active_seg = seg;
+  return bg_err_success;
+}
+
+/* find room for a record of 'size' bytes in the active segment */
+static errorcode_t reserve_space(uint16_t size, int for_compaction)
+{
+  errorcode_t res;
+
+  if (active_seg != SEG_NONE && segments[active_seg].write_offset + size <= REC_STORE_SEGMENT_SIZE) {
+    return bg_err_success;
+  }
+  if (active_seg != SEG_NONE) {
+    segments[active_seg].write_offset = REC_STORE_SEGMENT_SIZE;
+  }
+
+  res = open_segment(for_compaction);
+  while (res == bg_err_out_of_memory && !for_compaction) {
+    // out of free segments, reclaim space synchronously
+    if (!record_store_compact_step()) {
+      return bg_err_out_of_memory;
+    }
+    res = open_segment(0);
+  }
+  return res;
+}
+
+static errorcode_t append(uint16_t key, uint8_t type, const void *data, uint16_t len)
+{
+  tsRecHeader hdr;
+  uint16_t size = rec_size(len);
+  uint16_t off;
+  uint32_t addr;
+  errorcode_t res;
+
+  res = reserve_space(size, 0);
+  if (res != bg_err_success) {
+    return res;
+  }
+
+  hdr.key = key;
+  hdr.len = len;
+  hdr.type = type;
+  hdr.reserved = 0xFF;
+  hdr.crc = crc16_update(0xFFFF, (const uint8_t *)&hdr, offsetof(tsRecHeader, crc));
+  hdr.crc = crc16_update(hdr.crc, (const uint8_t *)data, len);
+
+  off = segments[active_seg].write_offset;
+  addr = seg_addr(active_seg) + off;
+  segments[active_seg].write_offset += size;
+
+  res = flash_program(addr, &hdr, sizeof(hdr));
+  if (res == bg_err_success && len) {
+    res = flash_program(addr + sizeof(hdr), data, len);
+  }
+  if (res != bg_err_success) {
+    return res;
+  }
+  stats.user_bytes += len;
+
+  return index_update(key, active_seg, off, len, type);
+}
+
+/* read a record header and check the CRC over header and payload */
+static int rec_check(uint16_t seg, uint16_t off, tsRecHeader *hdr)
+{
+  uint32_t addr = seg_addr(seg) + off;
+  uint32_t done, chunk;
+  uint16_t crc;
+
+  if (flash_read(addr, hdr, sizeof(*hdr)) != bg_err_success) {
+    return 0;
+  }
+  if (hdr->key == REC_STORE_KEY_INVALID
+      || (hdr->type != REC_TYPE_DATA && hdr->type != REC_TYPE_TOMBSTONE)
+      || off + rec_size(hdr->len) > REC_STORE_SEGMENT_SIZE) {
+    return 0;
+  }
+
+  crc = crc16_update(0xFFFF, (const uint8_t *)hdr, offsetof(tsRecHeader, crc));
+  for (done = 0; done < hdr->len; done += chunk) {
+    chunk = hdr->len - done;
+    if (chunk > sizeof(page_buf)) {
+      chunk = sizeof(page_buf);
+    }
+    if (flash_read(addr + sizeof(*hdr) + done, page_buf, chunk) != bg_err_success) {
+      return 0;
+    }
+    crc = crc16_update(crc, page_buf, chunk);
+  }
+  return crc == hdr->crc;
+}
+
+/* replay the records of one segment into the index */
+static void seg_scan(uint16_t seg)
+{
+  tsRecHeader hdr;
+  uint16_t off = SEG_HEADER_SIZE;
+
+  while (off + REC_HEADER_SIZE <= REC_STORE_SEGMENT_SIZE) {
+    if (!rec_check(seg, off, &hdr)) {
+      if (hdr.key != REC_STORE_KEY_INVALID || hdr.len != 0xFFFF) {
+        // torn or corrupted write, nothing more is appended to this segment
+        off = REC_STORE_SEGMENT_SIZE;
+      }
+      break;
+    }
+    index_update(hdr.key, seg, off, hdr.len, hdr.type);
+    off += rec_size(hdr.len);
+  }
+  segments[seg].write_offset = off;
+}
+
+/* copy one record verbatim to the active segment */
+static errorcode_t rec_move(uint16_t seg, uint16_t off, const tsRecHeader *hdr)
+{
+  uint16_t size = rec_size(hdr->len);
+  uint32_t src = seg_addr(seg) + off;
+  uint32_t dst, done, chunk;
+  uint16_t dst_off;
+  errorcode_t res;
+
+  res = reserve_space(size, 1);
+  if (res != bg_err_success) {
+    return res;
+  }
+  dst_off = segments[active_seg].write_offset;
+  dst = seg_addr(active_seg) + dst_off;
+  segments[active_seg].write_offset += size;
+
+  for (done = 0; done < REC_HEADER_SIZE + (uint32_t)hdr->len; done += chunk) {
+    chunk = REC_HEADER_SIZE + (uint32_t)hdr->len - done;
+    if (chunk > sizeof(page_buf)) {
+      chunk = sizeof(page_buf);
+    }
+    if (flash_read(src + done, page_buf, chunk) != bg_err_success
+        || flash_program(dst + done, page_buf, chunk) != bg_err_success) {
+      return bg_err_hardware;
+    }
+  }
+
+  return index_update(hdr->key, active_seg, dst_off, hdr->len, hdr->type);
+}
+
+static uint16_t pick_victim(void)
+{
+  uint16_t victim = SEG_NONE, coldest = SEG_NONE;
+  uint32_t min_erase = 0xFFFFFFFF, max_erase = 0;
+  uint16_t seg;
+
+  for (seg = 0; seg < REC_STORE_NUM_SEGMENTS; seg++) {
+    if (segments[seg].erase_count < min_erase) {
+      min_erase = segments[seg].erase_count;
+    }
+    if (segments[seg].erase_count > max_erase) {
+      max_erase = segments[seg].erase_count;
+    }
+    if (segments[seg].sequence == SEG_SEQ_FREE || seg == active_seg) {
+      continue;
+    }
+    // greedy: the segment with the least live data gives back the most space
+    if (victim == SEG_NONE || segments[seg].live_bytes < segments[victim].live_bytes) {
+      victim = seg;
+    }
+    if (coldest == SEG_NONE || segments[seg].erase_count < segments[coldest].erase_count) {
+      coldest = seg;
+    }
+  }
+
+  // static wear leveling: move long-lived data off rarely erased segments
+  if (coldest != SEG_NONE && max_erase - min_erase > REC_STORE_WEAR_DELTA
+      && segments[coldest].erase_count == min_erase) {
+    return coldest;
+  }
+  // a segment without garbage gives nothing back
+  if (victim != SEG_NONE && segments[victim].live_bytes >= REC_STORE_SEGMENT_SIZE - SEG_HEADER_SIZE) {
+    return SEG_NONE;
+  }
+  return victim;
+}
+
+static int is_oldest_segment(uint16_t seg)
+{
+  uint16_t s;
+
+  for (s = 0; s < REC_STORE_NUM_SEGMENTS; s++) {
+    if (segments[s].sequence != SEG_SEQ_FREE && seq_before(segments[s].sequence, segments[seg].sequence)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// public functions
+
+/**
+ * Scan the store area and rebuild the RAM index. Sectors without a valid segment
+ * header are erased and formatted.
+ *
+ * Programming can only clear bits, so a sequence number and its inverse torn by a
+ * reset never match. Records are appended only after the sequence has been
+ * written, so a segment with a torn sequence holds no record and is erased.
+ */
+errorcode_t record_store_mount(void)
+{
+  uint16_t order[REC_STORE_NUM_SEGMENTS];
+  uint16_t used = 0;
+  uint32_t start_ms = time_ms();
+  tsSegHeader hdr;
+  uint16_t seg, i, j;
+  errorcode_t res;
+
+  memset(segments, 0, sizeof(segments));
+  memset(index_key, 0xFF, sizeof(index_key));
+  index_count = 0;
+  active_seg = SEG_NONE;
+  next_sequence = 0;
+  free_segments = 0;
+  stats.torn_segments = 0;
+
+  for (seg = 0; seg < REC_STORE_NUM_SEGMENTS; seg++) {
+    res = flash_read(seg_addr(seg), &hdr, sizeof(hdr));
+    if (res != bg_err_success) {
+      return res;
+    }
+    if (hdr.magic != SEG_MAGIC || hdr.erase_count != ~hdr.erase_count_inv) {
+      res = seg_erase(seg);
+      if (res != bg_err_success) {
+        return res;
+      }
+      free_segments++;
+      continue;
+    }
+    segments[seg].erase_count = hdr.erase_count;
+    if (hdr.sequence == SEG_SEQ_FREE && hdr.sequence_inv == SEG_SEQ_FREE) {
+      segments[seg].sequence = SEG_SEQ_FREE;
+      segments[seg].write_offset = SEG_HEADER_SIZE;
+      free_segments++;
+      continue;
+    }
+    if (hdr.sequence == SEG_SEQ_FREE || hdr.sequence != ~hdr.sequence_inv) {
+      res = seg_erase(seg);
+      if (res != bg_err_success) {
+        return res;
+      }
+      stats.torn_segments++;
+      free_segments++;
+      continue;
+    }
+    segments[seg].sequence = hdr.sequence;
+
+    // insertion sort by sequence, newer copies of a key must be replayed last
+    for (i = used; i > 0 && seq_before(hdr.sequence, segments[order[i - 1]].sequence); i--) {
+      order[i] = order[i - 1];
+    }
+    order[i] = seg;
+    used++;
+  }
+
+  for (j = 0; j < used; j++) {
+    seg_scan(order[j]);
+  }
+  if (used) {
+    next_sequence = segments[order[used - 1]].sequence + 1;
+    if (segments[order[used - 1]].write_offset < REC_STORE_SEGMENT_SIZE) {
+      active_seg = order[used - 1];
+    }
+  }
+
+  mounted = 1;
+  stats.mount_ms = time_ms() - start_ms;
+  return bg_err_success;
+}
+
+/* Erase the whole store area, erase counts are preserved where known */
+errorcode_t record_store_format(void)
+{
+  uint16_t seg;
+  errorcode_t res;
+
+  for (seg = 0; seg < REC_STORE_NUM_SEGMENTS; seg++) {
+    res = seg_erase(seg);
+    if (res != bg_err_success) {
+      return res;
+    }
+  }
+  return record_store_mount();
+}
+
+errorcode_t record_store_write(uint16_t key, const void *data, uint16_t len)
+{
+  if (!mounted) {
+    return bg_err_wrong_state;
+  }
+  if (key == REC_STORE_KEY_INVALID || len > REC_STORE_MAX_DATA_LEN) {
+    return bg_err_invalid_param;
+  }
+  return append(key, REC_TYPE_DATA, data, len);
+}
+
+errorcode_t record_store_read(uint16_t key, void *data, uint16_t max_len, uint16_t *len)
+{
+  uint32_t bucket, loc;
+  tsRecHeader hdr;
+  errorcode_t res;
+
+  if (!mounted) {
+    return bg_err_wrong_state;
+  }
+
+  bucket = index_find(key);
+  if (bucket == INDEX_SIZE || (index_loc[bucket] & LOC_TOMBSTONE)) {
+    return bg_err_hardware_ps_key_not_found;
+  }
+  loc = index_loc[bucket];
+
+  res = flash_read(seg_addr(LOC_SEG(loc)) + LOC_OFF(loc), &hdr, sizeof(hdr));
+  if (res != bg_err_success) {
+    return res;
+  }
+  if (hdr.key != key) {
+    return bg_err_data_corrupted;
+  }
+  *len = hdr.len;
+  if (hdr.len > max_len) {
+    return bg_err_invalid_param;
+  }
+  return flash_read(seg_addr(LOC_SEG(loc)) + LOC_OFF(loc) + sizeof(hdr), data, hdr.len);
+}
+
+errorcode_t record_store_delete(uint16_t key)
+{
+  uint32_t bucket;
+
+  if (!mounted) {
+    return bg_err_wrong_state;
+  }
+  bucket = index_find(key);
+  if (bucket == INDEX_SIZE || (index_loc[bucket] & LOC_TOMBSTONE)) {
+    return bg_err_success;
+  }
+  return append(key, REC_TYPE_TOMBSTONE, NULL, 0);
+}
+
+int record_store_exists(uint16_t key)
+{
+  uint32_t bucket = index_find(key);
+
+  return bucket < INDEX_SIZE && !(index_loc[bucket] & LOC_TOMBSTONE);
+}
+
+/**
+ * Move the live records out of one segment and erase it. Intended to be called
+ * from a soft timer so that space is reclaimed before writers run out of it.
+ */
+int record_store_compact_step(void)
+{
+  tsRecHeader hdr;
+  uint16_t victim, off;
+  uint32_t bucket;
+  int oldest;
+
+  if (!mounted || free_segments >= REC_STORE_GC_THRESHOLD) {
+    return 0;
+  }
+
+  victim = pick_victim();
+  if (victim == SEG_NONE) {
+    return 0;
+  }
+  oldest = is_oldest_segment(victim);
+
+  for (off = SEG_HEADER_SIZE; off < segments[victim].write_offset; off += rec_size(hdr.len)) {
+    if (!rec_check(victim, off, &hdr)) {
+      break;
+    }
+    bucket = index_find(hdr.key);
+    if (bucket == INDEX_SIZE || (index_loc[bucket] & ~LOC_TOMBSTONE) != LOC(victim, off)) {
+      continue; // superseded
+    }
+    if (hdr.type == REC_TYPE_TOMBSTONE && oldest) {
+      // no older segment can hold a copy of this key any more
+      segments[victim].live_bytes -= rec_size(hdr.len);
+      index_remove(bucket);
+      continue;
+    }
+    if (rec_move(victim, off, &hdr) != bg_err_success) {
+      return 0;
+    }
+  }
+
+  if (seg_erase(victim) != bg_err_success) {
+    return 0;
+  }
+  free_segments++;
+  stats.compactions++;
+  return 1;
+}
+
+void record_store_get_stats(tsRecordStoreStats *out)
+{
+  uint32_t seg;
+
+  stats.records = 0;
+  stats.free_segments = free_segments;
+  stats.min_erase_count = 0xFFFFFFFF;
+  stats.max_erase_count = 0;
+  for (seg = 0; seg < REC_STORE_NUM_SEGMENTS; seg++) {
+    if (segments[seg].erase_count < stats.min_erase_count) {
+      stats.min_erase_count = segments[seg].erase_count;
+    }
+    if (segments[seg].erase_count > stats.max_erase_count) {
+      stats.max_erase_count = segments[seg].erase_count;
+    }
+  }
+  for (seg = 0; seg < INDEX_SIZE; seg++) {
+    if (index_key[seg] != REC_STORE_KEY_INVALID && !(index_loc[seg] & LOC_TOMBSTONE)) {
+      stats.records++;
+    }
+  }
+  *out = stats;
+}
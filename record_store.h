@@ -0,0 +1,84 @@
+#ifndef _RECORD_STORE_H
+#define _RECORD_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  Append-only record store on the external MX25 SPI flash.
+ *
+ *  The store area is divided into segments of one flash sector (4 kB). Records are
+ *  appended to the active segment and are never modified in place: writing a key
+ *  again appends a new copy and deleting a key appends a tombstone. Each record
+ *  carries a CRC so that a write torn by a reset is detected and ignored at mount.
+ *  The sequence number ordering the segments is stored with its inverse for the
+ *  same reason.
+ *
+ *  The location of the newest copy of each key is kept in a RAM index that is
+ *  rebuilt by record_store_mount(). Space taken by superseded copies is reclaimed by
+ *  record_store_compact_step(), which moves the live records out of a segment and
+ *  erases it. Free segments are handed out lowest erase count first, and segments
+ *  holding cold data are recycled when the erase counts drift too far apart.
+ */
+
+/* first byte of the store area in the external flash, must be sector aligned.
+ * The lower half of the flash is left for bootloader image storage. */
+#ifndef REC_STORE_BASE_ADDR
+#define REC_STORE_BASE_ADDR      0x00080000
+#endif
+
+/* number of 4 kB segments in the store area */
+#ifndef REC_STORE_NUM_SEGMENTS
+#define REC_STORE_NUM_SEGMENTS   64
+#endif
+
+/* number of distinct keys the RAM index can hold */
+#ifndef REC_STORE_MAX_RECORDS
+#define REC_STORE_MAX_RECORDS    512
+#endif
+
+/* compaction is started when fewer free segments than this are left */
+#ifndef REC_STORE_GC_THRESHOLD
+#define REC_STORE_GC_THRESHOLD   4
+#endif
+
+/* allowed spread of segment erase counts before cold data is moved */
+#ifndef REC_STORE_WEAR_DELTA
+#define REC_STORE_WEAR_DELTA     64
+#endif
+
+#define REC_STORE_SEGMENT_SIZE   0x1000
+#define REC_STORE_MAX_DATA_LEN   (REC_STORE_SEGMENT_SIZE - 20 - 8)
+
+/* key value reserved for unwritten flash */
+#define REC_STORE_KEY_INVALID    0xFFFF
+
+typedef struct {
+  uint32_t user_bytes;        /* record payload bytes written by the application */
+  uint32_t flash_bytes;       /* bytes programmed to flash, including headers and compaction */
+  uint32_t erases;            /* sector erases */
+  uint32_t compactions;       /* segments reclaimed */
+  uint32_t mount_ms;          /* duration of the last mount */
+  uint32_t torn_segments;     /* segments erased by the last mount for a torn sequence number */
+  uint16_t records;           /* keys currently stored */
+  uint16_t free_segments;
+  uint32_t min_erase_count;
+  uint32_t max_erase_count;
+} tsRecordStoreStats;
+
+errorcode_t record_store_mount(void);
+errorcode_t record_store_format(void);
+
+errorcode_t record_store_write(uint16_t key, const void *data, uint16_t len);
+errorcode_t record_store_read(uint16_t key, void *data, uint16_t max_len, uint16_t *len);
+errorcode_t record_store_delete(uint16_t key);
+int record_store_exists(uint16_t key);
+
+/* Reclaim one segment if free space is running low. Returns 1 if a segment was reclaimed. */
+int record_store_compact_step(void);
+
+void record_store_get_stats(tsRecordStoreStats *stats);
+
+#endif
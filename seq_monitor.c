@@ -0,0 +1,99 @@
+#include "seq_monitor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "native_gecko.h"
+
+/* weight of a new sample in the moving average of the rate, as a shift */
+#define RATE_SHIFT           3
+
+static tsSeqMonitorStats stats;
+static uint32_t prev_remaining;
+static uint32_t prev_seconds;
+static uint32_t rate_avg;              /* sequence numbers per hour << RATE_SHIFT */
+
+// local functions
+
+static void request_ivupdate(void)
+{
+  struct gecko_msg_mesh_node_request_ivupdate_rsp_t *rsp;
+
+  rsp = gecko_cmd_mesh_node_request_ivupdate();
+  stats.last_result = rsp->result;
+  stats.ivupdate_requests++;
+  printf("seq monitor: %lu left, about %lu hours, IV Update requested, result %x\r\n", (unsigned long) stats.remaining,
+      (unsigned long) stats.hours_left, rsp->result);
+}
+
+// public functions
+
+void seq_monitor_init(void)
+{
+  struct gecko_msg_mesh_node_get_ivupdate_state_rsp_t *iv;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.hours_left = SEQ_MONITOR_HOURS_UNKNOWN;
+  prev_remaining = 0;
+  rate_avg = 0;
+
+  iv = gecko_cmd_mesh_node_get_ivupdate_state();
+  if (iv->result == 0) {
+    stats.ivindex = iv->ivindex;
+    stats.ivupdate_state = iv->state;
+  }
+}
+
+void seq_monitor_sample(void)
+{
+  struct gecko_msg_mesh_node_get_seq_remaining_rsp_t *seq;
+  uint32_t now = gecko_cmd_hardware_get_time()->seconds;
+  uint32_t used, elapsed, rate;
+
+  seq = gecko_cmd_mesh_node_get_seq_remaining(0);
+  if (seq->result != 0) {
+    return;
+  }
+  stats.remaining = seq->count;
+  stats.samples++;
+
+  // the first sample and samples after an IV Update (remaining grows back) only set the baseline
+  if (stats.samples > 1 && seq->count <= prev_remaining && now > prev_seconds) {
+    used = prev_remaining - seq->count;
+    elapsed = now - prev_seconds;
+    rate = (uint32_t)(((uint64_t)used * 3600) / elapsed);
+    if (rate_avg == 0) {
+      rate_avg = rate << RATE_SHIFT;
+    } else {
+      rate_avg = rate_avg - (rate_avg >> RATE_SHIFT) + rate;
+    }
+    stats.rate_per_hour = rate_avg >> RATE_SHIFT;
+  }
+  prev_remaining = seq->count;
+  prev_seconds = now;
+
+  stats.hours_left = stats.rate_per_hour ? stats.remaining / stats.rate_per_hour : SEQ_MONITOR_HOURS_UNKNOWN;
+
+  if (stats.samples % SEQ_MONITOR_REPORT_SAMPLES == 0) {
+    printf("seq monitor: %lu left, %lu per hour, IV index %lu\r\n", (unsigned long) stats.remaining, (unsigned long) stats.rate_per_hour,
+        (unsigned long) stats.ivindex);
+  }
+
+  // a new request can only be made in normal operation, the stack refuses it during an update
+  if (stats.ivupdate_state == 0
+      && (stats.hours_left < SEQ_MONITOR_TRIGGER_HOURS || stats.remaining < SEQ_MONITOR_MIN_REMAINING)) {
+    request_ivupdate();
+  }
+}
+
+void seq_monitor_ivupdate_changed(uint32_t ivindex, uint8_t state)
+{
+  stats.ivindex = ivindex;
+  stats.ivupdate_state = state;
+  printf("seq monitor: IV index %lu, IV Update %s\r\n", (unsigned long) ivindex, state ? "in progress" : "done");
+}
+
+void seq_monitor_get_stats(tsSeqMonitorStats *s)
+{
+  *s = stats;
+}
@@ -0,0 +1,62 @@
+#ifndef _SEQ_MONITOR_H
+#define _SEQ_MONITOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  Watches the sequence number space of the provisioner's primary element.
+ *
+ *  The remaining sequence numbers are sampled periodically and the send rate is
+ *  tracked as a moving average of the samples. From the rate the time left
+ *  until the space runs out is projected, and an IV Update is requested while
+ *  there is still enough room for the procedure to complete: the new IV index
+ *  has to stay in use for at least 96 hours before the node can return to
+ *  normal operation and start over from sequence number 0.
+ */
+
+/* sampling interval */
+#ifndef SEQ_MONITOR_INTERVAL_S
+#define SEQ_MONITOR_INTERVAL_S       60
+#endif
+
+/* request an IV Update when the projected time left drops below this */
+#ifndef SEQ_MONITOR_TRIGGER_HOURS
+#define SEQ_MONITOR_TRIGGER_HOURS    (2 * 96)
+#endif
+
+/* request an IV Update when fewer sequence numbers than this are left, whatever the rate */
+#ifndef SEQ_MONITOR_MIN_REMAINING
+#define SEQ_MONITOR_MIN_REMAINING    0x200000
+#endif
+
+/* print the numbers every this many samples */
+#ifndef SEQ_MONITOR_REPORT_SAMPLES
+#define SEQ_MONITOR_REPORT_SAMPLES   60
+#endif
+
+/* hours reported when nothing has been sent recently */
+#define SEQ_MONITOR_HOURS_UNKNOWN    0xFFFFFFFF
+
+typedef struct {
+  uint32_t remaining;         /* sequence numbers left */
+  uint32_t rate_per_hour;     /* moving average of the send rate */
+  uint32_t hours_left;        /* projected, SEQ_MONITOR_HOURS_UNKNOWN if the rate is 0 */
+  uint32_t ivindex;
+  uint8_t ivupdate_state;     /* 0 normal, 1 update in progress */
+  uint16_t last_result;       /* result of the last IV Update request */
+  uint32_t ivupdate_requests;
+  uint32_t samples;
+} tsSeqMonitorStats;
+
+void seq_monitor_init(void);
+
+/* Take a sample, call every SEQ_MONITOR_INTERVAL_S seconds. */
+void seq_monitor_sample(void);
+
+/* gecko_evt_mesh_node_changed_ivupdate_state */
+void seq_monitor_ivupdate_changed(uint32_t ivindex, uint8_t state);
+
+void seq_monitor_get_stats(tsSeqMonitorStats *stats);
+
+#endif
@@ -0,0 +1,239 @@
+#include "sha256.h"
+
+#include <string.h>
+
+#ifndef SHA256_SOFTWARE
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_crypto.h"
+#include "mx25flash_spi.h"
+#endif
+
+static const uint32_t initial_state[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#ifndef SHA256_SOFTWARE
+
+/* Compress whole blocks into the state. The state goes to DDATA1, the blocks
+ * to QDATA1BIG, the same register use as CRYPTO_SHA_256(). */
+static void compress(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+  CRYPTO_TypeDef *crypto = SHA256_CRYPTO;
+  uint32_t block[SHA256_BLOCK_SIZE / 4];
+
+  CMU_ClockEnable(SHA256_CRYPTO_CLOCK, true);
+
+  crypto->CTRL = CRYPTO_CTRL_SHA_SHA2;
+  crypto->WAC = 0;
+  crypto->SEQCTRL = 0;
+  crypto->SEQCTRLB = 0;
+  CRYPTO_ResultWidthSet(crypto, cryptoResult256Bits);
+
+  CRYPTO_DDataWrite(&crypto->DDATA1, state);
+  CRYPTO_EXECUTE_2(crypto, CRYPTO_CMD_INSTR_DDATA1TODDATA0, CRYPTO_CMD_INSTR_SELDDATA0DDATA1);
+
+  while (blocks--) {
+    if ((uintptr_t) data & 3) {
+      memcpy(block, data, SHA256_BLOCK_SIZE);
+      CRYPTO_QDataWrite(&crypto->QDATA1BIG, block);
+    } else {
+      CRYPTO_QDataWrite(&crypto->QDATA1BIG, (uint32_t *) data);
+    }
+    CRYPTO_EXECUTE_3(crypto, CRYPTO_CMD_INSTR_SHA, CRYPTO_CMD_INSTR_MADD32, CRYPTO_CMD_INSTR_DDATA0TODDATA1);
+    data += SHA256_BLOCK_SIZE;
+  }
+
+  CRYPTO_InstructionSequenceWait(crypto);
+  CRYPTO_DDataRead(&crypto->DDATA1, state);
+}
+
+#else
+
+/* software reference, FIPS 180-4 */
+
+static const uint32_t k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void compress(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  while (blocks--) {
+    for (i = 0; i < 16; i++) {
+      w[i] = (uint32_t) data[4 * i] << 24 | (uint32_t) data[4 * i + 1] << 16 | (uint32_t) data[4 * i + 2] << 8
+          | data[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+      uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for (i = 0; i < 64; i++) {
+      t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    data += SHA256_BLOCK_SIZE;
+  }
+}
+
+#endif
+
+// public functions
+
+void sha256_init(tsSha256 *ctx)
+{
+  memcpy(ctx->state, initial_state, sizeof(ctx->state));
+  ctx->block_len = 0;
+  ctx->total_len = 0;
+}
+
+void sha256_update(tsSha256 *ctx, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  uint8_t *block = (uint8_t *) ctx->block;
+  size_t n;
+
+  ctx->total_len += len;
+
+  if (ctx->block_len) {
+    n = SHA256_BLOCK_SIZE - ctx->block_len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(block + ctx->block_len, p, n);
+    ctx->block_len += n;
+    p += n;
+    len -= n;
+    if (ctx->block_len < SHA256_BLOCK_SIZE) {
+      return;
+    }
+    compress(ctx->state, block, 1);
+    ctx->block_len = 0;
+  }
+
+  /* whole blocks straight from the caller's buffer */
+  n = len / SHA256_BLOCK_SIZE;
+  if (n) {
+    compress(ctx->state, p, n);
+    p += n * SHA256_BLOCK_SIZE;
+    len -= n * SHA256_BLOCK_SIZE;
+  }
+
+  memcpy(block, p, len);
+  ctx->block_len = len;
+}
+
+void sha256_final(tsSha256 *ctx, uint8_t *digest)
+{
+  uint8_t *block = (uint8_t *) ctx->block;
+  uint64_t bits = ctx->total_len * 8;
+  int i;
+
+  block[ctx->block_len++] = 0x80;
+  if (ctx->block_len > SHA256_BLOCK_SIZE - 8) {
+    memset(block + ctx->block_len, 0, SHA256_BLOCK_SIZE - ctx->block_len);
+    compress(ctx->state, block, 1);
+    ctx->block_len = 0;
+  }
+  memset(block + ctx->block_len, 0, SHA256_BLOCK_SIZE - 8 - ctx->block_len);
+  for (i = 0; i < 8; i++) {
+    block[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(bits >> (8 * i));
+  }
+  compress(ctx->state, block, 1);
+
+  for (i = 0; i < 8; i++) {
+    digest[4 * i] = (uint8_t)(ctx->state[i] >> 24);
+    digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+    digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+    digest[4 * i + 3] = (uint8_t) ctx->state[i];
+  }
+
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+#ifndef SHA256_SOFTWARE
+
+static uint32_t read_buf[2][SHA256_FLASH_CHUNK / 4];
+static volatile uint8_t read_busy;
+static volatile ReturnMsg read_result;
+
+static void read_done(ReturnMsg result, void *context)
+{
+  (void) context;
+  read_result = result;
+  read_busy = 0;
+}
+
+static int read_start(uint32_t addr, uint32_t *buf, uint32_t len)
+{
+  read_busy = 1;
+  if (MX25_READ_DMA(addr, (uint8_t *) buf, len, read_done, NULL) != FlashOperationSuccess) {
+    read_busy = 0;
+    return 0;
+  }
+  return 1;
+}
+
+errorcode_t sha256_flash(tsSha256 *ctx, uint32_t addr, uint32_t len)
+{
+  uint32_t n, chunk_len;
+  int cur = 0;
+
+  if (!len) {
+    return bg_err_success;
+  }
+
+  n = (len < SHA256_FLASH_CHUNK) ? len : SHA256_FLASH_CHUNK;
+  if (!read_start(addr, read_buf[cur], n)) {
+    return bg_err_hardware;
+  }
+
+  while (len) {
+    while (read_busy) {
+    }
+    if (read_result != FlashOperationSuccess) {
+      return bg_err_hardware;
+    }
+
+    chunk_len = n;
+    addr += n;
+    len -= n;
+
+    /* read the next chunk while this one is hashed */
+    if (len) {
+      n = (len < SHA256_FLASH_CHUNK) ? len : SHA256_FLASH_CHUNK;
+      if (!read_start(addr, read_buf[cur ^ 1], n)) {
+        return bg_err_hardware;
+      }
+    }
+
+    sha256_update(ctx, read_buf[cur], chunk_len);
+    cur ^= 1;
+  }
+
+  return bg_err_success;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bg_errorcodes.h"
+
+/**
+ *  Incremental SHA-256 on the CRYPTO block.
+ *
+ *  The hash state is kept in the context between calls and loaded into the
+ *  CRYPTO block only while full 64 byte blocks are compressed, so several
+ *  hashes can be in progress at the same time and other users of the CRYPTO
+ *  instance can run between the updates.
+ *
+ *  sha256_flash() hashes a range of the external MX25 flash. The range is read
+ *  with the LDMA into two alternating buffers, the next chunk is read while the
+ *  previous one is hashed.
+ *
+ *  Building with SHA256_SOFTWARE replaces the hardware with a portable software
+ *  implementation, used as a reference and on the host (without sha256_flash).
+ */
+
+/* CRYPTO instance used by the application, shared with aes_ccm */
+#ifndef SHA256_CRYPTO
+#define SHA256_CRYPTO            CRYPTO1
+#define SHA256_CRYPTO_CLOCK      cmuClock_CRYPTO1
+#endif
+
+/* size of each of the two read buffers of sha256_flash() */
+#ifndef SHA256_FLASH_CHUNK
+#define SHA256_FLASH_CHUNK       512
+#endif
+
+#define SHA256_BLOCK_SIZE        64
+#define SHA256_DIGEST_SIZE       32
+
+typedef struct {
+  uint32_t state[8];
+  uint32_t block[SHA256_BLOCK_SIZE / 4];  /* partial block */
+  uint8_t block_len;
+  uint64_t total_len;
+} tsSha256;
+
+void sha256_init(tsSha256 *ctx);
+void sha256_update(tsSha256 *ctx, const void *data, size_t len);
+void sha256_final(tsSha256 *ctx, uint8_t *digest);
+
+#ifndef SHA256_SOFTWARE
+/* Hash len bytes of the external flash starting at addr. */
+errorcode_t sha256_flash(tsSha256 *ctx, uint32_t addr, uint32_t len);
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Host simulation of the blob transfer (blob_xfer.c) over a lossy mesh link.
+ *
+ * The sender and the receiver run in one process and exchange their messages
+ * through a simulated link with 1 ms resolution:
+ *   - one shared radio channel, a message occupies it for SEG_AIRTIME_MS per
+ *     segment (12 octets of access payload and MIC per segment, one segment
+ *     for up to 11 octets)
+ *   - every message is lost with the given probability, after the retries of
+ *     the transport layer
+ *   - like the stack, at most MESH_CFG_MAX_SEND_SEGS segmented messages can be
+ *     in transit per device, a buffer is freed by the transport acknowledgement
+ *     (TRANSPORT_ACK_MS after the delivery) or by the transport timeout
+ *
+ * A blob is sent and compared with what the receiver stored, then a second one
+ * is cancelled half way and resumed.
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -I. -Iprotocol/bluetooth/bt_mesh/inc/common tools/blob_sim.c blob_xfer.c -o blob_sim
+ * Add -DBLOB_XFER_WINDOW=1 for the same link with one chunk per round trip.
+ *
+ * Usage:
+ *   blob_sim [size in bytes] [loss in percent] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob_xfer.h"
+
+#define SENDER_ADDR          0x0001
+#define RECEIVER_ADDR        0x0002
+
+#define SEG_AIRTIME_MS       15
+#define RELAY_DELAY_MS       30
+#define TRANSPORT_ACK_MS     150
+#define TRANSPORT_TIMEOUT_MS 1000
+#define TICK_MS              20
+#define TIME_LIMIT_MS        (30 * 60 * 1000)
+
+#define MAX_MESSAGES         256
+#define MAX_BLOB             65536
+
+struct message {
+  uint8_t used;
+  uint8_t lost;
+  uint8_t opcode;
+  uint16_t len;
+  uint16_t src;
+  uint32_t deliver_ms;
+  uint32_t release_ms;        /* segmentation buffer freed, 0 if unsegmented */
+  uint8_t data[BLOB_XFER_MAX_PAYLOAD];
+};
+
+static struct message link[MAX_MESSAGES];
+static uint32_t now_ms;
+static uint32_t channel_free_ms;
+static unsigned loss_percent;
+static uint32_t messages, lost;
+
+static uint8_t blob[MAX_BLOB];
+static uint8_t stored[MAX_BLOB];
+static uint32_t blob_size;
+static int done_result = -1;
+
+static uint32_t busy_buffers(uint16_t src)
+{
+  uint32_t n = 0;
+  int i;
+
+  for (i = 0; i < MAX_MESSAGES; i++) {
+    if (link[i].used && link[i].src == src && link[i].release_ms > now_ms) {
+      n++;
+    }
+  }
+  return n;
+}
+
+static errorcode_t sim_send(uint16_t addr, uint8_t opcode, const uint8_t *data, uint16_t len)
+{
+  uint32_t segs = (len + 3 <= 11) ? 1 : (len + 3 + 4 + 11) / 12;
+  uint16_t src = addr == RECEIVER_ADDR ? SENDER_ADDR : RECEIVER_ADDR;
+  uint32_t start = channel_free_ms > now_ms ? channel_free_ms : now_ms;
+  struct message *m = NULL;
+  int i;
+
+  if (segs > 1 && busy_buffers(src) >= MESH_CFG_MAX_SEND_SEGS) {
+    return bg_err_out_of_memory;
+  }
+  for (i = 0; i < MAX_MESSAGES && !m; i++) {
+    if (!link[i].used) {
+      m = &link[i];
+    }
+  }
+  if (!m) {
+    return bg_err_out_of_memory;
+  }
+
+  memset(m, 0, sizeof(*m));
+  m->used = 1;
+  m->src = src;
+  m->opcode = opcode;
+  m->len = len;
+  memcpy(m->data, data, len);
+  channel_free_ms = start + segs * SEG_AIRTIME_MS;
+  m->deliver_ms = channel_free_ms + RELAY_DELAY_MS;
+  m->lost = (unsigned)(rand() % 100) < loss_percent;
+  if (segs > 1) {
+    m->release_ms = m->lost ? now_ms + TRANSPORT_TIMEOUT_MS : m->deliver_ms + TRANSPORT_ACK_MS;
+  }
+  messages++;
+  lost += m->lost;
+  return bg_err_success;
+}
+
+static errorcode_t sim_read(uint32_t offset, uint8_t *data, uint16_t len)
+{
+  memcpy(data, blob + offset, len);
+  return bg_err_success;
+}
+
+static errorcode_t sim_accept(uint16_t addr, uint8_t id, uint32_t tag, uint32_t size)
+{
+  (void) addr;
+  (void) id;
+  (void) tag;
+  return size <= sizeof(stored) ? bg_err_success : bg_err_out_of_memory;
+}
+
+static errorcode_t sim_write(uint32_t offset, const uint8_t *data, uint16_t len)
+{
+  memcpy(stored + offset, data, len);
+  return bg_err_success;
+}
+
+static void sim_done(uint16_t addr, uint8_t id, uint8_t sent, errorcode_t result)
+{
+  if (sent) {
+    printf("  blob %u to %4.4x: result %x\n", id, addr, result);
+    done_result = result;
+  }
+}
+
+/* deliver what is due and free the buffers of the sent messages */
+static void step(void)
+{
+  int i;
+
+  for (i = 0; i < MAX_MESSAGES; i++) {
+    struct message *m = &link[i];
+
+    if (!m->used) {
+      continue;
+    }
+    if (m->deliver_ms == now_ms && !m->lost) {
+      blob_xfer_receive(m->src, m->opcode, m->data, m->len, now_ms);
+    }
+    if (now_ms >= m->deliver_ms && now_ms >= m->release_ms) {
+      m->used = 0;
+    }
+  }
+  if (now_ms % TICK_MS == 0) {
+    blob_xfer_tick(now_ms);
+  }
+  now_ms++;
+}
+
+/* run until the transfer ends, or until cancel_at bytes are acknowledged */
+static int run(uint8_t id, uint32_t cancel_at)
+{
+  tsBlobXferStats stats;
+  errorcode_t res;
+
+  done_result = -1;
+  res = blob_xfer_send_start(RECEIVER_ADDR, id, 0x12345678 + blob_size, blob_size, sim_read, now_ms);
+  if (res != bg_err_success) {
+    printf("  start failed %x\n", res);
+    return -1;
+  }
+  while (done_result < 0 && now_ms < TIME_LIMIT_MS) {
+    step();
+    blob_xfer_get_stats(&stats);
+    if (cancel_at && stats.bytes_acked >= cancel_at) {
+      blob_xfer_send_cancel();
+      break;
+    }
+  }
+
+  blob_xfer_get_stats(&stats);
+  printf("  from offset %lu: %lu of %lu bytes acknowledged, %lu chunks sent, %lu sent again, %lu acks, %lu timeouts,"
+         " %lu busy, %lu duplicates at the receiver\n",
+         (unsigned long) stats.resume_offset, (unsigned long) stats.bytes_acked, (unsigned long) stats.size,
+         (unsigned long) stats.chunks_sent, (unsigned long) stats.resent, (unsigned long) stats.acks,
+         (unsigned long) stats.timeouts, (unsigned long) stats.busy, (unsigned long) stats.rx_duplicates);
+  if (done_result >= 0) {
+    printf("  %lu ms, %lu bytes/s\n", (unsigned long) stats.elapsed_ms, (unsigned long) stats.bytes_per_s);
+  }
+  return done_result;
+}
+
+static void drain(void)
+{
+  uint32_t end = now_ms + 2 * TRANSPORT_TIMEOUT_MS;
+
+  while (now_ms < end) {
+    step();
+  }
+}
+
+int main(int argc, char **argv)
+{
+  tsBlobXferOps ops = { sim_send, sim_accept, sim_write, sim_done };
+  uint32_t i;
+  int failed = 0;
+
+  blob_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 4096;
+  loss_percent = argc > 2 ? strtoul(argv[2], NULL, 0) : 10;
+  srand(argc > 3 ? strtoul(argv[3], NULL, 0) : 1);
+  if (blob_size == 0 || blob_size > MAX_BLOB || loss_percent >= 100) {
+    fprintf(stderr, "usage: %s [size, up to %d] [loss in percent] [seed]\n", argv[0], MAX_BLOB);
+    return 2;
+  }
+
+  printf("%lu bytes, %u%% loss, %d byte chunks, window %d\n", (unsigned long) blob_size, loss_percent,
+         BLOB_XFER_CHUNK_SIZE, BLOB_XFER_WINDOW);
+  blob_xfer_init(&ops);
+
+  for (i = 0; i < blob_size; i++) {
+    blob[i] = (uint8_t)(i * 7 + (i >> 8));
+  }
+  printf("transfer:\n");
+  if (run(1, 0) != bg_err_success || memcmp(blob, stored, blob_size)) {
+    printf("FAILED\n");
+    failed = 1;
+  }
+  drain();
+
+  for (i = 0; i < blob_size; i++) {
+    blob[i] = (uint8_t)(i * 13 + 5);
+  }
+  memset(stored, 0, sizeof(stored));
+  printf("cancelled half way:\n");
+  run(2, blob_size / 2);
+  drain();
+  printf("resumed:\n");
+  if (run(2, 0) != bg_err_success || memcmp(blob, stored, blob_size)) {
+    printf("FAILED\n");
+    failed = 1;
+  }
+
+  printf("link: %lu messages, %lu lost\n", (unsigned long) messages, (unsigned long) lost);
+  return failed;
+}
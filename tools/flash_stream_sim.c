@@ -0,0 +1,140 @@
+/*
+ * Host test and benchmark of the internal flash writer (flash_stream.c).
+ *
+ * The writer runs unchanged on the flash emulation of tools/msc_emu.c, which
+ * starts out filled with zeros so that a page written without an erase is
+ * noticed. A stream is written in chunks of random size, the way it arrives
+ * from the UART or a blob transfer, once without and once with verify. Each
+ * time the region is compared with what was sent, the padding of the last
+ * burst must be 0xFF, and the throughput in bytes per second of simulated time
+ * is printed with the longest stall of the CPU in a single flash call. Regions
+ * over the application image or past the end of the flash must be refused.
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -DMSC_EMULATOR -I. -Itools -Iprotocol/bluetooth/bt_mesh/inc/common tools/flash_stream_sim.c
+ *      tools/msc_emu.c flash_stream.c -o flash_stream_sim
+ * Add -DFLASH_STREAM_BURST=<bytes> for another burst size.
+ *
+ * Usage:
+ *   flash_stream_sim [size in bytes] [largest chunk] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msc_emu.h"
+#include "flash_stream.h"
+
+#define REGION_ADDR          0x00080000
+#define REGION_SIZE          0x00040000
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+static uint8_t pattern(uint32_t offset)
+{
+  return (uint8_t)(offset * 7 ^ (offset >> 9));
+}
+
+static int run(uint32_t size, uint32_t max_chunk, int verify)
+{
+  static uint8_t chunk[4096];
+  tsFlashStream s;
+  tsMscEmuStats ms;
+  const uint8_t *flash = (const uint8_t *) msc_emu_ptr(REGION_ADDR);
+  uint32_t done = 0, len, i, end;
+  uint64_t start_us;
+  errorcode_t res;
+
+  msc_emu_fill(0x00);
+  msc_emu_clear_stats();
+  start_us = msc_emu_time_us();
+
+  res = flash_stream_open(&s, REGION_ADDR, REGION_SIZE, verify);
+  while (res == bg_err_success && done < size) {
+    len = 1 + next_rand() % max_chunk;
+    if (len > size - done) {
+      len = size - done;
+    }
+    for (i = 0; i < len; i++) {
+      chunk[i] = pattern(done + i);
+    }
+    res = flash_stream_write(&s, chunk, len);
+    done += len;
+  }
+  if (res == bg_err_success) {
+    res = flash_stream_close(&s);
+  }
+  if (res != bg_err_success) {
+    printf("write failed: 0x%x at %lu\n", res, (unsigned long) done);
+    return 1;
+  }
+
+  end = (size + FLASH_STREAM_BURST - 1) / FLASH_STREAM_BURST * FLASH_STREAM_BURST;
+  for (i = 0; i < end; i++) {
+    if (flash[i] != (i < size ? pattern(i) : 0xFF)) {
+      printf("byte %lu is %02x\n", (unsigned long) i, flash[i]);
+      return 1;
+    }
+  }
+
+  msc_emu_get_stats(&ms);
+  if (ms.rewrites) {
+    printf("%lu words written twice\n", (unsigned long) ms.rewrites);
+    return 1;
+  }
+  printf("%s: %lu bytes in %lu bursts, %lu pages erased, %lu bytes/s, longest stall %lu us, busy %lu ms\n",
+         verify ? "verify" : "no verify", (unsigned long) s.stats.bytes, (unsigned long) s.stats.bursts,
+         (unsigned long) s.stats.pages_erased,
+         (unsigned long) ((uint64_t) size * 1000000 / (msc_emu_time_us() - start_us)), (unsigned long) ms.max_stall_us,
+         (unsigned long) s.stats.busy_ms);
+  return 0;
+}
+
+static int refused(uint32_t start, uint32_t size, const char *what)
+{
+  tsFlashStream s;
+
+  if (flash_stream_open(&s, start, size, 0) != bg_err_invalid_param) {
+    printf("region %s not refused\n", what);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t size = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+  uint32_t max_chunk = argc > 2 ? strtoul(argv[2], NULL, 0) : 300;
+  int bad;
+
+  rand_state = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+  if (rand_state == 0) {
+    rand_state = 1;
+  }
+  if (size == 0 || size > REGION_SIZE || max_chunk == 0 || max_chunk > 4096) {
+    printf("size 1..%u, chunk 1..4096\n", REGION_SIZE);
+    return 1;
+  }
+
+  // the flash limit: one page erase and the word writes of the page
+  printf("burst %u bytes, limit %lu bytes/s\n", FLASH_STREAM_BURST,
+         (unsigned long) ((uint64_t) FLASH_PAGE_SIZE * 1000000000
+                          / ((uint64_t) MSC_EMU_PAGE_ERASE_US * 1000 + FLASH_PAGE_SIZE / 4 * MSC_EMU_WORD_NS)));
+
+  bad = refused(MSC_EMU_APP_END - FLASH_PAGE_SIZE, REGION_SIZE, "over the application");
+  bad |= refused(MSC_EMU_STORE_START - REGION_SIZE + FLASH_PAGE_SIZE, REGION_SIZE, "past the end of the flash");
+  bad |= refused(MSC_EMU_STORE_START, 0xFFFFF800, "wrapping around");
+  bad |= run(size, max_chunk, 0);
+  bad |= run(size, max_chunk, 1);
+  printf("%s\n", bad ? "FAILED" : "passed");
+  return bad;
+}
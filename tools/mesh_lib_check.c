@@ -0,0 +1,465 @@
+/*
+ * Host checks of the vendor model layer of mesh_lib.c.
+ *
+ * mesh_lib.c runs unchanged against native_gecko.h. The BGAPI commands it
+ * issues end up in the command handler below, which records them and answers
+ * with the result set by the check. Each check prints its name and whether it
+ * passed.
+ *
+ *   - payload limit: a message of MESH_LIB_VENDOR_MAX_PAYLOAD octets is sent,
+ *     published and received in parts of at most MESH_LIB_VENDOR_CMD_PAYLOAD,
+ *     one octet more is refused before anything reaches the stack
+ *   - duplicate requests: a repeated Level Set reaches the server once, a
+ *     repeated Level Delta Set or Level Move every time, and a Delta Set in
+ *     between makes the next Level Set a new request
+ *   - publish limit: publications over the limit of a vendor model and of a
+ *     server with two states are held back, replaced only by a newer one of
+ *     the same kind, and released when the credit has grown again
+ *   - packing: a packed message the stack has no room for is kept and sent
+ *     again, a new record is refused rather than dropping it, and records
+ *     refused for good or too many times are counted as lost
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -w -DEFR32BG12P332F1024GL125 -DMESH_LIB_NATIVE=1 -Iprotocol/bluetooth/bt_mesh/inc
+ *      -Iprotocol/bluetooth/bt_mesh/inc/common -Iprotocol/bluetooth/bt_mesh/inc/soc -Iplatform/emlib/inc
+ *      -Iplatform/CMSIS/Include -Iplatform/Device/SiliconLabs/EFR32BG12P/Include tools/mesh_lib_check.c
+ *      protocol/bluetooth/bt_mesh/src/mesh_lib.c protocol/bluetooth/bt_mesh/src/mesh_serdeser.c -o mesh_lib_check
+ *
+ * Usage:
+ *   mesh_lib_check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_gecko.h"
+#include "mesh_generic_model_capi_types.h"
+#include "mesh_lib.h"
+
+#define VENDOR_ID            0x02FF
+#define MODEL_ID             0x0001
+#define OPCODE               0x05
+#define PEER_ADDR            0x0102
+#define LEVEL_SERVER_ID      0x1002
+#define ONOFF_SERVER_ID      0x1000
+#define LIMIT_INTERVAL_MS    1000
+#define MAX_CMDS             64
+
+/* a command as it reached the stack */
+struct cmd {
+  uint32_t id;
+  uint16_t len;                /* payload octets, vendor send and set publication */
+  uint8_t final;
+  uint8_t kind;                /* server publish */
+};
+
+static uint8_t cmd_buf[512], rsp_buf[512];
+void *gecko_cmd_msg_buf = cmd_buf;
+void *gecko_rsp_msg_buf = rsp_buf;
+
+static struct cmd cmds[MAX_CMDS];
+static int num_cmds;
+static uint16_t result;        /* answer to the commands */
+static uint32_t now_ms;
+
+static size_t last_len;        /* payload of the last message dispatched */
+static int requests;           /* requests passed to the level server */
+static int failed;
+
+// stack
+
+void sli_bt_cmd_handler_delegate(uint32_t header, gecko_cmd_handler handler, const void *payload)
+{
+  struct gecko_cmd_packet *c = (struct gecko_cmd_packet *) cmd_buf;
+  struct gecko_cmd_packet *r = (struct gecko_cmd_packet *) rsp_buf;
+  struct cmd *k = &cmds[num_cmds < MAX_CMDS ? num_cmds++ : MAX_CMDS - 1];
+
+  (void) handler;
+  (void) payload;
+  memset(k, 0, sizeof(*k));
+  k->id = BGLIB_MSG_ID(header);
+  memset(rsp_buf, 0, sizeof(rsp_buf));
+
+  switch (k->id) {
+    case gecko_cmd_hardware_get_time_id:
+      num_cmds--;
+      r->data.rsp_hardware_get_time.seconds = now_ms / 1000;
+      r->data.rsp_hardware_get_time.ticks = (uint16_t)((now_ms % 1000) * 32768 / 1000);
+      return;
+    case gecko_cmd_mesh_vendor_model_send_id:
+      k->len = c->data.cmd_mesh_vendor_model_send.payload.len;
+      k->final = c->data.cmd_mesh_vendor_model_send.final;
+      break;
+    case gecko_cmd_mesh_vendor_model_set_publication_id:
+      k->len = c->data.cmd_mesh_vendor_model_set_publication.payload.len;
+      k->final = c->data.cmd_mesh_vendor_model_set_publication.final;
+      break;
+    case gecko_cmd_mesh_generic_server_publish_id:
+      k->kind = c->data.cmd_mesh_generic_server_publish.type;
+      break;
+  }
+  // every response starts with the result
+  r->data.rsp_mesh_vendor_model_send.result = result;
+}
+
+void sli_bt_cmd_hardware_get_time(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_generic_client_get(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_generic_client_publish(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_generic_client_set(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_generic_server_publish(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_generic_server_response(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_generic_server_update(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_vendor_model_deinit(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_vendor_model_init(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_vendor_model_publish(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_vendor_model_send(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_vendor_model_set_publication(const void *p) { (void) p; }
+
+// helpers
+
+static void check(int ok, const char *what)
+{
+  printf("  %-60s %s\n", what, ok ? "ok" : "FAILED");
+  failed |= !ok;
+}
+
+static void received(const struct mesh_lib_vendor_model_message *msg)
+{
+  last_len = msg->payload_len;
+}
+
+static const struct mesh_lib_vendor_model_handler handlers[] = {
+  { OPCODE, received },
+};
+
+static void level_request(uint16_t model_id, uint16_t element_index, uint16_t client_addr, uint16_t server_addr,
+                          uint16_t appkey_index, const struct mesh_generic_request *req, uint32_t transition_ms,
+                          uint16_t delay_ms, uint8_t request_flags)
+{
+  (void) model_id;
+  (void) element_index;
+  (void) client_addr;
+  (void) server_addr;
+  (void) appkey_index;
+  (void) req;
+  (void) transition_ms;
+  (void) delay_ms;
+  (void) request_flags;
+  requests++;
+}
+
+static void level_change(uint16_t model_id, uint16_t element_index, const struct mesh_generic_state *current,
+                         const struct mesh_generic_state *target, uint32_t remaining_ms)
+{
+  (void) model_id;
+  (void) element_index;
+  (void) current;
+  (void) target;
+  (void) remaining_ms;
+}
+
+/* a client request of the given type to the level server, 100 ms later than the last one */
+static void request(uint8_t type, const uint8_t *param, uint8_t len)
+{
+  static uint8_t buf[sizeof(struct gecko_cmd_packet) + 256];
+  struct gecko_cmd_packet *evt = (struct gecko_cmd_packet *) buf;
+  struct gecko_msg_mesh_generic_server_client_request_evt_t *req = &evt->data.evt_mesh_generic_server_client_request;
+
+  memset(buf, 0, sizeof(buf));
+  evt->header = gecko_evt_mesh_generic_server_client_request_id;
+  req->model_id = LEVEL_SERVER_ID;
+  req->client_address = PEER_ADDR;
+  req->type = type;
+  req->parameters.len = len;
+  memcpy(req->parameters.data, param, len);
+  now_ms += 100;
+  mesh_lib_generic_server_event_handler(evt);
+}
+
+/* a receive event with len octets, final if it is the last part */
+static void receive(size_t len, uint8_t final)
+{
+  static uint8_t buf[sizeof(struct gecko_cmd_packet) + 256];
+  struct gecko_cmd_packet *evt = (struct gecko_cmd_packet *) buf;
+  struct gecko_msg_mesh_vendor_model_receive_evt_t *rcv = &evt->data.evt_mesh_vendor_model_receive;
+
+  memset(buf, 0, sizeof(buf));
+  evt->header = gecko_evt_mesh_vendor_model_receive_id;
+  rcv->vendor_id = VENDOR_ID;
+  rcv->model_id = MODEL_ID;
+  rcv->source_address = PEER_ADDR;
+  rcv->opcode = OPCODE;
+  rcv->final = final;
+  rcv->payload.len = (uint8_t) len;
+  mesh_lib_vendor_model_event_handler(evt);
+}
+
+/* a message of len octets arriving in parts of MESH_LIB_VENDOR_CMD_PAYLOAD */
+static void receive_message(size_t len)
+{
+  size_t part;
+
+  do {
+    part = len > MESH_LIB_VENDOR_CMD_PAYLOAD ? MESH_LIB_VENDOR_CMD_PAYLOAD : len;
+    len -= part;
+    receive(part, len == 0);
+  } while (len);
+}
+
+/* the recorded commands split len octets of payload, the last one final */
+static int split(uint32_t id, size_t len)
+{
+  size_t total = 0;
+  int i, parts = 0;
+
+  for (i = 0; i < num_cmds; i++) {
+    if (cmds[i].id != id) {
+      continue;
+    }
+    if (cmds[i].len > MESH_LIB_VENDOR_CMD_PAYLOAD || cmds[i].final != (total + cmds[i].len == len)) {
+      return 0;
+    }
+    total += cmds[i].len;
+    parts++;
+  }
+  return parts > 0 && total == len;
+}
+
+/* the kinds of the server publications recorded, in order */
+static int published(const uint8_t *kinds, int n)
+{
+  int i, k = 0;
+
+  for (i = 0; i < num_cmds; i++) {
+    if (cmds[i].id == gecko_cmd_mesh_generic_server_publish_id && (k >= n || cmds[i].kind != kinds[k++])) {
+      return 0;
+    }
+  }
+  return k == n;
+}
+
+static int count(uint32_t id)
+{
+  int i, n = 0;
+
+  for (i = 0; i < num_cmds; i++) {
+    n += cmds[i].id == id;
+  }
+  return n;
+}
+
+// checks
+
+static void check_payload_limit(void)
+{
+  static uint8_t payload[MESH_LIB_VENDOR_MAX_PAYLOAD + 1];
+  struct mesh_lib_vendor_model_stats stats;
+  errorcode_t res;
+
+  printf("payload limit, %d octets:\n", MESH_LIB_VENDOR_MAX_PAYLOAD);
+
+  num_cmds = 0;
+  res = mesh_lib_vendor_model_send(VENDOR_ID, MODEL_ID, 0, PEER_ADDR, 0, OPCODE,
+                                   payload, MESH_LIB_VENDOR_MAX_PAYLOAD, 0);
+  check(res == bg_err_success && split(gecko_cmd_mesh_vendor_model_send_id, MESH_LIB_VENDOR_MAX_PAYLOAD),
+        "send of the longest payload");
+
+  num_cmds = 0;
+  res = mesh_lib_vendor_model_send(VENDOR_ID, MODEL_ID, 0, PEER_ADDR, 0, OPCODE,
+                                   payload, MESH_LIB_VENDOR_MAX_PAYLOAD + 1, 0);
+  check(res == bg_err_invalid_param && num_cmds == 0, "send of one octet more is refused");
+
+  num_cmds = 0;
+  res = mesh_lib_vendor_model_publish(VENDOR_ID, MODEL_ID, 0, OPCODE, payload, MESH_LIB_VENDOR_MAX_PAYLOAD);
+  check(res == bg_err_success
+        && split(gecko_cmd_mesh_vendor_model_set_publication_id, MESH_LIB_VENDOR_MAX_PAYLOAD)
+        && count(gecko_cmd_mesh_vendor_model_publish_id) == 1,
+        "publish of the longest payload");
+
+  num_cmds = 0;
+  res = mesh_lib_vendor_model_publish(VENDOR_ID, MODEL_ID, 0, OPCODE, payload, MESH_LIB_VENDOR_MAX_PAYLOAD + 1);
+  check(res == bg_err_invalid_param && num_cmds == 0, "publish of one octet more is refused");
+
+  mesh_lib_vendor_model_reset_stats();
+  last_len = 0;
+  receive_message(MESH_LIB_VENDOR_MAX_PAYLOAD);
+  mesh_lib_vendor_model_get_stats(&stats);
+  check(stats.dispatched == 1 && last_len == MESH_LIB_VENDOR_MAX_PAYLOAD, "the longest message is received");
+
+  mesh_lib_vendor_model_reset_stats();
+  receive_message(MESH_LIB_VENDOR_MAX_PAYLOAD + 1);
+  mesh_lib_vendor_model_get_stats(&stats);
+  check(stats.dispatched == 0 && stats.incomplete == 1, "a message of one octet more is dropped");
+}
+
+static void check_duplicates(void)
+{
+  static const uint8_t set[2] = { 0x00, 0x10 };
+  static const uint8_t delta[4] = { 0x00, 0x01, 0x00, 0x00 };
+  static const uint8_t move[2] = { 0x00, 0x01 };
+
+  printf("duplicate requests:\n");
+
+  requests = 0;
+  request(mesh_generic_request_level, set, sizeof(set));
+  request(mesh_generic_request_level, set, sizeof(set));
+  check(requests == 1, "a repeated Level Set is handled once");
+
+  requests = 0;
+  request(mesh_generic_request_level_delta, delta, sizeof(delta));
+  request(mesh_generic_request_level_delta, delta, sizeof(delta));
+  check(requests == 2, "a repeated Level Delta Set is handled every time");
+
+  requests = 0;
+  request(mesh_generic_request_level_move, move, sizeof(move));
+  request(mesh_generic_request_level_move, move, sizeof(move));
+  check(requests == 2, "a repeated Level Move is handled every time");
+
+  requests = 0;
+  request(mesh_generic_request_level, set, sizeof(set));
+  request(mesh_generic_request_level_delta, delta, sizeof(delta));
+  request(mesh_generic_request_level, set, sizeof(set));
+  check(requests == 3, "a Level Set after a Delta Set is a new request");
+}
+
+static void check_publish_limit(void)
+{
+  static const uint8_t level_then_on_off[2] = { mesh_generic_state_level, mesh_generic_state_on_off };
+  struct mesh_lib_publish_limit_stats stats;
+  uint8_t payload[4] = { 0 };
+  int i;
+
+  printf("publish limit, %d ms per publication:\n", LIMIT_INTERVAL_MS);
+
+  // vendor model, a burst of two
+  mesh_lib_publish_limit_set(VENDOR_ID, MODEL_ID, 0, LIMIT_INTERVAL_MS, 2);
+  num_cmds = 0;
+  for (i = 0; i < 5; i++) {
+    mesh_lib_vendor_model_publish(VENDOR_ID, MODEL_ID, 0, OPCODE, payload, sizeof(payload));
+    now_ms += 10;
+  }
+  mesh_lib_publish_limit_get_stats(VENDOR_ID, MODEL_ID, 0, &stats);
+  check(count(gecko_cmd_mesh_vendor_model_publish_id) == 2 && stats.passed == 2 && stats.throttled == 3
+        && stats.coalesced == 2, "a burst of five vendor publications sends two");
+
+  num_cmds = 0;
+  now_ms += LIMIT_INTERVAL_MS / 2;
+  mesh_lib_publish_limit_check_timeouts();
+  check(count(gecko_cmd_mesh_vendor_model_publish_id) == 0, "nothing is released before the interval");
+
+  now_ms += LIMIT_INTERVAL_MS / 2;
+  mesh_lib_publish_limit_check_timeouts();
+  mesh_lib_publish_limit_check_timeouts();
+  mesh_lib_publish_limit_get_stats(VENDOR_ID, MODEL_ID, 0, &stats);
+  check(count(gecko_cmd_mesh_vendor_model_publish_id) == 1 && stats.delayed == 1,
+        "the latest one is released once after the interval");
+
+  // server with two states, a burst of one
+  mesh_lib_publish_limit_set(MESH_LIB_SIG_VENDOR_ID, ONOFF_SERVER_ID, 0, LIMIT_INTERVAL_MS, 1);
+  num_cmds = 0;
+  mesh_lib_generic_server_publish(ONOFF_SERVER_ID, 0, mesh_generic_state_on_off);
+  mesh_lib_generic_server_publish(ONOFF_SERVER_ID, 0, mesh_generic_state_level);
+  mesh_lib_generic_server_publish(ONOFF_SERVER_ID, 0, mesh_generic_state_on_off);
+  mesh_lib_publish_limit_get_stats(MESH_LIB_SIG_VENDOR_ID, ONOFF_SERVER_ID, 0, &stats);
+  check(count(gecko_cmd_mesh_generic_server_publish_id) == 1 && stats.throttled == 2 && stats.coalesced == 0,
+        "a held back state is not replaced by another state");
+
+  num_cmds = 0;
+  for (i = 0; i < 4; i++) {
+    now_ms += LIMIT_INTERVAL_MS;
+    mesh_lib_publish_limit_check_timeouts();
+  }
+  mesh_lib_publish_limit_get_stats(MESH_LIB_SIG_VENDOR_ID, ONOFF_SERVER_ID, 0, &stats);
+  check(published(level_then_on_off, 2) && stats.delayed == 2 && stats.dropped == 0,
+        "both states are released, one per interval");
+
+  num_cmds = 0;
+  mesh_lib_generic_server_publish(ONOFF_SERVER_ID, 0, mesh_generic_state_level);
+  mesh_lib_generic_server_publish(ONOFF_SERVER_ID, 0, mesh_generic_state_level);
+  mesh_lib_generic_server_publish(ONOFF_SERVER_ID, 0, mesh_generic_state_level);
+  mesh_lib_publish_limit_get_stats(MESH_LIB_SIG_VENDOR_ID, ONOFF_SERVER_ID, 0, &stats);
+  check(count(gecko_cmd_mesh_generic_server_publish_id) == 1 && stats.coalesced == 1,
+        "a held back state is replaced by the same state");
+
+  num_cmds = 0;
+  mesh_lib_publish_limit_set(MESH_LIB_SIG_VENDOR_ID, ONOFF_SERVER_ID, 0, 0, 0);
+  check(count(gecko_cmd_mesh_generic_server_publish_id) == 1, "removing the limit sends what is held back");
+}
+
+static void check_pack(void)
+{
+  struct mesh_lib_vendor_model_stats stats;
+  uint8_t record[4] = { 0 };
+  errorcode_t res;
+  int i;
+
+  printf("packing, the stack out of buffers:\n");
+
+  // refused once, kept and sent on the next tick
+  num_cmds = 0;
+  result = bg_err_out_of_memory;
+  res = mesh_lib_vendor_pack_add(VENDOR_ID, MODEL_ID, 0, 0x0001, 0, 1, record, sizeof(record), 0);
+  result = bg_err_success;
+  mesh_lib_vendor_pack_check_timeouts();
+  mesh_lib_vendor_model_get_stats(&stats);
+  check(res == bg_err_success && count(gecko_cmd_mesh_vendor_model_send_id) == 2 && stats.pack_retries == 1
+        && stats.pack_lost == 0, "a refused record is kept and sent again");
+
+  // a kept buffer is not dropped to make room
+  num_cmds = 0;
+  result = bg_err_out_of_memory;
+  mesh_lib_vendor_pack_add(VENDOR_ID, MODEL_ID, 0, 0x0001, 0, 1, record, sizeof(record), 0);
+  mesh_lib_vendor_pack_add(VENDOR_ID, MODEL_ID, 0, 0x0002, 0, 1, record, sizeof(record), 0);
+  res = mesh_lib_vendor_pack_add(VENDOR_ID, MODEL_ID, 0, 0x0003, 0, 1, record, sizeof(record), 0);
+  mesh_lib_vendor_model_get_stats(&stats);
+  check(res == bg_err_out_of_memory && stats.pack_lost == 0, "a record is refused when no buffer can be freed");
+
+  // refused until the tries run out
+  for (i = 0; i < 100; i++) {
+    mesh_lib_vendor_pack_check_timeouts();
+  }
+  mesh_lib_vendor_model_get_stats(&stats);
+  check(stats.pack_lost == 2, "records are counted as lost after too many tries");
+
+  // refused for good
+  result = bg_err_invalid_param;
+  res = mesh_lib_vendor_pack_add(VENDOR_ID, MODEL_ID, 0, 0x0001, 0, 1, record, sizeof(record), 0);
+  mesh_lib_vendor_model_get_stats(&stats);
+  check(res == bg_err_invalid_param && stats.pack_lost == 3, "a record refused for good is counted as lost");
+  result = bg_err_success;
+}
+
+int main(void)
+{
+  errorcode_t res;
+
+  res = mesh_lib_init(malloc, free, 1);
+  if (res == bg_err_success) {
+    res = mesh_lib_vendor_init(1);
+  }
+  if (res == bg_err_success) {
+    res = mesh_lib_vendor_model_register(VENDOR_ID, MODEL_ID, 0, 1, handlers, 1);
+  }
+  if (res == bg_err_success) {
+    res = mesh_lib_generic_server_register_handler(LEVEL_SERVER_ID, 0, level_request, level_change);
+  }
+  if (res == bg_err_success) {
+    res = mesh_lib_publish_limit_init(2);
+  }
+  if (res == bg_err_success) {
+    res = mesh_lib_vendor_pack_init(OPCODE, 2);
+  }
+  if (res != bg_err_success) {
+    printf("init failed %x\n", res);
+    return 1;
+  }
+
+  check_payload_limit();
+  check_duplicates();
+  check_publish_limit();
+  check_pack();
+
+  printf("%s\n", failed ? "FAILED" : "passed");
+  return failed;
+}
@@ -0,0 +1,301 @@
+#!/usr/bin/env python3
+"""
+Mesh memory configuration generator.
+
+Sizes the MESH_CFG_* limits of mesh_app_memory_config.h for a target fleet
+size and traffic profile, updates the memory configuration and the RPL
+capacity in dcd.c, and checks that the resulting heaps fit in the RAM region
+of the linker script.
+
+The heap sizes are computed with the per-item sizes of the stack
+(protocol/bluetooth/bt_mesh/inc/common/mesh_sizes.h) using the same formula
+as BTMESH_HEAP_SIZE, plus DEFAULT_BLUETOOTH_HEAP() and the extra margin given
+to bluetooth_stack_heap in main.c.
+
+The RAM check is exact when the ELF of the current build is given with --elf:
+the RAM used by that build is taken from its section headers and adjusted by
+the change of the heap and node table sizes. Without it a rough estimate of
+the static RAM is used.
+
+Usage:
+  tools/mesh_memcfg.py --nodes 200 --profile normal
+  tools/mesh_memcfg.py --nodes 200 --profile normal --check --elf "GNU ARM v7.2.1 - Default/soc-btmesh-prov.axf"
+  tools/mesh_memcfg.py --check
+
+With --check nothing is written and the exit status is 1 if the configuration
+does not fit. Without --nodes the configuration in mesh_app_memory_config.h is
+checked as it is; both build configurations in .cproject run this as their
+pre-build step to stop the build on overflow.
+"""
+
+import argparse
+import math
+import os
+import re
+import struct
+import sys
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+APP_CONFIG = os.path.join(ROOT, 'mesh_app_memory_config.h')
+DCD = os.path.join(ROOT, 'dcd.c')
+MAIN = os.path.join(ROOT, 'main.c')
+SIZES = os.path.join(ROOT, 'protocol', 'bluetooth', 'bt_mesh', 'inc', 'common', 'mesh_sizes.h')
+GECKO_CONFIG = os.path.join(ROOT, 'protocol', 'bluetooth', 'bt_mesh', 'inc', 'common', 'gecko_configuration.h')
+LINKER = os.path.join(ROOT, 'efr32bg12p332f1024gl125.ld')
+CPROJECT = os.path.join(ROOT, '.cproject')
+
+# messages per node per minute, segmented transfers in flight, configuration commands in flight
+PROFILES = {
+    'light':  {'msgs_per_node_min': 1,  'segs': 2, 'config_parallel': 2},
+    'normal': {'msgs_per_node_min': 6,  'segs': 4, 'config_parallel': 4},
+    'heavy':  {'msgs_per_node_min': 30, 'segs': 8, 'config_parallel': 8},
+}
+
+# how long relayed copies of a message keep arriving (s); copies share one cache entry
+NET_CACHE_WINDOW_S = 4
+
+# bytes of application RAM per node: node_db arrays and its two hash indexes
+APP_BYTES_PER_NODE = 2 + 1 + 1 + 2 + 4 + 16 + 2 * 2 * 2
+
+# static RAM of the stack libraries and the application when no ELF is given
+DEFAULT_STATIC_RAM = 24 * 1024
+
+# the provisioner holds the old and the new network key while a key refresh runs
+MIN_NETKEYS = 2
+
+# order of the defines in mesh_app_memory_config.h
+CONFIG_ORDER = [
+    'MAX_ELEMENTS', 'MAX_MODELS', 'MAX_APP_BINDS', 'MAX_SUBSCRIPTIONS', 'MAX_NETKEYS', 'MAX_APPKEYS',
+    'MAX_DEVKEYS', 'NET_CACHE_SIZE', 'RPL_SIZE', 'MAX_SEND_SEGS', 'MAX_RECV_SEGS', 'MAX_VAS',
+    'MAX_PROV_SESSIONS', 'MAX_PROV_BEARERS', 'MAX_GATT_CONNECTIONS', 'GATT_TXQ_SIZE',
+    'MAX_PROVISIONED_DEVICES', 'MAX_PROVISIONED_DEVICE_NETKEYS', 'MAX_FOUNDATION_CLIENT_CMDS',
+    'MAX_FRIENDSHIPS', 'FRIEND_MAX_SUBS_LIST', 'FRIEND_MAX_TOTAL_CACHE', 'FRIEND_MAX_SINGLE_CACHE',
+]
+
+
+class ConfigError(Exception):
+    pass
+
+
+def read(path):
+    with open(path) as f:
+        return f.read()
+
+
+def write(path, text):
+    with open(path, 'w', newline='\n') as f:
+        f.write(text)
+
+
+def round_up(n, step):
+    return int(math.ceil(n / float(step))) * step
+
+
+def parse_app_config(text):
+    cfg = {}
+    for name, value in re.findall(r'#define\s+MESH_CFG_(\w+)\s+(\d+)', text):
+        cfg[name] = int(value, 10)
+    missing = [n for n in CONFIG_ORDER if n not in cfg]
+    if missing:
+        raise ConfigError('mesh_app_memory_config.h lacks ' + ', '.join(missing))
+    return cfg
+
+
+def parse_sizes(text):
+    return {name: int(value) for name, value in re.findall(r'#define\s+MESH_MEMSIZE_(\w+)\s+(\d+)', text)}
+
+
+def parse_dcd_models(text):
+    """Count the elements and models of __mesh_dcd."""
+    elements = len(re.findall(r'/\* Number of SIG Models', text))
+    models = sum(int(n, 16) for n in re.findall(r'0x([0-9a-fA-F]{2}), /\* Number of (?:SIG|Vendor) Models', text))
+    return elements, models
+
+
+def parse_ram(text):
+    m = re.search(r'RAM\s*\([^)]*\)\s*:\s*ORIGIN\s*=\s*(0x[0-9a-fA-F]+)\s*,\s*LENGTH\s*=\s*(0x[0-9a-fA-F]+)', text)
+    if not m:
+        raise ConfigError('RAM region not found in the linker script')
+    return int(m.group(1), 16), int(m.group(2), 16)
+
+
+def parse_cproject_define(text, name, default):
+    m = re.search(name + r'=(0x[0-9a-fA-F]+|\d+)', text)
+    return int(m.group(1), 0) if m else default
+
+
+def parse_bt_heap(gecko_config, main):
+    m = re.search(r'#define\s+DEFAULT_BLUETOOTH_HEAP\(CONNECTIONS\)\s*\((\d+)\s*\+\s*\(CONNECTIONS\)\s*\*\s*\((\d+)\)\)', gecko_config)
+    base, per_conn = (int(m.group(1)), int(m.group(2))) if m else (4824, 440)
+    m = re.search(r'#define\s+MAX_CONNECTIONS\s+(\d+)', main)
+    connections = int(m.group(1)) if m else 2
+    m = re.search(r'bluetooth_stack_heap\[[^\]]*BTMESH_HEAP_SIZE\s*\+\s*(\d+)\]', main)
+    margin = int(m.group(1)) if m else 0
+    return base + connections * per_conn + margin
+
+
+def btmesh_heap(cfg, s):
+    """BTMESH_HEAP_SIZE of mesh_sizes.h"""
+    return (s['MESH_BEARER']
+            + cfg['MAX_ELEMENTS'] * s['ELEMENT']
+            + cfg['MAX_MODELS'] * (s['MODEL_BASE']
+                                   + cfg['MAX_APP_BINDS'] * s['MODEL_PER_APP_BINDING']
+                                   + cfg['MAX_SUBSCRIPTIONS'] * s['MODEL_PER_SUBSCRIPTION'])
+            + cfg['MAX_NETKEYS'] * s['NETKEY']
+            + cfg['MAX_APPKEYS'] * s['APPKEY']
+            + cfg['MAX_DEVKEYS'] * s['DEVKEY']
+            + cfg['MAX_FRIENDSHIPS'] * s['FRIENDSHIP']
+            + cfg['NET_CACHE_SIZE'] * s['NET_CACHE_ENTRY']
+            + cfg['RPL_SIZE'] * s['RPL_ENTRY']
+            + cfg['MAX_SEND_SEGS'] * s['SEG_SEND']
+            + cfg['MAX_RECV_SEGS'] * s['SEG_RECV']
+            + cfg['MAX_VAS'] * s['VA']
+            + cfg['MAX_PROV_SESSIONS'] * (s['PROV_SESSION'] + s['PB_ADV'])
+            + cfg['MAX_PROV_BEARERS'] * s['PROV_BEARER']
+            + cfg['MAX_GATT_CONNECTIONS'] * (s['GATT_CONNECTION'] + s['MESH_BEARER'])
+            + cfg['GATT_TXQ_SIZE'] * s['GATT_TXQ_ENTRY']
+            + cfg['MAX_PROVISIONED_DEVICES'] * (s['PRV_DDB_ENTRY_BASE']
+                                                + cfg['MAX_PROVISIONED_DEVICE_NETKEYS'] * s['PRV_DDB_ENTRY_PER_NODE_NETKEY'])
+            + cfg['FRIEND_MAX_SUBS_LIST'] * 16
+            + cfg['MAX_FOUNDATION_CLIENT_CMDS'] * s['FOUNDATION_CMD'])
+
+
+def elf_ram_usage(path, origin, length):
+    """Sum of the allocated sections of a 32-bit little endian ELF that lie in RAM."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:4] != b'\x7fELF' or data[4] != 1 or data[5] != 1:
+        raise ConfigError(path + ' is not a 32-bit little endian ELF file')
+    shoff, = struct.unpack_from('<I', data, 0x20)
+    shentsize, shnum = struct.unpack_from('<HH', data, 0x2E)
+    used = 0
+    for i in range(shnum):
+        _, _, flags, addr, _, size = struct.unpack_from('<IIIIII', data, shoff + i * shentsize)
+        if flags & 0x2 and origin <= addr < origin + length:
+            used += size
+    return used
+
+
+def tune(cfg, args):
+    profile = PROFILES[args.profile]
+    new = dict(cfg)
+
+    elements, models = parse_dcd_models(read(DCD))
+    new['MAX_ELEMENTS'] = max(elements, 1)
+    new['MAX_MODELS'] = max(models, 1)
+
+    # one DDB entry per node, and the provisioner talks to every node
+    new['MAX_PROVISIONED_DEVICES'] = args.nodes
+    new['MAX_PROVISIONED_DEVICE_NETKEYS'] = args.netkeys
+    new['MAX_NETKEYS'] = max(args.netkeys, MIN_NETKEYS)
+    new['MAX_DEVKEYS'] = max(cfg['MAX_DEVKEYS'], 1)
+    new['RPL_SIZE'] = round_up(max(args.nodes + 8, 32), 8)
+
+    # the network cache must remember every message heard while its copies are still being relayed
+    msgs_per_s = args.nodes * profile['msgs_per_node_min'] / 60.0
+    new['NET_CACHE_SIZE'] = round_up(max(msgs_per_s * NET_CACHE_WINDOW_S, 16), 8)
+
+    # configuration responses (composition data) are segmented
+    new['MAX_FOUNDATION_CLIENT_CMDS'] = profile['config_parallel'] + 1
+    new['MAX_SEND_SEGS'] = profile['segs']
+    new['MAX_RECV_SEGS'] = max(profile['segs'], profile['config_parallel'])
+    return new
+
+
+def render_app_config(cfg):
+    lines = [
+        '#ifndef _MESH_APP_MEMORY_CONFIG_H',
+        '#define _MESH_APP_MEMORY_CONFIG_H',
+        '/*****************************************************************************',
+        ' *',
+        ' *  BT Mesh application memory configuration',
+        ' *',
+        ' *  Autogenerated file, do not edit',
+        ' *',
+        ' ****************************************************************************/',
+        '',
+        '',
+    ]
+    for name in CONFIG_ORDER:
+        lines.append('#define %-39s %d' % ('MESH_CFG_' + name, cfg[name]))
+    lines += ['', '#endif']
+    return '\n'.join(lines)
+
+
+def render_dcd(text, cfg, pstore_interval):
+    # RPL capacity advertised in the composition data must match the configured RPL
+    text, n = re.subn(r'0x[0-9a-fA-F]{2}, 0x[0-9a-fA-F]{2}, /\* Capacity of Replay Protection List = 0x[0-9a-fA-F]{4} \*/',
+                      '0x%02x, 0x%02x, /* Capacity of Replay Protection List = 0x%04x */'
+                      % (cfg['RPL_SIZE'] & 0xFF, cfg['RPL_SIZE'] >> 8, cfg['RPL_SIZE']), text)
+    if n != 1:
+        raise ConfigError('RPL capacity not found in dcd.c')
+    text, n = re.subn(r'(\.pstore_write_interval_elem_seq = )\d+', r'\g<1>%d' % pstore_interval, text)
+    if n != 1:
+        raise ConfigError('__mesh_memory_config not found in dcd.c')
+    return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate the mesh memory configuration for a fleet size.')
+    parser.add_argument('--nodes', type=int,
+                        help='number of nodes the provisioner manages; required unless --check is given')
+    parser.add_argument('--profile', choices=sorted(PROFILES), default='normal', help='traffic profile')
+    parser.add_argument('--netkeys', type=int, default=1, help='network keys per node')
+    parser.add_argument('--pstore-interval', type=int, default=65536,
+                        help='sequence numbers between writes of the sequence number to flash')
+    parser.add_argument('--elf', help='ELF of the current build, for an exact RAM check')
+    parser.add_argument('--static-ram', type=int, default=DEFAULT_STATIC_RAM,
+                        help='static RAM besides the heaps and stack when no ELF is given')
+    parser.add_argument('--check', action='store_true', help='only check, do not write any files')
+    args = parser.parse_args()
+
+    if args.nodes is None and not args.check:
+        parser.error('--nodes is required unless --check is given')
+    if args.nodes is not None and (args.nodes < 1 or args.nodes > 0x7FFF):
+        parser.error('--nodes must be between 1 and 32767')
+
+    try:
+        old = parse_app_config(read(APP_CONFIG))
+        sizes = parse_sizes(read(SIZES))
+        new = tune(old, args) if args.nodes is not None else dict(old)
+
+        bt_heap = parse_bt_heap(read(GECKO_CONFIG), read(MAIN))
+        old_heap = bt_heap + btmesh_heap(old, sizes)
+        new_heap = bt_heap + btmesh_heap(new, sizes)
+        app_delta = (new['MAX_PROVISIONED_DEVICES'] - old['MAX_PROVISIONED_DEVICES']) * APP_BYTES_PER_NODE
+
+        origin, length = parse_ram(read(LINKER))
+        if args.elf:
+            ram = elf_ram_usage(args.elf, origin, length) + (new_heap - old_heap) + app_delta
+            how = 'from ' + os.path.basename(args.elf)
+        else:
+            cproject = read(CPROJECT)
+            ram = (args.static_ram + new_heap + new['MAX_PROVISIONED_DEVICES'] * APP_BYTES_PER_NODE
+                   + parse_cproject_define(cproject, '__STACK_SIZE', 0x400)
+                   + parse_cproject_define(cproject, '__HEAP_SIZE', 0xC00))
+            how = 'estimated'
+
+        for name in CONFIG_ORDER:
+            if new[name] != old[name]:
+                print('MESH_CFG_%-32s %6d -> %d' % (name, old[name], new[name]))
+        print('mesh heap        %6d -> %d bytes' % (btmesh_heap(old, sizes), btmesh_heap(new, sizes)))
+        print('bluetooth heap   %6d bytes (bluetooth_stack_heap %d)' % (bt_heap, new_heap))
+        print('RAM              %6d of %d bytes (%s)' % (ram, length, how))
+
+        if ram > length:
+            print('error: configuration needs %d bytes more RAM than available' % (ram - length), file=sys.stderr)
+            return 1
+
+        if not args.check:
+            write(APP_CONFIG, render_app_config(new))
+            write(DCD, render_dcd(read(DCD), new, args.pstore_interval))
+            print('updated %s and %s' % (os.path.relpath(APP_CONFIG, ROOT), os.path.relpath(DCD, ROOT)))
+    except (ConfigError, IOError) as e:
+        print('error: %s' % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
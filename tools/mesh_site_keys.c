@@ -0,0 +1,81 @@
+/*
+ * Site key listing for offline commissioning.
+ *
+ * Derives the network and application key of a range of sites from the master
+ * secret with the same code as the provisioner (mesh_kdf.c) and prints them
+ * with the identifiers the network uses: NID and network ID of the netkey, AID
+ * of the appkey. One CSV line per site.
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -DAES_SOFTWARE -I. tools/mesh_site_keys.c mesh_kdf.c aes_block.c -o mesh_site_keys
+ *
+ * Usage:
+ *   mesh_site_keys <secret, 32 hex digits> <first site id> <number of sites>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_kdf.h"
+
+static int parse_hex(const char *s, uint8_t *out, size_t len)
+{
+  size_t i;
+  unsigned int v;
+
+  if (strlen(s) != 2 * len) {
+    return -1;
+  }
+  for (i = 0; i < len; i++) {
+    if (sscanf(s + 2 * i, "%2x", &v) != 1) {
+      return -1;
+    }
+    out[i] = (uint8_t) v;
+  }
+  return 0;
+}
+
+static void print_hex(const uint8_t *data, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    printf("%02X", data[i]);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint8_t secret[MESH_KDF_KEY_LEN];
+  uint8_t netkey[MESH_KDF_KEY_LEN], appkey[MESH_KDF_KEY_LEN];
+  uint8_t enc_key[MESH_KDF_KEY_LEN], priv_key[MESH_KDF_KEY_LEN];
+  uint8_t network_id[8];
+  uint8_t p = 0, nid;
+  unsigned long first, count, i;
+
+  if (argc != 4 || parse_hex(argv[1], secret, sizeof(secret))) {
+    fprintf(stderr, "usage: %s <secret, 32 hex digits> <first site id> <number of sites>\n", argv[0]);
+    return 2;
+  }
+  first = strtoul(argv[2], NULL, 0);
+  count = strtoul(argv[3], NULL, 0);
+
+  printf("site,netkey,appkey,nid,network_id,aid\n");
+  for (i = 0; i < count; i++) {
+    mesh_site_keys(secret, (uint32_t)(first + i), netkey, appkey);
+    // master credentials, P = 0x00
+    mesh_k2(netkey, &p, 1, &nid, enc_key, priv_key);
+    mesh_k3(netkey, network_id);
+
+    printf("%lu,", first + i);
+    print_hex(netkey, sizeof(netkey));
+    printf(",");
+    print_hex(appkey, sizeof(appkey));
+    printf(",%02X,", nid);
+    print_hex(network_id, sizeof(network_id));
+    printf(",%02X\n", mesh_k4(appkey));
+  }
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include "msc_emu.h"
+
+#include <string.h>
+
+#define WORDS                (FLASH_SIZE / 4)
+
+static uint32_t flash[WORDS];
+static uint8_t written[WORDS];           /* written since the last erase of the page */
+static uint8_t unlocked;
+
+static uint64_t now_ns;
+static tsMscEmuStats stats;
+
+// local functions
+
+/* word index of an address in the flash, WORDS if outside */
+static uint32_t word_of(const uint32_t *p)
+{
+  if (p < flash || p >= flash + WORDS) {
+    return WORDS;
+  }
+  return (uint32_t)(p - flash);
+}
+
+static void stall(uint64_t ns)
+{
+  now_ns += ns;
+  if (ns / 1000 > stats.max_stall_us) {
+    stats.max_stall_us = (uint32_t)(ns / 1000);
+  }
+}
+
+// public functions
+
+uint32_t *msc_emu_ptr(uint32_t addr)
+{
+  return &flash[(addr - FLASH_BASE) / 4];
+}
+
+void msc_emu_fill(uint8_t value)
+{
+  memset(flash, value, sizeof(flash));
+  memset(written, 1, sizeof(written));
+}
+
+uint64_t msc_emu_time_us(void)
+{
+  return now_ns / 1000;
+}
+
+void msc_emu_get_stats(tsMscEmuStats *out)
+{
+  *out = stats;
+}
+
+void msc_emu_clear_stats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+void MSC_Init(void)
+{
+  unlocked = 1;
+}
+
+void MSC_Deinit(void)
+{
+  unlocked = 0;
+}
+
+MSC_Status_TypeDef MSC_WriteWordFast(uint32_t *address, void const *data, uint32_t numBytes)
+{
+  uint32_t word = word_of(address);
+  uint32_t i, value;
+
+  if (word == WORDS || word + numBytes / 4 > WORDS) {
+    return mscReturnInvalidAddr;
+  }
+  if (numBytes % 4) {
+    return mscReturnUnaligned;
+  }
+  if (!unlocked) {
+    return mscReturnLocked;
+  }
+  if (word / (FLASH_PAGE_SIZE / 4) != (word + numBytes / 4 - 1) / (FLASH_PAGE_SIZE / 4)) {
+    return mscReturnInvalidAddr;
+  }
+
+  for (i = 0; i < numBytes / 4; i++) {
+    memcpy(&value, (const uint8_t *)data + 4 * i, 4);
+    flash[word + i] &= value;
+    if (written[word + i]) {
+      stats.rewrites++;
+    }
+    written[word + i] = 1;
+  }
+  stats.words_written += numBytes / 4;
+  stall((uint64_t)numBytes / 4 * MSC_EMU_WORD_NS);
+  return mscReturnOk;
+}
+
+MSC_Status_TypeDef MSC_ErasePage(uint32_t *startAddress)
+{
+  uint32_t word = word_of(startAddress);
+
+  if (word == WORDS) {
+    return mscReturnInvalidAddr;
+  }
+  if (word % (FLASH_PAGE_SIZE / 4)) {
+    return mscReturnUnaligned;
+  }
+  if (!unlocked) {
+    return mscReturnLocked;
+  }
+
+  memset(&flash[word], 0xFF, FLASH_PAGE_SIZE);
+  memset(&written[word], 0, FLASH_PAGE_SIZE / 4);
+  stats.pages_erased++;
+  stall((uint64_t)MSC_EMU_PAGE_ERASE_US * 1000);
+  return mscReturnOk;
+}
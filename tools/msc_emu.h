@@ -0,0 +1,70 @@
+#ifndef _MSC_EMU_H
+#define _MSC_EMU_H
+
+#include <stdint.h>
+
+/**
+ *  Emulation of the internal flash and its controller (em_msc) for host builds.
+ *
+ *  flash_stream.c includes this header instead of em_device.h and em_msc.h when
+ *  built with -DMSC_EMULATOR, and reaches the flash through msc_emu_ptr().
+ *
+ *  Like the flash, an erase sets a whole page to 0xFF and a write can only
+ *  clear bits, so data written over a page that was not erased comes out
+ *  wrong. Writes must be word aligned and must not cross a page. Every call
+ *  advances a simulated clock by the word write and page erase times; both
+ *  stall the CPU on the chip, the longest call is kept as the worst stall.
+ */
+
+/* word write of MSC_WriteWordFast() and page erase, in the range of the datasheet */
+#ifndef MSC_EMU_WORD_NS
+#define MSC_EMU_WORD_NS          10000
+#endif
+
+#ifndef MSC_EMU_PAGE_ERASE_US
+#define MSC_EMU_PAGE_ERASE_US    20000
+#endif
+
+/* the parts of em_device.h and em_msc.h that are used on the host */
+#define FLASH_BASE               0x00000000UL
+#define FLASH_SIZE               0x00100000UL
+#define FLASH_PAGE_SIZE          2048U
+
+/* end of the application image and start of the persistent store, from the linker script on the chip */
+#ifndef MSC_EMU_APP_END
+#define MSC_EMU_APP_END          0x00040000UL
+#endif
+#define MSC_EMU_STORE_START      (FLASH_BASE + FLASH_SIZE)
+
+typedef enum {
+  mscReturnOk          =  0,
+  mscReturnInvalidAddr = -1,
+  mscReturnLocked      = -2,
+  mscReturnTimeOut     = -3,
+  mscReturnUnaligned   = -4
+} MSC_Status_TypeDef;
+
+typedef struct {
+  uint32_t words_written;
+  uint32_t pages_erased;
+  uint32_t rewrites;          /* words written again without an erase in between */
+  uint32_t max_stall_us;      /* longest single call */
+} tsMscEmuStats;
+
+/* the flash at 'addr', FLASH_BASE to FLASH_BASE + FLASH_SIZE */
+uint32_t *msc_emu_ptr(uint32_t addr);
+
+/* Fill the whole flash with 'value', as left by earlier content. */
+void msc_emu_fill(uint8_t value);
+
+uint64_t msc_emu_time_us(void);
+
+void msc_emu_get_stats(tsMscEmuStats *stats);
+void msc_emu_clear_stats(void);
+
+void MSC_Init(void);
+void MSC_Deinit(void);
+MSC_Status_TypeDef MSC_WriteWordFast(uint32_t *address, void const *data, uint32_t numBytes);
+MSC_Status_TypeDef MSC_ErasePage(uint32_t *startAddress);
+
+#endif
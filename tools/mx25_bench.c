@@ -0,0 +1,120 @@
+/*
+ * Throughput of the MX25 transfers on the emulator (tools/mx25_emu.c).
+ *
+ * Reads 64 kB in 4 kB sectors with the polled driver (MX25_READ), with the LDMA
+ * waiting in EM1 (MX25_READ_DMA without callback) and with the LDMA and a
+ * callback, where the next sector is requested from the callback and the CPU
+ * is free meanwhile. Then programs 64 kB of pages polled and with the LDMA.
+ * For each mode the throughput and the share of the time the CPU spends in
+ * the driver are printed.
+ *
+ * The figures are output of the timing model of the emulator, not measurements:
+ * they follow from MX25_EMU_SPI_HZ and MX25_EMU_POLL_GAP_NS in particular and
+ * are only as good as those. The same reads on the board are measured by
+ * flash_benchmark() in main.c, built with -DFLASH_BENCHMARK; the emulator
+ * parameters can be set from those numbers with -D.
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -Itools tools/mx25_bench.c tools/mx25_emu.c -o mx25_bench
+ *
+ * Usage:
+ *   mx25_bench [image file]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mx25_emu.h"
+
+#define BENCH_ADDR           0x00080000
+#define BENCH_SIZE           0x10000
+
+static uint8_t buf[Sector_Offset];
+static uint32_t next_addr;
+
+static void report(const char *what, uint64_t start_us, const tsMx25EmuStats *s)
+{
+  uint64_t us = mx25_emu_time_us() - start_us;
+
+  printf("%-28s %6.2f MB/s, cpu in driver %5.1f%%\n", what, us ? (double) BENCH_SIZE / us : 0.0,
+         us ? 100.0 * s->cpu_us / us : 0.0);
+}
+
+/* requests the next sector from the completion of the previous one */
+static void read_done(ReturnMsg result, void *context)
+{
+  (void) context;
+  if (result == FlashOperationSuccess && next_addr < BENCH_ADDR + BENCH_SIZE) {
+    MX25_READ_DMA(next_addr, buf, sizeof(buf), read_done, NULL);
+    next_addr += sizeof(buf);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  tsMx25EmuStats s;
+  uint64_t start;
+  uint32_t addr;
+
+  if (mx25_emu_open(argc > 1 ? argv[1] : "mx25_bench.img") != 0) {
+    printf("cannot open the image\n");
+    return 1;
+  }
+  memset(buf, 0x5A, sizeof(buf));
+  printf("emulator timing model, SPI at %lu Hz, not measured on the board\n", (unsigned long) MX25_EMU_SPI_HZ);
+
+  mx25_emu_clear_stats();
+  start = mx25_emu_time_us();
+  for (addr = BENCH_ADDR; addr < BENCH_ADDR + BENCH_SIZE; addr += sizeof(buf)) {
+    MX25_READ(addr, buf, sizeof(buf));
+  }
+  mx25_emu_get_stats(&s);
+  report("read 64 kB polled", start, &s);
+
+  mx25_emu_clear_stats();
+  start = mx25_emu_time_us();
+  for (addr = BENCH_ADDR; addr < BENCH_ADDR + BENCH_SIZE; addr += sizeof(buf)) {
+    MX25_READ_DMA(addr, buf, sizeof(buf), NULL, NULL);
+  }
+  mx25_emu_get_stats(&s);
+  report("read 64 kB dma, EM1 wait", start, &s);
+
+  mx25_emu_clear_stats();
+  start = mx25_emu_time_us();
+  next_addr = BENCH_ADDR + sizeof(buf);
+  MX25_READ_DMA(BENCH_ADDR, buf, sizeof(buf), read_done, NULL);
+  while (MX25_DMA_Busy()) {
+    // the application runs here
+    mx25_emu_advance_us(10);
+  }
+  mx25_emu_get_stats(&s);
+  report("read 64 kB dma, callback", start, &s);
+
+  mx25_emu_clear_stats();
+  start = mx25_emu_time_us();
+  for (addr = BENCH_ADDR; addr < BENCH_ADDR + BENCH_SIZE; addr += Sector_Offset) {
+    MX25_SE(addr);
+  }
+  for (addr = BENCH_ADDR; addr < BENCH_ADDR + BENCH_SIZE; addr += Page_Offset) {
+    MX25_PP(addr, buf, Page_Offset);
+  }
+  mx25_emu_get_stats(&s);
+  report("erase and program polled", start, &s);
+
+  mx25_emu_clear_stats();
+  start = mx25_emu_time_us();
+  for (addr = BENCH_ADDR; addr < BENCH_ADDR + BENCH_SIZE; addr += Sector_Offset) {
+    MX25_SE(addr);
+  }
+  for (addr = BENCH_ADDR; addr < BENCH_ADDR + BENCH_SIZE; addr += Page_Offset) {
+    while (MX25_PP_DMA(addr, buf, Page_Offset, NULL, NULL) == FlashIsBusy) {
+      // the program cycle of the previous page runs, the application with it
+      mx25_emu_advance_us(10);
+    }
+  }
+  mx25_emu_get_stats(&s);
+  report("erase and program dma", start, &s);
+
+  mx25_emu_close();
+  return 0;
+}
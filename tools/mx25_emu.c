@@ -0,0 +1,367 @@
+#include "mx25_emu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* command byte and three address bytes */
+#define CMD_BYTES            4
+
+/* LDMA_CH_CTRL_XFERCNT of the driver, largest DMA chunk */
+#define DMA_MAX_XFER         2048
+
+static FILE *image;
+static uint8_t flash[FlashSize];
+
+static uint64_t now_ns;
+static uint64_t ready_ns;                /* end of the running program or erase cycle */
+static uint64_t cpu_ns;
+static uint64_t busy_ns;
+
+static struct {
+  bool busy;
+  uint64_t end_ns;
+  uint32_t addr;
+  uint8_t *target;                       /* read, NULL for a page program */
+  const uint8_t *source;
+  uint32_t len;
+  MX25_DmaCallback callback;
+  void *context;
+} dma;
+
+static bool powered = true;
+static bool fail_armed;
+static uint32_t fail_ops;
+static uint32_t rand_state;
+
+static tsMx25EmuStats stats;
+
+// local functions
+
+static uint32_t next_rand(void)
+{
+  // xorshift32
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+static uint64_t spi_ns(uint32_t bytes)
+{
+  return (uint64_t)bytes * 8 * 1000000000 / MX25_EMU_SPI_HZ;
+}
+
+static uint64_t polled_ns(uint32_t bytes)
+{
+  return spi_ns(bytes) + (uint64_t)bytes * MX25_EMU_POLL_GAP_NS;
+}
+
+/* time spent by the CPU in the driver */
+static void cpu(uint64_t ns)
+{
+  now_ns += ns;
+  cpu_ns += ns;
+}
+
+/* the polled driver polls WIP until the previous cycle is over */
+static void wait_ready(void)
+{
+  if (ready_ns > now_ns) {
+    cpu(ready_ns - now_ns);
+  }
+}
+
+static void cycle(uint64_t us)
+{
+  ready_ns = now_ns + us * 1000;
+  busy_ns += us * 1000;
+}
+
+static void store(uint32_t addr, uint32_t len)
+{
+  if (image != NULL) {
+    fseek(image, (long)addr, SEEK_SET);
+    fwrite(&flash[addr], 1, len, image);
+  }
+}
+
+/* returns the number of bytes that reach the flash, and whether power is lost in this operation */
+static uint32_t torn_length(uint32_t len, bool *tear)
+{
+  *tear = false;
+  if (!fail_armed) {
+    return len;
+  }
+  if (fail_ops > 0) {
+    fail_ops--;
+    return len;
+  }
+  fail_armed = false;
+  powered = false;
+  *tear = true;
+  return next_rand() % (len + 1);
+}
+
+static void program(uint32_t addr, const uint8_t *src, uint32_t len)
+{
+  uint32_t page = addr & ~(uint32_t)(Page_Offset - 1);
+  uint32_t off = addr - page;
+  uint32_t i, done;
+  bool tear;
+
+  // more than a page wraps around to the start of the page, like the chip
+  done = torn_length(len, &tear);
+  for (i = 0; i < done; i++) {
+    flash[page + (off + i) % Page_Offset] &= src[i];
+  }
+  if (tear && done < len) {
+    // the byte being programmed keeps part of its bits
+    flash[page + (off + done) % Page_Offset] &= src[done] | (uint8_t)next_rand();
+  }
+  store(page, Page_Offset);
+  stats.page_programs++;
+  stats.program_bytes += len;
+  cycle(MX25_EMU_PP_US);
+}
+
+static void erase(uint32_t addr, uint32_t size, uint32_t us)
+{
+  uint32_t base = addr & ~(size - 1);
+  uint32_t done;
+  bool tear;
+
+  done = torn_length(size, &tear);
+  memset(&flash[base], 0xFF, done);
+  if (tear && done < size) {
+    flash[base + done] |= (uint8_t)next_rand();
+  }
+  store(base, size);
+  cycle(us);
+}
+
+static void dma_complete(void)
+{
+  MX25_DmaCallback callback = dma.callback;
+
+  if (dma.target != NULL) {
+    memcpy(dma.target, &flash[dma.addr], dma.len);
+    stats.read_bytes += dma.len;
+    stats.reads++;
+  } else {
+    program(dma.addr, dma.source, dma.len);
+  }
+  dma.busy = false;
+  if (callback != NULL) {
+    callback(FlashOperationSuccess, dma.context);
+  }
+}
+
+static ReturnMsg dma_start(uint32_t addr, uint8_t *target, const uint8_t *source, uint32_t len,
+                           MX25_DmaCallback callback, void *context)
+{
+  uint32_t chunks = (len + DMA_MAX_XFER - 1) / DMA_MAX_XFER;
+
+  // command phase polled, data phase at the full SPI rate plus one interrupt per chunk
+  cpu(polled_ns(CMD_BYTES));
+  dma.busy = true;
+  dma.end_ns = now_ns + spi_ns(len) + (uint64_t)chunks * MX25_EMU_DMA_IRQ_NS;
+  dma.addr = addr;
+  dma.target = target;
+  dma.source = source;
+  dma.len = len;
+  dma.callback = callback;
+  dma.context = context;
+
+  if (callback == NULL) {
+    // the driver sleeps in EM1 until the transfer is over
+    now_ns = dma.end_ns;
+    dma_complete();
+  }
+  return FlashOperationSuccess;
+}
+
+// public functions
+
+int mx25_emu_open(const char *path)
+{
+  size_t got = 0;
+
+  memset(flash, 0xFF, sizeof(flash));
+  image = fopen(path, "r+b");
+  if (image != NULL) {
+    got = fread(flash, 1, sizeof(flash), image);
+  } else {
+    image = fopen(path, "w+b");
+    if (image == NULL) {
+      return -1;
+    }
+  }
+  if (got < sizeof(flash)) {
+    store((uint32_t)got, (uint32_t)(sizeof(flash) - got));
+  }
+  return 0;
+}
+
+void mx25_emu_close(void)
+{
+  if (image != NULL) {
+    fclose(image);
+    image = NULL;
+  }
+}
+
+uint64_t mx25_emu_time_us(void)
+{
+  return now_ns / 1000;
+}
+
+void mx25_emu_advance_us(uint64_t us)
+{
+  uint64_t end = now_ns + us * 1000;
+
+  if (dma.busy && dma.end_ns <= end) {
+    now_ns = dma.end_ns;
+    dma_complete();
+  }
+  now_ns = end;
+}
+
+void mx25_emu_power_fail(uint32_t ops, uint32_t seed)
+{
+  fail_armed = true;
+  fail_ops = ops;
+  rand_state = seed ? seed : 1;
+}
+
+void mx25_emu_power_on(void)
+{
+  fail_armed = false;
+  powered = true;
+  dma.busy = false;
+  ready_ns = now_ns;
+}
+
+bool mx25_emu_powered(void)
+{
+  return powered;
+}
+
+void mx25_emu_get_stats(tsMx25EmuStats *out)
+{
+  *out = stats;
+  out->cpu_us = cpu_ns / 1000;
+  out->busy_us = busy_ns / 1000;
+}
+
+void mx25_emu_clear_stats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+  cpu_ns = 0;
+  busy_ns = 0;
+}
+
+void MX25_init(void)
+{
+}
+
+ReturnMsg MX25_READ(uint32_t flash_address, uint8_t *target_address, uint32_t byte_length)
+{
+  if (!powered) {
+    return FlashTimeOut;
+  }
+  if (flash_address + byte_length > FlashSize) {
+    return FlashAddressInvalid;
+  }
+  wait_ready();
+  cpu(polled_ns(CMD_BYTES + byte_length));
+  memcpy(target_address, &flash[flash_address], byte_length);
+  stats.reads++;
+  stats.read_bytes += byte_length;
+  return FlashOperationSuccess;
+}
+
+ReturnMsg MX25_PP(uint32_t flash_address, uint8_t *source_address, uint32_t byte_length)
+{
+  if (!powered) {
+    return FlashTimeOut;
+  }
+  if (flash_address >= FlashSize) {
+    return FlashAddressInvalid;
+  }
+  if (dma.busy) {
+    return FlashIsBusy;
+  }
+  wait_ready();
+  cpu(polled_ns(1 + CMD_BYTES + byte_length));
+  program(flash_address, source_address, byte_length);
+  wait_ready();
+  return powered ? FlashOperationSuccess : FlashTimeOut;
+}
+
+ReturnMsg MX25_SE(uint32_t flash_address)
+{
+  if (!powered) {
+    return FlashTimeOut;
+  }
+  if (flash_address >= FlashSize) {
+    return FlashAddressInvalid;
+  }
+  wait_ready();
+  cpu(polled_ns(1 + CMD_BYTES));
+  erase(flash_address, Sector_Offset, MX25_EMU_SE_US);
+  stats.sector_erases++;
+  wait_ready();
+  return powered ? FlashOperationSuccess : FlashTimeOut;
+}
+
+ReturnMsg MX25_BE32K(uint32_t flash_address)
+{
+  if (!powered) {
+    return FlashTimeOut;
+  }
+  if (flash_address >= FlashSize) {
+    return FlashAddressInvalid;
+  }
+  wait_ready();
+  cpu(polled_ns(1 + CMD_BYTES));
+  erase(flash_address, Block32K_Offset, MX25_EMU_BE32K_US);
+  stats.block_erases++;
+  wait_ready();
+  return powered ? FlashOperationSuccess : FlashTimeOut;
+}
+
+ReturnMsg MX25_READ_DMA(uint32_t flash_address, uint8_t *target_address, uint32_t byte_length,
+                        MX25_DmaCallback callback, void *context)
+{
+  if (!powered) {
+    return FlashTimeOut;
+  }
+  if (flash_address + byte_length > FlashSize) {
+    return FlashAddressInvalid;
+  }
+  if (dma.busy) {
+    return FlashIsBusy;
+  }
+  return dma_start(flash_address, target_address, NULL, byte_length, callback, context);
+}
+
+ReturnMsg MX25_PP_DMA(uint32_t flash_address, const uint8_t *source_address, uint32_t byte_length,
+                      MX25_DmaCallback callback, void *context)
+{
+  if (!powered) {
+    return FlashTimeOut;
+  }
+  if (flash_address >= FlashSize) {
+    return FlashAddressInvalid;
+  }
+  if (dma.busy || ready_ns > now_ns) {
+    return FlashIsBusy;
+  }
+  cpu(polled_ns(1));
+  return dma_start(flash_address, NULL, source_address, byte_length, callback, context);
+}
+
+bool MX25_DMA_Busy(void)
+{
+  return dma.busy;
+}
@@ -0,0 +1,113 @@
+#ifndef _MX25_EMU_H
+#define _MX25_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ *  File-backed emulation of the MX25 SPI flash for host builds.
+ *
+ *  Provides the part of the mx25flash_spi.h interface used by the flash modules
+ *  (flash_cache.c, record_store.c), which include this header instead of the
+ *  driver when built with -DMX25_EMULATOR. The flash content is kept in a file
+ *  so that it survives the process, like the flash survives a reset.
+ *
+ *  Like the NOR flash, programming can only clear bits, a page program wraps
+ *  around within its 256 byte page and erasing sets a whole sector or block to
+ *  0xFF. Every operation advances a simulated clock by the time it would take
+ *  on the board: the SPI transfer at MX25_EMU_SPI_HZ, the CPU time between two
+ *  bytes of the polled driver, the interrupt per chunk of a DMA transfer and
+ *  the program and erase cycles. A DMA transfer with a callback completes in
+ *  the background, when the clock is moved past its end by mx25_emu_advance_us().
+ *
+ *  A power failure can be armed to tear a later program or erase operation:
+ *  only part of it reaches the flash and every access fails until
+ *  mx25_emu_power_on() is called.
+ */
+
+/* SPI clock, MX25_BAUDRATE of the driver */
+#ifndef MX25_EMU_SPI_HZ
+#define MX25_EMU_SPI_HZ          8000000
+#endif
+
+/* CPU time between two bytes of the polled driver, one USART round trip */
+#ifndef MX25_EMU_POLL_GAP_NS
+#define MX25_EMU_POLL_GAP_NS     1200
+#endif
+
+/* interrupt and channel restart per DMA chunk */
+#ifndef MX25_EMU_DMA_IRQ_NS
+#define MX25_EMU_DMA_IRQ_NS      4000
+#endif
+
+/* program and erase cycle times, typical values of the datasheet */
+#ifndef MX25_EMU_PP_US
+#define MX25_EMU_PP_US           850
+#endif
+
+#ifndef MX25_EMU_SE_US
+#define MX25_EMU_SE_US           40000
+#endif
+
+#ifndef MX25_EMU_BE32K_US
+#define MX25_EMU_BE32K_US        200000
+#endif
+
+/* the parts of mx25flash_spi.h that are used on the host */
+#define FlashSize                0x100000
+#define Block32K_Offset          0x8000
+#define Sector_Offset            0x1000
+#define Page_Offset              0x0100
+
+typedef enum {
+  FlashOperationSuccess,
+  FlashWriteRegFailed,
+  FlashTimeOut,
+  FlashIsBusy,
+  FlashQuadNotEnable,
+  FlashAddressInvalid
+} ReturnMsg;
+
+typedef void (*MX25_DmaCallback)(ReturnMsg result, void *context);
+
+typedef struct {
+  uint32_t reads;
+  uint32_t read_bytes;
+  uint32_t page_programs;
+  uint32_t program_bytes;
+  uint32_t sector_erases;
+  uint32_t block_erases;
+  uint64_t busy_us;           /* time the flash spent programming and erasing */
+  uint64_t cpu_us;            /* time the CPU spent in the driver, polling included, EM1 not */
+} tsMx25EmuStats;
+
+/* Open the flash image, a missing file is created erased. Returns 0 on success. */
+int mx25_emu_open(const char *path);
+void mx25_emu_close(void);
+
+uint64_t mx25_emu_time_us(void);
+
+/* Let time pass outside of the driver, completing DMA transfers that end meanwhile. */
+void mx25_emu_advance_us(uint64_t us);
+
+/* Tear the program or erase operation after the next 'ops' ones. */
+void mx25_emu_power_fail(uint32_t ops, uint32_t seed);
+void mx25_emu_power_on(void);
+bool mx25_emu_powered(void);
+
+void mx25_emu_get_stats(tsMx25EmuStats *stats);
+void mx25_emu_clear_stats(void);
+
+void MX25_init(void);
+ReturnMsg MX25_READ(uint32_t flash_address, uint8_t *target_address, uint32_t byte_length);
+ReturnMsg MX25_PP(uint32_t flash_address, uint8_t *source_address, uint32_t byte_length);
+ReturnMsg MX25_SE(uint32_t flash_address);
+ReturnMsg MX25_BE32K(uint32_t flash_address);
+
+ReturnMsg MX25_READ_DMA(uint32_t flash_address, uint8_t *target_address, uint32_t byte_length,
+                        MX25_DmaCallback callback, void *context);
+ReturnMsg MX25_PP_DMA(uint32_t flash_address, const uint8_t *source_address, uint32_t byte_length,
+                      MX25_DmaCallback callback, void *context);
+bool MX25_DMA_Busy(void);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Host check of the node table (node_db.c) with several thousand nodes.
+ *
+ * node_db.c runs unchanged, built with a large NODE_DB_MAX_NODES. A random
+ * sequence of operations is applied to the table and to a plain model of it:
+ *
+ *   - a new node is added at a free address or at one in use, which must be
+ *     refused
+ *   - a known node is provisioned again at a new address, free or in use by
+ *     another node, which must be refused
+ *   - a node is removed, which moves the last slot and shifts back the index
+ *     entries that probed past the removed ones
+ *
+ * The addresses are drawn from a range only a little larger than the table so
+ * that the index buckets collide and deletes have entries to shift. Every
+ * operation is checked against the model, and every few hundred operations
+ * all nodes are looked up by address and UUID and the addresses not in use
+ * must not be found.
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -w -DNODE_DB_MAX_NODES=4000 -DEFR32BG12P332F1024GL125 -I. -Iprotocol/bluetooth/bt_mesh/inc
+ *      -Iprotocol/bluetooth/bt_mesh/inc/common -Iprotocol/bluetooth/bt_mesh/inc/soc -Iplatform/emlib/inc
+ *      -Iplatform/CMSIS/Include -Iplatform/Device/SiliconLabs/EFR32BG12P/Include tools/node_db_check.c node_db.c
+ *      -o node_db_check
+ *
+ * Usage:
+ *   node_db_check [operations] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_gecko.h"
+#include "node_db.h"
+
+#define NUM_IDS        (2 * NODE_DB_MAX_NODES)          /* UUIDs used */
+#define NUM_ADDRESSES  (NODE_DB_MAX_NODES + NODE_DB_MAX_NODES / 4)
+#define FIRST_ADDRESS  0x0001
+#define CHECK_EVERY    500
+
+static uint8_t cmd_buf[512], rsp_buf[512];
+void *gecko_cmd_msg_buf = cmd_buf;
+void *gecko_rsp_msg_buf = rsp_buf;
+
+// model: address of each UUID (0 = not in the table) and owner of each address
+static uint16_t address_of[NUM_IDS];
+static uint32_t owner_of[NUM_ADDRESSES];               /* UUID + 1, 0 = free */
+static uint32_t nodes;
+
+static unsigned long adds, reprovisions, removes, refused, lookups;
+static int failed;
+
+// stack
+
+void sli_bt_cmd_handler_delegate(uint32_t header, gecko_cmd_handler handler, const void *payload)
+{
+  struct gecko_cmd_packet *r = (struct gecko_cmd_packet *) rsp_buf;
+
+  (void) header;
+  (void) handler;
+  (void) payload;
+  memset(rsp_buf, 0, sizeof(rsp_buf));
+  r->data.rsp_mesh_prov_ddb_list_devices.result = bg_err_not_implemented;
+}
+
+void sli_bt_cmd_hardware_get_time(const void *p) { (void) p; }
+void sli_bt_cmd_mesh_prov_ddb_list_devices(const void *p) { (void) p; }
+
+// helpers
+
+static void fail(const char *what, uint32_t id, uint16_t address)
+{
+  if (failed++ < 10) {
+    printf("FAILED: %s, UUID %lu, address %4.4x\n", what, (unsigned long) id, address);
+  }
+}
+
+static void make_uuid(uint32_t id, uint8_t *uuid)
+{
+  int i;
+
+  // the UUIDs differ in a few bytes only, as those of one product line do
+  memset(uuid, 0xA5, 16);
+  for (i = 0; i < 4; i++) {
+    uuid[12 + i] = (uint8_t)(id >> (8 * i));
+  }
+}
+
+static uint16_t random_address(void)
+{
+  return (uint16_t)(FIRST_ADDRESS + rand() % NUM_ADDRESSES);
+}
+
+static uint32_t owner(uint16_t address)
+{
+  return owner_of[address - FIRST_ADDRESS];
+}
+
+/* node_db_add() on the table and the model, as a provisioning would */
+static void provision(uint32_t id, uint16_t address)
+{
+  uint8_t uuid[16];
+  uint16_t slot;
+  int accept;
+
+  make_uuid(id, uuid);
+  accept = (!owner(address) || owner(address) == id + 1) && (address_of[id] || nodes < NODE_DB_MAX_NODES);
+  slot = node_db_add(uuid, address, 1);
+
+  if (!accept) {
+    refused++;
+    if (slot != NODE_DB_INVALID) {
+      fail("added at an address in use", id, address);
+    }
+    return;
+  }
+  if (slot == NODE_DB_INVALID || _sNodeDB.address[slot] != address || memcmp(_sNodeDB.uuid[slot], uuid, 16)) {
+    fail("not added", id, address);
+    return;
+  }
+
+  if (address_of[id]) {
+    reprovisions++;
+    owner_of[address_of[id] - FIRST_ADDRESS] = 0;
+  } else {
+    adds++;
+    nodes++;
+  }
+  address_of[id] = address;
+  owner_of[address - FIRST_ADDRESS] = id + 1;
+}
+
+static void remove_node(uint16_t address)
+{
+  uint32_t id = owner(address);
+
+  node_db_remove(address);
+  if (id) {
+    removes++;
+    address_of[id - 1] = 0;
+    owner_of[address - FIRST_ADDRESS] = 0;
+    nodes--;
+  }
+}
+
+/* every address and every UUID must be found where the model has it */
+static void check_all(void)
+{
+  uint8_t uuid[16];
+  uint16_t slot;
+  uint32_t i, id;
+
+  if (_sNodeDB.count != nodes) {
+    fail("node count differs", 0, 0);
+  }
+  for (i = 0; i < NUM_ADDRESSES; i++) {
+    slot = node_db_find_by_address((uint16_t)(FIRST_ADDRESS + i));
+    id = owner_of[i];
+    lookups++;
+    if (!id) {
+      if (slot != NODE_DB_INVALID) {
+        fail("free address found", 0, (uint16_t)(FIRST_ADDRESS + i));
+      }
+      continue;
+    }
+    make_uuid(id - 1, uuid);
+    if (slot == NODE_DB_INVALID || memcmp(_sNodeDB.uuid[slot], uuid, 16)) {
+      fail("address lookup", id - 1, (uint16_t)(FIRST_ADDRESS + i));
+    }
+  }
+  for (id = 0; id < NUM_IDS; id++) {
+    make_uuid(id, uuid);
+    slot = node_db_find_by_uuid(uuid);
+    lookups++;
+    if (address_of[id] ? (slot == NODE_DB_INVALID || _sNodeDB.address[slot] != address_of[id])
+        : slot != NODE_DB_INVALID) {
+      fail("UUID lookup", id, address_of[id]);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+  unsigned seed = argc > 2 ? (unsigned) strtoul(argv[2], NULL, 0) : 1;
+  unsigned long i;
+  uint32_t id;
+  int r;
+
+  srand(seed);
+  node_db_init();
+
+  // fill the table to three quarters first, then mix adds and removes
+  while (nodes < 3 * NODE_DB_MAX_NODES / 4) {
+    provision(rand() % NUM_IDS, random_address());
+  }
+  check_all();
+
+  for (i = 0; i < ops && failed == 0; i++) {
+    r = rand() % 100;
+    id = rand() % NUM_IDS;
+    if (r < 40) {
+      provision(id, random_address());
+    } else if (r < 55 && address_of[id]) {
+      // provisioned again, at its address or another one
+      provision(id, rand() % 2 ? address_of[id] : random_address());
+    } else {
+      remove_node(random_address());
+    }
+    if (i % CHECK_EVERY == 0) {
+      check_all();
+    }
+  }
+  check_all();
+
+  printf("%d nodes max, %lu operations: %lu added, %lu provisioned again, %lu removed, %lu refused, "
+         "%lu lookups, %lu nodes left\n", NODE_DB_MAX_NODES, ops, adds, reprovisions, removes, refused,
+         lookups, (unsigned long) nodes);
+  printf("%s\n", failed ? "FAILED" : "passed");
+  return failed != 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * P-256 keys for out of band public key provisioning.
+ *
+ * Computes the public key of a device private key with the same code as the
+ * provisioner (p256.c), in the 64 byte X || Y form of the provisioning
+ * protocol, e.g. to list the keys of devices that have a static key pair. With
+ * a peer public key it prints the ECDH secret instead.
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -DP256_SOFTWARE -I. -Iprotocol/bluetooth/bt_mesh/inc/common tools/p256_key.c p256.c -o p256_key
+ *
+ * Usage:
+ *   p256_key <private key, 64 hex digits> [<peer public key, 128 hex digits>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p256.h"
+
+static int parse_hex(const char *s, uint8_t *out, size_t len)
+{
+  size_t i;
+  unsigned int v;
+
+  if (strlen(s) != 2 * len) {
+    return -1;
+  }
+  for (i = 0; i < len; i++) {
+    if (sscanf(s + 2 * i, "%2x", &v) != 1) {
+      return -1;
+    }
+    out[i] = (uint8_t) v;
+  }
+  return 0;
+}
+
+static void print_hex(const uint8_t *data, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    printf("%02X", data[i]);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  uint8_t private_key[P256_PRIVATE_KEY_LEN];
+  uint8_t public_key[P256_PUBLIC_KEY_LEN];
+  uint8_t secret[P256_SECRET_LEN];
+
+  if (argc < 2 || argc > 3 || parse_hex(argv[1], private_key, sizeof(private_key))
+      || (argc == 3 && parse_hex(argv[2], public_key, sizeof(public_key)))) {
+    fprintf(stderr, "usage: %s <private key, 64 hex digits> [<peer public key, 128 hex digits>]\n", argv[0]);
+    return 2;
+  }
+
+  if (argc == 2) {
+    if (p256_public_key(private_key, public_key)) {
+      fprintf(stderr, "private key out of range\n");
+      return 1;
+    }
+    print_hex(public_key, sizeof(public_key));
+  } else {
+    if (p256_ecdh(private_key, public_key, secret)) {
+      fprintf(stderr, "invalid private key or peer public key\n");
+      return 1;
+    }
+    print_hex(secret, sizeof(secret));
+  }
+
+  return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Host test of the record store (record_store.c) on the MX25 emulator.
+ *
+ * The store runs unchanged, with the page cache, on a file-backed image of the
+ * flash (tools/mx25_emu.c) whose simulated clock gives the time the flash
+ * accesses would take on the board.
+ *
+ *   1. write: the store is formatted and the given number of records is written
+ *      to random keys, one in twenty is a delete. The segment sequence numbers
+ *      are started just below the wrap so that it is crossed early. Write
+ *      amplification, erases and wear spread are printed.
+ *   2. mount: the image file is closed and opened again and the store is
+ *      mounted from it, the mount time and the flash read volume are printed.
+ *   3. reset: power is cut during a random program or erase operation, by the
+ *      application or by compaction, and the store is mounted again. Every key
+ *      must read back its last value, the one in flight may read the value
+ *      before or after it. Repeated the given number of times.
+ *
+ * After each phase the content is compared with a copy kept in RAM.
+ *
+ * Build on the host from the project root:
+ *   cc -O2 -DMX25_EMULATOR -I. -Itools -Iprotocol/bluetooth/bt_mesh/inc/common tools/record_store_sim.c
+ *      tools/mx25_emu.c record_store.c flash_cache.c -o record_store_sim
+ *
+ * Usage:
+ *   record_store_sim [records] [keys] [resets] [seed] [image file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mx25_emu.h"
+#include "flash_cache.h"
+#include "record_store.h"
+
+#define MIN_LEN              8
+#define MAX_LEN              120
+#define MAX_KEYS             REC_STORE_MAX_RECORDS
+
+/* offset and magic of the segment header, see record_store.c */
+#define SEG_SEQUENCE_OFFSET  12
+#define WRAP_START           0xFFFFFFF0
+
+typedef struct {
+  uint8_t present;
+  uint16_t len;
+  uint32_t version;
+} tsModel;
+
+static tsModel model[MAX_KEYS];
+static uint32_t rand_state = 1;
+static uint32_t versions;
+
+static uint32_t next_rand(void)
+{
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+/* the content of a record follows from its key and version */
+static void fill(uint8_t *buf, uint16_t key, uint32_t version, uint16_t len)
+{
+  uint32_t x = key * 2654435761u ^ version;
+  uint16_t i;
+
+  for (i = 0; i < len; i++) {
+    x = x * 1103515245 + 12345;
+    buf[i] = (uint8_t)(x >> 16);
+  }
+}
+
+static int matches(uint16_t key, const tsModel *m)
+{
+  uint8_t expect[MAX_LEN], got[MAX_LEN];
+  uint16_t len = 0;
+  errorcode_t res;
+
+  res = record_store_read(key, got, sizeof(got), &len);
+  if (!m->present) {
+    return res == bg_err_hardware_ps_key_not_found;
+  }
+  if (res != bg_err_success || len != m->len) {
+    return 0;
+  }
+  fill(expect, key, m->version, m->len);
+  return memcmp(expect, got, len) == 0;
+}
+
+static int verify(const char *phase, uint16_t keys)
+{
+  uint16_t key;
+  int bad = 0;
+
+  for (key = 0; key < keys; key++) {
+    if (!matches(key, &model[key])) {
+      if (bad < 5) {
+        printf("%s: key %u does not match, version %lu\n", phase, key, (unsigned long) model[key].version);
+      }
+      bad++;
+    }
+  }
+  return bad;
+}
+
+/* one random write or delete, the model is updated only when the store accepts it */
+static errorcode_t random_op(uint16_t keys, uint16_t *key, tsModel *next)
+{
+  uint8_t buf[MAX_LEN];
+  errorcode_t res;
+
+  *key = next_rand() % keys;
+  next->version = ++versions;
+  if (next_rand() % 20 == 0) {
+    next->present = 0;
+    next->len = 0;
+    res = record_store_delete(*key);
+  } else {
+    next->present = 1;
+    next->len = MIN_LEN + next_rand() % (MAX_LEN - MIN_LEN + 1);
+    fill(buf, *key, next->version, next->len);
+    res = record_store_write(*key, buf, next->len);
+  }
+  if (res == bg_err_success) {
+    model[*key] = *next;
+  }
+  return res;
+}
+
+static void print_stats(void)
+{
+  tsRecordStoreStats rs;
+  tsFlashCacheStats cs;
+
+  record_store_get_stats(&rs);
+  flash_cache_get_stats(&cs);
+  printf("  %lu user bytes, %lu flash bytes, write amplification %.2f\n", (unsigned long) rs.user_bytes,
+         (unsigned long) rs.flash_bytes, rs.user_bytes ? (double) rs.flash_bytes / rs.user_bytes : 0.0);
+  printf("  %lu erases, %lu compactions, erase counts %lu..%lu, %u records, %u free segments\n",
+         (unsigned long) rs.erases, (unsigned long) rs.compactions, (unsigned long) rs.min_erase_count,
+         (unsigned long) rs.max_erase_count, rs.records, rs.free_segments);
+  printf("  cache %lu hits, %lu misses\n", (unsigned long) cs.hits, (unsigned long) cs.misses);
+}
+
+static int mount(void)
+{
+  flash_cache_init();
+  return record_store_mount() == bg_err_success;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t records = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000;
+  uint16_t keys = argc > 2 ? (uint16_t) strtoul(argv[2], NULL, 0) : 400;
+  uint32_t resets = argc > 3 ? strtoul(argv[3], NULL, 0) : 1000;
+  const char *path = argc > 5 ? argv[5] : "record_store_sim.img";
+  uint32_t seq[2] = { WRAP_START, ~(uint32_t)WRAP_START };
+  tsRecordStoreStats rs;
+  tsMx25EmuStats es;
+  tsModel next;
+  uint64_t start_us;
+  uint32_t i, torn = 0, in_flight = 0, ops = 0;
+  uint16_t key = 0;
+  errorcode_t res;
+  int bad = 0;
+
+  rand_state = argc > 4 ? strtoul(argv[4], NULL, 0) : 1;
+  if (rand_state == 0) {
+    rand_state = 1;
+  }
+  if (keys == 0 || keys > MAX_KEYS) {
+    printf("1..%u keys\n", MAX_KEYS);
+    return 1;
+  }
+  if (mx25_emu_open(path) != 0) {
+    printf("cannot open %s\n", path);
+    return 1;
+  }
+
+  // 1. write
+  flash_cache_init();
+  if (record_store_format() != bg_err_success) {
+    printf("format failed\n");
+    return 1;
+  }
+  // the first segment is opened by hand, close to the wrap of the sequence numbers
+  MX25_PP(REC_STORE_BASE_ADDR + SEG_SEQUENCE_OFFSET, (uint8_t *) seq, sizeof(seq));
+  if (!mount()) {
+    printf("mount failed\n");
+    return 1;
+  }
+  mx25_emu_clear_stats();
+  start_us = mx25_emu_time_us();
+  for (i = 0; i < records; i++) {
+    if (random_op(keys, &key, &next) != bg_err_success) {
+      printf("write %lu failed\n", (unsigned long) i);
+      return 1;
+    }
+    record_store_compact_step();
+  }
+  mx25_emu_get_stats(&es);
+  printf("write: %lu records to %u keys in %.1f s, %.2f ms per record\n", (unsigned long) records, keys,
+         (mx25_emu_time_us() - start_us) / 1e6, records ? (mx25_emu_time_us() - start_us) / 1e3 / records : 0.0);
+  print_stats();
+  bad += verify("write", keys);
+
+  // 2. mount from the file
+  mx25_emu_close();
+  mx25_emu_clear_stats();
+  if (mx25_emu_open(path) != 0 || !mount()) {
+    printf("mount failed\n");
+    return 1;
+  }
+  record_store_get_stats(&rs);
+  mx25_emu_get_stats(&es);
+  printf("mount: %lu ms, %u records, %lu kB read\n", (unsigned long) rs.mount_ms, rs.records,
+         (unsigned long) es.read_bytes / 1024);
+  bad += verify("mount", keys);
+
+  // 3. reset
+  mx25_emu_clear_stats();
+  for (i = 0; i < resets; i++) {
+    mx25_emu_power_fail(next_rand() % 32, next_rand());
+    while (mx25_emu_powered()) {
+      res = random_op(keys, &key, &next);
+      if (res != bg_err_success) {
+        if (mx25_emu_powered()) {
+          printf("write failed: 0x%x\n", res);
+          return 1;
+        }
+        in_flight++;
+        break;
+      }
+      ops++;
+      record_store_compact_step();
+    }
+    mx25_emu_power_on();
+    if (!mount()) {
+      printf("mount after reset %lu failed\n", (unsigned long) i);
+      return 1;
+    }
+    record_store_get_stats(&rs);
+    torn += rs.torn_segments;
+
+    // the interrupted write may or may not have made it
+    if (!matches(key, &model[key]) && matches(key, &next)) {
+      model[key] = next;
+    }
+    if (verify("reset", keys)) {
+      printf("after reset %lu\n", (unsigned long) i);
+      bad++;
+      break;
+    }
+  }
+  printf("reset: %lu resets, %lu during a write, %lu writes, %lu torn segment headers\n", (unsigned long) i,
+         (unsigned long) in_flight, (unsigned long) ops, (unsigned long) torn);
+  print_stats();
+
+  mx25_emu_close();
+  printf("%s\n", bad ? "FAILED" : "passed");
+  return bad ? 1 : 0;
+}